@@ -7,7 +7,7 @@
 
 // Define an alias structure
 typedef struct {
-    char *name;
+    const char *name;  // Interned
     char *value;
 } Alias;
 
@@ -26,8 +26,9 @@ int remove_alias(const char *name);
 // Get the value of an alias
 char *get_alias(const char *name);
 
-// Expand aliases in a command line
-char **expand_aliases(char **args);
+// Expand aliases, updating the parallel lexer flags array when given
+// A new array is allocated in the command arena when an alias applies
+char **expand_aliases_flags(char **args, unsigned int **flags);
 
 // Builtin commands
 int hush_alias(char **args);
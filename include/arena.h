@@ -0,0 +1,60 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for the lifetime of one command
+//
+// The stages between expansion and exec (expand_words, alias expansion,
+// globbing, redirection and pipe splitting) allocate their words and
+// argument arrays here instead of with malloc, and nothing is freed piece
+// by piece. The VM takes a mark before a command's first word and
+// releases back to it once the command has run. Marks nest: a for loop
+// keeps its items below the marks of the commands in its body.
+
+typedef struct ArenaBlock ArenaBlock;
+
+// A position to release back to
+typedef struct {
+    ArenaBlock *block;
+    size_t used;
+} ArenaMark;
+
+// Allocator counters, shown by the memstats builtin
+typedef struct {
+    unsigned long allocations;    // Requests served by the arena
+    unsigned long block_mallocs;  // malloc calls made for arena blocks
+    unsigned long commands;       // Commands whose memory was released
+    size_t in_use;                // Bytes handed out and not yet released
+    size_t peak;                  // Largest in_use seen
+} ArenaStats;
+
+// Allocate size bytes, aligned for any type; never returns NULL
+void *arena_alloc(size_t size);
+
+// Resize an allocation, in place when it is the most recent one since the
+// last mark; an allocation alone in an oversized block is realloc'd
+void *arena_grow(void *ptr, size_t old_size, size_t new_size);
+
+// Report that memory ran out and exit, for every allocation the shell
+// cannot do without
+void alloc_error(void);
+
+char *arena_strdup(const char *s);
+char *arena_strndup(const char *s, size_t n);
+
+// Remember the current position
+ArenaMark arena_mark(void);
+
+// Free everything allocated since mark was taken
+void arena_release(ArenaMark mark);
+
+// Release a command's memory and count it in the statistics
+void arena_end_command(ArenaMark mark);
+
+const ArenaStats *arena_stats(void);
+
+// Builtin: print the allocator counters
+int hush_memstats(char **args);
+
+#endif // ARENA_H
@@ -0,0 +1,31 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shell arithmetic for $((...)), let and ((...))
+// Expressions use the C operators on int64_t, plus ** for powers, and
+// overflow wraps. Each distinct text is parsed once into a tree with its
+// constant subexpressions folded, and kept in a small cache; variables are
+// read when the tree is evaluated.
+
+// Longest decimal form of a value, sign and NUL included
+#define ARITH_NUMBER_MAX 21
+
+// Evaluate expression text, storing its value in *result
+// Returns 0 after printing a message on a syntax or evaluation error.
+int arith_evaluate(const char *text, int64_t *result);
+
+// Parse s[0..len) as an integer constant: decimal, 0x hex, leading-0 octal
+// or base#digits, optionally signed and surrounded by blanks
+// Returns 0 if it is anything else.
+int arith_parse_number(const char *s, size_t len, int64_t *result);
+
+// Write value in decimal to buf (ARITH_NUMBER_MAX bytes), returning the length
+size_t arith_format(int64_t value, char *buf);
+
+// Built-in 'let' command - evaluate arithmetic expressions
+int hush_let(char **args);
+
+#endif // ARITH_H
@@ -0,0 +1,87 @@
+#ifndef ARRAYS_H
+#define ARRAYS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Array values for shell variables
+// Both kinds are open-addressing hash maps over a list of entries: indexed
+// arrays are keyed by index and sparse, so any index costs one entry, and
+// associative arrays keep their keys in insertion order.
+// Values are malloc'd, NUL-terminated and carry their length.
+
+// One value slot, value is NULL when the element is unset
+typedef struct {
+    char *value;
+    size_t len;
+} ArrayItem;
+
+typedef struct {
+    long index;
+    ArrayItem item;     // Value NULL once unset
+    uint32_t hash;
+} IndexedEntry;
+
+typedef struct {
+    IndexedEntry *entries;  // Unset elements leave holes
+    int count;              // Entries in use, holes included
+    int capacity;
+    int holes;
+    int sorted;             // Entries are in index order
+    long end;               // One past the highest set index
+    int *slots;             // Entry index plus one, zero when empty
+    size_t slot_capacity;   // Always a power of two
+} IndexedArray;
+
+typedef struct {
+    char *key;          // NULL once removed
+    size_t key_len;
+    ArrayItem item;
+    uint32_t hash;
+} AssocEntry;
+
+typedef struct {
+    AssocEntry *entries;  // Insertion order, removed keys leave holes
+    int count;            // Entries in use, holes included
+    int capacity;
+    int holes;
+    int *slots;           // Entry index plus one, zero when empty
+    size_t slot_capacity; // Always a power of two
+} AssocArray;
+
+IndexedArray *indexed_new(void);
+void indexed_free(IndexedArray *array);
+
+// Get the element at index, NULL when it is unset
+const ArrayItem *indexed_get(const IndexedArray *array, long index);
+
+// Set the element at index, returns 0 if the index is negative
+int indexed_set(IndexedArray *array, long index, const char *value, size_t len);
+
+void indexed_unset(IndexedArray *array, long index);
+
+// Number of elements set
+size_t indexed_size(const IndexedArray *array);
+
+// Get the set elements in index order, *count of them
+const IndexedEntry *indexed_entries(IndexedArray *array, int *count);
+
+// Remove every element
+void indexed_clear(IndexedArray *array);
+
+AssocArray *assoc_new(void);
+void assoc_free(AssocArray *array);
+
+// Get the value stored under key, NULL when there is none
+const ArrayItem *assoc_get(const AssocArray *array, const char *key, size_t key_len);
+
+void assoc_set(AssocArray *array, const char *key, size_t key_len, const char *value, size_t len);
+void assoc_unset(AssocArray *array, const char *key, size_t key_len);
+
+// Number of keys stored
+size_t assoc_size(const AssocArray *array);
+
+// Remove every key
+void assoc_clear(AssocArray *array);
+
+#endif // ARRAYS_H
@@ -0,0 +1,54 @@
+#ifndef BUILTIN_TABLE_H
+#define BUILTIN_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "intern.h"
+
+// Builtin flags
+#define BUILTIN_PURE 0x01  // Leaves the shell's state alone, $(...) may run it in-process
+
+// The builtin commands, defined once
+// X(name, function, flags) is expanded into builtin_str, builtin_func and
+// builtin_flags in builtins.c, and read at build time by
+// tools/gen_builtin_hash.c to generate the perfect hash in builtin_hash.h.
+// The order is the order shown by help and completion.
+#define HUSH_BUILTINS(X)                        \
+    X("cd",       hush_cd,        0)            \
+    X("help",     hush_help,      BUILTIN_PURE) \
+    X("echo",     hush_echo,      BUILTIN_PURE) \
+    X("printf",   hush_printf,    BUILTIN_PURE) \
+    X("read",     hush_read,      0)            \
+    X("exit",     hush_exit,      0)            \
+    X("export",   hush_export,    0)            \
+    X("history",  hush_history,   0)            \
+    X("alias",    hush_alias,     0)            \
+    X("unalias",  hush_unalias,   0)            \
+    X("pushd",    hush_pushd,     0)            \
+    X("popd",     hush_popd,      0)            \
+    X("dirs",     hush_dirs,      BUILTIN_PURE) \
+    X("jobs",     hush_jobs,      0)            \
+    X("fg",       hush_fg,        0)            \
+    X("bg",       hush_bg,        0)            \
+    X("wait",     hush_wait,      0)            \
+    X("disown",   hush_disown,    0)            \
+    X("set",      hush_set,       0)            \
+    X("unset",    hush_unset,     0)            \
+    X("declare",  hush_declare,   0)            \
+    X("local",    hush_local,     0)            \
+    X("return",   hush_return,    0)            \
+    X("let",      hush_let,       0)            \
+    X("test",     hush_test,      BUILTIN_PURE) \
+    X("[",        hush_test,      BUILTIN_PURE) \
+    X("shift",    hush_shift,     0)            \
+    X("break",    hush_break,     0)            \
+    X("continue", hush_continue,  0)            \
+    X("memstats", hush_memstats,  BUILTIN_PURE)
+
+// Seeded hash of the name, shared by the generator and the lookup
+static inline uint32_t builtin_hash(const char *name, size_t len, uint32_t seed) {
+    uint32_t hash = hash_text(name, len, seed);
+    return hash ^ (hash >> 15);
+}
+
+#endif // BUILTIN_TABLE_H
@@ -8,10 +8,20 @@
 int hush_cd(char **args);
 int hush_help(char **args);
 int hush_exit(char **args);
+int hush_break(char **args);
+int hush_continue(char **args);
 
 extern char *builtin_str[];
 extern int (*builtin_func[])(char **);
+extern const unsigned char builtin_flags[];  // BUILTIN_* bits from builtin_table.h
 
 int hush_num_builtins();
 
+// Find a builtin by name with one hash and one compare
+// Returns its index in builtin_str and builtin_func, or -1
+int find_builtin(const char *name);
+
+// Same for an interned name (NULL finds nothing), compared by pointer
+int find_interned_builtin(const char *name);
+
 #endif // BUILTINS_H
@@ -0,0 +1,103 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "parser.h"
+
+// Opcodes
+typedef enum {
+    BC_HALT = 0,    // End of program
+    BC_PUSH,        // Push word a as one field, no expansion needed
+    BC_EXPAND,      // Expand word a and push the resulting fields
+    BC_EXEC,        // Run the pushed fields as a simple command
+    BC_JUMP,        // Continue at a
+    BC_JUMP_IF_OK,  // Continue at a if $? is zero
+    BC_JUMP_IF_FAIL,// Continue at a if $? is not zero
+    BC_STATUS,      // Set $? to a
+    BC_SLOT_SAVE,   // Save $? in loop slot a
+    BC_SLOT_LOAD,   // Set $? from loop slot a
+    BC_FOR_INIT,    // Start a for loop over the pushed fields, variable is word a
+                    // (BC_FLAG_ARGS: over the positional parameters instead)
+    BC_FOR_NEXT,    // Assign the next item, or end the loop and continue at a
+    BC_FOR_POP,     // Drop the innermost for loop (break)
+    BC_PIPELINE,    // Run the b BC_STAGE entries that follow as a pipeline,
+                    // then continue at a
+    BC_STAGE,       // Pipeline stage whose code starts at a
+    BC_BACKGROUND,  // Run the code after this in a background job labelled by
+                    // string b, the parent continues at a
+    BC_EXIT,        // End of a subshell body, exit with $?
+    BC_FUNCTION,    // Define the function named by word a, body source is string b
+    BC_ASSIGN,      // Expand the NAME=value word a as an assignment for the next BC_EXEC
+                    // (BC_FLAG_BARE: no command follows, assign it now)
+    BC_ARITH,       // Evaluate the arithmetic expression string a, $? is 0 if non-zero
+    BC_COND_UNARY,  // [[ ]] primary: unary operator letter flags on word a
+    BC_COND,        // [[ ]] primary: word a, binary operator flags (a TestBinary), word b
+    BC_NOT,         // Set $? to 1 if it is zero, otherwise to 0
+    BC_REDIRECT,    // Apply the pushed operator/target pairs until BC_UNREDIRECT,
+                    // continuing at that BC_UNREDIRECT (a) if one fails
+                    // (BC_FLAG_OWN_INPUT: a pipeline stage's loop, up to a, is
+                    // the only reader of stdin)
+    BC_UNREDIRECT,  // Undo the innermost BC_REDIRECT
+    BC_OPCODE_COUNT
+} Opcode;
+
+// Instruction flags
+#define BC_FLAG_ARGS      0x01  // BC_FOR_INIT: loop over "$@"
+#define BC_FLAG_SINGLE    0x02  // BC_STAGE, BC_BACKGROUND: body is one simple command
+#define BC_FLAG_OWN_INPUT 0x04  // BC_REDIRECT: stdin may be read ahead across commands
+#define BC_FLAG_BARE      0x08  // BC_ASSIGN: part of a command of only assignments
+
+// One instruction, jump targets are absolute instruction indexes
+typedef struct {
+    uint8_t op;
+    uint8_t flags;
+    uint32_t a;
+    uint32_t b;
+} Instr;
+
+// A word of the program, text is an offset into the string pool
+typedef struct {
+    uint32_t offset;
+    uint32_t flags;  // Lexer flags
+} ProgWord;
+
+// A compiled program, self-contained and free of pointers into the source
+typedef struct {
+    Instr *code;
+    int code_count;
+    int code_capacity;
+
+    ProgWord *words;
+    int word_count;
+    int word_capacity;
+
+    // Interned handles of the words flagged HUSH_TOK_INTERNED, parallel to
+    // words; built at compile or load time and never saved
+    const char **names;
+
+    char *strings;        // NUL-terminated texts back to back
+    size_t strings_len;
+    size_t strings_capacity;
+
+    int slot_count;       // Loop status slots the VM must provide
+} Program;
+
+// Compile a parsed tree into a new program, the tree can be freed after
+Program *compile_program(const AstNode *root);
+
+// Compile a tree onto the end of a program, replacing its final BC_HALT
+// Returns the index of the first new instruction
+int compile_append(Program *prog, const AstNode *root);
+
+// Intern the names of a program read back from its saved form
+void program_resolve_names(Program *prog);
+
+// Empty a program but keep its allocations for reuse
+void program_clear(Program *prog);
+
+// Free a program
+void free_program(Program *prog);
+
+#endif // BYTECODE_H
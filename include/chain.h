@@ -1,11 +0,0 @@
-#ifndef CHAIN_H
-#define CHAIN_H
-
-#include <stdio.h>
-#include <string.h>
-#include <stdlib.h>
-
-// Execute a command chain with ; && ||
-int execute_command_chain(char *line);
-
-#endif // CHAIN_H
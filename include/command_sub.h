@@ -7,13 +7,33 @@
 #include <unistd.h>
 #include <sys/wait.h>
 
-// Perform command substitution on a line
-char *perform_command_substitution(char *line);
+// Execute a command and return its output without trailing newlines
+// The output is in the arena, NUL-terminated, and may itself contain NUL
+// bytes, so its length is stored in *len. HUSH_CAPTURE_MAX, when set,
+// limits how many bytes are kept. $? is set to the command's status.
+char *capture_command_output(const char *command, size_t *len);
 
-// Check if a string contains command substitution
-int has_command_substitution(const char *line);
+// Substitutions run so far, so a command can tell whether its words ran any
+extern unsigned long capture_count;
 
-// Execute a command and return its output as a string
-char *capture_command_output(const char *command);
+// Substitutions run together ahead of time, handed out in order
+typedef struct {
+    char **commands;
+    char **outputs;
+    size_t *lengths;
+    int *statuses;
+    int count;
+    int next;
+} CaptureBatch;
+
+// Start the commands that need a subshell all at once and wait for all of
+// them; the results are in the arena. Commands that can run in-process are
+// left out and run when they are reached.
+void capture_batch_run(CaptureBatch *batch, char **commands, int count);
+
+// Let capture_command_output take results from batch, or from nothing when
+// batch is NULL, as long as the commands come in the same order
+// Returns the batch that was in use before
+CaptureBatch *capture_batch_use(CaptureBatch *batch);
 
 #endif // COMMAND_SUB_H
@@ -6,28 +6,44 @@
 #include <string.h>
 #include <ctype.h>
 
-// Check if line contains a control structure keyword (if, then, else, fi, etc.)
-int is_control_keyword(const char *line);
-
-// Execute an if-then-else-fi control structure
-int execute_if_statement(char **lines, int line_count);
-
-// Parse input for control structures and execute them
-int parse_and_execute_control(char **lines, int line_count);
-
-// Process control flow in a script
-int process_script_control_flow(FILE *script_file);
-
-// Execute a for loop
-int execute_for_loop(char **lines, int line_count);
-
-// Execute a while loop
-int execute_while_loop(char **lines, int line_count);
-
-// Check if a line starts a loop (for, while)
-int is_loop_start(const char *line);
-
-// Check if a line ends a loop (done)
-int is_loop_end(const char *line);
+#include "bytecode.h"
+
+// Buffers that grew past this are released once their command has run
+#define CONTROL_BUFFER_KEEP (64 * 1024)
+
+// Collects input lines until they form complete commands
+typedef struct {
+    char *text;       // Buffered lines joined with newlines
+    size_t len;
+    size_t capacity;
+    int depth;        // Compound commands opened and not yet closed
+
+    Program *prog;    // Bytecode of the completed commands
+    int keep;         // Append to prog instead of reusing it per command
+    int errors;       // Syntax errors seen
+} ControlBuffer;
+
+// Initialize an empty buffer
+void control_buffer_init(ControlBuffer *cb);
+
+// Free the buffered text and program
+void control_buffer_free(ControlBuffer *cb);
+
+// Add a line of input
+// Once the buffered lines form complete commands they are compiled into
+// cb->prog and the index of their first instruction is returned, for
+// vm_execute_at. Returns -1 while more input is needed or after a syntax
+// error.
+int control_buffer_add(ControlBuffer *cb, const char *line);
+
+// Input ended, compile whatever is still buffered
+// Returns the start index, or -1 after reporting a command left unfinished
+int control_buffer_finish(ControlBuffer *cb);
+
+// Run a script file, each command as soon as it is complete
+// Reading stops at an exit. When compiled is given, the whole script is
+// handed back compiled in *compiled (NULL if any command failed to parse,
+// or an exit left part of it unread)
+int process_script_compiled(FILE *script_file, Program **compiled);
 
 #endif // CONTROL_H
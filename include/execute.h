@@ -6,6 +6,9 @@
 #include "loop.h"
 #include <string.h>
 
-int hush_execute(char **args);
+// Execute an expanded simple command (aliases are expanded here)
+// assigns holds its NAME=value prefix assignments, NULL-terminated, or is
+// NULL. The arrays are not kept; intermediate copies go in the command arena
+int execute_fields(char **args, unsigned int *flags, char **assigns);
 
 #endif // EXECUTE_H
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "parser.h"
+#include "command_sub.h"
+
+// Expand the words of a simple command into a NULL-terminated argv
+// Parameters and command substitutions are expanded, unquoted results are
+// split on IFS, quotes are removed and operators pass through unchanged.
+// Each field gets lexer-style flags in *flags (HUSH_TOK_GLOB only when an
+// unquoted glob character survived). The strings and arrays are allocated
+// in the command arena. Returns NULL when an expansion failed.
+char **expand_words(const Word *words, int count, unsigned int **flags);
+
+// Set when an expansion failed after printing why: ${name?word} with name
+// unset, a bad substitution or an arithmetic error. The command must not
+// run, and the caller clears it before the next one.
+extern int expansion_failed;
+
+// With HUSH_PARALLEL_SUBST set, run the command substitutions in a
+// command's words all at once, before the words are expanded. The caller
+// installs the batch with capture_batch_use. Off by default: substitutions
+// that touch the same files could see each other's effects in a new order.
+// Commands with ${...} run in order, since an assignment there could
+// change what a later substitution sees. Returns 1 if batch was filled.
+int expand_substitutions_early(const Word *words, int count, CaptureBatch *batch);
+
+// Expand a single word without field splitting, the result is in the arena
+char *expand_word_nosplit(const char *text);
+
+// Expand a word into a glob pattern, or an extended regular expression
+// when regex is set, without splitting it; quoted parts are escaped so
+// they match literally
+char *expand_pattern_word(const char *text, int regex);
+
+// Expand the value of a NAME=value word, unsplit and with a leading ~,
+// into a new NAME=value string in the arena; the key of NAME[key]=value
+// is expanded as well
+char *expand_assignment(const char *text);
+
+#endif // EXPAND_H
@@ -0,0 +1,45 @@
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+#include "bytecode.h"
+
+// Shell functions
+// A definition compiles the body's source once into its own program, so
+// the program that defined it can be freed or reused. Calls run that
+// program in a new variable scope with their own positional parameters.
+
+// A compiled body, shared by the calls still running it
+typedef struct {
+    Program *prog;
+    int refs;
+} FunctionBody;
+
+typedef struct {
+    const char *name;  // Interned, NULL once removed
+    FunctionBody *body;
+} ShellFunction;
+
+// Deepest call nesting allowed, each level recurses in the C stack
+#define FUNCTION_DEPTH_MAX 1000
+
+// Set by return, the running function stops after the current command
+extern int function_returning;
+
+// Define or redefine a function from the source text of its body
+// Returns 0 and prints a message if the body does not parse.
+int define_function(const char *name, const char *body);
+
+// Find a function by name, NULL if there is none
+ShellFunction *find_function(const char *name);
+
+// Remove a function
+int remove_function(const char *name);
+
+// Run a function with args[0] as its name and the rest as $1...
+// Returns 0 if the shell should exit, the status is in $?
+int call_function(ShellFunction *fn, char **args);
+
+// Builtin commands
+int hush_return(char **args);
+
+#endif // FUNCTIONS_H
@@ -9,9 +9,12 @@
 int has_wildcards(const char *token);
 
 // Expand a single argument that might contain wildcards
+// The matches and the array are allocated in the command arena
 char **expand_wildcard(char *arg, int *count);
 
-// Expand all arguments that contain wildcards
-char **expand_wildcards(char **args);
+// Expand wildcards, using lexer flags (may be NULL) to skip quoted arguments
+// When out_flags is given it receives the flags of the expanded arguments
+// Always returns a new array in the command arena; the words may be shared
+char **expand_wildcards_flags(char **args, const unsigned int *flags, unsigned int **out_flags);
 
 #endif // GLOB_H
@@ -0,0 +1,36 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+// The read builtin and the shell's buffer over standard input
+// Reading one byte per system call is only needed where the bytes after the
+// line must be left for someone else. A regular file is read in blocks and
+// whatever was read ahead is given back with lseek before anything else can
+// read the descriptor: before a fork, a redirection of standard input, the
+// terminal prompt and exit. A pipe is read in blocks only while a loop owns
+// it: a pipeline stage that runs nothing but builtins, which the compiler
+// decides and the VM confirms no function or alias has replaced; otherwise
+// pipes and terminals are read a byte at a time.
+
+#define INPUT_BUFFER_SIZE (64 * 1024)
+
+// Give back what was read ahead of a regular file, so the descriptor's
+// offset is where the read builtin stopped
+void input_sync(void);
+
+// Standard input is about to be replaced, or has just been restored
+// The buffer of the outer input is kept aside until it comes back.
+void input_push(void);
+void input_pop(void);
+
+// A loop that is the only reader of standard input starts or ends
+void input_own(void);
+void input_disown(void);
+
+// Forget the buffer of an inherited standard input, in a child that has
+// just been given a new one
+void input_reset(void);
+
+// Built-in 'read' command - read a line into variables
+int hush_read(char **args);
+
+#endif // INPUT_H
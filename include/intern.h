@@ -0,0 +1,34 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Interned strings
+// Each distinct name is stored once and never freed, so two interned names
+// are equal exactly when their pointers are. Variable, alias and builtin
+// names are kept interned and compared by pointer.
+
+// Get the interned copy of a string, adding it if needed
+const char *intern(const char *s);
+const char *intern_n(const char *s, size_t len);
+
+// Get the interned copy of a string without adding it
+// Returns NULL when the string was never interned, in which case nothing
+// can be stored under that name
+const char *intern_find(const char *s);
+const char *intern_find_n(const char *s, size_t len);
+
+// 32-bit FNV-1a, the hash behind every table keyed by text
+// The seed is mixed into the offset basis, so one text can hash differently
+// for different tables or kinds of entry.
+static inline uint32_t hash_text(const char *s, size_t len, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)s[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#endif // INTERN_H
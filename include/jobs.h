@@ -49,6 +49,10 @@ extern int shell_terminal;
 extern int shell_is_interactive;
 extern struct termios shell_tmodes;
 
+// Set while a script file runs, which is never interactive even from a
+// terminal: errors that end a script end the shell
+extern int shell_runs_script;
+
 // Current active jobs array
 extern Job *jobs[MAX_JOBS];
 
@@ -106,9 +110,22 @@ void continue_job(Job *job, int foreground);
 // Launch a job (for both foreground and background processes)
 int launch_job(Job *job, char **args, int foreground);
 
+// Runs the body of a background job in the forked child, must not return
+typedef void (*job_body_fn)(void *data);
+
+// Fork body as a background job labelled for the jobs list
+int launch_background(const char *label, job_body_fn body, void *data);
+
 // Update the status of a specific process
 void update_process_status(pid_t pid, int status);
 
+// Set up a freshly forked child: process group (0 for a new one), terminal
+// ownership and default signal dispositions
+void prepare_child_process(pid_t pgid, int foreground);
+
+// Convert a wait status into a shell exit status
+int wait_status_to_exit(int status);
+
 // Built-in commands
 int hush_jobs(char **args);
 int hush_fg(char **args);
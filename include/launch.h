@@ -8,4 +8,8 @@
 
 int hush_launch(char **args);
 
+// Set in forked subshells whose last act is running a single command,
+// hush_launch then execs in place instead of forking again
+extern int launch_in_place;
+
 #endif // LAUNCH_H
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+
+// Token flags
+#define HUSH_TOK_OPERATOR  0x01  // Control or redirection operator
+#define HUSH_TOK_SQUOTED   0x02  // Contains single-quoted text
+#define HUSH_TOK_DQUOTED   0x04  // Contains double-quoted text
+#define HUSH_TOK_ESCAPED   0x08  // Contains backslash escapes
+#define HUSH_TOK_GLOB      0x10  // Contains unquoted glob characters
+#define HUSH_TOK_EXPAND    0x20  // Contains $ or ` outside single quotes
+#define HUSH_TOK_INTERNED  0x40  // Word text is an interned name (set by the compiler)
+#define HUSH_TOK_ARRAY     0x80  // name=(...) array literal, expanded by the assignment
+
+#define HUSH_TOK_QUOTED (HUSH_TOK_SQUOTED | HUSH_TOK_DQUOTED | HUSH_TOK_ESCAPED)
+
+// Operator kind is stored above the flag bits
+#define HUSH_TOK_OP_SHIFT 8
+#define HUSH_TOK_OP(flags) ((int)((flags) >> HUSH_TOK_OP_SHIFT))
+
+// Operator kinds
+typedef enum {
+    OP_NONE = 0,
+    OP_PIPE,        // |
+    OP_OR,          // ||
+    OP_AMP,         // &
+    OP_AND,         // &&
+    OP_SEMI,        // ;
+    OP_NEWLINE,     // end of line
+    OP_LESS,        // <
+    OP_HEREDOC,     // <<
+    OP_GREAT,       // >
+    OP_DGREAT,      // >>
+    OP_ERR_GREAT,   // 2>
+    OP_ERR_DGREAT,  // 2>>
+    OP_ALL_GREAT,   // &>
+    OP_COUNT
+} OperatorKind;
+
+// A token is a span of the source line, nothing is copied
+typedef struct {
+    size_t offset;       // Start of the raw token text
+    size_t length;       // Length of the raw text (quotes included)
+    unsigned int flags;  // HUSH_TOK_* bits and operator kind
+} Token;
+
+// Growable list of tokens
+typedef struct {
+    Token *items;
+    int count;
+    int capacity;
+} TokenList;
+
+// Initialize an empty token list
+void token_list_init(TokenList *list);
+
+// Free the tokens held by a list
+void token_list_free(TokenList *list);
+
+// Split a line into tokens in a single pass
+// Returns 0 on success, -1 if a quote was left open
+int hush_lex(const char *line, TokenList *list);
+
+// Get the canonical text of an operator
+const char *operator_str(int op);
+
+// Check if an operator kind is a redirection
+int is_redirection_op(int op);
+
+// Check that s[0..len) is a variable or function name
+int is_name(const char *s, size_t len);
+
+// Find the end of the $ expansion starting at line[i]
+size_t lex_skip_dollar(const char *line, size_t i);
+
+// Find the end of the backtick substitution starting at line[i]
+size_t lex_skip_backtick(const char *line, size_t i);
+
+// Remove quotes and escapes from a token, in place
+// Returns a pointer into line to the NUL-terminated word
+char *token_dequote(char *line, const Token *token);
+
+#endif // LEXER_H
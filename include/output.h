@@ -0,0 +1,28 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+// echo and printf, which write to the shell's standard output buffer
+// Builtins share stdout's stdio buffer, which the shell makes
+// OUTPUT_BUFFER_SIZE bytes and fully buffered unless it is a terminal or
+// the same file as stderr, where it stays line buffered.
+// It is flushed before every fork, before a redirection moves standard
+// output and before it is restored, before reading a line from the
+// terminal and at exit, and at no other time.
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Set up buffering for standard output, before anything is written to it
+void output_init(void);
+
+// Flush standard output after the builtin name, or NULL for any commands,
+// wrote to it
+// A write that failed is reported and cleared. Returns 0 if one did.
+int output_flush(const char *name);
+
+// Built-in 'echo' command - print its arguments
+int hush_echo(char **args);
+
+// Built-in 'printf' command - print arguments under control of a format
+int hush_printf(char **args);
+
+#endif // OUTPUT_H
@@ -0,0 +1,92 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "lexer.h"
+
+// Node types, from the outermost grammar level inwards
+typedef enum {
+    AST_LIST,       // and-or ; and-or & ...
+    AST_AND_OR,     // pipeline && pipeline || ...
+    AST_PIPELINE,   // command | command ...
+    AST_COMMAND,    // simple command
+    AST_IF,         // if list; then list; [elif list; then list;]... [else list;] fi
+    AST_WHILE,      // while list; do list; done
+    AST_UNTIL,      // until list; do list; done
+    AST_FOR,        // for name [in word...]; do list; done
+    AST_ARITH_FOR,  // for ((init; cond; step)); do list; done
+    AST_GROUP,      // { list; }
+    AST_FUNCTION,   // name() compound-command, or function name compound-command
+    AST_ARITH,      // ((expression))
+    AST_COND,       // [[ expression ]]
+    AST_COND_NOT,   // ! expression, inside [[ ]]
+    AST_COND_TEST,  // One primary of a [[ ]] expression
+    AST_REDIRECT    // compound-command redirection...
+} AstType;
+
+// AST_FOR without "in": loop over the positional parameters
+#define AST_FOR_ARGS 0x01
+
+// A word of a simple command, raw text with quotes and expansions intact
+typedef struct {
+    char *text;
+    unsigned int flags;  // Lexer flags, operators keep their kind
+} Word;
+
+typedef struct AstNode {
+    AstType type;
+
+    // AST_COMMAND: words and redirections in source order
+    // AST_FOR: the loop variable followed by the item words
+    // AST_COND_TEST: the operand, or the two operands of a binary operator
+    // AST_REDIRECT: operator and target pairs
+    // AST_FUNCTION: the function name
+    Word *words;
+    int word_count;
+
+    // AST_COMMAND: how many of the leading words are NAME=value
+    // assignments for the command rather than part of it
+    int assign_count;
+
+    // AST_LIST, AST_AND_OR, AST_PIPELINE: child nodes
+    // AST_IF: condition/body pairs, then the else body if there is one
+    // AST_WHILE, AST_UNTIL: condition and body
+    // AST_FOR, AST_GROUP, AST_FUNCTION: body
+    // AST_ARITH_FOR: the AST_ARITH init, condition and step, then the body
+    // AST_REDIRECT: the compound command the redirections apply to
+    // AST_COND, AST_COND_NOT: the expression, where AST_AND_OR joins
+    // the primaries that && and || connect
+    struct AstNode **children;
+    int child_count;
+
+    // AST_AND_OR: OP_AND or OP_OR joining child i to the one before it
+    // AST_LIST: OP_SEMI or OP_AMP terminating child i
+    int *ops;
+
+    // AST_FOR: AST_FOR_ARGS
+    // AST_COND_TEST: the letter of a unary operator (n for a lone operand),
+    // or the TestBinary between the two operands
+    int flags;
+
+    // Root: the copy of the source line the words point into
+    // AST_FUNCTION: the body's source text, compiled when the definition runs
+    // AST_ARITH: the expression
+    char *source;
+} AstNode;
+
+// Parse a command line into an AST
+// Returns NULL and prints a message on a syntax error
+AstNode *parse_line(const char *line);
+
+// Parse input that may continue on further lines
+// When the text ends inside a quote, a compound command or after an
+// operator, returns NULL with *incomplete set and prints nothing.
+AstNode *parse_input(const char *text, int *incomplete);
+
+// Count the compound commands a line opens minus those it closes
+// A cheap hint for line collectors, parse_input has the final say.
+int parse_block_depth(const char *line);
+
+// Free an AST returned by parse_line
+void free_ast(AstNode *node);
+
+#endif // PARSER_H
@@ -0,0 +1,59 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compiled shell glob patterns: * ? [...] and backslash escapes
+// A pattern is compiled once into literal runs, wildcards and character
+// sets. Matching checks the fixed literal text at both ends before it
+// tries the wildcards, so most failed matches cost one memcmp.
+
+typedef enum {
+    PAT_LITERAL,    // Bytes text[offset..offset+len)
+    PAT_ANY,        // ?
+    PAT_STAR,       // *
+    PAT_SET         // [...], sets[offset]
+} PatternOpKind;
+
+typedef struct {
+    uint8_t kind;
+    uint32_t offset;
+    uint32_t len;
+} PatternOp;
+
+// A set of bytes, one bit each
+typedef struct {
+    uint8_t bits[32];
+} PatternSet;
+
+typedef struct {
+    PatternOp *ops;
+    int count;
+    char *text;         // Unescaped literal bytes
+    PatternSet *sets;
+    size_t head;        // Literal bytes every match starts with
+    size_t tail;        // Literal bytes every match ends with
+    size_t min_len;     // Shortest text that can match
+    int has_star;       // Without a star every match is exactly min_len long
+} Pattern;
+
+// Compile a pattern; a backslash makes the next byte literal
+Pattern *pattern_compile(const char *text, size_t len);
+
+void pattern_free(Pattern *pattern);
+
+// Check if the whole of s matches
+int pattern_match(const Pattern *pattern, const char *s, size_t len);
+
+// Length of the shortest (or longest) prefix of s that matches, -1 if none
+long pattern_match_prefix(const Pattern *pattern, const char *s, size_t len, int longest);
+
+// Start of the shortest (or longest) suffix of s that matches, -1 if none
+long pattern_match_suffix(const Pattern *pattern, const char *s, size_t len, int longest);
+
+// Find the first place a non-empty match starts, the longest one there
+// Returns its start and sets *match_len, or -1 if there is none
+long pattern_search(const Pattern *pattern, const char *s, size_t len, size_t *match_len);
+
+#endif // PATTERN_H
@@ -9,10 +9,17 @@
 // Check if a token is a pipe symbol
 int is_pipe(char *token);
 
-// Split a command line by pipe symbols
+// Split a command line by pipe symbols, the arrays are allocated in the
+// command arena
 char ***split_by_pipe(char **args, int *num_commands);
 
 // Execute a pipeline of commands
 int execute_pipeline(char **args);
 
+// Runs stage index of a pipeline in the forked child, must not return
+typedef void (*pipeline_stage_fn)(int index, void *data);
+
+// Fork num_commands stages connected by pipes and wait for them
+int execute_pipeline_stages(int num_commands, pipeline_stage_fn stage, void *data);
+
 #endif // PIPES_H
@@ -9,9 +9,19 @@
 int is_redirection(char *token);
 
 // Setup IO redirection for a command
-// Returns new args array with redirection operators removed
+// Returns new args array with redirection operators removed, allocated in
+// the command arena
 char **setup_redirection(char **args, int *stdin_copy, int *stdout_copy, int *stderr_copy);
 
+// Same as setup_redirection, flags (may be NULL) are the lexer flags of args
+// so quoted operator characters are left alone
+char **setup_redirection_flags(char **args, const unsigned int *flags,
+                               int *stdin_copy, int *stdout_copy, int *stderr_copy);
+
+// Set by setup_redirection when a redirection could not be made, the
+// ones before it are in place and reset_redirection undoes them
+extern int redirection_failed;
+
 // Reset IO after command completes
 void reset_redirection(int stdin_copy, int stdout_copy, int stderr_copy);
 
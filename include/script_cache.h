@@ -0,0 +1,31 @@
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "bytecode.h"
+
+// Compiled scripts are kept in $HUSH_CACHE_DIR, else $XDG_CACHE_HOME/hush,
+// else ~/.cache/hush. Setting HUSH_CACHE_DIR to an empty string disables
+// the cache.
+
+// Larger scripts are streamed without caching: hashing them up front would
+// delay the first command and the compiled form would grow with the script
+#define SCRIPT_CACHE_MAX_SIZE (1024 * 1024)
+
+// Hash a script's contents, the file is rewound afterwards
+// Returns 0 on success, -1 on a read error
+int script_cache_hash(FILE *file, uint64_t *hash);
+
+// Load the compiled form of a script
+// Returns NULL unless an entry exists for the same path whose mtime, size
+// and content hash all still match
+Program *script_cache_load(const char *path, const struct stat *st, uint64_t hash);
+
+// Save the compiled form of a script, failures are silently ignored
+void script_cache_store(const char *path, const struct stat *st, uint64_t hash,
+                        const Program *prog);
+
+#endif // SCRIPT_CACHE_H
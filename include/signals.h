@@ -14,6 +14,12 @@ extern volatile sig_atomic_t signal_received;
 // Set up signal handlers for the shell
 void setup_signal_handlers(void);
 
+// Block SIGCHLD so the handler cannot reap a child we are about to wait for
+void block_sigchld(sigset_t *old_mask);
+
+// Restore the signal mask saved by block_sigchld
+void restore_sigmask(const sigset_t *old_mask);
+
 // Handler for SIGINT (Ctrl+C)
 void handle_sigint(int sig);
 
@@ -1,13 +1,13 @@
 #ifndef SPLITLINE_H
 #define SPLITLINE_H
 
-#define HUSH_TOK_BUFSIZE 64
-#define HUSH_TOK_DELIM " \t\r\n\a|"  // Add pipe to delimiters
-
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-char **hush_split_line(char *line);
+// Split a line into words, the words point into line which is modified in place
+// Also returns the lexer flags of each word. The arrays are allocated in
+// the command arena
+char **hush_split_line_flags(char *line, unsigned int **flags);
 
 #endif // SPLITLINE_H
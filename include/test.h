@@ -0,0 +1,52 @@
+#ifndef TEST_H
+#define TEST_H
+
+// Conditional expressions for test, [ and [[ ]]
+// test and [ parse their arguments every time they run. A [[ ]] command is
+// parsed once along with the rest of the line and compiled to one
+// instruction per primary, which calls cond_unary or cond_binary. Its glob
+// patterns and regular expressions are compiled once per distinct text and
+// kept in a cache.
+
+// String and integer comparisons, then the file ones
+typedef enum {
+    TEST_NONE,
+    TEST_STR_EQ,
+    TEST_STR_NE,
+    TEST_STR_LT,
+    TEST_STR_GT,
+    TEST_EQ,
+    TEST_NE,
+    TEST_LT,
+    TEST_LE,
+    TEST_GT,
+    TEST_GE,
+    TEST_NEWER,
+    TEST_OLDER,
+    TEST_SAME_FILE,
+    TEST_AND,         // -a and -o are binary only with three operands
+    TEST_OR,
+    TEST_MATCH,       // [[ ]] only: == and != against a glob pattern
+    TEST_NO_MATCH,
+    TEST_REGEX,       // [[ ]] only: =~ against an extended regular expression
+    TEST_BINARY_COUNT
+} TestBinary;
+
+// Check if s is a unary operator such as -f, returning its letter or 0
+char test_unary_op(const char *s);
+
+// The binary operator s names, TEST_NONE if it is none
+// -a and -o count only when connectives is set.
+TestBinary test_binary_op(const char *s, int connectives);
+
+// Evaluate one [[ ]] primary, returning its exit status: 0 when it is
+// true, 1 when it is false and 2 after printing an error
+// The integer comparisons take arithmetic expressions, and a successful
+// =~ leaves the match and its groups in BASH_REMATCH.
+int cond_unary(char op, const char *arg);
+int cond_binary(const char *left, TestBinary op, const char *right);
+
+// Built-in 'test' and '[' commands
+int hush_test(char **args);
+
+#endif // TEST_H
@@ -0,0 +1,41 @@
+#ifndef TEXT_CACHE_H
+#define TEXT_CACHE_H
+
+#include <stddef.h>
+
+// A small cache of things compiled from text, such as arithmetic
+// expressions and [[ ]] patterns
+// Entries are found by their text and a kind, with open addressing in a
+// fixed table that is kept at most half full. Instead of evicting single
+// entries, a full table is cleared and starts over.
+
+typedef struct {
+    char *text;      // NULL for an empty entry
+    int kind;
+    void *value;
+} TextCacheEntry;
+
+typedef struct {
+    TextCacheEntry *entries;
+    size_t size;                         // A power of two
+    size_t count;
+    void (*free_value)(void *value, int kind);
+} TextCache;
+
+// A cache over a static table of size entries
+#define TEXT_CACHE_INIT(table, size, free_value) \
+    { (table), (size), 0, (free_value) }
+
+// Get the value cached for text and kind, or NULL
+void *text_cache_find(const TextCache *cache, const char *text, int kind);
+
+// Check if storing one more entry clears the cache first
+int text_cache_full(const TextCache *cache);
+
+// Cache value for text and kind, which must not be cached yet
+void text_cache_store(TextCache *cache, const char *text, int kind, void *value);
+
+// Free every entry
+void text_cache_clear(TextCache *cache);
+
+#endif // TEXT_CACHE_H
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <stdint.h>
 
 // Initialize shell variables
 void init_shell_variables();
@@ -13,12 +14,81 @@ void init_shell_variables();
 // Set a shell variable
 int set_shell_variable(const char *name, const char *value);
 
-// Get a shell variable value
+// Set a shell variable whose name is already interned (see intern.h)
+int set_interned_variable(const char *name, const char *value);
+
+// Get a shell variable value, as a malloc'd copy
 char *get_shell_variable(const char *name);
 
+// A borrowed view of a value, ptr[len] is always a NUL
+// Valid until the variable or special parameter next changes
+typedef struct {
+    const char *ptr;
+    size_t len;
+} VarView;
+
+// Look up a variable, special parameter ($? $$ $! $# $@ $*), positional
+// parameter or environment variable without copying anything
+// The name need not be terminated. Returns 0 when it is not set.
+int lookup_variable(const char *name, size_t name_len, VarView *view);
+
+// Set a variable, interned name, to the result of arithmetic
+// The number is kept with its decimal text, so arithmetic reading it back
+// does not parse anything.
+int set_number_variable(const char *name, int64_t value);
+
+// Get a variable's value as a number when it holds one natively: it was
+// set by arithmetic or is declared -i. Returns 0 otherwise.
+int lookup_number(const char *name, int64_t *value);
+
 // Unset a shell variable
 int unset_shell_variable(const char *name);
 
+// Mark a set scalar variable for export to the commands the shell runs
+int export_variable(const char *name);
+
+// The NAME=value environment of the exported variables, which is also
+// installed as environ so fork and exec pass it on. Cached: it is only
+// rebuilt after an exported variable changed, so call it before forking
+// and the children reuse the parent's vector.
+char **exported_environment(void);
+
+// Lay NAME=value entries over the environment exported_environment builds,
+// for one command's prefix assignments. The NULL-terminated entries are not
+// copied; clear the overlay with NULL before they go away.
+void set_environment_overlay(char **entries);
+
+// Kinds of shell variable
+typedef enum {
+    VAR_SCALAR,
+    VAR_INDEXED,  // Indexed array, name[0] name[1] ...
+    VAR_ASSOC     // Associative array, keyed by strings
+} VarKind;
+
+// Make name an array of the given kind, creating it if needed
+// A scalar value becomes element 0. Returns 0 if it is the other kind.
+int declare_array(const char *name, VarKind kind);
+
+// Look up one element of an array, like lookup_variable
+// Indexed arrays take a number, negative ones counting from the end, or a
+// variable holding one. A scalar is an array whose only element is 0.
+int lookup_element(const char *name, size_t name_len, const char *key, size_t key_len, VarView *view);
+
+// Set one element, turning a scalar or unset name into an indexed array
+// Returns 0 when the subscript is out of range.
+int set_element(const char *name, const char *key, size_t key_len, const char *value, size_t len);
+
+// Remove one element
+int unset_element(const char *name, const char *key, size_t key_len);
+
+// Called with each element's key and value, valid for the call only
+typedef void (*ElementVisitor)(VarView key, VarView value, void *data);
+
+// Visit the set elements in order: indexed arrays by index, associative
+// arrays in insertion order, and for @ or * the positional parameters.
+// Returns how many there are; a NULL visit only counts them.
+size_t for_each_element(const char *name, size_t name_len, ElementVisitor visit, void *data);
+
 // Set the last exit status
 void set_last_exit_status(int status);
 
@@ -31,6 +101,46 @@ void set_last_background_pid(pid_t pid);
 // Get last background process PID
 pid_t get_last_background_pid();
 
+// Variable scopes of function calls
+// Entering a scope is O(1). make_local moves the variable's current value
+// aside, and leaving the scope puts back only what its locals shadowed.
+void push_variable_scope(void);
+void pop_variable_scope(void);
+
+// Make name local to the innermost scope, unset until assigned
+// Returns 0 when no scope is active.
+int make_local(const char *name);
+
+// Assign NAME=value entries, as a command of only assignments does
+void assign_variables(char **entries);
+
+// Assign one word of a command of only assignments: NAME=value,
+// NAME[key]=value with the key and value expanded, or NAME=(list) as
+// written when list is set, its elements are expanded here
+// Returns 0 after printing an error.
+int assign_command_word(const char *word, int list);
+
+// Assign one NAME=value entry as a local of the innermost scope
+void assign_local_entry(const char *entry);
+
+// Enter a scope where NAME=value entries are exported locals, for a
+// builtin or function run with prefix assignments; pop_variable_scope
+// leaves it
+void push_assignment_scope(char **entries);
+
+// Positional parameters set aside during a function call
+typedef struct {
+    char **args;
+    int count;
+} ScriptArgs;
+
+// Make argv[1]... the positional parameters, keeping $0
+// Returns the previous ones, nothing is copied.
+ScriptArgs replace_script_args(char **argv);
+
+// Free the current positional parameters and put saved ones back
+void restore_script_args(ScriptArgs saved);
+
 // Set command line arguments for scripts
 void set_script_args(int argc, char **argv);
 
@@ -40,15 +150,15 @@ int get_script_arg_count();
 // Get specific script argument
 char *get_script_arg(int index);
 
-// Expand variables in a string
-char *expand_variables(char *line);
-
-// Advanced parameter expansion like ${var:-default}
-char *expand_parameter(const char *param, int *offset);
-
 // Built-in 'set' command - display or set variables
 int hush_set(char **args);
 
+// Built-in 'declare' command - declare arrays, set or display variables
+int hush_declare(char **args);
+
+// Built-in 'local' command - declare variables local to a function
+int hush_local(char **args);
+
 // Built-in 'unset' command
 int hush_unset(char **args);
 
@@ -0,0 +1,13 @@
+#ifndef VM_H
+#define VM_H
+
+#include "bytecode.h"
+
+// Run a compiled program
+// Returns 0 if the shell should exit, the command status is in $?
+int vm_execute(const Program *prog);
+
+// Run a program starting at instruction pc
+int vm_execute_at(const Program *prog, int pc);
+
+#endif // VM_H
@@ -1,4 +1,8 @@
 #include "alias.h"
+#include "lexer.h"
+#include "splitline.h"
+#include "arena.h"
+#include "intern.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,16 +14,30 @@
 static Alias aliases[MAX_ALIASES];
 static int alias_count = 0;
 
-// Find an alias by name
-static Alias *find_alias(const char *name) {
+// Find an alias by its interned name
+static Alias *find_interned_alias(const char *name) {
+    if (!name) {
+        return NULL;
+    }
     for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].name, name) == 0) {
+        if (aliases[i].name == name) {
             return &aliases[i];
         }
     }
     return NULL;
 }
 
+// Find an alias by name
+static Alias *find_alias(const char *name) {
+    return find_interned_alias(intern_find(name));
+}
+
+// Get the value of an alias, NULL if there is none
+char *get_alias(const char *name) {
+    Alias *alias = find_alias(name);
+    return alias ? alias->value : NULL;
+}
+
 // Add or update an alias
 int add_alias(const char *name, const char *value) {  // REMOVED static
     if (alias_count >= MAX_ALIASES) {
@@ -28,7 +46,8 @@ int add_alias(const char *name, const char *value) {  // REMOVED static
     }
 
     // Check if the alias already exists
-    Alias *existing = find_alias(name);
+    name = intern(name);
+    Alias *existing = find_interned_alias(name);
     if (existing) {
         // Update existing alias
         free(existing->value);
@@ -37,7 +56,7 @@ int add_alias(const char *name, const char *value) {  // REMOVED static
     }
 
     // Add new alias
-    aliases[alias_count].name = strdup(name);
+    aliases[alias_count].name = name;
     aliases[alias_count].value = strdup(value);
     alias_count++;
     return 1;
@@ -45,10 +64,10 @@ int add_alias(const char *name, const char *value) {  // REMOVED static
 
 // Remove an alias
 int remove_alias(const char *name) {  // REMOVED static
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].name, name) == 0) {
+    name = intern_find(name);
+    for (int i = 0; name && i < alias_count; i++) {
+        if (aliases[i].name == name) {
             // Free memory
-            free(aliases[i].name);
             free(aliases[i].value);
 
             // Move all subsequent aliases one position back
@@ -125,7 +144,6 @@ int hush_unalias(char **args) {
         if (strcmp(args[i], "-a") == 0) {
             // Remove all aliases
             for (int j = 0; j < alias_count; j++) {
-                free(aliases[j].name);
                 free(aliases[j].value);
             }
             alias_count = 0;
@@ -137,35 +155,33 @@ int hush_unalias(char **args) {
     return 1;
 }
 
-// Expand aliases in the arguments array
-char **expand_aliases(char **args) {
+// Expand aliases, keeping the lexer flags array (if given) in step with args
+char **expand_aliases_flags(char **args, unsigned int **flags) {
     if (args == NULL || args[0] == NULL) {
         return args;
     }
 
-    // Check if the command matches an alias
-    Alias *alias = find_alias(args[0]);
+    // A quoted or operator command word is never an alias
+    if (flags && *flags && ((*flags)[0] & (HUSH_TOK_QUOTED | HUSH_TOK_OPERATOR))) {
+        return args;
+    }
+
+    // Check if the command matches an alias, compiled command names are
+    // already interned
+    Alias *alias = (flags && *flags && ((*flags)[0] & HUSH_TOK_INTERNED)) ?
+                   find_interned_alias(args[0]) : find_alias(args[0]);
     if (!alias) {
         return args;  // No alias found, return original args
     }
 
-    // Parse the alias value into tokens
-    char *alias_value = strdup(alias->value);
-    char **alias_args = NULL;
-    int alias_arg_count = 0;
-    int alias_arg_capacity = 0;
-
-    // Tokenize the alias value
-    char *token = strtok(alias_value, " \t");
-    while (token != NULL) {
-        // Resize the array if needed
-        if (alias_arg_count >= alias_arg_capacity) {
-            alias_arg_capacity = alias_arg_capacity == 0 ? 4 : alias_arg_capacity * 2;
-            alias_args = realloc(alias_args, alias_arg_capacity * sizeof(char *));
-        }
+    // Split the alias value with the same lexer used for command lines
+    char *alias_value = arena_strdup(alias->value);
+    unsigned int *alias_flags = NULL;
+    char **alias_args = hush_split_line_flags(alias_value, &alias_flags);
 
-        alias_args[alias_arg_count++] = strdup(token);
-        token = strtok(NULL, " \t");
+    int alias_arg_count = 0;
+    while (alias_args[alias_arg_count] != NULL) {
+        alias_arg_count++;
     }
 
     // Count the original arguments
@@ -174,26 +190,37 @@ char **expand_aliases(char **args) {
         orig_arg_count++;
     }
 
-    // Create a new array for the expanded command
+    // Create a new array for the expanded command, the words themselves
+    // are shared since everything lives until the command finishes
     int total_args = alias_arg_count + orig_arg_count - 1; // -1 because we replace the first arg
-    char **expanded_args = malloc((total_args + 1) * sizeof(char *));
+    char **expanded_args = arena_alloc((total_args + 1) * sizeof(char *));
+    unsigned int *expanded_flags = NULL;
+    if (flags) {
+        expanded_flags = arena_alloc((total_args + 1) * sizeof(unsigned int));
+    }
 
     // Copy the alias arguments
     for (int i = 0; i < alias_arg_count; i++) {
         expanded_args[i] = alias_args[i];
+        if (expanded_flags) {
+            expanded_flags[i] = alias_flags[i];
+        }
     }
 
     // Copy the remaining original arguments
     for (int i = 1; i < orig_arg_count; i++) {
-        expanded_args[alias_arg_count + i - 1] = strdup(args[i]);
+        expanded_args[alias_arg_count + i - 1] = args[i];
+        if (expanded_flags) {
+            expanded_flags[alias_arg_count + i - 1] = *flags ? (*flags)[i] : 0;
+        }
     }
 
     // Null-terminate the array
     expanded_args[total_args] = NULL;
-
-    // Clean up
-    free(alias_args);
-    free(alias_value);
+    if (expanded_flags) {
+        expanded_flags[total_args] = 0;
+        *flags = expanded_flags;
+    }
 
     return expanded_args;
 }
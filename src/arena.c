@@ -0,0 +1,197 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK_SIZE (16 * 1024)
+#define ARENA_SPARE_MAX 4   // Released blocks kept for reuse
+
+struct ArenaBlock {
+    ArenaBlock *prev;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+static ArenaBlock *current;    // Block being allocated from
+static ArenaBlock *spare;      // Released blocks of the standard size
+static int spare_count;
+static void *last;             // Most recent allocation, for arena_grow
+static ArenaStats stats;
+
+void alloc_error(void) {
+    fprintf(stderr, "hush: allocation error\n");
+    exit(EXIT_FAILURE);
+}
+
+// Bytes needed to align an address
+static size_t block_padding_at(const char *p) {
+    return (size_t)(-(uintptr_t)p) & (ARENA_ALIGN - 1);
+}
+
+// Bytes needed to align the next allocation in a block
+static size_t block_padding(const ArenaBlock *block) {
+    return block_padding_at(block->data + block->used);
+}
+
+// Start a new block big enough for size bytes
+static void new_block(size_t size) {
+    ArenaBlock *block;
+
+    if (size + ARENA_ALIGN <= ARENA_BLOCK_SIZE && spare) {
+        block = spare;
+        spare = block->prev;
+        spare_count--;
+    } else {
+        size_t block_size = ARENA_BLOCK_SIZE;
+        if (size + ARENA_ALIGN > block_size) {
+            block_size = size + ARENA_ALIGN;
+        }
+        block = malloc(sizeof(ArenaBlock) + block_size);
+        if (!block) {
+            alloc_error();
+        }
+        block->size = block_size;
+        stats.block_mallocs++;
+    }
+
+    block->used = 0;
+    block->prev = current;
+    current = block;
+}
+
+void *arena_alloc(size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    if (!current || block_padding(current) + size > current->size - current->used) {
+        new_block(size);
+    }
+
+    size_t pad = block_padding(current);
+    void *ptr = current->data + current->used + pad;
+    current->used += pad + size;
+
+    stats.allocations++;
+    stats.in_use += pad + size;
+    if (stats.in_use > stats.peak) {
+        stats.peak = stats.in_use;
+    }
+    last = ptr;
+    return ptr;
+}
+
+void *arena_grow(void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr) {
+        return arena_alloc(new_size);
+    }
+
+    // The newest allocation can simply move the end of the block
+    if (ptr == last) {
+        size_t start = (size_t)((char *)ptr - current->data);
+        if (start + new_size > current->size && start == block_padding_at(current->data) &&
+            current->size != ARENA_BLOCK_SIZE) {
+            // It has an oversized block to itself, let realloc move or
+            // remap the whole block
+            ArenaBlock *block = realloc(current, sizeof(ArenaBlock) + new_size + ARENA_ALIGN);
+            if (!block) {
+                alloc_error();
+            }
+            stats.block_mallocs++;
+            block->size = new_size + ARENA_ALIGN;
+            current = block;
+
+            // Keep the data aligned if realloc's alignment was weaker
+            size_t pad = block_padding_at(block->data);
+            if (pad != start) {
+                memmove(block->data + pad, block->data + start, old_size);
+                start = pad;
+            }
+            ptr = last = block->data + start;
+        }
+        if (start + new_size <= current->size) {
+            current->used = start + new_size;
+            stats.in_use = stats.in_use - old_size + new_size;
+            if (stats.in_use > stats.peak) {
+                stats.peak = stats.in_use;
+            }
+            return ptr;
+        }
+    }
+
+    // Anything can shrink where it is
+    if (new_size <= old_size) {
+        return ptr;
+    }
+
+    void *grown = arena_alloc(new_size);
+    memcpy(grown, ptr, old_size);
+    return grown;
+}
+
+char *arena_strndup(const char *s, size_t n) {
+    char *copy = arena_alloc(n + 1);
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    return copy;
+}
+
+char *arena_strdup(const char *s) {
+    return arena_strndup(s, strlen(s));
+}
+
+ArenaMark arena_mark(void) {
+    ArenaMark mark = { current, current ? current->used : 0 };
+
+    // Growing an allocation in place past a mark would let release cut it
+    last = NULL;
+    return mark;
+}
+
+void arena_release(ArenaMark mark) {
+    // Hand back whole blocks started since the mark
+    while (current && current != mark.block) {
+        ArenaBlock *block = current;
+        current = block->prev;
+        stats.in_use -= block->used;
+
+        if (block->size == ARENA_BLOCK_SIZE && spare_count < ARENA_SPARE_MAX) {
+            block->prev = spare;
+            spare = block;
+            spare_count++;
+        } else {
+            free(block);
+        }
+    }
+
+    if (current) {
+        stats.in_use -= current->used - mark.used;
+        current->used = mark.used;
+    }
+    last = NULL;
+}
+
+void arena_end_command(ArenaMark mark) {
+    arena_release(mark);
+    stats.commands++;
+}
+
+const ArenaStats *arena_stats(void) {
+    return &stats;
+}
+
+int hush_memstats(char **args) {
+    (void)args;
+    unsigned long commands = stats.commands ? stats.commands : 1;
+
+    printf("commands:          %lu\n", stats.commands);
+    printf("arena allocations: %lu (%.1f per command)\n",
+           stats.allocations, (double)stats.allocations / commands);
+    printf("block mallocs:     %lu (%.2f per command)\n",
+           stats.block_mallocs, (double)stats.block_mallocs / commands);
+    printf("bytes in use:      %zu\n", stats.in_use);
+    printf("peak bytes:        %zu\n", stats.peak);
+    return 1;
+}
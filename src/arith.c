@@ -0,0 +1,848 @@
+#include "arith.h"
+#include "arena.h"
+#include "intern.h"
+#include "text_cache.h"
+#include "variables.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+// Node kinds, from leaves to the lowest precedence operators
+typedef enum {
+    AR_NUM,
+    AR_VAR,
+    AR_NEG,
+    AR_NOT,
+    AR_BITNOT,
+    AR_PREINC,
+    AR_PREDEC,
+    AR_POSTINC,
+    AR_POSTDEC,
+    AR_POW,
+    AR_MUL,
+    AR_DIV,
+    AR_MOD,
+    AR_ADD,
+    AR_SUB,
+    AR_SHL,
+    AR_SHR,
+    AR_LT,
+    AR_LE,
+    AR_GT,
+    AR_GE,
+    AR_EQ,
+    AR_NE,
+    AR_BITAND,
+    AR_BITXOR,
+    AR_BITOR,
+    AR_AND,
+    AR_OR,
+    AR_COND,
+    AR_ASSIGN,
+    AR_COMMA
+} ArithKind;
+
+// One node of a parsed expression, children are indexes into the same array
+typedef struct {
+    uint8_t kind;
+    uint8_t assign_op;  // AR_ASSIGN: operator of a compound assignment, AR_NUM for =
+    int left;           // -1 for none; AR_VAR: the subscript
+    int right;
+    int third;          // AR_COND: the false branch
+    int64_t value;      // AR_NUM
+    const char *name;   // AR_VAR: interned
+    size_t name_len;
+} ArithNode;
+
+typedef struct {
+    char *text;
+    ArithNode *nodes;
+    int count;
+    int root;
+} ArithExpr;
+
+typedef struct {
+    const char *text;
+    size_t pos;
+    ArithNode *nodes;
+    int count;
+    int capacity;
+    int error;
+} ArithParser;
+
+// Binary operators, longest first so the first match is the right one
+typedef struct {
+    const char *text;
+    uint8_t len;
+    uint8_t kind;
+    uint8_t prec;       // Higher binds tighter
+    uint8_t compound;   // Also an assignment operator when followed by =
+} BinaryOp;
+
+static const BinaryOp binary_ops[] = {
+    { "**", 2, AR_POW,    11, 0 },
+    { "<<", 2, AR_SHL,     8, 1 },
+    { ">>", 2, AR_SHR,     8, 1 },
+    { "<=", 2, AR_LE,      7, 0 },
+    { ">=", 2, AR_GE,      7, 0 },
+    { "==", 2, AR_EQ,      6, 0 },
+    { "!=", 2, AR_NE,      6, 0 },
+    { "&&", 2, AR_AND,     2, 0 },
+    { "||", 2, AR_OR,      1, 0 },
+    { "*",  1, AR_MUL,    10, 1 },
+    { "/",  1, AR_DIV,    10, 1 },
+    { "%",  1, AR_MOD,    10, 1 },
+    { "+",  1, AR_ADD,     9, 1 },
+    { "-",  1, AR_SUB,     9, 1 },
+    { "<",  1, AR_LT,      7, 0 },
+    { ">",  1, AR_GT,      7, 0 },
+    { "&",  1, AR_BITAND,  5, 1 },
+    { "^",  1, AR_BITXOR,  4, 1 },
+    { "|",  1, AR_BITOR,   3, 1 },
+};
+
+#define BINARY_OP_COUNT (sizeof(binary_ops) / sizeof(binary_ops[0]))
+
+// Parsed expressions by text, open addressing, at most half full
+#define ARITH_CACHE_SIZE 256
+
+static TextCacheEntry cache_entries[ARITH_CACHE_SIZE];
+static void free_cached(void *value, int kind);
+static TextCache cache = TEXT_CACHE_INIT(cache_entries, ARITH_CACHE_SIZE, free_cached);
+
+// Variables holding expressions are evaluated recursively, up to this deep
+#define ARITH_DEPTH_MAX 64
+
+static int depth = 0;
+
+// Value of a digit: 0-9, then a-z, A-Z, @ and _ for bases up to 64
+// Up to base 36 letters are the same in either case
+static int digit_value(char c, int base) {
+    int value;
+    if (isdigit((unsigned char)c)) {
+        value = c - '0';
+    } else if (islower((unsigned char)c)) {
+        value = c - 'a' + 10;
+    } else if (isupper((unsigned char)c)) {
+        value = c - 'A' + (base <= 36 ? 10 : 36);
+    } else if (c == '@') {
+        value = 62;
+    } else if (c == '_') {
+        value = 63;
+    } else {
+        return -1;
+    }
+    return value < base ? value : -1;
+}
+
+// Scan an unsigned constant at s, returning how many characters it takes,
+// or 0 if there is none or it runs into characters its base does not have
+static size_t scan_number(const char *s, size_t len, int64_t *result) {
+    size_t i = 0;
+    int base = 10;
+
+    if (len >= 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        i = 2;
+    } else if (len >= 1 && s[0] == '0') {
+        base = 8;
+    } else {
+        // base#digits
+        size_t j = 0;
+        int b = 0;
+        while (j < len && isdigit((unsigned char)s[j]) && b <= 64) {
+            b = b * 10 + (s[j++] - '0');
+        }
+        if (j < len && s[j] == '#') {
+            if (b < 2 || b > 64) {
+                return 0;
+            }
+            base = b;
+            i = j + 1;
+        }
+    }
+
+    size_t start = i;
+    uint64_t value = 0;
+    int digit;
+    while (i < len && (digit = digit_value(s[i], base)) >= 0) {
+        value = value * (uint64_t)base + (uint64_t)digit;
+        i++;
+    }
+    if (i == start || (i < len && (isalnum((unsigned char)s[i]) || s[i] == '_' || s[i] == '#'))) {
+        return 0;
+    }
+    *result = (int64_t)value;
+    return i;
+}
+
+int arith_parse_number(const char *s, size_t len, int64_t *result) {
+    size_t i = 0;
+    while (i < len && isspace((unsigned char)s[i])) {
+        i++;
+    }
+    int negative = 0;
+    if (i < len && (s[i] == '-' || s[i] == '+')) {
+        negative = s[i++] == '-';
+    }
+
+    int64_t value;
+    size_t n = scan_number(s + i, len - i, &value);
+    if (n == 0) {
+        return 0;
+    }
+    for (i += n; i < len; i++) {
+        if (!isspace((unsigned char)s[i])) {
+            return 0;
+        }
+    }
+    *result = negative ? (int64_t)(0 - (uint64_t)value) : value;
+    return 1;
+}
+
+size_t arith_format(int64_t value, char *buf) {
+    return (size_t)snprintf(buf, ARITH_NUMBER_MAX, "%" PRId64, value);
+}
+
+// Apply a binary operator, wrapping on overflow like the hardware does
+// Returns 0 with *error set when the operation is undefined.
+static int apply_binary(int kind, int64_t a, int64_t b, int64_t *result, const char **error) {
+    uint64_t ua = (uint64_t)a;
+    uint64_t ub = (uint64_t)b;
+
+    switch (kind) {
+        case AR_ADD: *result = (int64_t)(ua + ub); break;
+        case AR_SUB: *result = (int64_t)(ua - ub); break;
+        case AR_MUL: *result = (int64_t)(ua * ub); break;
+        case AR_DIV:
+        case AR_MOD:
+            if (b == 0) {
+                *error = "division by 0";
+                return 0;
+            }
+            // INT64_MIN / -1 overflows, it wraps to itself
+            if (b == -1) {
+                *result = kind == AR_DIV ? (int64_t)(0 - ua) : 0;
+            } else {
+                *result = kind == AR_DIV ? a / b : a % b;
+            }
+            break;
+        case AR_POW: {
+            if (b < 0) {
+                *error = "exponent less than 0";
+                return 0;
+            }
+            uint64_t power = 1;
+            for (; ub; ub >>= 1) {
+                if (ub & 1) {
+                    power *= ua;
+                }
+                ua *= ua;
+            }
+            *result = (int64_t)power;
+            break;
+        }
+        case AR_SHL: *result = (int64_t)(ua << (b & 63)); break;
+        case AR_SHR: *result = a >> (b & 63); break;
+        case AR_LT: *result = a < b; break;
+        case AR_LE: *result = a <= b; break;
+        case AR_GT: *result = a > b; break;
+        case AR_GE: *result = a >= b; break;
+        case AR_EQ: *result = a == b; break;
+        case AR_NE: *result = a != b; break;
+        case AR_BITAND: *result = a & b; break;
+        case AR_BITXOR: *result = a ^ b; break;
+        case AR_BITOR: *result = a | b; break;
+        case AR_AND: *result = a && b; break;
+        case AR_OR: *result = a || b; break;
+    }
+    return 1;
+}
+
+// Parsing
+
+static void syntax_error(ArithParser *p) {
+    if (!p->error) {
+        const char *token = p->text + p->pos;
+        if (*token) {
+            fprintf(stderr, "hush: %s: syntax error in expression (error token is \"%s\")\n",
+                    p->text, token);
+        } else {
+            fprintf(stderr, "hush: %s: syntax error: operand expected\n", p->text);
+        }
+        p->error = 1;
+    }
+}
+
+static void skip_blanks(ArithParser *p) {
+    while (isspace((unsigned char)p->text[p->pos])) {
+        p->pos++;
+    }
+}
+
+// Check for text at the current position, skipping it if it is there
+static int accept(ArithParser *p, const char *text) {
+    size_t len = strlen(text);
+    skip_blanks(p);
+    if (strncmp(p->text + p->pos, text, len) == 0) {
+        p->pos += len;
+        return 1;
+    }
+    return 0;
+}
+
+static int add_node(ArithParser *p, int kind, int left, int right) {
+    if (p->count == p->capacity) {
+        int capacity = p->capacity ? p->capacity * 2 : 16;
+        ArithNode *nodes = realloc(p->nodes, capacity * sizeof(ArithNode));
+        if (!nodes) {
+            alloc_error();
+        }
+        p->nodes = nodes;
+        p->capacity = capacity;
+    }
+
+    ArithNode *node = &p->nodes[p->count];
+    memset(node, 0, sizeof(*node));
+    node->kind = (uint8_t)kind;
+    node->left = left;
+    node->right = right;
+    node->third = -1;
+    return p->count++;
+}
+
+static int is_const(const ArithParser *p, int i) {
+    return p->nodes[i].kind == AR_NUM;
+}
+
+// Fold two constant operands into one constant where the left one was
+// Operands are single nodes once folded, so they are the last two.
+static int fold(ArithParser *p, int left, int64_t value) {
+    p->nodes[left].kind = AR_NUM;
+    p->nodes[left].value = value;
+    p->count = left + 1;
+    return left;
+}
+
+static int make_binary(ArithParser *p, int kind, int left, int right) {
+    if (is_const(p, left) && is_const(p, right) && right == left + 1 && right == p->count - 1) {
+        int64_t value;
+        const char *error;
+        // An error is left for evaluation to report
+        if (apply_binary(kind, p->nodes[left].value, p->nodes[right].value, &value, &error)) {
+            return fold(p, left, value);
+        }
+    }
+    return add_node(p, kind, left, right);
+}
+
+static int parse_comma(ArithParser *p);
+static int parse_assign(ArithParser *p);
+static int parse_unary(ArithParser *p);
+
+// number | name | name[expr] | (expr)
+static int parse_primary(ArithParser *p) {
+    skip_blanks(p);
+    const char *s = p->text + p->pos;
+
+    if (*s == '(') {
+        p->pos++;
+        int inner = parse_comma(p);
+        if (!p->error && !accept(p, ")")) {
+            syntax_error(p);
+        }
+        return inner;
+    }
+
+    if (isdigit((unsigned char)*s)) {
+        int64_t value;
+        size_t n = scan_number(s, strlen(s), &value);
+        if (n == 0) {
+            fprintf(stderr, "hush: %s: value too great for base (error token is \"%s\")\n", p->text, s);
+            p->error = 1;
+            return -1;
+        }
+        p->pos += n;
+        int node = add_node(p, AR_NUM, -1, -1);
+        p->nodes[node].value = value;
+        return node;
+    }
+
+    if (isalpha((unsigned char)*s) || *s == '_') {
+        size_t n = 1;
+        while (isalnum((unsigned char)s[n]) || s[n] == '_') {
+            n++;
+        }
+        p->pos += n;
+
+        int subscript = -1;
+        if (p->text[p->pos] == '[') {
+            p->pos++;
+            subscript = parse_comma(p);
+            if (!p->error && !accept(p, "]")) {
+                syntax_error(p);
+            }
+        }
+        int node = add_node(p, AR_VAR, subscript, -1);
+        p->nodes[node].name = intern_n(s, n);
+        p->nodes[node].name_len = n;
+        return node;
+    }
+
+    syntax_error(p);
+    return -1;
+}
+
+// primary, primary++ or primary--
+static int parse_postfix(ArithParser *p) {
+    int operand = parse_primary(p);
+    if (p->error) {
+        return -1;
+    }
+    if (p->nodes[operand].kind == AR_VAR) {
+        if (accept(p, "++")) {
+            return add_node(p, AR_POSTINC, operand, -1);
+        }
+        if (accept(p, "--")) {
+            return add_node(p, AR_POSTDEC, operand, -1);
+        }
+    }
+    return operand;
+}
+
+static int make_unary(ArithParser *p, int kind, int operand) {
+    if (p->error) {
+        return -1;
+    }
+    if (kind == AR_PREINC || kind == AR_PREDEC) {
+        if (p->nodes[operand].kind != AR_VAR) {
+            fprintf(stderr, "hush: %s: attempted assignment to non-variable\n", p->text);
+            p->error = 1;
+            return -1;
+        }
+        return add_node(p, kind, operand, -1);
+    }
+
+    ArithNode *node = &p->nodes[operand];
+    if (node->kind == AR_NUM && operand == p->count - 1) {
+        switch (kind) {
+            case AR_NEG: node->value = (int64_t)(0 - (uint64_t)node->value); break;
+            case AR_NOT: node->value = !node->value; break;
+            case AR_BITNOT: node->value = ~node->value; break;
+        }
+        return operand;
+    }
+    return add_node(p, kind, operand, -1);
+}
+
+// ++x --x -x +x !x ~x
+static int parse_unary(ArithParser *p) {
+    if (accept(p, "++")) {
+        return make_unary(p, AR_PREINC, parse_unary(p));
+    }
+    if (accept(p, "--")) {
+        return make_unary(p, AR_PREDEC, parse_unary(p));
+    }
+    if (accept(p, "-")) {
+        return make_unary(p, AR_NEG, parse_unary(p));
+    }
+    if (accept(p, "+")) {
+        return parse_unary(p);
+    }
+    if (p->text[p->pos] == '!' && p->text[p->pos + 1] != '=') {
+        p->pos++;
+        return make_unary(p, AR_NOT, parse_unary(p));
+    }
+    if (accept(p, "~")) {
+        return make_unary(p, AR_BITNOT, parse_unary(p));
+    }
+    return parse_postfix(p);
+}
+
+// The binary operator at the current position, NULL if there is none
+static const BinaryOp *match_binary(ArithParser *p) {
+    skip_blanks(p);
+    const char *s = p->text + p->pos;
+    for (size_t i = 0; i < BINARY_OP_COUNT; i++) {
+        const BinaryOp *op = &binary_ops[i];
+        if (strncmp(s, op->text, op->len) == 0) {
+            // x += 1 is an assignment, left to parse_assign
+            return op->compound && s[op->len] == '=' ? NULL : op;
+        }
+    }
+    return NULL;
+}
+
+// Binary operators binding at least as tight as min_prec
+static int parse_binary(ArithParser *p, int min_prec) {
+    int left = parse_unary(p);
+
+    while (!p->error) {
+        const BinaryOp *op = match_binary(p);
+        if (!op || op->prec < min_prec) {
+            break;
+        }
+        p->pos += op->len;
+
+        // ** groups to the right, everything else to the left
+        int right = parse_binary(p, op->kind == AR_POW ? op->prec : op->prec + 1);
+        if (p->error) {
+            break;
+        }
+        left = make_binary(p, op->kind, left, right);
+    }
+    return p->error ? -1 : left;
+}
+
+// cond ? expr : cond
+static int parse_cond(ArithParser *p) {
+    int cond = parse_binary(p, 1);
+    if (p->error || !accept(p, "?")) {
+        return cond;
+    }
+
+    int then = parse_comma(p);
+    if (p->error) {
+        return -1;
+    }
+    if (!accept(p, ":")) {
+        syntax_error(p);
+        return -1;
+    }
+    int otherwise = parse_cond(p);
+    if (p->error) {
+        return -1;
+    }
+
+    if (is_const(p, cond) && is_const(p, then) && is_const(p, otherwise) &&
+        then == cond + 1 && otherwise == then + 1 && otherwise == p->count - 1) {
+        int64_t value = p->nodes[cond].value ? p->nodes[then].value : p->nodes[otherwise].value;
+        return fold(p, cond, value);
+    }
+    int node = add_node(p, AR_COND, cond, then);
+    p->nodes[node].third = otherwise;
+    return node;
+}
+
+// The assignment operator at the current position: AR_NUM for =, the
+// operator of a compound one, or -1
+static int match_assign(ArithParser *p) {
+    skip_blanks(p);
+    const char *s = p->text + p->pos;
+
+    if (s[0] == '=' && s[1] != '=') {
+        p->pos++;
+        return AR_NUM;
+    }
+    for (size_t i = 0; i < BINARY_OP_COUNT; i++) {
+        const BinaryOp *op = &binary_ops[i];
+        if (op->compound && strncmp(s, op->text, op->len) == 0 && s[op->len] == '=') {
+            p->pos += op->len + 1;
+            return op->kind;
+        }
+    }
+    return -1;
+}
+
+// name = expr, name op= expr, or a conditional
+static int parse_assign(ArithParser *p) {
+    int target = parse_cond(p);
+    if (p->error) {
+        return -1;
+    }
+
+    size_t pos = p->pos;
+    int op = match_assign(p);
+    if (op < 0) {
+        p->pos = pos;
+        return target;
+    }
+    if (p->nodes[target].kind != AR_VAR) {
+        fprintf(stderr, "hush: %s: attempted assignment to non-variable\n", p->text);
+        p->error = 1;
+        return -1;
+    }
+
+    int value = parse_assign(p);
+    if (p->error) {
+        return -1;
+    }
+    int node = add_node(p, AR_ASSIGN, target, value);
+    p->nodes[node].assign_op = (uint8_t)op;
+    return node;
+}
+
+// expr, expr, ...
+static int parse_comma(ArithParser *p) {
+    int left = parse_assign(p);
+    while (!p->error && accept(p, ",")) {
+        int right = parse_assign(p);
+        if (p->error) {
+            return -1;
+        }
+        left = add_node(p, AR_COMMA, left, right);
+    }
+    return left;
+}
+
+static void free_expr(ArithExpr *expr) {
+    if (expr) {
+        free(expr->text);
+        free(expr->nodes);
+        free(expr);
+    }
+}
+
+// Parse text into a new expression, NULL after printing an error
+static ArithExpr *parse_expr(const char *text) {
+    ArithParser p;
+    memset(&p, 0, sizeof(p));
+    p.text = text;
+
+    skip_blanks(&p);
+    int root;
+    if (!text[p.pos]) {
+        // An empty expression is 0
+        root = add_node(&p, AR_NUM, -1, -1);
+    } else {
+        root = parse_comma(&p);
+        skip_blanks(&p);
+        if (!p.error && text[p.pos]) {
+            syntax_error(&p);
+        }
+    }
+    if (p.error) {
+        free(p.nodes);
+        return NULL;
+    }
+
+    ArithExpr *expr = malloc(sizeof(ArithExpr));
+    if (!expr || !(expr->text = strdup(text))) {
+        alloc_error();
+    }
+    expr->nodes = p.nodes;
+    expr->count = p.count;
+    expr->root = root;
+    return expr;
+}
+
+static void free_cached(void *value, int kind) {
+    (void)kind;
+    free_expr(value);
+}
+
+// Find or parse the expression for text
+// *owned is set when the result is not cached and the caller must free it.
+static ArithExpr *get_expr(const char *text, int *owned) {
+    ArithExpr *expr = text_cache_find(&cache, text, 0);
+    *owned = 0;
+    if (expr) {
+        return expr;
+    }
+
+    expr = parse_expr(text);
+    if (!expr) {
+        return NULL;
+    }
+
+    // A full cache starts over, unless outer evaluations are using it
+    if (text_cache_full(&cache) && depth > 1) {
+        *owned = 1;
+        return expr;
+    }
+    text_cache_store(&cache, text, 0, expr);
+    return expr;
+}
+
+// Evaluation
+
+typedef struct {
+    const ArithExpr *expr;
+    int error;
+} Eval;
+
+static void eval_error(Eval *ev, const char *message) {
+    if (!ev->error) {
+        fprintf(stderr, "hush: %s: %s\n", ev->expr->text, message);
+        ev->error = 1;
+    }
+}
+
+static int64_t eval(Eval *ev, int i);
+
+// The subscript of a name[expr] node as an element key, 0 for a plain name
+static size_t subscript_key(Eval *ev, const ArithNode *var, char *key) {
+    if (var->left < 0) {
+        return 0;
+    }
+    return arith_format(eval(ev, var->left), key);
+}
+
+// A variable's value as a number: natively held, a constant, or the value
+// of the expression it holds
+static int64_t read_variable(Eval *ev, const ArithNode *var, const char *key, size_t key_len) {
+    int64_t value;
+    VarView view;
+
+    if (var->left < 0) {
+        if (lookup_number(var->name, &value)) {
+            return value;
+        }
+        if (!lookup_variable(var->name, var->name_len, &view)) {
+            return 0;
+        }
+    } else if (!lookup_element(var->name, var->name_len, key, key_len, &view)) {
+        return 0;
+    }
+
+    if (arith_parse_number(view.ptr, view.len, &value)) {
+        return value;
+    }
+    if (!arith_evaluate(view.ptr, &value)) {
+        ev->error = 1;
+        return 0;
+    }
+    return value;
+}
+
+static void write_variable(Eval *ev, const ArithNode *var, const char *key, size_t key_len, int64_t value) {
+    if (var->left < 0) {
+        set_number_variable(var->name, value);
+        return;
+    }
+    char text[ARITH_NUMBER_MAX];
+    size_t len = arith_format(value, text);
+    if (!set_element(var->name, key, key_len, text, len)) {
+        eval_error(ev, "bad array subscript");
+    }
+}
+
+static int64_t eval(Eval *ev, int i) {
+    const ArithNode *node = &ev->expr->nodes[i];
+    char key[ARITH_NUMBER_MAX];
+    size_t key_len;
+    int64_t a, b, result;
+    const char *error;
+
+    if (ev->error) {
+        return 0;
+    }
+
+    switch (node->kind) {
+        case AR_NUM:
+            return node->value;
+
+        case AR_VAR:
+            key_len = subscript_key(ev, node, key);
+            return ev->error ? 0 : read_variable(ev, node, key, key_len);
+
+        case AR_NEG:
+            return (int64_t)(0 - (uint64_t)eval(ev, node->left));
+        case AR_NOT:
+            return !eval(ev, node->left);
+        case AR_BITNOT:
+            return ~eval(ev, node->left);
+
+        case AR_PREINC:
+        case AR_PREDEC:
+        case AR_POSTINC:
+        case AR_POSTDEC: {
+            const ArithNode *var = &ev->expr->nodes[node->left];
+            key_len = subscript_key(ev, var, key);
+            a = read_variable(ev, var, key, key_len);
+            int up = node->kind == AR_PREINC || node->kind == AR_POSTINC;
+            b = (int64_t)((uint64_t)a + (up ? 1 : (uint64_t)-1));
+            if (!ev->error) {
+                write_variable(ev, var, key, key_len, b);
+            }
+            return node->kind == AR_PREINC || node->kind == AR_PREDEC ? b : a;
+        }
+
+        case AR_AND:
+            return eval(ev, node->left) && eval(ev, node->right);
+        case AR_OR:
+            return eval(ev, node->left) || eval(ev, node->right);
+
+        case AR_COND:
+            return eval(ev, node->left) ? eval(ev, node->right) : eval(ev, node->third);
+
+        case AR_COMMA:
+            eval(ev, node->left);
+            return eval(ev, node->right);
+
+        case AR_ASSIGN: {
+            const ArithNode *var = &ev->expr->nodes[node->left];
+            key_len = subscript_key(ev, var, key);
+            if (node->assign_op == AR_NUM) {
+                result = eval(ev, node->right);
+            } else {
+                a = read_variable(ev, var, key, key_len);
+                b = eval(ev, node->right);
+                if (!ev->error && !apply_binary(node->assign_op, a, b, &result, &error)) {
+                    eval_error(ev, error);
+                }
+            }
+            if (ev->error) {
+                return 0;
+            }
+            write_variable(ev, var, key, key_len, result);
+            return result;
+        }
+
+        default:
+            a = eval(ev, node->left);
+            b = eval(ev, node->right);
+            if (ev->error) {
+                return 0;
+            }
+            if (!apply_binary(node->kind, a, b, &result, &error)) {
+                eval_error(ev, error);
+                return 0;
+            }
+            return result;
+    }
+}
+
+int arith_evaluate(const char *text, int64_t *result) {
+    if (depth >= ARITH_DEPTH_MAX) {
+        fprintf(stderr, "hush: %s: expression recursion level exceeded\n", text);
+        return 0;
+    }
+
+    depth++;
+    int owned;
+    ArithExpr *expr = get_expr(text, &owned);
+    int ok = 0;
+    if (expr) {
+        Eval ev = { expr, 0 };
+        *result = eval(&ev, expr->root);
+        ok = !ev.error;
+        if (owned) {
+            free_expr(expr);
+        }
+    }
+    depth--;
+    return ok;
+}
+
+// Built-in: let
+int hush_let(char **args) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "hush: let: expression expected\n");
+        set_last_exit_status(1);
+        return 1;
+    }
+
+    // The status is that of the last expression: 0 when it is non-zero
+    int64_t value = 0;
+    for (int i = 1; args[i] != NULL; i++) {
+        if (!arith_evaluate(args[i], &value)) {
+            set_last_exit_status(1);
+            return 1;
+        }
+    }
+    set_last_exit_status(value != 0 ? 0 : 1);
+    return 1;
+}
@@ -0,0 +1,364 @@
+#include "arrays.h"
+#include "arena.h"
+#include "intern.h"
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *zalloc(size_t size) {
+    void *ptr = calloc(1, size);
+    if (!ptr) {
+        alloc_error();
+    }
+    return ptr;
+}
+
+// Copy a value into a slot, replacing what was there
+static void item_set(ArrayItem *item, const char *value, size_t len) {
+    char *copy = malloc(len + 1);
+    if (!copy) {
+        alloc_error();
+    }
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+
+    free(item->value);
+    item->value = copy;
+    item->len = len;
+}
+
+// Empty slot i of a probe table, shifting the later entries of its probe
+// run back so no lookup stops early
+// home gives the hash of the entry a slot holds.
+static void close_slot(int *slots, size_t capacity, size_t i,
+                       uint32_t (*home)(const void *entries, int entry), const void *entries) {
+    size_t mask = capacity - 1;
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!slots[j]) {
+            break;
+        }
+        size_t h = home(entries, slots[j] - 1) & mask;
+        int movable = (j > i) ? (h <= i || h > j) : (h <= i && h > j);
+        if (movable) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i] = 0;
+}
+
+static uint32_t hash_index(long index) {
+    return hash_text((const char *)&index, sizeof(index), 0);
+}
+
+static uint32_t indexed_home(const void *entries, int entry) {
+    return ((const IndexedEntry *)entries)[entry].hash;
+}
+
+// Find the slot holding index, or the empty slot where it would go
+static size_t indexed_find_slot(const IndexedArray *array, long index, uint32_t hash) {
+    size_t mask = array->slot_capacity - 1;
+    size_t i = hash & mask;
+
+    while (array->slots[i] && array->entries[array->slots[i] - 1].index != index) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    long x = ((const IndexedEntry *)a)->index;
+    long y = ((const IndexedEntry *)b)->index;
+    return (x > y) - (x < y);
+}
+
+// Rebuild the slots with the given size, squeezing out holes and putting
+// the entries in index order first
+static void indexed_rebuild(IndexedArray *array, size_t capacity) {
+    if (array->holes > 0) {
+        int n = 0;
+        for (int i = 0; i < array->count; i++) {
+            if (array->entries[i].item.value) {
+                array->entries[n++] = array->entries[i];
+            }
+        }
+        array->count = n;
+        array->holes = 0;
+    }
+    if (!array->sorted) {
+        qsort(array->entries, array->count, sizeof(IndexedEntry), compare_entries);
+        array->sorted = 1;
+    }
+
+    free(array->slots);
+    array->slots = zalloc(capacity * sizeof(int));
+    array->slot_capacity = capacity;
+
+    for (int i = 0; i < array->count; i++) {
+        const IndexedEntry *entry = &array->entries[i];
+        array->slots[indexed_find_slot(array, entry->index, entry->hash)] = i + 1;
+    }
+}
+
+IndexedArray *indexed_new(void) {
+    IndexedArray *array = zalloc(sizeof(IndexedArray));
+    array->sorted = 1;
+    indexed_rebuild(array, 16);
+    return array;
+}
+
+void indexed_clear(IndexedArray *array) {
+    for (int i = 0; i < array->count; i++) {
+        free(array->entries[i].item.value);
+    }
+    array->count = 0;
+    array->holes = 0;
+    array->sorted = 1;
+    array->end = 0;
+    memset(array->slots, 0, array->slot_capacity * sizeof(int));
+}
+
+void indexed_free(IndexedArray *array) {
+    if (!array) {
+        return;
+    }
+    indexed_clear(array);
+    free(array->entries);
+    free(array->slots);
+    free(array);
+}
+
+const ArrayItem *indexed_get(const IndexedArray *array, long index) {
+    if (index < 0 || index >= array->end) {
+        return NULL;
+    }
+    size_t slot = indexed_find_slot(array, index, hash_index(index));
+    return array->slots[slot] ? &array->entries[array->slots[slot] - 1].item : NULL;
+}
+
+int indexed_set(IndexedArray *array, long index, const char *value, size_t len) {
+    // The end must stay representable
+    if (index < 0 || index == LONG_MAX) {
+        return 0;
+    }
+
+    // Keep the slots at most half full
+    if ((size_t)(array->count - array->holes + 1) * 2 > array->slot_capacity) {
+        indexed_rebuild(array, array->slot_capacity * 2);
+    }
+
+    uint32_t hash = hash_index(index);
+    size_t slot = indexed_find_slot(array, index, hash);
+    if (array->slots[slot]) {
+        item_set(&array->entries[array->slots[slot] - 1].item, value, len);
+        return 1;
+    }
+
+    if (array->count == array->capacity) {
+        int capacity = array->capacity ? array->capacity * 2 : 8;
+        IndexedEntry *entries = realloc(array->entries, capacity * sizeof(IndexedEntry));
+        if (!entries) {
+            alloc_error();
+        }
+        array->entries = entries;
+        array->capacity = capacity;
+    }
+
+    IndexedEntry *entry = &array->entries[array->count];
+    entry->index = index;
+    entry->hash = hash;
+    entry->item.value = NULL;
+    item_set(&entry->item, value, len);
+    array->slots[slot] = ++array->count;
+
+    // Appending past the end keeps the entries in order
+    if (index < array->end) {
+        array->sorted = 0;
+    } else {
+        array->end = index + 1;
+    }
+    return 1;
+}
+
+void indexed_unset(IndexedArray *array, long index) {
+    if (index < 0 || index >= array->end) {
+        return;
+    }
+    size_t slot = indexed_find_slot(array, index, hash_index(index));
+    if (!array->slots[slot]) {
+        return;
+    }
+
+    IndexedEntry *entry = &array->entries[array->slots[slot] - 1];
+    free(entry->item.value);
+    entry->item.value = NULL;
+    array->holes++;
+    close_slot(array->slots, array->slot_capacity, slot, indexed_home, array->entries);
+
+    // Keep end one past the highest set element, which in order is the
+    // last entry that is not a hole
+    if (index == array->end - 1) {
+        array->end = 0;
+        for (int i = array->count - 1; i >= 0; i--) {
+            const IndexedEntry *last = &array->entries[i];
+            if (last->item.value && last->index >= array->end) {
+                array->end = last->index + 1;
+                if (array->sorted) {
+                    break;
+                }
+            }
+        }
+    }
+
+    if (array->holes > 16 && array->holes * 2 > array->count) {
+        indexed_rebuild(array, array->slot_capacity);
+    }
+}
+
+size_t indexed_size(const IndexedArray *array) {
+    return (size_t)(array->count - array->holes);
+}
+
+const IndexedEntry *indexed_entries(IndexedArray *array, int *count) {
+    if (array->holes > 0 || !array->sorted) {
+        indexed_rebuild(array, array->slot_capacity);
+    }
+    *count = array->count;
+    return array->entries;
+}
+
+// Find the slot holding key, or the empty slot where it would go
+static size_t assoc_find_slot(const AssocArray *array, const char *key, size_t len, uint32_t hash) {
+    size_t mask = array->slot_capacity - 1;
+    size_t i = hash & mask;
+
+    while (array->slots[i]) {
+        const AssocEntry *entry = &array->entries[array->slots[i] - 1];
+        if (entry->hash == hash && entry->key_len == len && memcmp(entry->key, key, len) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Rebuild the slots with the given size, squeezing out holes first
+static void assoc_rebuild(AssocArray *array, size_t capacity) {
+    if (array->holes > 0) {
+        int n = 0;
+        for (int i = 0; i < array->count; i++) {
+            if (array->entries[i].key) {
+                array->entries[n++] = array->entries[i];
+            }
+        }
+        array->count = n;
+        array->holes = 0;
+    }
+
+    free(array->slots);
+    array->slots = zalloc(capacity * sizeof(int));
+    array->slot_capacity = capacity;
+
+    for (int i = 0; i < array->count; i++) {
+        const AssocEntry *entry = &array->entries[i];
+        array->slots[assoc_find_slot(array, entry->key, entry->key_len, entry->hash)] = i + 1;
+    }
+}
+
+AssocArray *assoc_new(void) {
+    AssocArray *array = zalloc(sizeof(AssocArray));
+    assoc_rebuild(array, 16);
+    return array;
+}
+
+void assoc_clear(AssocArray *array) {
+    for (int i = 0; i < array->count; i++) {
+        free(array->entries[i].key);
+        free(array->entries[i].item.value);
+    }
+    array->count = 0;
+    array->holes = 0;
+    memset(array->slots, 0, array->slot_capacity * sizeof(int));
+}
+
+void assoc_free(AssocArray *array) {
+    if (!array) {
+        return;
+    }
+    assoc_clear(array);
+    free(array->entries);
+    free(array->slots);
+    free(array);
+}
+
+const ArrayItem *assoc_get(const AssocArray *array, const char *key, size_t key_len) {
+    size_t slot = assoc_find_slot(array, key, key_len, hash_text(key, key_len, 0));
+    return array->slots[slot] ? &array->entries[array->slots[slot] - 1].item : NULL;
+}
+
+void assoc_set(AssocArray *array, const char *key, size_t key_len, const char *value, size_t len) {
+    // Keep the slots at most half full
+    if ((size_t)(array->count - array->holes + 1) * 2 > array->slot_capacity) {
+        assoc_rebuild(array, array->slot_capacity * 2);
+    }
+
+    uint32_t hash = hash_text(key, key_len, 0);
+    size_t slot = assoc_find_slot(array, key, key_len, hash);
+    if (array->slots[slot]) {
+        item_set(&array->entries[array->slots[slot] - 1].item, value, len);
+        return;
+    }
+
+    if (array->count == array->capacity) {
+        int capacity = array->capacity ? array->capacity * 2 : 8;
+        AssocEntry *entries = realloc(array->entries, capacity * sizeof(AssocEntry));
+        if (!entries) {
+            alloc_error();
+        }
+        array->entries = entries;
+        array->capacity = capacity;
+    }
+
+    AssocEntry *entry = &array->entries[array->count];
+    entry->key = malloc(key_len + 1);
+    if (!entry->key) {
+        alloc_error();
+    }
+    memcpy(entry->key, key, key_len);
+    entry->key[key_len] = '\0';
+    entry->key_len = key_len;
+    entry->hash = hash;
+    entry->item.value = NULL;
+    item_set(&entry->item, value, len);
+    array->slots[slot] = ++array->count;
+}
+
+static uint32_t assoc_home(const void *entries, int entry) {
+    return ((const AssocEntry *)entries)[entry].hash;
+}
+
+void assoc_unset(AssocArray *array, const char *key, size_t key_len) {
+    size_t i = assoc_find_slot(array, key, key_len, hash_text(key, key_len, 0));
+    if (!array->slots[i]) {
+        return;
+    }
+
+    AssocEntry *entry = &array->entries[array->slots[i] - 1];
+    free(entry->key);
+    free(entry->item.value);
+    entry->key = NULL;
+    entry->item.value = NULL;
+    array->holes++;
+    close_slot(array->slots, array->slot_capacity, i, assoc_home, array->entries);
+
+    if (array->holes > 16 && array->holes * 2 > array->count) {
+        assoc_rebuild(array, array->slot_capacity);
+    }
+}
+
+size_t assoc_size(const AssocArray *array) {
+    return (size_t)(array->count - array->holes);
+}
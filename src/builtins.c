@@ -5,55 +5,73 @@
 #include "dir_stack.h"
 #include "jobs.h"
 #include "variables.h"
+#include "functions.h"
+#include "arith.h"
+#include "test.h"
+#include "output.h"
+#include "input.h"
+#include "arena.h"
+#include "intern.h"
+#include "builtin_table.h"
+#include "builtin_hash.h"
+#include <string.h>
 
 // Define the arrays here - only once in the entire program
+// Both come from the single list in builtin_table.h
+#define BUILTIN_NAME(name, func, flags) name,
 char *builtin_str[] = {
-    "cd",
-    "help",
-    "exit",
-    "export",
-    "history",
-    "alias",
-    "unalias",
-    "pushd",
-    "popd",
-    "dirs",
-    "jobs",
-    "fg",
-    "bg",
-    "wait",
-    "disown",
-    "set",
-    "unset",
-    "shift"
+    HUSH_BUILTINS(BUILTIN_NAME)
 };
+#undef BUILTIN_NAME
 
+#define BUILTIN_FUNC(name, func, flags) &func,
 int (*builtin_func[])(char **) = {
-    &hush_cd,
-    &hush_help,
-    &hush_exit,
-    &hush_export,
-    &hush_history,
-    &hush_alias,
-    &hush_unalias,
-    &hush_pushd,
-    &hush_popd,
-    &hush_dirs,
-    &hush_jobs,
-    &hush_fg,
-    &hush_bg,
-    &hush_wait,
-    &hush_disown,
-    &hush_set,
-    &hush_unset,
-    &hush_shift
+    HUSH_BUILTINS(BUILTIN_FUNC)
 };
+#undef BUILTIN_FUNC
+
+#define BUILTIN_FLAGS(name, func, flags) flags,
+const unsigned char builtin_flags[] = {
+    HUSH_BUILTINS(BUILTIN_FLAGS)
+};
+#undef BUILTIN_FLAGS
 
 int hush_num_builtins()
 {
     return sizeof(builtin_str) / sizeof(char *);
 }
 
+// Interned builtin names, parallel to builtin_str
+static const char *builtin_names[sizeof(builtin_str) / sizeof(char *)];
+
+// The only candidate for a name is the builtin in its perfect hash slot
+static int builtin_slot(const char *name)
+{
+    uint32_t hash = builtin_hash(name, strlen(name), BUILTIN_HASH_SEED);
+    return builtin_hash_slots[hash & (BUILTIN_HASH_SIZE - 1)];
+}
+
+int find_builtin(const char *name)
+{
+    int i = builtin_slot(name);
+    return (i >= 0 && strcmp(builtin_str[i], name) == 0) ? i : -1;
+}
+
+int find_interned_builtin(const char *name)
+{
+    if (!name) {
+        return -1;
+    }
+    if (!builtin_names[0]) {
+        for (int i = 0; i < hush_num_builtins(); i++) {
+            builtin_names[i] = intern(builtin_str[i]);
+        }
+    }
+
+    int i = builtin_slot(name);
+    return (i >= 0 && builtin_names[i] == name) ? i : -1;
+}
+
 int hush_cd(char **args)
 {
         if (args[1] == NULL)
@@ -88,5 +106,22 @@ int hush_help(char **args)
 
 int hush_exit(char **args)
 {
+        // "exit N" leaves with status N, otherwise with the last status
+        if (args[1] != NULL) {
+                set_last_exit_status(atoi(args[1]) & 0xff);
+        }
         return 0;
 }
+
+// Loop control compiles to jumps inside loops; these only run elsewhere
+// (outside any loop, in a pipeline stage, or with a computed count)
+int hush_break(char **args)
+{
+        fprintf(stderr, "hush: %s: only meaningful in a `for', `while', or `until' loop\n", args[0]);
+        return 1;
+}
+
+int hush_continue(char **args)
+{
+        return hush_break(args);
+}
@@ -1,277 +1,512 @@
+// For F_SETPIPE_SZ
+#define _GNU_SOURCE
 #include "command_sub.h"
+#include "parser.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "builtins.h"
+#include "builtin_table.h"
+#include "alias.h"
+#include "functions.h"
+#include "jobs.h"
+#include "launch.h"
+#include "signals.h"
+#include "variables.h"
+#include "arena.h"
+#include "input.h"
+#include "expand.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+// Nested in-process substitutions each get their own capture file
+#define CAPTURE_DEPTH_MAX 8
+
+#define CAPTURE_INITIAL_SIZE 4096
+#define CAPTURE_PIPE_SIZE (1024 * 1024)   // Pipe buffer asked for, when supported
+
+static FILE *capture_files[CAPTURE_DEPTH_MAX];
+static int capture_depth = 0;
+
+unsigned long capture_count = 0;
+
+// Results handed out by capture_command_output before running anything
+static CaptureBatch *active_batch;
+
+// Output collected from a substitution, grown geometrically in the arena
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t limit;    // Most bytes kept, 0 for no limit
+    int truncated;   // Output went past the limit
+} Capture;
+
+static void capture_init(Capture *c) {
+    c->data = NULL;
+    c->len = 0;
+    c->cap = 0;
+    c->limit = 0;
+    c->truncated = 0;
+
+    // HUSH_CAPTURE_MAX caps the size of one substitution's output
+    VarView limit;
+    if (lookup_variable("HUSH_CAPTURE_MAX", 16, &limit)) {
+        char *end;
+        unsigned long long value = strtoull(limit.ptr, &end, 10);
+        if (end != limit.ptr && end == limit.ptr + limit.len) {
+            c->limit = (size_t)value;
+        }
+    }
+}
 
-// Check if a string contains command substitution
-int has_command_substitution(const char *line) {
-    return (strchr(line, '`') != NULL ||
-            (strchr(line, '$') != NULL && strchr(line, '(') != NULL));
+// Make room for at least room more bytes and a terminator
+static void capture_reserve(Capture *c, size_t room) {
+    if (c->len + room + 1 <= c->cap) {
+        return;
+    }
+    size_t cap = c->cap ? c->cap : CAPTURE_INITIAL_SIZE;
+    while (c->len + room + 1 > cap) {
+        cap *= 2;
+    }
+    c->data = arena_grow(c->data, c->cap, cap);
+    c->cap = cap;
 }
 
-// Execute a command and capture its output
-char *capture_command_output(const char *command) {
+// Do one read() from fd into the free space
+// Returns 0 at end of file or once the limit is reached
+static int capture_read_some(Capture *c, int fd) {
+    ssize_t n;
+
+    if (c->limit && c->len >= c->limit) {
+        char byte;
+        while ((n = read(fd, &byte, 1)) < 0 && errno == EINTR) {
+            // Interrupted, try again
+        }
+        c->truncated = n > 0;
+        return 0;
+    }
+
+    capture_reserve(c, 1);
+    size_t want = c->cap - c->len - 1;
+    if (c->limit && want > c->limit - c->len) {
+        want = c->limit - c->len;
+    }
+
+    while ((n = read(fd, c->data + c->len, want)) < 0 && errno == EINTR) {
+        // Interrupted, try again
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    c->len += n;
+    return 1;
+}
+
+// Read fd to end of file, or until the limit is reached
+// Each read fills all the free space, so reads get larger as the buffer does
+static void capture_read(Capture *c, int fd) {
+    while (capture_read_some(c, fd)) {
+        // Keep reading
+    }
+}
+
+// Finish the capture: drop trailing newlines, terminate, trim the buffer
+static char *capture_finish(Capture *c, size_t *len) {
+    if (c->truncated) {
+        fprintf(stderr, "hush: command substitution: output cut at %zu bytes (HUSH_CAPTURE_MAX)\n",
+                c->limit);
+    }
+
+    capture_reserve(c, 0);
+    while (c->len > 0 && (c->data[c->len-1] == '\n' || c->data[c->len-1] == '\r')) {
+        c->len--;
+    }
+    c->data[c->len] = '\0';
+
+    *len = c->len;
+    return arena_grow(c->data, c->cap, c->len + 1);
+}
+
+// Check if expanding a word might assign to a variable
+// ${name=word} and ${name:=word} do, and so can any arithmetic: $((...)),
+// an array subscript or a substring offset, since even an expression with
+// no = in it can reach one through the value of a variable it names.
+static int expansion_may_assign(const char *text) {
+    if (strstr(text, "$((")) {
+        return 1;
+    }
+    if (!strstr(text, "${")) {
+        return 0;
+    }
+    for (const char *p = text; *p; p++) {
+        if (*p == '=') {
+            return 1;
+        }
+        if (*p == '[' && !((p[1] == '@' || p[1] == '*') && p[2] == ']')) {
+            return 1;
+        }
+        if (*p == ':' && !strchr("-=?+", p[1])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Functions a substitution calls are checked as deep as this
+#define PURE_FUNCTION_DEPTH 8
+
+static int is_pure_program(const Program *prog, int depth);
+
+// Check that a command name runs something that leaves the shell's state
+// alone: a pure builtin, or a function whose body is pure
+// In a function body local, return and shift are fine too, the call's
+// scope and positional parameters are dropped when it returns.
+static int is_pure_command(const char *name, int depth) {
+    if (get_alias(name)) {
+        return 0;
+    }
+
+    // A function by a builtin's name runs instead of the builtin
+    ShellFunction *fn = find_function(name);
+    if (fn) {
+        return depth < PURE_FUNCTION_DEPTH && is_pure_program(fn->body->prog, depth + 1);
+    }
+
+    int i = find_interned_builtin(name);
+    if (i < 0) {
+        return 0;
+    }
+    if (builtin_flags[i] & BUILTIN_PURE) {
+        return 1;
+    }
+    return depth > 0 && (strcmp(name, "local") == 0 || strcmp(name, "return") == 0 ||
+                         strcmp(name, "shift") == 0);
+}
+
+// Check for straight-line code where every command is pure, depth is the
+// number of function calls it is nested in
+static int is_pure_program(const Program *prog, int depth) {
+    int at_name = 1;
+    int at_printf_option = 0;
+
+    for (int pc = 0; pc < prog->code_count; pc++) {
+        const Instr *instr = &prog->code[pc];
+
+        switch (instr->op) {
+            case BC_PUSH:
+            case BC_EXPAND: {
+                const char *text = prog->strings + prog->words[instr->a].offset;
+
+                if (instr->op == BC_EXPAND && expansion_may_assign(text)) {
+                    return 0;
+                }
+                if (at_name) {
+                    const char *name = prog->names[instr->a];
+                    if (instr->op != BC_PUSH || !name || !is_pure_command(name, depth)) {
+                        return 0;
+                    }
+                    at_name = 0;
+                    at_printf_option = strcmp(name, "printf") == 0;
+                } else if (at_printf_option) {
+                    // printf -v assigns, so its first argument has to be
+                    // something else for certain
+                    if (strstr(text, "-v") || strpbrk(text, "$`")) {
+                        return 0;
+                    }
+                    at_printf_option = 0;
+                }
+                break;
+            }
+            case BC_EXEC:
+                at_name = 1;
+                at_printf_option = 0;
+                break;
+            case BC_JUMP:
+            case BC_JUMP_IF_OK:
+            case BC_JUMP_IF_FAIL:
+            case BC_STATUS:
+            case BC_HALT:
+                break;
+            default:
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// Check that a substitution can run inside the shell: straight-line code
+// that only runs pure builtins and functions made of them, so the result
+// is the same as from a subshell
+static int runs_in_process(const Program *prog) {
+    return is_pure_program(prog, 0);
+}
+
+// Check for a program that is just one simple command
+static int is_simple_command(const Program *prog) {
+    int commands = 0;
+
+    for (int pc = 0; pc < prog->code_count; pc++) {
+        int op = prog->code[pc].op;
+        if (op == BC_EXEC) {
+            commands++;
+        } else if (op != BC_PUSH && op != BC_EXPAND && op != BC_HALT) {
+            return 0;
+        }
+    }
+    return commands == 1;
+}
+
+// Run builtins here with stdout pointed at a reusable capture file
+static int capture_in_process(const Program *prog, Capture *c) {
+    FILE *file = capture_files[capture_depth];
+    if (!file) {
+        file = tmpfile();
+        if (!file) {
+            return 0;
+        }
+        capture_files[capture_depth] = file;
+    }
+    int fd = fileno(file);
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    if (saved_stdout < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+        if (saved_stdout >= 0) {
+            close(saved_stdout);
+        }
+        return 0;
+    }
+
+    // Commands run here must not take the results of an outer batch, and
+    // an error ends them as it would a subshell, leaving the outer
+    // command's expansion alone
+    CaptureBatch *batch = capture_batch_use(NULL);
+    int interactive = shell_is_interactive;
+    int failed = expansion_failed;
+    shell_is_interactive = 0;
+    capture_depth++;
+    vm_execute(prog);
+    fflush(stdout);
+    capture_depth--;
+    shell_is_interactive = interactive;
+    expansion_failed = failed;
+    capture_batch_use(batch);
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    // The size is known, read it back in one go
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        capture_reserve(c, (size_t)st.st_size);
+    }
+    lseek(fd, 0, SEEK_SET);
+    capture_read(c, fd);
+
+    // Empty the file for the next substitution
+    if (ftruncate(fd, 0) < 0) {
+        perror("hush: command substitution");
+    }
+    lseek(fd, 0, SEEK_SET);
+
+    return 1;
+}
+
+// Fork a copy of the shell to run the program with stdout on a pipe
+// Returns the pid and the pipe's read end in *fd, or -1. The caller has
+// SIGCHLD blocked so the handler cannot reap the child first.
+static pid_t start_subshell(const Program *prog, int *fd) {
     int pipefd[2];
     if (pipe(pipefd) == -1) {
         perror("hush: pipe error in command substitution");
-        return strdup("");
+        return -1;
     }
 
+    // Later children must not inherit this end
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+#ifdef F_SETPIPE_SZ
+    // A bigger pipe means fewer context switches for large output; the
+    // kernel may refuse, the default size still works
+    fcntl(pipefd[0], F_SETPIPE_SZ, CAPTURE_PIPE_SIZE);
+#endif
+
+    input_sync();
+    fflush(stdout);
+    fflush(stderr);
+    exported_environment();
+
     pid_t pid = fork();
     if (pid == -1) {
         perror("hush: fork error in command substitution");
         close(pipefd[0]);
         close(pipefd[1]);
-        return strdup("");
+        return -1;
     }
 
     if (pid == 0) {
-        // Child process
-        close(pipefd[0]);  // Close read end
+        // Child: stay in the shell's process group, no job control
+        prepare_child_process(getpgrp(), 0);
+        shell_is_interactive = 0;
 
-        // Redirect stdout to pipe
+        close(pipefd[0]);
         if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
             perror("hush: dup2 error in command substitution");
-            exit(EXIT_FAILURE);
+            _exit(EXIT_FAILURE);
         }
+        close(pipefd[1]);
 
-        // Also redirect stderr to pipe (optional)
-        if (dup2(pipefd[1], STDERR_FILENO) == -1) {
-            perror("hush: dup2 error redirecting stderr");
-            exit(EXIT_FAILURE);
-        }
+        // A lone external command replaces the subshell
+        launch_in_place = is_simple_command(prog);
+        vm_execute(prog);
 
-        close(pipefd[1]);  // Close the pipe's write end in child
-
-        // Execute the command through the shell
-        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
-
-        // If execl fails
-        perror("hush: exec error in command substitution");
-        exit(EXIT_FAILURE);
-    } else {
-        // Parent process
-        close(pipefd[1]);  // Close write end
-
-        // Read the command's output
-        char buffer[4096];
-        size_t total_size = 0;
-        size_t buffer_size = 4096;
-        char *output = malloc(buffer_size);
-        if (!output) {
-            perror("hush: malloc error in command substitution");
-            close(pipefd[0]);
-            return strdup("");
-        }
-        output[0] = '\0';
-
-        ssize_t bytes_read;
-        while ((bytes_read = read(pipefd[0], buffer, sizeof(buffer) - 1)) > 0) {
-            buffer[bytes_read] = '\0';
-
-            // Check if we need to resize the output buffer
-            if (total_size + bytes_read + 1 > buffer_size) {
-                buffer_size = (total_size + bytes_read + 1) * 2;
-                output = realloc(output, buffer_size);
-                if (!output) {
-                    perror("hush: realloc error in command substitution");
-                    close(pipefd[0]);
-                    return strdup("");
-                }
-            }
+        // _exit: stdio cleanup would move the parent's script file offset
+        fflush(stdout);
+        fflush(stderr);
+        _exit(get_last_exit_status());
+    }
 
-            // Append the read data to the output
-            strcat(output + total_size, buffer);
-            total_size += bytes_read;
-        }
+    close(pipefd[1]);
+    *fd = pipefd[0];
+    return pid;
+}
 
-        close(pipefd[0]);  // Close read end
+// Wait for a substitution's subshell, returning its exit status
+static int finish_subshell(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        // Interrupted, wait again
+    }
+    return wait_status_to_exit(status);
+}
 
-        // Wait for the child to complete
-        int status;
-        waitpid(pid, &status, 0);
+// Run the program in a forked copy of the shell, reading its output
+static void capture_in_subshell(const Program *prog, Capture *c) {
+    sigset_t old_mask;
+    block_sigchld(&old_mask);
 
-        // Remove trailing newlines
-        while (total_size > 0 && (output[total_size-1] == '\n' || output[total_size-1] == '\r')) {
-            output[--total_size] = '\0';
-        }
+    int fd;
+    pid_t pid = start_subshell(prog, &fd);
+    if (pid != -1) {
+        capture_read(c, fd);
 
-        return output;
+        // Past the limit the child gets SIGPIPE on its next write
+        close(fd);
+        set_last_exit_status(finish_subshell(pid));
     }
+    restore_sigmask(&old_mask);
 }
 
-// Helper function to find matching parenthesis
-static int find_matching_parenthesis(const char *str, int start) {
-    int depth = 1;
-    int i = start;
+// Execute a command and capture its output
+// The command runs in hush itself: builtins that cannot change the shell
+// run in-process, anything else in a forked subshell without an exec
+char *capture_command_output(const char *command, size_t *len) {
+    capture_count++;
+
+    // Already run as part of a batch
+    CaptureBatch *batch = active_batch;
+    if (batch && batch->next < batch->count && strcmp(batch->commands[batch->next], command) == 0) {
+        int i = batch->next++;
+        set_last_exit_status(batch->statuses[i]);
+        *len = batch->lengths[i];
+        return batch->outputs[i];
+    }
+
+    Capture c;
+    capture_init(&c);
+
+    AstNode *root = parse_line(command);
+    if (root) {
+        Program *prog = compile_program(root);
+        free_ast(root);
 
-    while (str[i] != '\0' && depth > 0) {
-        if (str[i] == '(') {
-            depth++;
-        } else if (str[i] == ')') {
-            depth--;
+        if (!(capture_depth < CAPTURE_DEPTH_MAX && runs_in_process(prog) &&
+              capture_in_process(prog, &c))) {
+            capture_in_subshell(prog, &c);
         }
-        i++;
+        free_program(prog);
     }
 
-    if (depth != 0) return -1;  // No matching parenthesis
-    return i - 1;
+    return capture_finish(&c, len);
 }
 
-// Helper function to find matching backtick
-static int find_matching_backtick(const char *str, int start) {
-    int i = start;
+CaptureBatch *capture_batch_use(CaptureBatch *batch) {
+    CaptureBatch *previous = active_batch;
+    active_batch = batch;
+    return previous;
+}
 
-    while (str[i] != '\0') {
-        if (str[i] == '`' && (i == 0 || str[i-1] != '\\')) {
-            return i;
-        }
-        i++;
+void capture_batch_run(CaptureBatch *batch, char **commands, int count) {
+    batch->count = 0;
+    batch->next = 0;
+    if (count == 0) {
+        return;
     }
 
-    return -1;  // No matching backtick
-}
+    batch->commands = arena_alloc(count * sizeof(char *));
+    batch->outputs = arena_alloc(count * sizeof(char *));
+    batch->lengths = arena_alloc(count * sizeof(size_t));
+    batch->statuses = arena_alloc(count * sizeof(int));
 
-// Process command substitution for the entire line
-char *perform_command_substitution(char *line) {
-    if (!has_command_substitution(line)) {
-        return strdup(line);
-    }
-
-    // Allocate a reasonably large initial buffer
-    size_t initial_size = strlen(line) * 4 + 1024;
-    size_t result_size = initial_size;
-    char *result = malloc(result_size);
-    if (!result) {
-        perror("hush: malloc error in command substitution");
-        return strdup(line);
-    }
-    result[0] = '\0';
-
-    int i = 0;
-    int len = strlen(line);
-    int result_pos = 0;
-
-    while (i < len) {
-        // Check for $(command) substitution
-        if (line[i] == '$' && i + 1 < len && line[i+1] == '(') {
-            int end = find_matching_parenthesis(line, i + 2);
-            if (end != -1) {
-                // Extract the command
-                int cmd_len = end - (i + 2);
-                char *cmd = malloc(cmd_len + 1);
-                if (!cmd) {
-                    perror("hush: malloc error");
-                    free(result);
-                    return strdup(line);
-                }
-                strncpy(cmd, line + i + 2, cmd_len);
-                cmd[cmd_len] = '\0';
-
-                // Execute the command and get its output
-                char *output = capture_command_output(cmd);
-                size_t output_len = strlen(output);
-
-                // Make sure there's enough space in result
-                if (result_pos + output_len + 1 > result_size) {
-                    // Double the result size or ensure it's big enough for this output
-                    size_t new_size = (result_size * 2 > result_pos + output_len + 1) ?
-                                       result_size * 2 : result_pos + output_len + 1024;
-                    char *new_result = realloc(result, new_size);
-                    if (!new_result) {
-                        perror("hush: realloc error");
-                        free(cmd);
-                        free(output);
-                        free(result);
-                        return strdup(line);
-                    }
-                    result = new_result;
-                    result_size = new_size;
-                }
+    Capture *captures = arena_alloc(count * sizeof(Capture));
+    pid_t *pids = arena_alloc(count * sizeof(pid_t));
+    struct pollfd *fds = arena_alloc(count * sizeof(struct pollfd));
 
-                // Append the output to the result (safely)
-                memcpy(result + result_pos, output, output_len + 1);
-                result_pos += output_len;
+    sigset_t old_mask;
+    block_sigchld(&old_mask);
 
-                // Clean up and move past the command substitution
-                free(cmd);
-                free(output);
-                i = end + 1;
-                continue;
+    // Start every subshell; cheap in-process ones are left for later
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        AstNode *root = parse_line(commands[i]);
+        if (!root) {
+            continue;
+        }
+        Program *prog = compile_program(root);
+        free_ast(root);
+
+        if (!runs_in_process(prog)) {
+            pids[n] = start_subshell(prog, &fds[n].fd);
+            if (pids[n] != -1) {
+                fds[n].events = POLLIN;
+                batch->commands[n] = commands[i];
+                capture_init(&captures[n]);
+                n++;
             }
         }
+        free_program(prog);
+    }
 
-        // Check for `command` substitution
-        if (line[i] == '`' && (i == 0 || line[i-1] != '\\')) {
-            int end = find_matching_backtick(line, i + 1);
-            if (end != -1) {
-                // Extract the command
-                int cmd_len = end - (i + 1);
-                char *cmd = malloc(cmd_len + 1);
-                if (!cmd) {
-                    perror("hush: malloc error");
-                    free(result);
-                    return strdup(line);
-                }
-                strncpy(cmd, line + i + 1, cmd_len);
-                cmd[cmd_len] = '\0';
-
-                // Execute the command and get its output
-                char *output = capture_command_output(cmd);
-                size_t output_len = strlen(output);
-
-                // Make sure there's enough space in result
-                if (result_pos + output_len + 1 > result_size) {
-                    // Double the result size or ensure it's big enough for this output
-                    size_t new_size = (result_size * 2 > result_pos + output_len + 1) ?
-                                       result_size * 2 : result_pos + output_len + 1024;
-                    char *new_result = realloc(result, new_size);
-                    if (!new_result) {
-                        perror("hush: realloc error");
-                        free(cmd);
-                        free(output);
-                        free(result);
-                        return strdup(line);
-                    }
-                    result = new_result;
-                    result_size = new_size;
-                }
-
-                // Append the output to the result (safely)
-                memcpy(result + result_pos, output, output_len + 1);
-                result_pos += output_len;
-
-                // Clean up and move past the command substitution
-                free(cmd);
-                free(output);
-                i = end + 1;
+    // Drain all the pipes together so no child blocks on a full one
+    int open_count = n;
+    while (open_count > 0) {
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) {
                 continue;
             }
+            perror("hush: poll error in command substitution");
+            break;
         }
-
-        // Regular character - ensure we have enough space
-        if (result_pos + 2 > result_size) {
-            result_size *= 2;
-            char *new_result = realloc(result, result_size);
-            if (!new_result) {
-                perror("hush: realloc error");
-                free(result);
-                return strdup(line);
+        for (int i = 0; i < n; i++) {
+            if (fds[i].fd >= 0 && fds[i].revents && !capture_read_some(&captures[i], fds[i].fd)) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                open_count--;
             }
-            result = new_result;
         }
-
-        result[result_pos++] = line[i++];
     }
 
-    result[result_pos] = '\0';
-
-    // Check if we need to process nested substitutions
-    if (has_command_substitution(result)) {
-        char *nested_result = perform_command_substitution(result);
-        free(result);
-        return nested_result;
+    // Collect in order; everything is in the arena, so the buffers can
+    // only be finished once all of them are full
+    for (int i = 0; i < n; i++) {
+        if (fds[i].fd >= 0) {
+            close(fds[i].fd);
+        }
+        batch->statuses[i] = finish_subshell(pids[i]);
+        batch->outputs[i] = capture_finish(&captures[i], &batch->lengths[i]);
     }
+    restore_sigmask(&old_mask);
 
-    // Reallocate to exact size to save memory
-    char *final_result = strdup(result);
-    free(result);
-    return final_result;
+    batch->count = n;
 }
@@ -0,0 +1,722 @@
+#include "bytecode.h"
+#include "arena.h"
+#include "intern.h"
+#include "builtins.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// An enclosing loop while its body is compiled
+typedef struct {
+    int is_for;
+    int slot;            // Status slot of a while/until loop
+    int continue_pc;     // Where continue jumps to
+    int redirect_depth;  // Redirected compound commands around the loop
+    int *breaks;         // BC_JUMP instructions to patch with the loop end
+    int break_count;
+    int break_capacity;
+} LoopContext;
+
+typedef struct {
+    Program *prog;
+    LoopContext *loops;
+    int loop_count;
+    int loop_capacity;
+    int redirect_depth;  // Redirected compound commands being compiled
+} Compiler;
+
+// Append an instruction and return its index
+static int emit(Compiler *c, int op, int flags, uint32_t a, uint32_t b) {
+    Program *prog = c->prog;
+    if (prog->code_count >= prog->code_capacity) {
+        int capacity = prog->code_capacity ? prog->code_capacity * 2 : 64;
+        Instr *code = realloc(prog->code, capacity * sizeof(Instr));
+        if (!code) {
+            alloc_error();
+        }
+        prog->code = code;
+        prog->code_capacity = capacity;
+    }
+
+    Instr *instr = &prog->code[prog->code_count];
+    instr->op = (uint8_t)op;
+    instr->flags = (uint8_t)flags;
+    instr->a = a;
+    instr->b = b;
+    return prog->code_count++;
+}
+
+// Index of the next instruction to be emitted
+static uint32_t here(Compiler *c) {
+    return (uint32_t)c->prog->code_count;
+}
+
+// Copy a string into the pool and return its offset
+static uint32_t add_string(Compiler *c, const char *text) {
+    Program *prog = c->prog;
+    size_t len = strlen(text) + 1;
+
+    if (prog->strings_len + len > prog->strings_capacity) {
+        size_t capacity = prog->strings_capacity ? prog->strings_capacity : 256;
+        while (prog->strings_len + len > capacity) {
+            capacity *= 2;
+        }
+        char *strings = realloc(prog->strings, capacity);
+        if (!strings) {
+            alloc_error();
+        }
+        prog->strings = strings;
+        prog->strings_capacity = capacity;
+    }
+
+    uint32_t offset = (uint32_t)prog->strings_len;
+    memcpy(prog->strings + offset, text, len);
+    prog->strings_len += len;
+    return offset;
+}
+
+// Add a word to the program and return its index
+// Names (HUSH_TOK_INTERNED in flags) are resolved to their interned handle now
+static uint32_t add_word_flags(Compiler *c, const Word *word, unsigned int flags) {
+    Program *prog = c->prog;
+    if (prog->word_count >= prog->word_capacity) {
+        int capacity = prog->word_capacity ? prog->word_capacity * 2 : 64;
+        ProgWord *words = realloc(prog->words, capacity * sizeof(ProgWord));
+        const char **names = realloc(prog->names, capacity * sizeof(const char *));
+        if (!words || !names) {
+            alloc_error();
+        }
+        prog->words = words;
+        prog->names = names;
+        prog->word_capacity = capacity;
+    }
+
+    prog->words[prog->word_count].offset = add_string(c, word->text);
+    prog->words[prog->word_count].flags = flags;
+    prog->names[prog->word_count] = (flags & HUSH_TOK_INTERNED) ? intern(word->text) : NULL;
+    return (uint32_t)prog->word_count++;
+}
+
+static uint32_t add_word(Compiler *c, const Word *word) {
+    return add_word_flags(c, word, word->flags);
+}
+
+// Walk down single-child wrappers to see if a node is one simple command
+static int is_single_command(const AstNode *node) {
+    while (node->type != AST_COMMAND) {
+        if (node->type > AST_COMMAND || node->child_count != 1 ||
+            (node->type == AST_LIST && node->ops[0] == OP_AMP)) {
+            return 0;
+        }
+        node = node->children[0];
+    }
+    return 1;
+}
+
+// Build a display label for a job from the words of a tree
+static void ast_label(const AstNode *node, char *buf, size_t size, size_t *used) {
+    static const char *keywords[] = { [AST_IF] = "if", [AST_WHILE] = "while",
+                                      [AST_UNTIL] = "until", [AST_FOR] = "for",
+                                      [AST_ARITH_FOR] = "for",
+                                      [AST_GROUP] = "{", [AST_FUNCTION] = "function",
+                                      [AST_ARITH] = "((", [AST_COND] = "[[" };
+    if (node->type == AST_REDIRECT) {
+        ast_label(node->children[0], buf, size, used);
+        return;
+    }
+    if (node->type > AST_COMMAND) {
+        // Compound commands are labelled by their keyword
+        *used += snprintf(buf + *used, size - *used, *used > 0 ? " %s ..." : "%s ...",
+                          keywords[node->type]);
+        return;
+    }
+
+    if (node->type == AST_COMMAND) {
+        for (int i = 0; i < node->word_count && *used < size - 1; i++) {
+            *used += snprintf(buf + *used, size - *used, *used > 0 ? " %s" : "%s",
+                              node->words[i].text);
+        }
+        return;
+    }
+
+    for (int i = 0; i < node->child_count && *used < size - 1; i++) {
+        if (i > 0 && node->type != AST_LIST) {
+            *used += snprintf(buf + *used, size - *used, " %s", operator_str(node->ops[i]));
+        }
+        ast_label(node->children[i], buf, size, used);
+    }
+}
+
+static void compile_node(Compiler *c, const AstNode *node);
+
+// Compile a forked subshell body, loops outside it are out of reach
+static void compile_subshell(Compiler *c, const AstNode *node) {
+    LoopContext *loops = c->loops;
+    int loop_count = c->loop_count;
+    int loop_capacity = c->loop_capacity;
+    int redirect_depth = c->redirect_depth;
+
+    c->loops = NULL;
+    c->loop_count = 0;
+    c->loop_capacity = 0;
+    c->redirect_depth = 0;
+
+    compile_node(c, node);
+    emit(c, BC_EXIT, 0, 0, 0);
+
+    free(c->loops);
+    c->loops = loops;
+    c->loop_count = loop_count;
+    c->loop_capacity = loop_capacity;
+    c->redirect_depth = redirect_depth;
+}
+
+// Enter a loop whose continue target is known, slot being the status slot
+// of a while/until loop
+static LoopContext *push_loop(Compiler *c, int is_for, int slot, int continue_pc) {
+    if (c->loop_count >= c->loop_capacity) {
+        int capacity = c->loop_capacity ? c->loop_capacity * 2 : 8;
+        LoopContext *loops = realloc(c->loops, capacity * sizeof(LoopContext));
+        if (!loops) {
+            alloc_error();
+        }
+        c->loops = loops;
+        c->loop_capacity = capacity;
+    }
+
+    LoopContext *loop = &c->loops[c->loop_count];
+    loop->is_for = is_for;
+    loop->slot = slot;
+    loop->continue_pc = continue_pc;
+    loop->redirect_depth = c->redirect_depth;
+    loop->breaks = NULL;
+    loop->break_count = 0;
+    loop->break_capacity = 0;
+    return &c->loops[c->loop_count++];
+}
+
+// Leave the innermost loop, pointing its breaks at the current position
+static void pop_loop(Compiler *c) {
+    LoopContext *loop = &c->loops[--c->loop_count];
+    for (int i = 0; i < loop->break_count; i++) {
+        c->prog->code[loop->breaks[i]].a = here(c);
+    }
+    free(loop->breaks);
+}
+
+// Compile break/continue with a literal count into jumps
+// Returns 0 if the command has to run as a builtin instead
+static int compile_loop_control(Compiler *c, const AstNode *node) {
+    const Word *words = node->words;
+    int is_break;
+
+    if (c->loop_count == 0 || node->word_count > 2 || node->assign_count > 0 ||
+        (words[0].flags & (HUSH_TOK_QUOTED | HUSH_TOK_EXPAND | HUSH_TOK_OPERATOR))) {
+        return 0;
+    }
+    if (strcmp(words[0].text, "break") == 0) {
+        is_break = 1;
+    } else if (strcmp(words[0].text, "continue") == 0) {
+        is_break = 0;
+    } else {
+        return 0;
+    }
+
+    int levels = 1;
+    if (node->word_count == 2) {
+        const char *p = words[1].text;
+        if ((words[1].flags & HUSH_TOK_OPERATOR) || !isdigit((unsigned char)*p)) {
+            return 0;
+        }
+        levels = atoi(p);
+        if (levels < 1) {
+            return 0;
+        }
+    }
+    if (levels > c->loop_count) {
+        levels = c->loop_count;
+    }
+
+    // Undo the redirections of the compound commands being left, then drop
+    // the iterators of the for loops
+    LoopContext *target = &c->loops[c->loop_count - levels];
+    for (int depth = c->redirect_depth; depth > target->redirect_depth; depth--) {
+        emit(c, BC_UNREDIRECT, 0, 0, 0);
+    }
+    for (LoopContext *loop = &c->loops[c->loop_count - 1]; loop > target; loop--) {
+        if (loop->is_for) {
+            emit(c, BC_FOR_POP, 0, 0, 0);
+        }
+    }
+
+    emit(c, BC_STATUS, 0, 0, 0);
+    if (is_break) {
+        if (target->is_for) {
+            emit(c, BC_FOR_POP, 0, 0, 0);
+        }
+        if (target->break_count >= target->break_capacity) {
+            int capacity = target->break_capacity ? target->break_capacity * 2 : 4;
+            int *breaks = realloc(target->breaks, capacity * sizeof(int));
+            if (!breaks) {
+                alloc_error();
+            }
+            target->breaks = breaks;
+            target->break_capacity = capacity;
+        }
+        target->breaks[target->break_count++] = emit(c, BC_JUMP, 0, 0, 0);
+    } else {
+        if (!target->is_for) {
+            emit(c, BC_SLOT_SAVE, 0, target->slot, 0);
+        }
+        emit(c, BC_JUMP, 0, target->continue_pc, 0);
+    }
+    return 1;
+}
+
+// Push a word as is when nothing in it expands, array literals are
+// expanded by the assignment itself
+static void compile_word(Compiler *c, const Word *word) {
+    int literal = (word->flags & (HUSH_TOK_OPERATOR | HUSH_TOK_ARRAY)) ||
+                  (!(word->flags & (HUSH_TOK_QUOTED | HUSH_TOK_EXPAND)) && word->text[0] != '~');
+    emit(c, literal ? BC_PUSH : BC_EXPAND, 0, add_word(c, word), 0);
+}
+
+static void compile_command(Compiler *c, const AstNode *node) {
+    if (compile_loop_control(c, node)) {
+        return;
+    }
+
+    // With no command name, only redirections, the assignments are made
+    // as they are expanded
+    int bare = 1;
+    for (int j = node->assign_count; j < node->word_count; j++) {
+        if (!(node->words[j].flags & HUSH_TOK_OPERATOR) &&
+            !(j > 0 && (node->words[j - 1].flags & HUSH_TOK_OPERATOR))) {
+            bare = 0;
+            break;
+        }
+    }
+
+    int i = 0;
+    for (; i < node->assign_count; i++) {
+        emit(c, BC_ASSIGN, bare ? BC_FLAG_BARE : 0, add_word(c, &node->words[i]), 0);
+    }
+
+    // A plain command name is interned so builtins and aliases are found by
+    // pointer when it runs
+    if (i < node->word_count && node->words[i].flags == 0) {
+        emit(c, BC_PUSH, 0, add_word_flags(c, &node->words[i], HUSH_TOK_INTERNED), 0);
+        i++;
+    }
+    for (; i < node->word_count; i++) {
+        compile_word(c, &node->words[i]);
+    }
+    emit(c, BC_EXEC, 0, 0, 0);
+}
+
+static void compile_list(Compiler *c, const AstNode *node) {
+    for (int i = 0; i < node->child_count; i++) {
+        const AstNode *child = node->children[i];
+
+        if (node->ops[i] != OP_AMP) {
+            compile_node(c, child);
+            continue;
+        }
+
+        // Background job: the body runs in the child, the parent skips it
+        char label[1024] = {0};
+        size_t used = 0;
+        ast_label(child, label, sizeof(label), &used);
+
+        int flags = is_single_command(child) ? BC_FLAG_SINGLE : 0;
+        int site = emit(c, BC_BACKGROUND, flags, 0, add_string(c, label));
+        compile_subshell(c, child);
+        c->prog->code[site].a = here(c);
+    }
+}
+
+// Each && or || skips the next pipeline based on $?
+static void compile_and_or(Compiler *c, const AstNode *node) {
+    compile_node(c, node->children[0]);
+
+    for (int i = 1; i < node->child_count; i++) {
+        int op = node->ops[i] == OP_AND ? BC_JUMP_IF_FAIL : BC_JUMP_IF_OK;
+        int site = emit(c, op, 0, 0, 0);
+        compile_node(c, node->children[i]);
+        c->prog->code[site].a = here(c);
+    }
+}
+
+// Check for a command substitution, $((...)) is arithmetic
+static int has_substitution(const char *text) {
+    if (strchr(text, '`')) {
+        return 1;
+    }
+    for (const char *p = strstr(text, "$("); p; p = strstr(p + 2, "$(")) {
+        if (p[2] != '(') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Check that nothing in a tree but the shell itself can read its standard
+// input: every command is a builtin named by a plain word, and nothing is
+// substituted, piped or put in the background
+// A loop like that may keep what it reads ahead of the current line between
+// iterations, even from a pipe. It must not define functions or aliases,
+// which could take the place of the builtins; the VM checks for ones
+// defined before the loop starts.
+static int keeps_stdin(const AstNode *node) {
+    for (int i = 0; i < node->word_count; i++) {
+        if (has_substitution(node->words[i].text)) {
+            return 0;
+        }
+    }
+
+    switch (node->type) {
+        case AST_COMMAND:
+            if (node->assign_count < node->word_count) {
+                const Word *name = &node->words[node->assign_count];
+                return name->flags == 0 && find_builtin(name->text) >= 0 &&
+                       strcmp(name->text, "alias") != 0;
+            }
+            return 1;
+        case AST_PIPELINE:
+            if (node->child_count > 1) {
+                return 0;
+            }
+            break;
+        case AST_LIST:
+            for (int i = 0; i < node->child_count; i++) {
+                if (node->ops[i] == OP_AMP) {
+                    return 0;
+                }
+            }
+            break;
+        case AST_ARITH:
+            return !has_substitution(node->source);
+        case AST_FUNCTION:
+            return 0;
+        default:
+            break;
+    }
+
+    for (int i = 0; i < node->child_count; i++) {
+        if (!keeps_stdin(node->children[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Check for a while or until loop that can own its standard input
+static int owns_input(const AstNode *node) {
+    return (node->type == AST_WHILE || node->type == AST_UNTIL) && keeps_stdin(node);
+}
+
+// Check for a redirection of standard input among operator/target pairs
+// Whatever it opens may be shared with other readers, like /dev/stdin, so a
+// loop never owns it; a regular file is read in blocks all the same.
+static int redirects_stdin(const AstNode *node) {
+    for (int i = 0; i + 1 < node->word_count; i += 2) {
+        const char *op = node->words[i].text;
+        if (strcmp(op, "<") == 0 || strcmp(op, "<<") == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The redirections are pushed and applied around the body, and undone after
+// it, or by break and continue on their way out
+static void compile_redirect(Compiler *c, const AstNode *node) {
+    for (int i = 0; i < node->word_count; i++) {
+        compile_word(c, &node->words[i]);
+    }
+    int site = emit(c, BC_REDIRECT, 0, 0, 0);
+
+    c->redirect_depth++;
+    compile_node(c, node->children[0]);
+    c->redirect_depth--;
+
+    // A failed redirection skips the body
+    c->prog->code[site].a = emit(c, BC_UNREDIRECT, 0, 0, 0);
+}
+
+// A stage table followed by one subshell body per stage
+static void compile_pipeline(Compiler *c, const AstNode *node) {
+    if (node->child_count == 1) {
+        compile_node(c, node->children[0]);
+        return;
+    }
+
+    int site = emit(c, BC_PIPELINE, 0, 0, node->child_count);
+    int first_stage = here(c);
+    for (int i = 0; i < node->child_count; i++) {
+        emit(c, BC_STAGE, is_single_command(node->children[i]) ? BC_FLAG_SINGLE : 0, 0, 0);
+    }
+
+    for (int i = 0; i < node->child_count; i++) {
+        c->prog->code[first_stage + i].a = here(c);
+
+        // A loop reading the pipe is its only reader, up to the end of
+        // the stage
+        const AstNode *stage = node->children[i];
+        if (stage->type == AST_REDIRECT && !redirects_stdin(stage)) {
+            stage = stage->children[0];
+        }
+        int own = i > 0 && owns_input(stage) ? emit(c, BC_REDIRECT, BC_FLAG_OWN_INPUT, 0, 0) : -1;
+        compile_subshell(c, node->children[i]);
+        if (own >= 0) {
+            c->prog->code[own].a = here(c);
+        }
+    }
+    c->prog->code[site].a = here(c);
+}
+
+static void compile_if(Compiler *c, const AstNode *node) {
+    int *ends = malloc((node->child_count / 2 + 1) * sizeof(int));
+    int end_count = 0;
+    int i;
+
+    if (!ends) {
+        alloc_error();
+    }
+
+    for (i = 0; i + 1 < node->child_count; i += 2) {
+        compile_node(c, node->children[i]);
+        int next = emit(c, BC_JUMP_IF_FAIL, 0, 0, 0);
+        compile_node(c, node->children[i + 1]);
+        ends[end_count++] = emit(c, BC_JUMP, 0, 0, 0);
+        c->prog->code[next].a = here(c);
+    }
+
+    // Else branch, or status 0 when no branch ran
+    if (i < node->child_count) {
+        compile_node(c, node->children[i]);
+    } else {
+        emit(c, BC_STATUS, 0, 0, 0);
+    }
+
+    for (int j = 0; j < end_count; j++) {
+        c->prog->code[ends[j]].a = here(c);
+    }
+    free(ends);
+}
+
+// The loop's status is that of the last body run, kept in a slot while
+// the condition overwrites $?
+// Every loop gets its own slot, a loop in another's condition runs while
+// the outer one's status is kept.
+static void compile_while(Compiler *c, const AstNode *node) {
+    int slot = c->prog->slot_count++;
+
+    emit(c, BC_STATUS, 0, 0, 0);
+    emit(c, BC_SLOT_SAVE, 0, slot, 0);
+
+    uint32_t top = here(c);
+    compile_node(c, node->children[0]);
+    int exit_site = emit(c, node->type == AST_WHILE ? BC_JUMP_IF_FAIL : BC_JUMP_IF_OK, 0, 0, 0);
+
+    push_loop(c, 0, slot, top);
+    compile_node(c, node->children[1]);
+    emit(c, BC_SLOT_SAVE, 0, slot, 0);
+    emit(c, BC_JUMP, 0, top, 0);
+
+    c->prog->code[exit_site].a = here(c);
+    emit(c, BC_SLOT_LOAD, 0, slot, 0);
+    pop_loop(c);
+}
+
+static void compile_for(Compiler *c, const AstNode *node) {
+    int flags = 0;
+
+    if (node->flags & AST_FOR_ARGS) {
+        flags = BC_FLAG_ARGS;
+    } else {
+        for (int i = 1; i < node->word_count; i++) {
+            compile_word(c, &node->words[i]);
+        }
+    }
+    const Word *var = &node->words[0];
+    emit(c, BC_FOR_INIT, flags, add_word_flags(c, var, var->flags | HUSH_TOK_INTERNED), 0);
+
+    uint32_t top = here(c);
+    int next = emit(c, BC_FOR_NEXT, 0, 0, 0);
+
+    push_loop(c, 1, -1, top);
+    compile_node(c, node->children[0]);
+    emit(c, BC_JUMP, 0, top, 0);
+
+    c->prog->code[next].a = here(c);
+    pop_loop(c);
+}
+
+// Compile one expression of for ((init; cond; step)), nothing if it is blank
+// Returns 0 when there was nothing to compile.
+static int compile_arith_part(Compiler *c, const AstNode *node) {
+    if (node->source[strspn(node->source, " \t\n")] == '\0') {
+        return 0;
+    }
+    compile_node(c, node);
+    return 1;
+}
+
+// for ((init; cond; step)): the step comes before each test after the
+// first, so continue jumps to it; the status is kept in a slot as for while
+// A blank condition is always true.
+static void compile_arith_for(Compiler *c, const AstNode *node) {
+    int slot = c->prog->slot_count++;
+
+    compile_arith_part(c, node->children[0]);
+    emit(c, BC_STATUS, 0, 0, 0);
+    emit(c, BC_SLOT_SAVE, 0, slot, 0);
+    int enter = emit(c, BC_JUMP, 0, 0, 0);
+
+    uint32_t step = here(c);
+    compile_arith_part(c, node->children[2]);
+    c->prog->code[enter].a = here(c);
+    int exit_site = -1;
+    if (compile_arith_part(c, node->children[1])) {
+        exit_site = emit(c, BC_JUMP_IF_FAIL, 0, 0, 0);
+    }
+
+    push_loop(c, 0, slot, step);
+    compile_node(c, node->children[3]);
+    emit(c, BC_SLOT_SAVE, 0, slot, 0);
+    emit(c, BC_JUMP, 0, step, 0);
+
+    if (exit_site >= 0) {
+        c->prog->code[exit_site].a = here(c);
+    }
+    emit(c, BC_SLOT_LOAD, 0, slot, 0);
+    pop_loop(c);
+}
+
+// One instruction per primary, && and || jump over the ones they skip
+static void compile_cond_test(Compiler *c, const AstNode *node) {
+    if (node->word_count == 1) {
+        emit(c, BC_COND_UNARY, node->flags, add_word(c, &node->words[0]), 0);
+    } else {
+        emit(c, BC_COND, node->flags, add_word(c, &node->words[0]), add_word(c, &node->words[1]));
+    }
+}
+
+// The body is compiled when the definition runs, from its source text
+static void compile_function(Compiler *c, const AstNode *node) {
+    const Word *name = &node->words[0];
+    emit(c, BC_FUNCTION, 0, add_word_flags(c, name, name->flags | HUSH_TOK_INTERNED),
+         add_string(c, node->source));
+}
+
+static void compile_node(Compiler *c, const AstNode *node) {
+    switch (node->type) {
+        case AST_LIST:
+            compile_list(c, node);
+            break;
+        case AST_AND_OR:
+            compile_and_or(c, node);
+            break;
+        case AST_PIPELINE:
+            compile_pipeline(c, node);
+            break;
+        case AST_COMMAND:
+            compile_command(c, node);
+            break;
+        case AST_IF:
+            compile_if(c, node);
+            break;
+        case AST_WHILE:
+        case AST_UNTIL:
+            compile_while(c, node);
+            break;
+        case AST_FOR:
+            compile_for(c, node);
+            break;
+        case AST_ARITH_FOR:
+            compile_arith_for(c, node);
+            break;
+        case AST_GROUP:
+            compile_node(c, node->children[0]);
+            break;
+        case AST_FUNCTION:
+            compile_function(c, node);
+            break;
+        case AST_ARITH:
+            emit(c, BC_ARITH, 0, add_string(c, node->source), 0);
+            break;
+        case AST_COND:
+            compile_node(c, node->children[0]);
+            break;
+        case AST_COND_NOT:
+            compile_node(c, node->children[0]);
+            emit(c, BC_NOT, 0, 0, 0);
+            break;
+        case AST_COND_TEST:
+            compile_cond_test(c, node);
+            break;
+        case AST_REDIRECT:
+            compile_redirect(c, node);
+            break;
+    }
+}
+
+Program *compile_program(const AstNode *root) {
+    Program *prog = calloc(1, sizeof(Program));
+    if (!prog) {
+        alloc_error();
+    }
+
+    compile_append(prog, root);
+    return prog;
+}
+
+int compile_append(Program *prog, const AstNode *root) {
+    // Continue over the previous end of program
+    if (prog->code_count > 0 && prog->code[prog->code_count - 1].op == BC_HALT) {
+        prog->code_count--;
+    }
+
+    int start = prog->code_count;
+    Compiler c = { prog, NULL, 0, 0, 0 };
+    if (root) {
+        compile_node(&c, root);
+    }
+    emit(&c, BC_HALT, 0, 0, 0);
+    free(c.loops);
+
+    return start;
+}
+
+void program_resolve_names(Program *prog) {
+    free(prog->names);
+    prog->names = calloc(prog->word_count ? prog->word_count : 1, sizeof(const char *));
+    if (!prog->names) {
+        alloc_error();
+    }
+    for (int i = 0; i < prog->word_count; i++) {
+        if (prog->words[i].flags & HUSH_TOK_INTERNED) {
+            prog->names[i] = intern(prog->strings + prog->words[i].offset);
+        }
+    }
+}
+
+void program_clear(Program *prog) {
+    prog->code_count = 0;
+    prog->word_count = 0;
+    prog->strings_len = 0;
+    prog->slot_count = 0;
+}
+
+void free_program(Program *prog) {
+    if (!prog) {
+        return;
+    }
+    free(prog->code);
+    free(prog->words);
+    free(prog->names);
+    free(prog->strings);
+    free(prog);
+}
@@ -10,6 +10,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include "builtins.h"
+#include "variables.h"
 
 #define MANY_COMPLETIONS_THRESHOLD 100
 
@@ -135,7 +136,8 @@ static char *expand_tilde(const char *path) {
         }
     } else {
         // Simple ~ case, use current user's home
-        home = getenv("HOME");
+        VarView home_view;
+        home = lookup_variable("HOME", 4, &home_view) ? home_view.ptr : NULL;
         if (!home) {
             struct passwd *pw = getpwuid(getuid());
             if (pw) {
@@ -189,8 +191,9 @@ static void parse_path(const char *input, char **dir_path, char **file_prefix) {
 
 // Get executables from PATH for command completion
 static void add_executables_from_path(completion_list *completions, const char *prefix) {
-    char *path = getenv("PATH");
-    if (!path) return;
+    VarView path_view;
+    if (!lookup_variable("PATH", 4, &path_view)) return;
+    const char *path = path_view.ptr;
 
     // Make a copy of PATH since strtok modifies its input
     char *path_copy = strdup(path);
@@ -210,8 +213,10 @@ static void add_executables_from_path(completion_list *completions, const char *
                 // Skip hidden files and directories
                 if (entry->d_name[0] == '.') continue;
 
-                // Check if name starts with prefix
-                if (strncmp(entry->d_name, prefix, prefix_len) == 0) {
+                // Check if name starts with prefix; builtins are listed
+                // already, so skip the stat and duplicate check for them
+                if (strncmp(entry->d_name, prefix, prefix_len) == 0 &&
+                    find_builtin(entry->d_name) < 0) {
                     // Build full path to check if it's executable
                     char full_path[PATH_MAX];
                     snprintf(full_path, PATH_MAX, "%s/%s", dir, entry->d_name);
@@ -1,625 +1,183 @@
 #include "control.h"
-#include "chain.h"
-#include "execute.h"
-#include "splitline.h"
-#include "environment.h"
-#include "variables.h"  // Added for set_shell_variable
-
-// Trim leading and trailing whitespace
-static char *trim(char *str) {
-    if (!str) return NULL;
-
-    // Skip leading spaces
-    char *start = str;
-    while (*start && isspace((unsigned char)*start)) {
-        start++;
-    }
-
-    if (*start == '\0') {  // All spaces
-        return start;
-    }
-
-    // Trim trailing spaces
-    char *end = start + strlen(start) - 1;
-    while (end > start && isspace((unsigned char)*end)) {
-        end--;
-    }
-    *(end + 1) = '\0';
-
-    return start;
-}
-
-// Check if line contains a control structure keyword
-int is_control_keyword(const char *line) {
-    const char *trimmed = line;
-
-    // Skip leading whitespace
-    while (*trimmed && isspace((unsigned char)*trimmed)) {
-        trimmed++;
-    }
-
-    // Check for control keywords
-    if (strncmp(trimmed, "if", 2) == 0 && (isspace(trimmed[2]) || trimmed[2] == '\0')) {
-        return 1;
-    }
-    if (strncmp(trimmed, "then", 4) == 0 && (isspace(trimmed[4]) || trimmed[4] == '\0')) {
-        return 2;
-    }
-    if (strncmp(trimmed, "else", 4) == 0 && (isspace(trimmed[4]) || trimmed[4] == '\0')) {
-        return 3;
-    }
-    if (strncmp(trimmed, "elif", 4) == 0 && (isspace(trimmed[4]) || trimmed[4] == '\0')) {
-        return 4;
-    }
-    if (strncmp(trimmed, "fi", 2) == 0 && (isspace(trimmed[2]) || trimmed[2] == '\0')) {
-        return 5;
-    }
-
-    return 0;
+#include "vm.h"
+#include "variables.h"
+
+void control_buffer_init(ControlBuffer *cb) {
+    cb->text = NULL;
+    cb->len = 0;
+    cb->capacity = 0;
+    cb->depth = 0;
+    cb->prog = NULL;
+    cb->keep = 0;
+    cb->errors = 0;
 }
 
-// Check if a line starts a loop
-int is_loop_start(const char *line) {
-    const char *trimmed = line;
-
-    // Skip leading whitespace
-    while (*trimmed && isspace((unsigned char)*trimmed)) {
-        trimmed++;
-    }
-
-    // Check for loop keywords
-    if (strncmp(trimmed, "for", 3) == 0 && (isspace(trimmed[3]) || trimmed[3] == '\0')) {
-        return 1; // for loop
-    }
-    if (strncmp(trimmed, "while", 5) == 0 && (isspace(trimmed[5]) || trimmed[5] == '\0')) {
-        return 2; // while loop
-    }
-
-    return 0; // not a loop
-}
-
-// Check if a line ends a loop
-int is_loop_end(const char *line) {
-    const char *trimmed = line;
-
-    // Skip leading whitespace
-    while (*trimmed && isspace((unsigned char)*trimmed)) {
-        trimmed++;
-    }
-
-    // Check for loop end keyword
-    if (strncmp(trimmed, "done", 4) == 0 && (isspace(trimmed[4]) || trimmed[4] == '\0')) {
-        return 1;
-    }
-
-    return 0;
+void control_buffer_free(ControlBuffer *cb) {
+    free(cb->text);
+    free_program(cb->prog);
+    control_buffer_init(cb);
 }
 
-// Extract the condition part from an if statement
-static char *get_condition(const char *if_line) {
-    const char *start = if_line;
-
-    // Skip "if" and any spaces
-    while (*start && !isspace((unsigned char)*start)) {
-        start++;
-    }
-    while (*start && isspace((unsigned char)*start)) {
-        start++;
+// Drop the buffered text, keeping the allocation unless a large block
+// made it grow
+static void control_buffer_reset(ControlBuffer *cb) {
+    cb->len = 0;
+    cb->depth = 0;
+    if (cb->capacity > CONTROL_BUFFER_KEEP) {
+        free(cb->text);
+        cb->text = NULL;
+        cb->capacity = 0;
+    } else if (cb->text) {
+        cb->text[0] = '\0';
     }
-
-    return strdup(start);
 }
 
-// Extract items for a for loop
-static char **extract_for_items(const char *for_line, int *count) {
-    const char *start = for_line;
-    char **items = NULL;
-    *count = 0;
-
-    // Skip "for" keyword
-    while (*start && !isspace((unsigned char)*start)) {
-        start++;
-    }
-    while (*start && isspace((unsigned char)*start)) {
-        start++;
+// Compile a parsed tree into the buffer's program and free it
+static int control_buffer_compile(ControlBuffer *cb, AstNode *root) {
+    if (!root) {
+        cb->errors++;
+        return -1;
     }
 
-    // Skip variable name
-    while (*start && !isspace((unsigned char)*start)) {
-        start++;
-    }
-    while (*start && isspace((unsigned char)*start)) {
-        start++;
-    }
-
-    // Skip "in" keyword
-    if (strncmp(start, "in", 2) == 0) {
-        start += 2;
-        while (*start && isspace((unsigned char)*start)) {
-            start++;
-        }
-    }
-
-    // Process items until end of line
-    char *items_str = strdup(start);
-    if (!items_str) return NULL;
-
-    // Allocate initial array for items
-    items = malloc(10 * sizeof(char *));
-    if (!items) {
-        free(items_str);
-        return NULL;
-    }
-
-    // Split by whitespace, handling quotes
-    char *token = strtok(items_str, " \t\n");
-    int capacity = 10;
-
-    while (token != NULL) {
-        // Resize array if needed
-        if (*count >= capacity) {
-            capacity *= 2;
-            char **new_items = realloc(items, capacity * sizeof(char *));
-            if (!new_items) {
-                for (int i = 0; i < *count; i++) {
-                    free(items[i]);
-                }
-                free(items);
-                free(items_str);
-                return NULL;
-            }
-            items = new_items;
+    if (!cb->prog) {
+        cb->prog = calloc(1, sizeof(Program));
+        if (!cb->prog) {
+            perror("hush: memory allocation error");
+            free_ast(root);
+            return -1;
         }
-
-        // Add item to array
-        items[*count] = strdup(token);
-        (*count)++;
-
-        token = strtok(NULL, " \t\n");
-    }
-
-    free(items_str);
-    return items;
-}
-
-static char *extract_for_var(const char *for_line) {
-    const char *start = for_line;
-
-    // Skip "for" keyword
-    while (*start && !isspace((unsigned char)*start)) {
-        start++;
-    }
-    while (*start && isspace((unsigned char)*start)) {
-        start++;
-    }
-
-    // Extract variable name
-    const char *var_start = start;
-    while (*start && !isspace((unsigned char)*start)) {
-        start++;
+    } else if (!cb->keep) {
+        program_clear(cb->prog);
     }
 
-    int var_len = start - var_start;
-    char *var_name = malloc(var_len + 1);
-    if (!var_name) return NULL;
-
-    strncpy(var_name, var_start, var_len);
-    var_name[var_len] = '\0';
-
-    return var_name;
+    int start = compile_append(cb->prog, root);
+    free_ast(root);
+    return start;
 }
 
-// Execute a for loop
-int execute_for_loop(char **lines, int line_count) {
-    int result = 1; // Success by default
-    int do_index = -1;
-    int done_index = -1;
-
-    // Find the 'do' and 'done' markers
-    for (int i = 1; i < line_count; i++) {
-        char *trimmed = trim(lines[i]);
-        if (strncmp(trimmed, "do", 2) == 0 && (isspace(trimmed[2]) || trimmed[2] == '\0')) {
-            do_index = i;
-        } else if (is_loop_end(trimmed)) {
-            done_index = i;
-            break;
-        }
-    }
-
-    // Check for syntax errors
-    if (do_index == -1) {
-        fprintf(stderr, "hush: syntax error: for loop without 'do'\n");
-        return 1;
-    }
-    if (done_index == -1) {
-        fprintf(stderr, "hush: syntax error: for loop without 'done'\n");
-        return 1;
-    }
+int control_buffer_add(ControlBuffer *cb, const char *line) {
+    size_t n = strlen(line);
 
-    // Extract the variable and items
-    char *var_name = extract_for_var(lines[0]);
-    if (!var_name) {
-        fprintf(stderr, "hush: memory allocation error in for loop\n");
-        return 1;
-    }
-
-    int item_count = 0;
-    char **items = extract_for_items(lines[0], &item_count);
-    if (!items) {
-        fprintf(stderr, "hush: memory allocation error in for loop\n");
-        free(var_name);
-        return 1;
-    }
-
-    // Execute the loop body for each item
-    for (int i = 0; i < item_count; i++) {
-        // Set the loop variable
-        set_shell_variable(var_name, items[i]);
-
-        // Execute the loop body (lines between 'do' and 'done')
-        for (int j = do_index + 1; j < done_index; j++) {
-            char *cmd = lines[j];
-            if (strlen(trim(cmd)) > 0 && !is_control_keyword(cmd)) {
-                // Process the command with variable expansion
-                char *expanded = expand_variables(cmd);
-                result = execute_command_chain(expanded);
-                free(expanded);
-
-                // Break on error if needed
-                // (optional: you might want to continue the loop regardless of errors)
-                // if (result != 0) break;
-            }
+    // Lines are joined with newlines so the parser sees the block as written
+    if (cb->len + n + 2 > cb->capacity) {
+        size_t capacity = cb->capacity ? cb->capacity : 256;
+        while (cb->len + n + 2 > capacity) {
+            capacity *= 2;
         }
-    }
-
-    // Clean up
-    free(var_name);
-    for (int i = 0; i < item_count; i++) {
-        free(items[i]);
-    }
-    free(items);
-
-    return result;
-}
-
-// Execute a while loop
-int execute_while_loop(char **lines, int line_count) {
-    int result = 1; // Success by default
-    int do_index = -1;
-    int done_index = -1;
-
-    // Find the 'do' and 'done' markers
-    for (int i = 1; i < line_count; i++) {
-        char *trimmed = trim(lines[i]);
-        if (strncmp(trimmed, "do", 2) == 0 && (isspace(trimmed[2]) || trimmed[2] == '\0')) {
-            do_index = i;
-        } else if (is_loop_end(trimmed)) {
-            done_index = i;
-            break;
+        char *text = realloc(cb->text, capacity);
+        if (!text) {
+            perror("hush: memory allocation error");
+            control_buffer_reset(cb);
+            return -1;
         }
+        cb->text = text;
+        cb->capacity = capacity;
     }
+    memcpy(cb->text + cb->len, line, n);
+    cb->len += n;
+    cb->text[cb->len++] = '\n';
+    cb->text[cb->len] = '\0';
 
-    // Check for syntax errors
-    if (do_index == -1) {
-        fprintf(stderr, "hush: syntax error: while loop without 'do'\n");
-        return 1;
-    }
-    if (done_index == -1) {
-        fprintf(stderr, "hush: syntax error: while loop without 'done'\n");
-        return 1;
-    }
-
-    // Extract the condition (everything after 'while')
-    const char *condition_start = lines[0] + 5; // Skip "while"
-    while (*condition_start && isspace((unsigned char)*condition_start)) {
-        condition_start++;
-    }
-
-    char *condition = strdup(condition_start);
-    if (!condition) {
-        fprintf(stderr, "hush: memory allocation error in while loop\n");
-        return 1;
+    // Only try a full parse once every block opened so far looks closed
+    cb->depth += parse_block_depth(line);
+    if (cb->depth > 0) {
+        return -1;
     }
 
-    // Loop execution
-    while (1) {
-        // Evaluate the condition
-        char *expanded_condition = expand_variables(condition);
-        int condition_result = execute_command_chain(expanded_condition);
-        free(expanded_condition);
-
-        // If the condition is false (non-zero exit status), break the loop
-        if (condition_result != 0) {
-            break;
-        }
-
-        // Execute the loop body
-        for (int j = do_index + 1; j < done_index; j++) {
-            char *cmd = lines[j];
-            if (strlen(trim(cmd)) > 0 && !is_control_keyword(cmd)) {
-                // Process the command with variable expansion
-                char *expanded = expand_variables(cmd);
-                result = execute_command_chain(expanded);
-                free(expanded);
-
-                // Could handle break/continue here if we implement them
-            }
-        }
+    int incomplete = 0;
+    AstNode *root = parse_input(cb->text, &incomplete);
+    if (incomplete) {
+        return -1;
     }
-
-    free(condition);
-    return result;
+    control_buffer_reset(cb);
+    return control_buffer_compile(cb, root);
 }
 
-// Execute an if-then-else-fi block
-int execute_if_statement(char **lines, int line_count) {
-    int i = 0;
-    int if_result = 0;
-    int in_then_block = 0;
-    int in_else_block = 0;
-    int else_index = -1;
-    int fi_index = -1;
-
-    // First, find the structure of the if statement
-    for (i = 0; i < line_count; i++) {
-        int keyword = is_control_keyword(lines[i]);
-
-        if (keyword == 2) {  // then
-            in_then_block = 1;
-        } else if (keyword == 3) {  // else
-            in_then_block = 0;
-            in_else_block = 1;
-            else_index = i;
-        } else if (keyword == 5) {  // fi
-            fi_index = i;
-            break;
-        }
-    }
-
-    // If we didn't find a complete structure, report an error
-    if (fi_index == -1) {
-        fprintf(stderr, "hush: syntax error: if without fi\n");
-        return 1;
-    }
-
-    // Execute the condition
-    char *condition = get_condition(lines[0]);
-    if_result = execute_command_chain(condition);
-    free(condition);
-
-    // Find where the "then" block starts
-    int then_start = -1;
-    for (i = 1; i < line_count; i++) {
-        if (is_control_keyword(lines[i]) == 2) {  // then
-            then_start = i + 1;
-            break;
-        }
-    }
-
-    if (then_start == -1 || then_start >= line_count) {
-        fprintf(stderr, "hush: syntax error: if without then\n");
-        return 1;
+int control_buffer_finish(ControlBuffer *cb) {
+    if (cb->len == 0) {
+        return -1;
     }
 
-    // Execute the appropriate block based on the condition result
-    int block_end = else_index != -1 ? else_index : fi_index;
-    int result = 1;  // Default success
-
-    if (if_result == 0) {  // Condition succeeded (zero exit status)
-        // Execute the then block
-        for (i = then_start; i < block_end; i++) {
-            if (is_control_keyword(lines[i])) continue;  // Skip embedded keywords
-            result = execute_command_chain(lines[i]);
-        }
-    } else if (else_index != -1) {  // Condition failed and there's an else block
-        // Execute the else block
-        for (i = else_index + 1; i < fi_index; i++) {
-            if (is_control_keyword(lines[i])) continue;  // Skip embedded keywords
-            result = execute_command_chain(lines[i]);
-        }
-    }
-
-    return result;
+    // No more input: parse what is left, reporting anything unfinished
+    AstNode *root = parse_line(cb->text);
+    control_buffer_reset(cb);
+    return control_buffer_compile(cb, root);
 }
 
-// Parse and execute a series of lines that may contain control structures
-int parse_and_execute_control(char **lines, int line_count) {
-    int i = 0;
-    int result = 1;  // Default success
-
-    while (i < line_count) {
-        // Check for control structures
-        if (is_control_keyword(lines[i]) == 1) {  // if statement
-            // Find matching fi
-            int nesting = 1;
-            int fi_index = -1;
-
-            for (int j = i + 1; j < line_count; j++) {
-                int kw = is_control_keyword(lines[j]);
-                if (kw == 1) {  // Nested if
-                    nesting++;
-                } else if (kw == 5) {  // fi
-                    nesting--;
-                    if (nesting == 0) {
-                        fi_index = j;
-                        break;
-                    }
-                }
-            }
-
-            if (fi_index == -1) {
-                fprintf(stderr, "hush: syntax error: if without fi\n");
-                return 1;
-            }
-
-            // Create a subarray with just the if block
-            char **if_block = malloc((fi_index - i + 1) * sizeof(char *));
-            if (!if_block) {
-                perror("hush: memory allocation error");
-                return 1;
-            }
-
-            for (int j = i; j <= fi_index; j++) {
-                if_block[j - i] = lines[j];
-            }
-
-            // Execute the if statement
-            result = execute_if_statement(if_block, fi_index - i + 1);
-
-            // Clean up and move past this block
-            free(if_block);
-            i = fi_index + 1;
+// Check that the rest of a script is only blank lines and comments
+static int only_comments_left(FILE *script_file, char **line, size_t *line_capacity) {
+    while (getline(line, line_capacity, script_file) > 0) {
+        const char *first = *line;
+        while (isspace((unsigned char)*first)) {
+            first++;
         }
-        else if (is_loop_start(lines[i]) == 1) {  // for loop
-            // Find matching done
-            int nesting = 1;
-            int done_index = -1;
-
-            for (int j = i + 1; j < line_count; j++) {
-                if (is_loop_start(lines[j])) {
-                    nesting++;
-                } else if (is_loop_end(lines[j])) {
-                    nesting--;
-                    if (nesting == 0) {
-                        done_index = j;
-                        break;
-                    }
-                }
-            }
-
-            if (done_index == -1) {
-                fprintf(stderr, "hush: syntax error: for without done\n");
-                return 1;
-            }
-
-            // Create a subarray with just the for block
-            char **for_block = malloc((done_index - i + 1) * sizeof(char *));
-            if (!for_block) {
-                perror("hush: memory allocation error");
-                return 1;
-            }
-
-            for (int j = i; j <= done_index; j++) {
-                for_block[j - i] = lines[j];
-            }
-
-            // Execute the for loop
-            result = execute_for_loop(for_block, done_index - i + 1);
-
-            // Clean up and move past this block
-            free(for_block);
-            i = done_index + 1;
-        }
-        else if (is_loop_start(lines[i]) == 2) {  // while loop
-            // Find matching done
-            int nesting = 1;
-            int done_index = -1;
-
-            for (int j = i + 1; j < line_count; j++) {
-                if (is_loop_start(lines[j])) {
-                    nesting++;
-                } else if (is_loop_end(lines[j])) {
-                    nesting--;
-                    if (nesting == 0) {
-                        done_index = j;
-                        break;
-                    }
-                }
-            }
-
-            if (done_index == -1) {
-                fprintf(stderr, "hush: syntax error: while without done\n");
-                return 1;
-            }
-
-            // Create a subarray with just the while block
-            char **while_block = malloc((done_index - i + 1) * sizeof(char *));
-            if (!while_block) {
-                perror("hush: memory allocation error");
-                return 1;
-            }
-
-            for (int j = i; j <= done_index; j++) {
-                while_block[j - i] = lines[j];
-            }
-
-            // Execute the while loop
-            result = execute_while_loop(while_block, done_index - i + 1);
-
-            // Clean up and move past this block
-            free(while_block);
-            i = done_index + 1;
-        }
-        else {
-            // Regular command, execute it
-            if (strlen(trim(lines[i])) > 0) {
-                char *expanded = expand_variables(lines[i]);
-                result = execute_command_chain(expanded);
-                free(expanded);
-            }
-            i++;
+        if (*first != '#' && *first != '\0') {
+            return 0;
         }
     }
-
-    return result;
+    return 1;
 }
 
-// Process a script file, handling control structures
-int process_script_control_flow(FILE *script_file) {
-    char line[1024];
-    char **lines = NULL;
-    int line_count = 0;
-    int capacity = 16;
+int process_script_compiled(FILE *script_file, Program **compiled) {
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t len;
+    ControlBuffer cb;
     int result = 1;
 
-    // Allocate initial array for lines
-    lines = malloc(capacity * sizeof(char *));
-    if (!lines) {
-        perror("hush: memory allocation error");
-        return 1;
-    }
+    control_buffer_init(&cb);
+    cb.keep = compiled != NULL;
 
-    // Read all lines from the script
-    while (fgets(line, sizeof(line), script_file)) {
+    // Run each command as soon as it is complete, so only the command being
+    // collected is held in memory. Nothing after an exit is read: the rest
+    // of the file need not even be shell code.
+    while ((len = getline(&line, &line_capacity, script_file)) > 0) {
         // Remove trailing newline
-        size_t len = strlen(line);
-        if (len > 0 && line[len-1] == '\n') {
+        if (line[len-1] == '\n') {
             line[len-1] = '\0';
         }
 
-        // Skip comments and empty lines
-        char *trimmed = trim(line);
-        if (trimmed[0] == '#' || trimmed[0] == '\0') {
+        // Skip comments and empty lines, unless inside a command (a quote
+        // may span them)
+        const char *first = line;
+        while (isspace((unsigned char)*first)) {
+            first++;
+        }
+        if (cb.len == 0 && (*first == '#' || *first == '\0')) {
             continue;
         }
 
-        // Expand the array if needed
-        if (line_count >= capacity) {
-            capacity *= 2;
-            char **new_lines = realloc(lines, capacity * sizeof(char *));
-            if (!new_lines) {
-                perror("hush: memory allocation error");
-                for (int i = 0; i < line_count; i++) {
-                    free(lines[i]);
-                }
-                free(lines);
-                return 1;
+        int pc = control_buffer_add(&cb, line);
+        if (pc >= 0) {
+            result = vm_execute_at(cb.prog, pc);
+            if (!result) {
+                break;
             }
-            lines = new_lines;
         }
-
-        // Add this line to the array
-        lines[line_count++] = strdup(line);
     }
 
-    // Parse and execute the script
-    result = parse_and_execute_control(lines, line_count);
+    // An exit that was the last command still leaves the whole script
+    // compiled, one before the end leaves the rest unread
+    int whole = 1;
+    if (result) {
+        int pc = control_buffer_finish(&cb);
+        if (pc >= 0) {
+            result = vm_execute_at(cb.prog, pc);
+        }
+    } else if (compiled) {
+        whole = only_comments_left(script_file, &line, &line_capacity);
+    }
+    free(line);
 
-    // Clean up
-    for (int i = 0; i < line_count; i++) {
-        free(lines[i]);
+    // Only a whole script that compiled without errors is worth keeping
+    if (compiled) {
+        *compiled = NULL;
+        if (whole && cb.errors == 0 && cb.prog) {
+            *compiled = cb.prog;
+            cb.prog = NULL;
+        }
     }
-    free(lines);
+    control_buffer_free(&cb);
 
     return result;
 }
@@ -122,9 +122,8 @@
 int hush_export(char **args) {
     // The 'export' built-in command
     if (args[1] == NULL) {
-        // With no arguments, list all environment variables
-        extern char **environ;
-        for (char **env = environ; *env != NULL; env++) {
+        // With no arguments, list the environment commands get
+        for (char **env = exported_environment(); *env != NULL; env++) {
             printf("%s\n", *env);
         }
         return 1;
@@ -136,11 +135,8 @@ int hush_export(char **args) {
         char *equals = strchr(arg, '=');
 
         if (equals == NULL) {
-            // No equals sign, print the current value
-            char *value = getenv(arg);
-            if (value != NULL) {
-                printf("%s=%s\n", arg, value);
-            }
+            // No equals sign, export the variable as it is
+            export_variable(arg);
             continue;
         }
 
@@ -149,9 +145,10 @@ int hush_export(char **args) {
         char *name = arg;
         char *value = equals + 1;
 
-        // Set the environment variable
-        if (setenv(name, value, 1) != 0) {
+        // Set the variable and mark it for export
+        if (!set_shell_variable(name, value) || !export_variable(name)) {
             fprintf(stderr, "hush: export: error setting environment variable %s\n", name);
+            set_last_exit_status(1);
         }
 
         *equals = '='; // Restore the equals sign
@@ -4,27 +4,36 @@
 #include "glob.h"
 #include "alias.h"
 #include "variables.h"
+#include "lexer.h"
+#include "arena.h"
+#include "functions.h"
+#include "output.h"
 
 #include <sys/stat.h>
 #include <limits.h>
 
-// Function to check if command contains a pipe
-int has_pipe(char **args) {
+// ShellFunction to check if command contains a pipe
+int has_pipe(char **args, const unsigned int *flags) {
     for (int i = 0; args[i] != NULL; i++) {
-        if (strcmp(args[i], "|") == 0) {
+        if (flags ? HUSH_TOK_OP(flags[i]) == OP_PIPE : strcmp(args[i], "|") == 0) {
             return 1;
         }
     }
     return 0;
 }
 
-int hush_execute(char **args)
+// Run a simple command with its prefix assignments (NULL for none)
+static int execute_simple(char **args, const unsigned int *flags, char **assigns)
 {
     int i;
     int result;
 
     if (args[0] == NULL)
     {
+        if (assigns) {
+            assign_variables(assigns);
+            set_last_exit_status(0);
+        }
         return 1;
     }
 
@@ -34,17 +43,14 @@ int hush_execute(char **args)
 
         // Handle tilde expansion for home directory
         char *path = args[0];
-        char *expanded_path = NULL;
 
         if (path[0] == '~' && (path[1] == '/' || path[1] == '\0')) {
-            const char *home = getenv("HOME");
-            if (home) {
-                expanded_path = malloc(strlen(home) + strlen(path));
-                if (expanded_path) {
-                    strcpy(expanded_path, home);
-                    strcat(expanded_path, path + 1);  // Skip the ~
-                    path = expanded_path;
-                }
+            VarView home;
+            if (lookup_variable("HOME", 4, &home)) {
+                char *expanded_path = arena_alloc(home.len + strlen(path));
+                memcpy(expanded_path, home.ptr, home.len);
+                strcpy(expanded_path + home.len, path + 1);  // Skip the ~
+                path = expanded_path;
             }
         }
 
@@ -59,32 +65,20 @@ int hush_execute(char **args)
             if (getcwd(cwd, sizeof(cwd)) != NULL) {
                 printf("%s\n", cwd);
             }
-
-            if (expanded_path) {
-                free(expanded_path);
-            }
             return 1; // Continue the shell loop
         }
-
-        if (expanded_path) {
-            free(expanded_path);
-        }
     }
 
     // First, expand any wildcards in arguments
-    char **expanded_args = expand_wildcards(args);
-
+    // Everything below is allocated in the command arena, the VM releases it
+    unsigned int *expanded_flags = NULL;
+    char **expanded_args = expand_wildcards_flags(args, flags, flags ? &expanded_flags : NULL);
 
     // Check if the command contains pipes
-    if (has_pipe(expanded_args)) {
+    if (has_pipe(expanded_args, expanded_flags)) {
+        set_environment_overlay(assigns);
         result = execute_pipeline(expanded_args);
-
-        // Free expanded args
-        for (i = 0; expanded_args[i] != NULL; i++) {
-            free(expanded_args[i]);
-        }
-        free(expanded_args);
-
+        set_environment_overlay(NULL);
         return result;
     }
 
@@ -93,49 +87,84 @@ int hush_execute(char **args)
     int stdin_copy = -1, stdout_copy = -1, stderr_copy = -1;
 
     // Setup redirection and get clean args
-    char **clean_args = setup_redirection(expanded_args, &stdin_copy, &stdout_copy, &stderr_copy);
+    char **clean_args = setup_redirection_flags(expanded_args, expanded_flags,
+                                                &stdin_copy, &stdout_copy, &stderr_copy);
+
+    // Nothing left once the redirections are taken out
+    if (clean_args[0] == NULL) {
+        int failed = redirection_failed;
+        reset_redirection(stdin_copy, stdout_copy, stderr_copy);
+        if (assigns) {
+            assign_variables(assigns);
+        }
+        set_last_exit_status(failed ? 1 : 0);
+        return 1;
+    }
 
-    // Check for builtins
-    for (i = 0; i < hush_num_builtins(); i++)
-    {
-        if (strcmp(clean_args[0], builtin_str[i]) == 0)
-        {
-            result = (*builtin_func[i])(clean_args);
-            reset_redirection(stdin_copy, stdout_copy, stderr_copy);
-
-            // Free the clean_args array if it's different from expanded_args
-            if (clean_args != expanded_args) {
-                free(clean_args);
-            }
+    // Functions come before builtins and commands
+    // Both see prefix assignments as exported variables until they return
+    ShellFunction *fn = find_function(clean_args[0]);
+    if (fn) {
+        if (assigns) {
+            push_assignment_scope(assigns);
+        }
+        result = call_function(fn, clean_args);
+        if (assigns) {
+            pop_variable_scope();
+        }
 
-            // Free the expanded args
-            for (i = 0; expanded_args[i] != NULL; i++) {
-                free(expanded_args[i]);
-            }
-            free(expanded_args);
+        if (stdout_copy != -1 && !output_flush(NULL)) {
+            set_last_exit_status(1);
+        }
+        reset_redirection(stdin_copy, stdout_copy, stderr_copy);
+        return result;
+    }
+
+    // Check for builtins, a compiled command name is already interned
+    if (expanded_flags && (expanded_flags[0] & HUSH_TOK_INTERNED) &&
+        clean_args[0] == expanded_args[0]) {
+        i = find_interned_builtin(clean_args[0]);
+    } else {
+        i = find_builtin(clean_args[0]);
+    }
+    if (i >= 0)
+    {
+        // Builtins succeed unless they report otherwise
+        set_last_exit_status(0);
+        if (assigns) {
+            push_assignment_scope(assigns);
+        }
+        result = (*builtin_func[i])(clean_args);
+        if (assigns) {
+            pop_variable_scope();
+        }
 
-            return result;
+        // Buffered output only fails once it is flushed to the redirection
+        if (stdout_copy != -1 && !output_flush(clean_args[0])) {
+            set_last_exit_status(1);
         }
+        reset_redirection(stdin_copy, stdout_copy, stderr_copy);
+
+        return result;
     }
 
-    // Reset redirection since we're about to launch a new process
+    // If not a builtin, launch the program with the redirections already in
+    // place and the prefix assignments only in its environment
+    set_environment_overlay(assigns);
+    result = hush_launch(clean_args);
+    set_environment_overlay(NULL);
+
+    // Restore the shell's own file descriptors
     reset_redirection(stdin_copy, stdout_copy, stderr_copy);
 
-    // Free the clean_args if we created a new array
-    if (clean_args != expanded_args) {
-        free(clean_args);
-    }
+    // The exit status goes to $?, the shell itself keeps running
+    set_last_exit_status(result < 0 ? 1 : result);
+    return 1;
+}
 
-    // If not a builtin, launch the program with expanded args
-    result = hush_launch(expanded_args);
+// Run a simple command from expanded fields
+int execute_fields(char **args, unsigned int *flags, char **assigns) {
+    char **expanded_args = expand_aliases_flags(args, &flags);
 
-    // Free the expanded args
-    if (expanded_args != args) {
-            for (i = 0; expanded_args[i] != NULL; i++) {
-                free(expanded_args[i]);
-            }
-            free(expanded_args);
-        }
-    set_last_exit_status(result);
-    return result;
+    return execute_simple(expanded_args, flags, assigns);
 }
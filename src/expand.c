@@ -0,0 +1,1204 @@
+#include "expand.h"
+#include "variables.h"
+#include "command_sub.h"
+#include "arena.h"
+#include "intern.h"
+#include "pattern.h"
+#include "arith.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Characters a backslash makes literal in a glob pattern and in an
+// extended regular expression
+#define GLOB_SPECIAL "*?[]\\"
+#define REGEX_SPECIAL "\\.[]()*+?{}|^$"
+
+int expansion_failed = 0;
+
+// An expansion failed after printing why, the command must not run
+static void expansion_error(void) {
+    expansion_failed = 1;
+    set_last_exit_status(1);
+}
+
+// Fields produced while expanding a command's words, all in the arena
+typedef struct {
+    char **fields;
+    unsigned int *flags;
+    int count;
+    int capacity;
+
+    // The field being built
+    char *buf;
+    size_t len;
+    size_t cap;
+    int started;              // Field exists even if empty (e.g. "")
+    int no_elements;          // A quoted "$@" or "${name[@]}" was empty
+    unsigned int cur_flags;   // Quoting and glob flags of the current field
+
+    const char *ifs;          // Field separators for unquoted expansions
+    int split;                // Zero to keep unquoted expansions whole
+    const char *special;      // Building a pattern: quoted characters in this set are escaped
+} FieldList;
+
+static void field_list_init(FieldList *fl, int split) {
+    fl->fields = NULL;
+    fl->flags = NULL;
+    fl->count = 0;
+    fl->capacity = 0;
+    fl->buf = NULL;
+    fl->len = 0;
+    fl->cap = 0;
+    fl->started = 0;
+    fl->no_elements = 0;
+    fl->cur_flags = 0;
+    fl->split = split;
+    fl->special = NULL;
+
+    // IFS unset means the default, IFS empty means no splitting
+    // A ${IFS:=...} during expansion could free the value, so anything but
+    // the default is copied
+    VarView ifs;
+    if (!split) {
+        fl->ifs = NULL;
+    } else if (!lookup_variable("IFS", 3, &ifs) || strcmp(ifs.ptr, " \t\n") == 0) {
+        fl->ifs = " \t\n";
+    } else {
+        fl->ifs = arena_strndup(ifs.ptr, ifs.len);
+    }
+}
+
+// Append bytes to the current field
+static void field_append(FieldList *fl, const char *s, size_t n) {
+    if (fl->len + n > fl->cap) {
+        size_t cap = fl->cap ? fl->cap : 64;
+        while (fl->len + n > cap) {
+            cap *= 2;
+        }
+        fl->buf = arena_grow(fl->buf, fl->cap, cap);
+        fl->cap = cap;
+    }
+    if (n > 0) {
+        memcpy(fl->buf + fl->len, s, n);
+        fl->len += n;
+    }
+    fl->started = 1;
+}
+
+static void field_putc(FieldList *fl, char c) {
+    field_append(fl, &c, 1);
+}
+
+// Append quoted text, which a pattern must take literally
+static void field_append_quoted(FieldList *fl, const char *s, size_t n) {
+    if (!fl->special) {
+        field_append(fl, s, n);
+        return;
+    }
+    size_t start = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] && strchr(fl->special, s[i])) {
+            field_append(fl, s + start, i - start);
+            field_putc(fl, '\\');
+            start = i;
+        }
+    }
+    field_append(fl, s + start, n - start);
+}
+
+static void field_putc_quoted(FieldList *fl, char c) {
+    field_append_quoted(fl, &c, 1);
+}
+
+// Push a finished field onto the list
+static void field_push(FieldList *fl, char *text, unsigned int flags) {
+    if (fl->count + 1 >= fl->capacity) {
+        int capacity = fl->capacity ? fl->capacity * 2 : 8;
+        fl->fields = arena_grow(fl->fields, fl->capacity * sizeof(char *),
+                                capacity * sizeof(char *));
+        fl->flags = arena_grow(fl->flags, fl->capacity * sizeof(unsigned int),
+                               capacity * sizeof(unsigned int));
+        fl->capacity = capacity;
+    }
+    fl->fields[fl->count] = text;
+    fl->flags[fl->count] = flags;
+    fl->count++;
+}
+
+// Finish the current field if one was started
+// The buffer itself becomes the field, trimmed when nothing followed it
+static void field_end(FieldList *fl) {
+    if (!fl->started) {
+        return;
+    }
+    field_append(fl, "", 1);
+    char *text = arena_grow(fl->buf, fl->cap, fl->len);
+    field_push(fl, text, fl->cur_flags);
+
+    fl->buf = NULL;
+    fl->cap = 0;
+    fl->len = 0;
+    fl->started = 0;
+    fl->cur_flags = 0;
+}
+
+static int is_glob_char(char c) {
+    return c == '*' || c == '?' || c == '[' || c == '{';
+}
+
+// Glob flag for a piece of unquoted text
+static unsigned int glob_flags(const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (is_glob_char(s[i])) {
+            return HUSH_TOK_GLOB;
+        }
+    }
+    return 0;
+}
+
+// Append the result of an expansion, splitting it unless quoted
+static void field_append_expansion(FieldList *fl, const char *value, size_t len, int quoted) {
+    if (!value) {
+        return;
+    }
+    if (quoted || !fl->split || !fl->ifs || !*fl->ifs) {
+        if (quoted) {
+            field_append_quoted(fl, value, len);
+        } else {
+            field_append(fl, value, len);
+        }
+        if (!quoted) {
+            fl->cur_flags |= glob_flags(value, len);
+        }
+        return;
+    }
+
+    // Copy runs between separators whole
+    size_t start = 0;
+    for (size_t i = 0; i <= len; i++) {
+        if (i < len && !strchr(fl->ifs, value[i])) {
+            continue;
+        }
+        if (i > start) {
+            field_append(fl, value + start, i - start);
+            fl->cur_flags |= glob_flags(value + start, i - start);
+        }
+        if (i < len) {
+            field_end(fl);
+        }
+        start = i + 1;
+    }
+}
+
+// Make text at the end of an arena buffer the current field, no copy
+// The byte after it must be free, so the field can be terminated there
+static void field_adopt(FieldList *fl, char *text, size_t n, unsigned int flags) {
+    fl->buf = text;
+    fl->len = n;
+    fl->cap = n + 1;
+    fl->started = 1;
+    fl->cur_flags |= flags;
+}
+
+// Finish the current field, which is still empty, with text as it is
+static void field_end_with(FieldList *fl, char *text, unsigned int flags) {
+    field_push(fl, text, fl->cur_flags | flags);
+
+    fl->buf = NULL;
+    fl->cap = 0;
+    fl->len = 0;
+    fl->started = 0;
+    fl->cur_flags = 0;
+}
+
+// Append command output, which is in the arena and is split in place
+// Fields the output starts are pointed into it instead of being copied
+static void field_append_output(FieldList *fl, char *out, size_t n, int quoted) {
+    // Arguments cannot hold NUL bytes, drop them like other shells do
+    char *nul = memchr(out, '\0', n);
+    if (nul) {
+        size_t kept = nul - out;
+        for (size_t i = kept + 1; i < n; i++) {
+            if (out[i]) {
+                out[kept++] = out[i];
+            }
+        }
+        n = kept;
+        out[n] = '\0';
+    }
+
+    if (quoted || !fl->split || !fl->ifs || !*fl->ifs) {
+        unsigned int flags = quoted ? 0 : glob_flags(out, n);
+        if (quoted && fl->special) {
+            field_append_quoted(fl, out, n);
+        } else if (fl->len == 0 && n > 0) {
+            field_adopt(fl, out, n, flags);
+        } else {
+            field_append(fl, out, n);
+            fl->cur_flags |= flags;
+        }
+        return;
+    }
+
+    size_t start = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!strchr(fl->ifs, out[i])) {
+            continue;
+        }
+        if (i > start && fl->len == 0) {
+            out[i] = '\0';
+            field_end_with(fl, out + start, glob_flags(out + start, i - start));
+        } else {
+            if (i > start) {
+                field_append(fl, out + start, i - start);
+                fl->cur_flags |= glob_flags(out + start, i - start);
+            }
+            field_end(fl);
+        }
+        start = i + 1;
+    }
+
+    // The rest continues into whatever follows the substitution
+    if (start < n) {
+        unsigned int flags = glob_flags(out + start, n - start);
+        if (fl->len == 0) {
+            field_adopt(fl, out + start, n - start, flags);
+        } else {
+            field_append(fl, out + start, n - start);
+            fl->cur_flags |= flags;
+        }
+    }
+}
+
+// Run a command substitution and append its output
+static void expand_command(FieldList *fl, const char *command, size_t len, int quoted) {
+    // Nothing more runs once an expansion of the command failed
+    if (expansion_failed) {
+        return;
+    }
+
+    char *cmd = arena_strndup(command, len);
+
+    size_t n;
+    char *output = capture_command_output(cmd, &n);
+    field_append_output(fl, output, n, quoted);
+}
+
+// The command inside a backtick substitution starting at t[i]
+// Sets *end past the closing backtick and *len to the command's length
+static char *backtick_command(const char *t, size_t i, size_t *end, size_t *len) {
+    *end = lex_skip_backtick(t, i);
+    size_t close = (t[*end - 1] == '`' && *end - 1 > i) ? *end - 1 : *end;
+
+    // Undo the backslash escapes that protected the inner command
+    char *cmd = arena_alloc(close - i + 1);
+    size_t n = 0;
+    for (size_t j = i + 1; j < close; j++) {
+        if (t[j] == '\\' && j + 1 < close && (t[j + 1] == '`' || t[j + 1] == '\\' || t[j + 1] == '$')) {
+            j++;
+        }
+        cmd[n++] = t[j];
+    }
+    cmd[n] = '\0';
+    *len = n;
+    return cmd;
+}
+
+// Expand a backtick substitution, t[*i] is the opening backtick
+static void expand_backtick(FieldList *fl, const char *t, size_t *i, int quoted) {
+    size_t end, n;
+    char *cmd = backtick_command(t, *i, &end, &n);
+
+    expand_command(fl, cmd, n, quoted);
+    *i = end;
+}
+
+static void expand_range(FieldList *fl, const char *t, size_t i, size_t end);
+static size_t expand_dquoted(FieldList *fl, const char *t, size_t i, size_t end);
+static void expand_dollar(FieldList *fl, const char *t, size_t *i, int quoted);
+
+// Expand the word of a ${name op word} in the current quoting context
+static void expand_argument(FieldList *fl, const char *t, size_t start, size_t end, int quoted) {
+    if (!quoted) {
+        expand_range(fl, t, start, end);
+        return;
+    }
+
+    // Inside double quotes, quotes in the word only group
+    size_t i = start;
+    while (i < end) {
+        i = expand_dquoted(fl, t, i, end);
+        if (i < end) {
+            i++;
+        }
+    }
+}
+
+// Expand the word of a ${name op word} to one string in the arena
+static char *expand_argument_string(const char *t, size_t start, size_t end, int quoted) {
+    FieldList sub;
+    field_list_init(&sub, 0);
+
+    expand_argument(&sub, t, start, end, quoted);
+    field_end(&sub);
+
+    return sub.count > 0 ? sub.fields[0] : "";
+}
+
+// Length of a parameter name at t[i]: an identifier, digits or one
+// special character
+static size_t parameter_name_length(const char *t, size_t i) {
+    size_t j = i;
+
+    if (isalpha((unsigned char)t[i]) || t[i] == '_') {
+        while (isalnum((unsigned char)t[j]) || t[j] == '_') {
+            j++;
+        }
+    } else if (isdigit((unsigned char)t[i])) {
+        while (isdigit((unsigned char)t[j])) {
+            j++;
+        }
+    } else if (t[i] && strchr("?$!#@*", t[i])) {
+        j++;
+    }
+    return j - i;
+}
+
+// Check for $@ or $*, the positional parameters as a whole
+static int is_all_args(const char *name, size_t n) {
+    return n == 1 && (name[0] == '@' || name[0] == '*');
+}
+
+// A pattern, substring or case operator applied to a value
+typedef struct {
+    char kind;              // # % / : ^ , or NUL for none
+    int longest;            // ## %% // ^^ ,,
+    char anchor;            // # or % of ${v/#p/r} and ${v/%p/r}
+    Pattern *pattern;       // NULL for none
+    const char *replacement;
+    long offset;
+    long length;
+    int has_length;
+} ValueOp;
+
+// Expand the pattern of a ${name op pattern}, quoted parts taken literally
+static char *expand_pattern_string(const char *t, size_t start, size_t end, size_t *len) {
+    FieldList sub;
+    field_list_init(&sub, 0);
+    sub.special = GLOB_SPECIAL;
+
+    expand_range(&sub, t, start, end);
+    field_end(&sub);
+
+    char *text = sub.count > 0 ? sub.fields[0] : "";
+    *len = strlen(text);
+    return text;
+}
+
+// Find stop at the top level of t[i..end), past quotes and expansions
+static size_t operand_end(const char *t, size_t i, size_t end, char stop) {
+    while (i < end) {
+        char c = t[i];
+        if (c == '\\') {
+            i += 2;
+        } else if (c == '\'') {
+            const char *q = memchr(t + i + 1, '\'', end - i - 1);
+            i = q ? (size_t)(q - t) + 1 : end;
+        } else if (c == '"') {
+            for (i++; i < end && t[i] != '"'; i++) {
+                if (t[i] == '\\') {
+                    i++;
+                }
+            }
+            i++;
+        } else if (c == '$' && (t[i + 1] == '{' || t[i + 1] == '(')) {
+            i = lex_skip_dollar(t, i);
+        } else if (c == '`') {
+            i = lex_skip_backtick(t, i);
+        } else if (c == stop) {
+            return i;
+        } else {
+            i++;
+        }
+    }
+    return end;
+}
+
+// Expand an offset or length, an arithmetic expression
+static long expand_number(const char *t, size_t start, size_t end) {
+    const char *text = expand_argument_string(t, start, end, 1);
+    int64_t value;
+    if (!arith_evaluate(text, &value)) {
+        expansion_error();
+        return 0;
+    }
+    return (long)value;
+}
+
+// Check for a pattern, substring or case operator at t[p]
+static int is_value_op(const char *t, size_t p) {
+    if (t[p] == ':') {
+        return !strchr("-=+?", t[p + 1]);
+    }
+    return t[p] && strchr("#%/^,", t[p]) != NULL;
+}
+
+// Parse and expand the operator at t[p], up to close
+static void parse_value_op(const char *t, size_t p, size_t close, int quoted, ValueOp *op) {
+    size_t n;
+    char *text;
+
+    memset(op, 0, sizeof(*op));
+    op->kind = t[p++];
+
+    switch (op->kind) {
+        case '#':
+        case '%':
+        case '^':
+        case ',':
+            if (t[p] == op->kind) {
+                op->longest = 1;
+                p++;
+            }
+            // Case conversion without a pattern applies to every character
+            if (p < close || op->kind == '#' || op->kind == '%') {
+                text = expand_pattern_string(t, p, close, &n);
+                op->pattern = pattern_compile(text, n);
+            }
+            break;
+
+        case '/': {
+            if (t[p] == '/') {
+                op->longest = 1;
+                p++;
+            } else if (t[p] == '#' || t[p] == '%') {
+                op->anchor = t[p++];
+            }
+            size_t slash = operand_end(t, p, close, '/');
+            text = expand_pattern_string(t, p, slash, &n);
+            op->pattern = pattern_compile(text, n);
+            op->replacement = slash < close ? expand_argument_string(t, slash + 1, close, quoted) : "";
+            break;
+        }
+
+        case ':': {
+            size_t colon = operand_end(t, p, close, ':');
+            op->offset = expand_number(t, p, colon);
+            if (colon < close) {
+                op->has_length = 1;
+                op->length = expand_number(t, colon + 1, close);
+            }
+            break;
+        }
+    }
+}
+
+// Replace matches of the pattern, building the result in the arena
+static const char *substitute(const ValueOp *op, const char *s, size_t len, size_t *out_len) {
+    const Pattern *pattern = op->pattern;
+    FieldList out;
+    field_list_init(&out, 0);
+
+    size_t rest = 0;
+    if (op->anchor == '#') {
+        long n = pattern_match_prefix(pattern, s, len, 1);
+        if (n < 0) {
+            *out_len = len;
+            return s;
+        }
+        field_append(&out, op->replacement, strlen(op->replacement));
+        rest = (size_t)n;
+    } else if (op->anchor == '%') {
+        long start = pattern_match_suffix(pattern, s, len, 1);
+        if (start < 0) {
+            *out_len = len;
+            return s;
+        }
+        field_append(&out, s, (size_t)start);
+        field_append(&out, op->replacement, strlen(op->replacement));
+        rest = len;
+    } else {
+        size_t match_len;
+        long start;
+        while (rest < len && (start = pattern_search(pattern, s + rest, len - rest, &match_len)) >= 0) {
+            field_append(&out, s + rest, (size_t)start);
+            field_append(&out, op->replacement, strlen(op->replacement));
+            rest += (size_t)start + match_len;
+            if (!op->longest) {
+                break;
+            }
+        }
+        if (rest == 0) {
+            *out_len = len;
+            return s;
+        }
+    }
+    field_append(&out, s + rest, len - rest);
+    *out_len = out.len;
+    field_end(&out);
+    return out.fields[0];
+}
+
+// Apply an operator to a value, returning the result and its length
+// Removals and substrings point into the value, nothing is copied
+static const char *apply_value_op(const ValueOp *op, const char *s, size_t len, size_t *out_len) {
+    switch (op->kind) {
+        case '#': {
+            long n = pattern_match_prefix(op->pattern, s, len, op->longest);
+            if (n > 0) {
+                s += n;
+                len -= (size_t)n;
+            }
+            break;
+        }
+
+        case '%': {
+            long start = pattern_match_suffix(op->pattern, s, len, op->longest);
+            if (start >= 0) {
+                len = (size_t)start;
+            }
+            break;
+        }
+
+        case '/':
+            return substitute(op, s, len, out_len);
+
+        case ':': {
+            // Negative offsets count from the end, a negative length
+            // leaves that many characters off the end
+            long offset = op->offset < 0 ? (long)len + op->offset : op->offset;
+            if (offset < 0 || offset > (long)len) {
+                offset = (long)len;
+            }
+            long end = (long)len;
+            if (op->has_length) {
+                end = op->length < 0 ? (long)len + op->length : offset + op->length;
+                if (end > (long)len) {
+                    end = (long)len;
+                }
+                if (end < offset) {
+                    end = offset;
+                }
+            }
+            s += offset;
+            len = (size_t)(end - offset);
+            break;
+        }
+
+        case '^':
+        case ',': {
+            char *copy = arena_strndup(s, len);
+            for (size_t i = 0; i < len; i++) {
+                if (!op->pattern || pattern_match(op->pattern, copy + i, 1)) {
+                    copy[i] = (char)(op->kind == '^' ? toupper((unsigned char)copy[i])
+                                                     : tolower((unsigned char)copy[i]));
+                }
+                // ^ and , only look at the first character
+                if (!op->longest) {
+                    break;
+                }
+            }
+            s = copy;
+            break;
+        }
+    }
+    *out_len = len;
+    return s;
+}
+
+// State for expanding every element of an array
+typedef struct {
+    FieldList *fl;
+    int quoted;
+    int keys;        // ${!name[@]}: the keys instead of the values
+    int join;        // Elements share one field, separated by sep
+    char sep;        // NUL for none
+    int first;
+    const ValueOp *op;
+} ElementExpansion;
+
+static void expand_element(VarView key, VarView value, void *data) {
+    ElementExpansion *e = data;
+    VarView *v = e->keys ? &key : &value;
+
+    if (!e->first) {
+        if (!e->join) {
+            field_end(e->fl);
+        } else if (e->sep) {
+            field_putc(e->fl, e->sep);
+        }
+    }
+    e->first = 0;
+
+    // "${name[@]}" keeps empty elements as empty fields
+    if (e->quoted && !e->join) {
+        e->fl->started = 1;
+    }
+    if (e->op && !e->keys) {
+        size_t len;
+        const char *s = apply_value_op(e->op, v->ptr, v->len, &len);
+        field_append_expansion(e->fl, s, len, e->quoted);
+    } else {
+        field_append_expansion(e->fl, v->ptr, v->len, e->quoted);
+    }
+}
+
+// Expand all elements of an array: "${name[@]}" gives a field per element,
+// "${name[*]}" one field joined with the first IFS character and the
+// unquoted forms are split like any other expansion. An operator, when
+// given, applies to each element.
+static void expand_elements(FieldList *fl, const char *name, size_t n, char mode, int keys, int quoted,
+                            const ValueOp *op) {
+    ElementExpansion e = { fl, quoted, keys, 0, ' ', 1, op };
+
+    if (mode == '*' && quoted) {
+        VarView ifs;
+        e.join = 1;
+        if (lookup_variable("IFS", 3, &ifs)) {
+            e.sep = ifs.ptr[0];
+        }
+    } else if (!fl->split) {
+        // Nowhere to split to, as in an assignment
+        e.join = 1;
+    }
+    if (for_each_element(name, n, expand_element, &e) == 0 && quoted && !e.join) {
+        fl->no_elements = 1;
+    }
+}
+
+// Find the ] closing the subscript that starts at t[i], or end
+static size_t subscript_end(const char *t, size_t i, size_t end) {
+    int depth = 0;
+    while (i < end) {
+        if (t[i] == '[') {
+            depth++;
+        } else if (t[i] == ']' && --depth == 0) {
+            return i;
+        } else if (t[i] == '\\' && i + 1 < end) {
+            i++;
+        } else if (t[i] == '$' && (t[i + 1] == '{' || t[i + 1] == '(')) {
+            i = lex_skip_dollar(t, i);
+            continue;
+        }
+        i++;
+    }
+    return end;
+}
+
+// Expand ${...} in one pass, t[start] is the $ and t[close] the }
+// Each form is evaluated once, and the word of :- := :+ :? only when used
+static void expand_brace(FieldList *fl, const char *t, size_t start, size_t close, int quoted) {
+    size_t p = start + 2;
+
+    // ${#name} is the length of the value, ${#} alone is $#
+    // ${#name[@]} counts the elements, ${#name[key]} is an element's length
+    // ${!name[@]} lists the keys
+    if ((t[p] == '#' || t[p] == '!') && p + 1 < close) {
+        char prefix = t[p];
+        size_t n = parameter_name_length(t, p + 1);
+        if (n == 0) {
+            goto bad;
+        }
+        const char *name = t + p + 1;
+        size_t q = p + 1 + n;
+        size_t len = 0;
+        VarView view;
+
+        if (q < close && t[q] == '[') {
+            size_t sub_end = subscript_end(t, q, close);
+            if (sub_end + 1 != close) {
+                goto bad;
+            }
+            int all = sub_end == q + 2 && (t[q + 1] == '@' || t[q + 1] == '*');
+            if (prefix == '!') {
+                if (!all) {
+                    goto bad;
+                }
+                expand_elements(fl, name, n, t[q + 1], 1, quoted, NULL);
+                return;
+            }
+            if (all && !is_all_args(name, n)) {
+                len = for_each_element(name, n, NULL, NULL);
+            } else if (!all) {
+                char *key = expand_argument_string(t, q + 1, sub_end, 1);
+                len = lookup_element(name, n, key, strlen(key), &view) ? view.len : 0;
+            }
+        } else if (prefix == '#' && q == close && is_all_args(name, n)) {
+            // ${#@} is $#
+            len = for_each_element(name, n, NULL, NULL);
+        } else if (prefix == '#' && q == close) {
+            len = lookup_variable(name, n, &view) ? view.len : 0;
+        } else {
+            goto bad;
+        }
+
+        char number[24];
+        int digits = snprintf(number, sizeof(number), "%zu", len);
+        field_append_expansion(fl, number, (size_t)digits, quoted);
+        return;
+    }
+
+    size_t n = parameter_name_length(t, p);
+    if (n == 0) {
+        goto bad;
+    }
+    const char *name = t + p;
+    p += n;
+
+    VarView view;
+    int is_set;
+    char *key = NULL;
+
+    // ${name[@]} and ${name[*]} expand every element, ${@} and ${*} every
+    // positional parameter, with a pattern, substring or case operator
+    // applied to each
+    // Other operators see them joined
+    char mode = is_all_args(name, n) && (p == close || is_value_op(t, p)) ? name[0] : 0;
+    if (!mode && t[p] == '[' && (isalpha((unsigned char)name[0]) || name[0] == '_')) {
+        size_t sub_end = subscript_end(t, p, close);
+        if (sub_end == close) {
+            goto bad;
+        }
+        if (sub_end == p + 2 && (t[p + 1] == '@' || t[p + 1] == '*')) {
+            mode = t[p + 1];
+        } else {
+            key = expand_argument_string(t, p + 1, sub_end, 1);
+        }
+        p = sub_end + 1;
+    }
+    if (mode) {
+        ValueOp op = { 0 };
+        if (p < close) {
+            if (!is_value_op(t, p)) {
+                goto bad;
+            }
+            parse_value_op(t, p, close, quoted, &op);
+        }
+        expand_elements(fl, name, n, mode, 0, quoted, op.kind ? &op : NULL);
+        pattern_free(op.pattern);
+        return;
+    }
+
+    // Operands are expanded before the value is looked up, since they may
+    // change it
+    ValueOp value_op = { 0 };
+    if (p < close && is_value_op(t, p)) {
+        parse_value_op(t, p, close, quoted, &value_op);
+    }
+    if (key) {
+        is_set = lookup_element(name, n, key, strlen(key), &view);
+    } else {
+        is_set = lookup_variable(name, n, &view);
+    }
+
+    if (value_op.kind) {
+        if (is_set) {
+            size_t len;
+            const char *s = apply_value_op(&value_op, view.ptr, view.len, &len);
+            field_append_expansion(fl, s, len, quoted);
+        }
+        pattern_free(value_op.pattern);
+        return;
+    }
+
+    if (p == close) {
+        if (is_set) {
+            field_append_expansion(fl, view.ptr, view.len, quoted);
+        }
+        return;
+    }
+
+    // With a colon an empty value counts as unset
+    int colon = t[p] == ':';
+    if (colon) {
+        p++;
+    }
+    char op = t[p];
+    if (!op || !strchr("-=+?", op)) {
+        goto bad;
+    }
+    p++;
+    int use_value = is_set && (!colon || view.len > 0);
+
+    switch (op) {
+        case '-':
+            if (use_value) {
+                field_append_expansion(fl, view.ptr, view.len, quoted);
+            } else {
+                expand_argument(fl, t, p, close, quoted);
+            }
+            return;
+
+        case '+':
+            if (use_value) {
+                expand_argument(fl, t, p, close, quoted);
+            }
+            return;
+
+        case '=':
+            if (use_value) {
+                field_append_expansion(fl, view.ptr, view.len, quoted);
+            } else if (!isalpha((unsigned char)name[0]) && name[0] != '_') {
+                fprintf(stderr, "hush: $%.*s: cannot assign in this way\n", (int)n, name);
+                expansion_error();
+            } else {
+                char *value = expand_argument_string(t, p, close, quoted);
+                if (key) {
+                    set_element(intern_n(name, n), key, strlen(key), value, strlen(value));
+                } else {
+                    set_interned_variable(intern_n(name, n), value);
+                }
+                field_append_expansion(fl, value, strlen(value), quoted);
+            }
+            return;
+
+        case '?':
+            if (use_value) {
+                field_append_expansion(fl, view.ptr, view.len, quoted);
+            } else {
+                const char *message = p < close ? expand_argument_string(t, p, close, quoted)
+                                                : "parameter null or not set";
+                fprintf(stderr, "hush: %.*s: %s\n", (int)n, name, message);
+                expansion_error();
+            }
+            return;
+    }
+
+bad:
+    fprintf(stderr, "hush: %.*s: bad substitution\n", (int)(close + 1 - start), t + start);
+    expansion_error();
+}
+
+// Expand $((expression)), the text between the double parens
+// Parameters and substitutions in it are expanded before it is evaluated.
+static void expand_arith(FieldList *fl, const char *expr, size_t len, int quoted) {
+    char *text = arena_strndup(expr, len);
+    if (strpbrk(text, "$`\\'\"")) {
+        text = expand_word_nosplit(text);
+    }
+
+    int64_t value;
+    if (!arith_evaluate(text, &value)) {
+        expansion_error();
+        return;
+    }
+    char number[ARITH_NUMBER_MAX];
+    field_append_expansion(fl, number, arith_format(value, number), quoted);
+}
+
+// Expand a $ expansion, t[*i] is the $
+static void expand_dollar(FieldList *fl, const char *t, size_t *i, int quoted) {
+    size_t start = *i;
+    char next = t[start + 1];
+
+    if (next == '(' && t[start + 2] == '(') {
+        // $((expression)), when the group closes with ))
+        size_t end = lex_skip_dollar(t, start);
+        if (t[end - 1] == ')' && t[end - 2] == ')' && end - 2 > start + 2) {
+            expand_arith(fl, t + start + 3, end - 2 - (start + 3), quoted);
+            *i = end;
+            return;
+        }
+    }
+
+    if (next == '(') {
+        // $(command)
+        size_t end = lex_skip_dollar(t, start);
+        size_t inner_end = (t[end - 1] == ')') ? end - 1 : end;
+        expand_command(fl, t + start + 2, inner_end - (start + 2), quoted);
+        *i = end;
+        return;
+    }
+
+    if (next == '{') {
+        // ${parameter...}
+        size_t end = lex_skip_dollar(t, start);
+        size_t close = (t[end - 1] == '}') ? end - 1 : end;
+        expand_brace(fl, t, start, close, quoted);
+        *i = end;
+        return;
+    }
+
+    // $name, a positional digit or a special parameter, looked up in place
+    size_t j = start + 1;
+
+    if (isalpha((unsigned char)next) || next == '_') {
+        while (isalnum((unsigned char)t[j]) || t[j] == '_') {
+            j++;
+        }
+    } else if (next == '@' || next == '*') {
+        expand_elements(fl, t + start + 1, 1, next, 0, quoted, NULL);
+        *i = start + 2;
+        return;
+    } else if (isdigit((unsigned char)next) || next == '?' || next == '$' ||
+               next == '!' || next == '#') {
+        j++;
+    } else {
+        // A lone $ is literal
+        field_putc(fl, '$');
+        *i = start + 1;
+        return;
+    }
+
+    VarView view;
+    if (lookup_variable(t + start + 1, j - (start + 1), &view)) {
+        field_append_expansion(fl, view.ptr, view.len, quoted);
+    }
+    *i = j;
+}
+
+// Expand double-quoted text from t[i] up to a closing quote or end
+// Returns the index of the closing quote, or end
+static size_t expand_dquoted(FieldList *fl, const char *t, size_t i, size_t end) {
+    while (i < end && t[i] != '"') {
+        if (t[i] == '\\' && (t[i + 1] == '$' || t[i + 1] == '`' ||
+                             t[i + 1] == '"' || t[i + 1] == '\\')) {
+            field_putc_quoted(fl, t[i + 1]);
+            i += 2;
+        } else if (t[i] == '\\' && t[i + 1] == '\n') {
+            i += 2;
+        } else if (t[i] == '$') {
+            expand_dollar(fl, t, &i, 1);
+        } else if (t[i] == '`') {
+            expand_backtick(fl, t, &i, 1);
+        } else {
+            field_putc_quoted(fl, t[i++]);
+        }
+    }
+    return i;
+}
+
+// Expand unquoted text t[i..end) into the field list
+static void expand_range(FieldList *fl, const char *t, size_t i, size_t end) {
+    while (i < end) {
+        char c = t[i];
+
+        if (c == '\\') {
+            if (i + 1 < end) {
+                field_putc_quoted(fl, t[i + 1]);
+                i += 2;
+            } else {
+                i++;
+            }
+        } else if (c == '\'') {
+            i++;
+            fl->started = 1;
+            while (i < end && t[i] != '\'') {
+                field_putc_quoted(fl, t[i++]);
+            }
+            if (i < end) {
+                i++;
+            }
+        } else if (c == '"') {
+            // "$@" with nothing to expand is no field at all, unless
+            // something else makes one
+            int started = fl->started;
+            size_t len = fl->len;
+            fl->started = 1;
+            fl->no_elements = 0;
+            i = expand_dquoted(fl, t, i + 1, end);
+            if (fl->no_elements && !started && fl->len == len) {
+                fl->started = 0;
+            }
+            if (i < end) {
+                i++;
+            }
+        } else if (c == '$') {
+            expand_dollar(fl, t, &i, 0);
+        } else if (c == '`') {
+            expand_backtick(fl, t, &i, 0);
+        } else {
+            if (is_glob_char(c)) {
+                fl->cur_flags |= HUSH_TOK_GLOB;
+            }
+            field_putc(fl, c);
+            i++;
+        }
+    }
+}
+
+// Expand one word into the field list
+static void expand_word_into(FieldList *fl, const char *t, unsigned int word_flags) {
+    size_t i = 0;
+
+    // Keep the quoting bits so later stages (aliases) can see them
+    fl->cur_flags = word_flags & HUSH_TOK_QUOTED;
+
+    // Tilde expansion at the start of an unquoted word
+    if (t[0] == '~' && (t[1] == '/' || t[1] == '\0')) {
+        VarView home;
+        if (lookup_variable("HOME", 4, &home)) {
+            field_append(fl, home.ptr, home.len);
+            i = 1;
+        }
+    }
+
+    expand_range(fl, t, i, strlen(t));
+    field_end(fl);
+}
+
+// Command substitutions found ahead of expansion
+typedef struct {
+    char **commands;
+    int count;
+    int capacity;
+} SubstList;
+
+static void subst_push(SubstList *list, char *command) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 8;
+        list->commands = arena_grow(list->commands, list->capacity * sizeof(char *),
+                                    capacity * sizeof(char *));
+        list->capacity = capacity;
+    }
+    list->commands[list->count++] = command;
+}
+
+// Collect a word's command substitutions in the order expand_word_into
+// reaches them. Returns 0 for a word with ${...}, which may assign a
+// variable that a later substitution depends on.
+static int scan_substitutions(const char *t, SubstList *list) {
+    int in_dquote = 0;
+    size_t i = 0;
+
+    while (t[i]) {
+        char c = t[i];
+
+        if (c == '\\') {
+            i += t[i + 1] ? 2 : 1;
+        } else if (c == '\'' && !in_dquote) {
+            i++;
+            while (t[i] && t[i] != '\'') {
+                i++;
+            }
+            if (t[i]) {
+                i++;
+            }
+        } else if (c == '"') {
+            in_dquote = !in_dquote;
+            i++;
+        } else if (c == '$' && t[i + 1] == '(' && t[i + 2] == '(') {
+            // Arithmetic can assign, like ${...}
+            return 0;
+        } else if (c == '$' && t[i + 1] == '(') {
+            size_t end = lex_skip_dollar(t, i);
+            size_t inner_end = (t[end - 1] == ')') ? end - 1 : end;
+            subst_push(list, arena_strndup(t + i + 2, inner_end - (i + 2)));
+            i = end;
+        } else if (c == '$' && t[i + 1] == '{') {
+            return 0;
+        } else if (c == '`') {
+            size_t end, n;
+            subst_push(list, backtick_command(t, i, &end, &n));
+            i = end;
+        } else {
+            i++;
+        }
+    }
+    return 1;
+}
+
+int expand_substitutions_early(const Word *words, int count, CaptureBatch *batch) {
+    SubstList list = { NULL, 0, 0 };
+    for (int i = 0; i < count; i++) {
+        if ((words[i].flags & (HUSH_TOK_EXPAND | HUSH_TOK_DQUOTED)) && !(words[i].flags & HUSH_TOK_OPERATOR) &&
+            !scan_substitutions(words[i].text, &list)) {
+            return 0;
+        }
+    }
+
+    // One substitution gains nothing from running early
+    if (list.count < 2) {
+        return 0;
+    }
+
+    VarView enabled;
+    if (!lookup_variable("HUSH_PARALLEL_SUBST", 19, &enabled) || enabled.len == 0 ||
+        (enabled.len == 1 && enabled.ptr[0] == '0')) {
+        return 0;
+    }
+
+    capture_batch_run(batch, list.commands, list.count);
+    return batch->count > 0;
+}
+
+char **expand_words(const Word *words, int count, unsigned int **flags) {
+    FieldList fl;
+    field_list_init(&fl, 1);
+
+    for (int i = 0; i < count && !expansion_failed; i++) {
+        if (words[i].flags & (HUSH_TOK_OPERATOR | HUSH_TOK_ARRAY)) {
+            // Redirection operators are kept for setup_redirection, array
+            // literals for the assignment that expands their elements
+            field_push(&fl, arena_strdup(words[i].text), words[i].flags);
+        } else if (!(words[i].flags & (HUSH_TOK_QUOTED | HUSH_TOK_EXPAND)) && words[i].text[0] != '~') {
+            // Nothing to expand, the word is its own field
+            field_push(&fl, arena_strdup(words[i].text), words[i].flags);
+        } else {
+            expand_word_into(&fl, words[i].text, words[i].flags);
+        }
+    }
+
+    if (expansion_failed) {
+        return NULL;
+    }
+
+    // Make sure there is room for the terminator even with no fields
+    field_push(&fl, NULL, 0);
+
+    if (flags) {
+        *flags = fl.flags;
+    }
+    return fl.fields;
+}
+
+char *expand_word_nosplit(const char *text) {
+    FieldList fl;
+    field_list_init(&fl, 0);
+
+    expand_word_into(&fl, text, 0);
+
+    return fl.count > 0 ? fl.fields[0] : arena_strdup("");
+}
+
+char *expand_pattern_word(const char *text, int regex) {
+    FieldList fl;
+    field_list_init(&fl, 0);
+    fl.special = regex ? REGEX_SPECIAL : GLOB_SPECIAL;
+
+    expand_word_into(&fl, text, 0);
+
+    return fl.count > 0 ? fl.fields[0] : arena_strdup("");
+}
+
+char *expand_assignment(const char *text) {
+    size_t name_len = strcspn(text, "=");
+
+    // The subscript of NAME[key]=value is expanded too, before the value
+    const char *bracket = memchr(text, '[', name_len);
+    const char *key = NULL;
+    size_t base_len = name_len;
+    size_t key_len = 0;
+    if (bracket && text[name_len - 1] == ']') {
+        base_len = (size_t)(bracket - text) + 1;
+        key = expand_word_nosplit(arena_strndup(bracket + 1, name_len - base_len - 1));
+        key_len = strlen(key);
+    }
+    const char *value = expand_word_nosplit(text + name_len + 1);
+
+    size_t value_len = strlen(value);
+    char *result = arena_alloc(name_len + key_len + value_len + 3);
+    char *out = result;
+    memcpy(out, text, base_len);
+    out += base_len;
+    if (key) {
+        memcpy(out, key, key_len);
+        out += key_len;
+        *out++ = ']';
+    }
+    *out++ = '=';
+    memcpy(out, value, value_len + 1);
+    return result;
+}
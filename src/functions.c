@@ -0,0 +1,191 @@
+#include "functions.h"
+#include "arena.h"
+#include "parser.h"
+#include "vm.h"
+#include "variables.h"
+#include "launch.h"
+#include "intern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+int function_returning = 0;
+
+// Open-addressing table keyed by the interned name pointer, with linear
+// probing; a NULL name marks an empty slot
+static ShellFunction *functions = NULL;
+static size_t function_capacity = 0;   // Always a power of two
+static size_t function_count = 0;
+
+static int call_depth = 0;
+
+static size_t hash_name(const char *name) {
+    uint64_t x = (uint64_t)(uintptr_t)name;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+// Find the slot of an interned name, or the empty slot where it goes
+static ShellFunction *find_slot(const char *name) {
+    size_t mask = function_capacity - 1;
+    size_t i = hash_name(name) & mask;
+
+    while (functions[i].name && functions[i].name != name) {
+        i = (i + 1) & mask;
+    }
+    return &functions[i];
+}
+
+static void release_body(FunctionBody *body) {
+    if (body && --body->refs == 0) {
+        free_program(body->prog);
+        free(body);
+    }
+}
+
+// Double the table
+static void grow_table(void) {
+    ShellFunction *old = functions;
+    size_t old_capacity = function_capacity;
+
+    function_capacity = old_capacity ? old_capacity * 2 : 32;
+    functions = calloc(function_capacity, sizeof(ShellFunction));
+    if (!functions) {
+        alloc_error();
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].name) {
+            *find_slot(old[i].name) = old[i];
+        }
+    }
+    free(old);
+}
+
+int define_function(const char *name, const char *body) {
+    AstNode *root = parse_line(body);
+    if (!root) {
+        return 0;
+    }
+    FunctionBody *compiled = malloc(sizeof(FunctionBody));
+    if (!compiled) {
+        alloc_error();
+    }
+    compiled->prog = compile_program(root);
+    compiled->refs = 1;
+    free_ast(root);
+
+    if ((function_count + 1) * 2 > function_capacity) {
+        grow_table();
+    }
+
+    name = intern(name);
+    ShellFunction *fn = find_slot(name);
+    if (fn->name) {
+        // A call still running the old body keeps it alive until it returns
+        release_body(fn->body);
+    } else {
+        function_count++;
+    }
+    fn->name = name;
+    fn->body = compiled;
+    return 1;
+}
+
+ShellFunction *find_function(const char *name) {
+    if (function_count == 0) {
+        return NULL;
+    }
+    name = intern_find(name);
+    if (!name) {
+        return NULL;
+    }
+    ShellFunction *fn = find_slot(name);
+    return fn->name ? fn : NULL;
+}
+
+int remove_function(const char *name) {
+    ShellFunction *fn = find_function(name);
+    if (!fn) {
+        return 0;
+    }
+    release_body(fn->body);
+    function_count--;
+
+    // Shift later entries of the probe run back so no lookup stops early
+    size_t mask = function_capacity - 1;
+    size_t i = (size_t)(fn - functions);
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!functions[j].name) {
+            break;
+        }
+        size_t home = hash_name(functions[j].name) & mask;
+        int movable = (j > i) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable) {
+            functions[i] = functions[j];
+            i = j;
+        }
+    }
+    functions[i].name = NULL;
+    functions[i].body = NULL;
+    return 1;
+}
+
+int call_function(ShellFunction *fn, char **args) {
+    if (call_depth >= FUNCTION_DEPTH_MAX) {
+        fprintf(stderr, "hush: %s: maximum function nesting level exceeded (%d)\n",
+                args[0], FUNCTION_DEPTH_MAX);
+        set_last_exit_status(1);
+        return 1;
+    }
+
+    FunctionBody *body = fn->body;
+    body->refs++;
+    call_depth++;
+
+    // A subshell that was going to exec its last command still has the
+    // function's commands to run
+    int in_place = launch_in_place;
+    launch_in_place = 0;
+
+    ScriptArgs saved = replace_script_args(args);
+    push_variable_scope();
+
+    int result = vm_execute(body->prog);
+    function_returning = 0;
+
+    pop_variable_scope();
+    restore_script_args(saved);
+    launch_in_place = in_place;
+
+    call_depth--;
+    release_body(body);
+    return result;
+}
+
+// Built-in: return
+int hush_return(char **args) {
+    if (call_depth == 0) {
+        fprintf(stderr, "hush: return: can only `return' from a function\n");
+        set_last_exit_status(1);
+        return 1;
+    }
+
+    int status = get_last_exit_status();
+    if (args[1]) {
+        char *end;
+        long value = strtol(args[1], &end, 10);
+        if (*args[1] == '\0' || *end != '\0') {
+            fprintf(stderr, "hush: return: %s: numeric argument required\n", args[1]);
+            value = 2;
+        }
+        status = (int)(value & 0xff);
+    }
+    set_last_exit_status(status);
+    function_returning = 1;
+    return 1;
+}
@@ -1,4 +1,6 @@
 #include "glob.h"
+#include "lexer.h"
+#include "arena.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -10,7 +12,7 @@
 #include <libgen.h>
 #include <limits.h>
 
-// Vector for matches
+// Vector for matches, allocated in the command arena
 typedef struct {
     char **items;
     int count;
@@ -18,31 +20,23 @@ typedef struct {
 } match_vector;
 
 static void vector_init(match_vector *v) {
-    v->items = malloc(10 * sizeof(char *));
+    v->items = arena_alloc(10 * sizeof(char *));
     v->count = 0;
     v->capacity = 10;
 }
 
-static void vector_add(match_vector *v, const char *item) {
+// Add a string the vector can share
+static void vector_push(match_vector *v, char *item) {
     if (v->count >= v->capacity) {
+        v->items = arena_grow(v->items, v->capacity * sizeof(char *),
+                              v->capacity * 2 * sizeof(char *));
         v->capacity *= 2;
-        v->items = realloc(v->items, v->capacity * sizeof(char *));
     }
-    v->items[v->count++] = strdup(item);
-}
-
-static void vector_free(match_vector *v) {
-    free(v->items);
-    v->items = NULL;
-    v->count = v->capacity = 0;
+    v->items[v->count++] = item;
 }
 
-// Free a list of strings
-static void free_string_array(char **array, int count) {
-    for (int i = 0; i < count; i++) {
-        free(array[i]);
-    }
-    free(array);
+static void vector_add(match_vector *v, const char *item) {
+    vector_push(v, arena_strdup(item));
 }
 
 // Check if a pattern contains globbing characters
@@ -85,8 +79,8 @@ static char **expand_braces(const char *pattern, int *count) {
     if (!open) {
         // No braces to expand
         *count = 1;
-        char **result = malloc(sizeof(char *));
-        result[0] = strdup(pattern);
+        char **result = arena_alloc(sizeof(char *));
+        result[0] = arena_strdup(pattern);
         return result;
     }
 
@@ -108,8 +102,8 @@ static char **expand_braces(const char *pattern, int *count) {
     if (!close) {
         // No matching closing brace
         *count = 1;
-        char **result = malloc(sizeof(char *));
-        result[0] = strdup(pattern);
+        char **result = arena_alloc(sizeof(char *));
+        result[0] = arena_strdup(pattern);
         return result;
     }
 
@@ -150,17 +144,12 @@ static char **expand_braces(const char *pattern, int *count) {
         char **sub_patterns = expand_braces(new_pattern, &sub_count);
 
         for (int j = 0; j < sub_count; j++) {
-            vector_add(&results, sub_patterns[j]);
+            vector_push(&results, sub_patterns[j]);
         }
-
-        free_string_array(sub_patterns, sub_count);
     }
 
     *count = results.count;
-    char **result = results.items;
-
-    vector_free(&options);
-    return result;
+    return results.items;
 }
 
 // Get all matching files in a directory for a pattern
@@ -231,7 +220,7 @@ static char **process_glob_pattern(const char *pattern, int *count) {
 
     // Handle special case for ** recursive glob
     if (strstr(pattern, "**") != NULL) {
-        char *dir_part = strdup(pattern);
+        char *dir_part = arena_strdup(pattern);
         char *star_pos = strstr(dir_part, "**");
 
         // Extract the directory part before **
@@ -246,10 +235,9 @@ static char **process_glob_pattern(const char *pattern, int *count) {
 
         // Recursively traverse directories
         traverse_directories(dir_path, file_pattern, &matches);
-        free(dir_part);
     } else {
         // Extract directory and file parts
-        char *pattern_copy = strdup(pattern);
+        char *pattern_copy = arena_strdup(pattern);
         char *dir_path = ".";
         char *file_pattern = pattern_copy;
 
@@ -263,7 +251,6 @@ static char **process_glob_pattern(const char *pattern, int *count) {
 
         // Match files in the directory
         match_files_in_dir(dir_path, file_pattern, &matches);
-        free(pattern_copy);
     }
 
     // If no matches found, return the original pattern
@@ -291,88 +278,74 @@ char **expand_wildcard(char *pattern, int *count) {
             char **glob_matches = process_glob_pattern(brace_expanded[i], &glob_count);
 
             for (int j = 0; j < glob_count; j++) {
-                vector_add(&all_matches, glob_matches[j]);
+                vector_push(&all_matches, glob_matches[j]);
             }
-
-            free_string_array(glob_matches, glob_count);
         } else {
-            vector_add(&all_matches, brace_expanded[i]);
+            vector_push(&all_matches, brace_expanded[i]);
         }
     }
 
-    free_string_array(brace_expanded, brace_count);
-
     *count = all_matches.count;
     return all_matches.items;
 }
 
-// Expand all arguments that contain wildcards
-char **expand_wildcards(char **args) {
-    if (!args || !args[0]) {
-        return args;
-    }
-
+// Expand wildcards using the lexer flags to decide which arguments glob
+char **expand_wildcards_flags(char **args, const unsigned int *flags, unsigned int **out_flags) {
     // Count the original arguments
     int arg_count = 0;
-    while (args[arg_count] != NULL) {
+    while (args && args[arg_count] != NULL) {
         arg_count++;
     }
 
     // Initial capacity for expanded args
-    int capacity = arg_count * 2;
-    char **expanded_args = malloc(capacity * sizeof(char *));
-    if (!expanded_args) {
-        perror("hush: allocation error");
-        exit(EXIT_FAILURE);
+    int capacity = arg_count * 2 + 1;
+    char **expanded_args = arena_alloc(capacity * sizeof(char *));
+    unsigned int *expanded_flags = NULL;
+    if (out_flags) {
+        expanded_flags = arena_alloc(capacity * sizeof(unsigned int));
     }
 
     // Process each argument
     int expanded_count = 0;
     for (int i = 0; i < arg_count; i++) {
-        // Skip empty arguments
-        if (!args[i] || args[i][0] == '\0') {
+        // Skip empty arguments, unless they were quoted on purpose
+        if (!args[i] || (args[i][0] == '\0' && !(flags && (flags[i] & HUSH_TOK_QUOTED)))) {
             continue;
         }
 
-        // Check if this argument has wildcards
-        if (has_wildcards(args[i])) {
-            int match_count;
-            char **matches = expand_wildcard(args[i], &match_count);
-
-            // Ensure we have enough capacity
-            if (expanded_count + match_count >= capacity) {
-                capacity = (expanded_count + match_count) * 2;
-                expanded_args = realloc(expanded_args, capacity * sizeof(char *));
-                if (!expanded_args) {
-                    perror("hush: allocation error");
-                    exit(EXIT_FAILURE);
-                }
-            }
+        // The lexer already knows whether an unquoted glob character is present
+        int globbing = flags ? (flags[i] & HUSH_TOK_GLOB) != 0 : has_wildcards(args[i]);
 
-            // Add the matches to our result
-            for (int j = 0; j < match_count; j++) {
-                expanded_args[expanded_count++] = matches[j];
-            }
+        int match_count = 1;
+        char **matches = globbing ? expand_wildcard(args[i], &match_count) : &args[i];
 
-            // Free the matches array (but not the strings)
-            free(matches);
-        } else {
-            // No wildcards, just copy the argument
-            if (expanded_count >= capacity) {
-                capacity *= 2;
-                expanded_args = realloc(expanded_args, capacity * sizeof(char *));
-                if (!expanded_args) {
-                    perror("hush: allocation error");
-                    exit(EXIT_FAILURE);
-                }
+        // Ensure we have enough capacity, keeping room for the terminator
+        if (expanded_count + match_count >= capacity) {
+            int new_capacity = (expanded_count + match_count) * 2;
+            expanded_args = arena_grow(expanded_args, capacity * sizeof(char *),
+                                       new_capacity * sizeof(char *));
+            if (expanded_flags) {
+                expanded_flags = arena_grow(expanded_flags, capacity * sizeof(unsigned int),
+                                            new_capacity * sizeof(unsigned int));
             }
+            capacity = new_capacity;
+        }
 
-            expanded_args[expanded_count++] = strdup(args[i]);
+        // The words are shared, they all live until the command finishes
+        for (int j = 0; j < match_count; j++) {
+            if (expanded_flags) {
+                expanded_flags[expanded_count] = (!globbing && flags) ? flags[i] : 0;
+            }
+            expanded_args[expanded_count++] = matches[j];
         }
     }
 
     // Null-terminate the result
     expanded_args[expanded_count] = NULL;
+    if (expanded_flags) {
+        expanded_flags[expanded_count] = 0;
+        *out_flags = expanded_flags;
+    }
 
     return expanded_args;
 }
@@ -0,0 +1,415 @@
+#include "input.h"
+#include "arena.h"
+#include "variables.h"
+#include "lexer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// What standard input turned out to be
+typedef enum {
+    INPUT_UNKNOWN,   // Not looked at since it last changed
+    INPUT_FILE,      // Seekable, read ahead and given back
+    INPUT_STREAM,    // Pipe or device, read ahead only while owned
+    INPUT_TERMINAL   // A stream whose reader may be waiting for a prompt
+} InputMode;
+
+typedef struct {
+    char *data;       // INPUT_BUFFER_SIZE bytes once anything was read
+    size_t start;     // First byte not used yet
+    size_t end;       // End of the bytes read
+    InputMode mode;
+    int owners;       // Loops that are the only reader
+} InputBuffer;
+
+static InputBuffer input;
+
+// The buffers of the inputs redirections replaced, innermost last
+static InputBuffer *saved;
+static int saved_count;
+static int saved_capacity;
+
+// The record read, and which of its characters a backslash protected
+static char *record;
+static unsigned char *escaped;
+static size_t record_capacity;
+
+void input_sync(void) {
+    if (input.mode != INPUT_FILE) {
+        return;
+    }
+    if (input.start < input.end) {
+        lseek(STDIN_FILENO, -(off_t)(input.end - input.start), SEEK_CUR);
+    }
+    input.start = input.end = 0;
+}
+
+void input_push(void) {
+    input_sync();
+    if (saved_count >= saved_capacity) {
+        int capacity = saved_capacity ? saved_capacity * 2 : 8;
+        InputBuffer *buffers = realloc(saved, capacity * sizeof(InputBuffer));
+        if (!buffers) {
+            alloc_error();
+        }
+        saved = buffers;
+        saved_capacity = capacity;
+    }
+    saved[saved_count++] = input;
+    memset(&input, 0, sizeof(input));
+}
+
+void input_pop(void) {
+    if (saved_count == 0) {
+        return;
+    }
+    free(input.data);
+    input = saved[--saved_count];
+}
+
+void input_own(void) {
+    input.owners++;
+}
+
+void input_disown(void) {
+    if (input.owners > 0) {
+        input.owners--;
+    }
+}
+
+void input_reset(void) {
+    input.start = input.end = 0;
+    input.mode = INPUT_UNKNOWN;
+    input.owners = 0;
+}
+
+// Find out what standard input is, the first time it is read
+static void input_probe(void) {
+    static int registered = 0;
+    struct stat st;
+
+    if (isatty(STDIN_FILENO)) {
+        input.mode = INPUT_TERMINAL;
+    } else if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) &&
+               lseek(STDIN_FILENO, 0, SEEK_CUR) != -1) {
+        input.mode = INPUT_FILE;
+    } else {
+        input.mode = INPUT_STREAM;
+    }
+
+    // A file read ahead of is given back when the shell exits as well
+    if (!registered) {
+        atexit(input_sync);
+        registered = 1;
+    }
+}
+
+// Read more of standard input into the empty buffer
+// Returns the number of bytes read, 0 at end of file and -1 on an error.
+static ssize_t input_fill(void) {
+    if (input.mode == INPUT_UNKNOWN) {
+        input_probe();
+    }
+    if (!input.data) {
+        input.data = malloc(INPUT_BUFFER_SIZE);
+        if (!input.data) {
+            alloc_error();
+        }
+    }
+    input.start = input.end = 0;
+
+    // Without an owner the bytes after the record belong to whoever reads next
+    size_t want = 1;
+    if (input.mode == INPUT_FILE || input.owners > 0) {
+        want = INPUT_BUFFER_SIZE;
+    }
+    if (input.mode == INPUT_TERMINAL) {
+        fflush(stdout);
+    }
+
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, input.data, want)) < 0 && errno == EINTR) {
+    }
+    if (n > 0) {
+        input.end = (size_t)n;
+    }
+    return n;
+}
+
+// Make room for size bytes in the record and its escape marks
+static void record_reserve(size_t size) {
+    if (size <= record_capacity) {
+        return;
+    }
+    size_t capacity = record_capacity ? record_capacity : 256;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    char *text = realloc(record, capacity);
+    unsigned char *marks = realloc(escaped, capacity);
+    if (!text || !marks) {
+        alloc_error();
+    }
+    record = text;
+    escaped = marks;
+    record_capacity = capacity;
+}
+
+// Check if the character at end is escaped by the backslashes before it
+static int is_escaped(size_t end) {
+    size_t count = 0;
+    while (count < end && record[end - count - 1] == '\\') {
+        count++;
+    }
+    return count % 2 == 1;
+}
+
+// Read up to the first delimiter not escaped by a backslash, or any
+// delimiter when raw, into the record
+// Returns 1 when the delimiter was found, 0 at end of file and -1 on an
+// error. The delimiter itself is not kept.
+static int read_delimited(int delim, int raw, size_t *len) {
+    *len = 0;
+    for (;;) {
+        if (input.start == input.end) {
+            ssize_t n = input_fill();
+            if (n <= 0) {
+                return n < 0 ? -1 : 0;
+            }
+        }
+
+        const char *begin = input.data + input.start;
+        size_t avail = input.end - input.start;
+        const char *hit = memchr(begin, delim, avail);
+        size_t take = hit ? (size_t)(hit - begin) + 1 : avail;
+
+        record_reserve(*len + take + 1);
+        memcpy(record + *len, begin, take);
+        *len += take;
+        input.start += take;
+
+        if (hit && (raw || !is_escaped(*len - 1))) {
+            (*len)--;
+            return 1;
+        }
+    }
+}
+
+// Read at most limit characters, stopping early at the delimiter
+// An escaped character counts once, an escaped newline not at all.
+static int read_counted(int delim, int raw, size_t limit, size_t *len) {
+    size_t count = 0;
+    int escape = 0;
+
+    *len = 0;
+    while (count < limit) {
+        if (input.start == input.end) {
+            ssize_t n = input_fill();
+            if (n <= 0) {
+                return n < 0 ? -1 : 0;
+            }
+        }
+
+        char c = input.data[input.start++];
+        if (!escape && c == (char)delim) {
+            return 1;
+        }
+        record_reserve(*len + 2);
+        record[(*len)++] = c;
+        if (escape) {
+            escape = 0;
+            count += c != '\n';
+        } else if (c == '\\' && !raw) {
+            escape = 1;
+        } else {
+            count++;
+        }
+    }
+    return 1;
+}
+
+// Take out the backslashes of the record, marking the characters they
+// protect from splitting; an escaped newline goes away entirely
+// Returns the marks, or NULL when there was no backslash.
+static const unsigned char *remove_escapes(size_t *len) {
+    if (!memchr(record, '\\', *len)) {
+        return NULL;
+    }
+
+    size_t out = 0;
+    for (size_t i = 0; i < *len; i++) {
+        int protect = 0;
+        if (record[i] == '\\' && i + 1 < *len) {
+            i++;
+            if (record[i] == '\n') {
+                continue;
+            }
+            protect = 1;
+        }
+        escaped[out] = (unsigned char)protect;
+        record[out++] = record[i];
+    }
+    *len = out;
+    return escaped;
+}
+
+// Kinds of character for splitting
+enum { NOT_IFS, IFS_SPACE, IFS_OTHER };
+
+// Split the record between the variables as bash does: IFS whitespace
+// around the fields is dropped, and the last variable gets the rest of the
+// line with its trailing IFS whitespace dropped, and the delimiter after it
+// too when the rest is a single field
+static void assign_fields(char **names, int count, size_t len, const unsigned char *protect) {
+    char *text = record;
+    text[len] = '\0';
+
+    // No names: the whole line, unsplit and untrimmed
+    if (count == 0) {
+        set_shell_variable("REPLY", text);
+        return;
+    }
+
+    // Classified up front, assigning IFS itself must not change the split
+    unsigned char kind[256] = {0};
+    VarView ifs;
+    const char *chars = lookup_variable("IFS", 3, &ifs) ? ifs.ptr : " \t\n";
+    for (const char *c = chars; *c; c++) {
+        kind[(unsigned char)*c] = (*c == ' ' || *c == '\t' || *c == '\n') ? IFS_SPACE : IFS_OTHER;
+    }
+#define CHAR_KIND(i) ((protect && protect[i]) ? NOT_IFS : kind[(unsigned char)text[i]])
+
+    size_t i = 0;
+    while (i < len && CHAR_KIND(i) == IFS_SPACE) {
+        i++;
+    }
+    for (int v = 0; v < count - 1; v++) {
+        size_t start = i;
+        while (i < len && CHAR_KIND(i) == NOT_IFS) {
+            i++;
+        }
+        size_t end = i;
+
+        // The separator: whitespace around at most one other IFS character
+        while (i < len && CHAR_KIND(i) == IFS_SPACE) {
+            i++;
+        }
+        if (i < len && CHAR_KIND(i) == IFS_OTHER) {
+            i++;
+            while (i < len && CHAR_KIND(i) == IFS_SPACE) {
+                i++;
+            }
+        }
+
+        char saved_char = text[end];
+        text[end] = '\0';
+        set_shell_variable(names[v], text + start);
+        text[end] = saved_char;
+    }
+
+    size_t end = len;
+    while (end > i && CHAR_KIND(end - 1) == IFS_SPACE) {
+        end--;
+    }
+
+    // A lone field keeps no delimiter after it either
+    if (end > i && CHAR_KIND(end - 1) == IFS_OTHER) {
+        size_t field_end = end - 1;
+        while (field_end > i && CHAR_KIND(field_end - 1) == IFS_SPACE) {
+            field_end--;
+        }
+        size_t j = i;
+        while (j < field_end && CHAR_KIND(j) == NOT_IFS) {
+            j++;
+        }
+        if (j == field_end) {
+            end = field_end;
+        }
+    }
+#undef CHAR_KIND
+    text[end] = '\0';
+    set_shell_variable(names[count - 1], text + i);
+}
+
+static void read_usage(void) {
+    fprintf(stderr, "hush: read: usage: read [-r] [-d delim] [-n nchars] [name ...]\n");
+    set_last_exit_status(2);
+}
+
+int hush_read(char **args) {
+    int raw = 0;
+    int delim = '\n';
+    long limit = -1;
+    int i = 1;
+
+    // Options may be grouped, -d and -n take the rest of the word or the
+    // next one
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *opt = args[i] + 1; *opt; opt++) {
+            if (*opt == 'r') {
+                raw = 1;
+                continue;
+            }
+            if (*opt != 'd' && *opt != 'n') {
+                fprintf(stderr, "hush: read: -%c: invalid option\n", *opt);
+                read_usage();
+                return 1;
+            }
+
+            const char *value = opt[1] ? opt + 1 : args[++i];
+            if (!value) {
+                fprintf(stderr, "hush: read: -%c: option requires an argument\n", *opt);
+                read_usage();
+                return 1;
+            }
+            if (*opt == 'd') {
+                // An empty delimiter means NUL
+                delim = (unsigned char)value[0];
+            } else {
+                char *end;
+                errno = 0;
+                limit = strtol(value, &end, 10);
+                if (end == value || *end || limit < 0 || errno == ERANGE) {
+                    fprintf(stderr, "hush: read: %s: invalid number\n", value);
+                    set_last_exit_status(1);
+                    return 1;
+                }
+            }
+            break;
+        }
+    }
+
+    char **names = args + i;
+    int count = 0;
+    for (; names[count]; count++) {
+        if (!is_name(names[count], strlen(names[count]))) {
+            fprintf(stderr, "hush: read: `%s': not a valid identifier\n", names[count]);
+            set_last_exit_status(1);
+            return 1;
+        }
+    }
+
+    size_t len;
+    int found = limit >= 0 ? read_counted(delim, raw, (size_t)limit, &len)
+                           : read_delimited(delim, raw, &len);
+    if (found < 0) {
+        perror("hush: read");
+        set_last_exit_status(1);
+        return 1;
+    }
+    record_reserve(len + 1);
+
+    const unsigned char *protect = raw ? NULL : remove_escapes(&len);
+    assign_fields(names, count, len, protect);
+
+    // End of file before the delimiter fails, what was read is still set
+    set_last_exit_status(found ? 0 : 1);
+    return 1;
+}
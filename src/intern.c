@@ -0,0 +1,114 @@
+#include "intern.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define POOL_CHUNK_SIZE 4096
+
+// One slot of the open-addressing table
+typedef struct {
+    const char *text;  // NULL when empty
+    uint32_t hash;
+    uint32_t len;
+} InternSlot;
+
+// String bytes are carved out of chunks that are never freed
+typedef struct PoolChunk {
+    struct PoolChunk *prev;
+    size_t used;
+    size_t size;
+    char data[];
+} PoolChunk;
+
+static InternSlot *slots;
+static size_t slot_capacity;   // Always a power of two
+static size_t slot_count;
+static PoolChunk *pool;
+
+// Find the slot holding s, or the empty slot where it would go
+static InternSlot *find_slot(const char *s, size_t len, uint32_t hash) {
+    size_t mask = slot_capacity - 1;
+    size_t i = hash & mask;
+
+    while (slots[i].text) {
+        if (slots[i].hash == hash && slots[i].len == len &&
+            memcmp(slots[i].text, s, len) == 0) {
+            return &slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return &slots[i];
+}
+
+// Double the table, keeping it at most half full
+static void grow_table(void) {
+    size_t old_capacity = slot_capacity;
+    InternSlot *old_slots = slots;
+
+    slot_capacity = old_capacity ? old_capacity * 2 : 256;
+    slots = calloc(slot_capacity, sizeof(InternSlot));
+    if (!slots) {
+        alloc_error();
+    }
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].text) {
+            *find_slot(old_slots[i].text, old_slots[i].len, old_slots[i].hash) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+// Copy a name into the pool
+static const char *pool_copy(const char *s, size_t len) {
+    if (!pool || pool->size - pool->used < len + 1) {
+        size_t size = len + 1 > POOL_CHUNK_SIZE ? len + 1 : POOL_CHUNK_SIZE;
+        PoolChunk *chunk = malloc(sizeof(PoolChunk) + size);
+        if (!chunk) {
+            alloc_error();
+        }
+        chunk->prev = pool;
+        chunk->used = 0;
+        chunk->size = size;
+        pool = chunk;
+    }
+
+    char *copy = pool->data + pool->used;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    pool->used += len + 1;
+    return copy;
+}
+
+const char *intern_find_n(const char *s, size_t len) {
+    if (slot_count == 0) {
+        return NULL;
+    }
+    return find_slot(s, len, hash_text(s, len, 0))->text;
+}
+
+const char *intern_find(const char *s) {
+    return intern_find_n(s, strlen(s));
+}
+
+const char *intern_n(const char *s, size_t len) {
+    if ((slot_count + 1) * 2 > slot_capacity) {
+        grow_table();
+    }
+
+    uint32_t hash = hash_text(s, len, 0);
+    InternSlot *slot = find_slot(s, len, hash);
+    if (!slot->text) {
+        slot->text = pool_copy(s, len);
+        slot->hash = hash;
+        slot->len = (uint32_t)len;
+        slot_count++;
+    }
+    return slot->text;
+}
+
+const char *intern(const char *s) {
+    return intern_n(s, strlen(s));
+}
@@ -2,12 +2,15 @@
 #include "builtins.h"
 #include "signals.h"
 #include "readline.h"
+#include "variables.h"
+#include "input.h"
 
 // Terminal information
 pid_t shell_pgid;
 int shell_terminal;
 int shell_is_interactive;
 struct termios shell_tmodes;
+int shell_runs_script;
 
 // Current active jobs array
 Job *jobs[MAX_JOBS] = {NULL};
@@ -211,7 +214,8 @@ void wait_for_job(Job *job) {
     int status;
 
     do {
-        pid = waitpid(-job->pgid, &status, WUNTRACED);
+        // Without job control the children share our process group
+        pid = waitpid(shell_is_interactive ? -job->pgid : WAIT_ANY, &status, WUNTRACED);
         if (pid < 0) {
             if (errno == ECHILD) {
                 // No more children to wait for
@@ -319,56 +323,89 @@ void continue_job(Job *job, int foreground) {
     }
 }
 
+// Set up a freshly forked child process
+void prepare_child_process(pid_t pgid, int foreground) {
+    if (shell_is_interactive) {
+        // Put this process in the job's process group
+        pid_t group = pgid ? pgid : getpid();
+        if (setpgid(0, group) < 0) {
+            perror("hush: setpgid");
+            exit(EXIT_FAILURE);
+        }
+
+        // If foreground job, grab control of terminal
+        if (foreground) {
+            if (tcsetpgrp(shell_terminal, group) < 0) {
+                perror("hush: tcsetpgrp");
+            }
+        }
+
+        // Reset signal handlers
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+    }
+    signal(SIGCHLD, SIG_DFL);
+
+    // The parent blocks SIGCHLD around fork, the child must not inherit that
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+}
+
+// Convert a wait status into a shell exit status
+int wait_status_to_exit(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    if (WIFSTOPPED(status)) {
+        return 128 + WSTOPSIG(status);
+    }
+    return 0;
+}
+
 // Launch a job (for both foreground and background processes)
 int launch_job(Job *job, char **args, int foreground) {
-    Process *proc;
     pid_t pid;
     int status = 0;
+    sigset_t old_mask;
 
     // Set default foreground/background state
     job->foreground = foreground;
 
+    // Keep the SIGCHLD handler from reaping the child before we wait for it
+    block_sigchld(&old_mask);
+    input_sync();
+    fflush(stdout);
+
+    // Build the environment here so later launches reuse it
+    exported_environment();
+
     // Fork the child process
     pid = fork();
 
     if (pid == 0) {
         // Child process
-
-        // Put this process in a new process group
-        if (shell_is_interactive) {
-            pid = getpid();
-            if (setpgid(pid, job->pgid) < 0) {
-                perror("hush: setpgid");
-                exit(EXIT_FAILURE);
-            }
-
-            // If foreground job, grab control of terminal
-            if (foreground) {
-                if (tcsetpgrp(shell_terminal, job->pgid) < 0) {
-                    perror("hush: tcsetpgrp");
-                }
-            }
-
-            // Reset signal handlers
-            signal(SIGINT, SIG_DFL);
-            signal(SIGQUIT, SIG_DFL);
-            signal(SIGTSTP, SIG_DFL);
-            signal(SIGTTIN, SIG_DFL);
-            signal(SIGTTOU, SIG_DFL);
-            signal(SIGCHLD, SIG_DFL);
-        }
+        prepare_child_process(job->pgid, foreground);
 
         // Execute the command
         if (execvp(args[0], args) < 0) {
             perror("hush: execvp");
-            exit(EXIT_FAILURE);
+            _exit(EXIT_FAILURE);
         }
 
-        exit(EXIT_SUCCESS); // Should not reach here
+        _exit(EXIT_SUCCESS); // Should not reach here
     }
     else if (pid < 0) {
         // Error forking
         perror("hush: fork");
+        restore_sigmask(&old_mask);
         return -1;
     }
     else {
@@ -393,14 +430,18 @@ int launch_job(Job *job, char **args, int foreground) {
 
         // If foreground job, wait for it
         if (foreground) {
-            put_job_in_foreground(job, 0);
+            if (shell_is_interactive) {
+                put_job_in_foreground(job, 0);
+            } else {
+                wait_for_job(job);
+            }
 
             // Check job status
             if (job_is_completed(job)) {
                 // Extract exit status from first process
                 Process *p = job->first_process;
-                if (p && p->completed && WIFEXITED(p->status)) {
-                    status = WEXITSTATUS(p->status);
+                if (p && p->completed) {
+                    status = wait_status_to_exit(p->status);
                 }
                 remove_job(job->id);
             }
@@ -412,12 +453,53 @@ int launch_job(Job *job, char **args, int foreground) {
         else {
             // Background job
             put_job_in_background(job, 0);
+            set_last_background_pid(pid);
         }
 
+        restore_sigmask(&old_mask);
         return status;
     }
 }
 
+// Run a shell-side body (a list or compound command) as a background job
+int launch_background(const char *label, job_body_fn body, void *data) {
+    Job *job = create_job((char *)label);
+    if (!job) {
+        set_last_exit_status(1);
+        return 1;
+    }
+    job->foreground = 0;
+
+    input_sync();
+    fflush(stdout);
+    fflush(stderr);
+    exported_environment();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("hush: fork");
+        remove_job(job->id);
+        set_last_exit_status(1);
+        return 1;
+    }
+
+    if (pid == 0) {
+        prepare_child_process(0, 0);
+        body(data);
+        _exit(EXIT_FAILURE);  // Should not reach here
+    }
+
+    add_process_to_job(job, pid);
+    if (shell_is_interactive && setpgid(pid, job->pgid) < 0 && errno != EACCES) {
+        perror("hush: setpgid");
+    }
+
+    put_job_in_background(job, 0);
+    set_last_background_pid(pid);
+    set_last_exit_status(0);
+    return 1;
+}
+
 // Implementation of jobs built-in command
 int hush_jobs(char **args) {
     int show_pid = 0;
@@ -2,17 +2,37 @@
 #include "signals.h"
 #include "redirection.h"
 #include "jobs.h"
+#include "arena.h"
+#include "variables.h"
+#include "input.h"
+#include <string.h>
 
 // Declare the external variable
 extern volatile sig_atomic_t child_running;
 
+int launch_in_place = 0;
+
 int hush_launch(char **args) {
+    // A subshell with nothing left to do becomes the command
+    if (launch_in_place) {
+        input_sync();
+        fflush(stdout);
+        exported_environment();
+        execvp(args[0], args);
+        perror("hush: execvp");
+        _exit(EXIT_FAILURE);
+    }
+
     // Create a job for this command
     char command_str[1024] = {0};
+    size_t used = 0;
     int i = 0;
     while (args[i]) {
-        if (i > 0) strcat(command_str, " ");
-        strcat(command_str, args[i]);
+        // The job label is only for display, long argument lists are cut short
+        if (used < sizeof(command_str) - 1) {
+            used += snprintf(command_str + used, sizeof(command_str) - used,
+                             i > 0 ? " %s" : "%s", args[i]);
+        }
         i++;
     }
 
@@ -33,7 +53,6 @@ int hush_launch(char **args) {
     Job *job = create_job(command_str);
     if (!job) {
         reset_redirection(stdin_copy, stdout_copy, stderr_copy);
-        if (clean_args != args) free(clean_args);
         return 1;
     }
 
@@ -43,10 +62,5 @@ int hush_launch(char **args) {
     // Reset file descriptors to their original state
     reset_redirection(stdin_copy, stdout_copy, stderr_copy);
 
-    // Free the clean_args array if it's different from args
-    if (clean_args != args) {
-        free(clean_args);
-    }
-
     return status;
 }
@@ -0,0 +1,372 @@
+#include "lexer.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Canonical operator text, indexed by OperatorKind
+static const char *operator_text[OP_COUNT] = {
+    "",
+    "|",
+    "||",
+    "&",
+    "&&",
+    ";",
+    "\n",
+    "<",
+    "<<",
+    ">",
+    ">>",
+    "2>",
+    "2>>",
+    "&>"
+};
+
+void token_list_init(TokenList *list) {
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+void token_list_free(TokenList *list) {
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+// Append a span to the token list
+static void token_push(TokenList *list, size_t offset, size_t length, unsigned int flags) {
+    if (list->count >= list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        Token *items = realloc(list->items, list->capacity * sizeof(Token));
+        if (!items) {
+            alloc_error();
+        }
+        list->items = items;
+    }
+
+    list->items[list->count].offset = offset;
+    list->items[list->count].length = length;
+    list->items[list->count].flags = flags;
+    list->count++;
+}
+
+const char *operator_str(int op) {
+    if (op <= OP_NONE || op >= OP_COUNT) {
+        return "";
+    }
+    return operator_text[op];
+}
+
+int is_redirection_op(int op) {
+    return op >= OP_LESS && op <= OP_ALL_GREAT;
+}
+
+// Match an operator at the start of a token, returns its length or 0
+static size_t match_operator(const char *s, int *op) {
+    switch (s[0]) {
+        case '|':
+            *op = (s[1] == '|') ? OP_OR : OP_PIPE;
+            return (s[1] == '|') ? 2 : 1;
+        case '&':
+            if (s[1] == '&') { *op = OP_AND; return 2; }
+            if (s[1] == '>') { *op = OP_ALL_GREAT; return 2; }
+            *op = OP_AMP;
+            return 1;
+        case ';':
+            *op = OP_SEMI;
+            return 1;
+        case '\n':
+            *op = OP_NEWLINE;
+            return 1;
+        case '<':
+            *op = (s[1] == '<') ? OP_HEREDOC : OP_LESS;
+            return (s[1] == '<') ? 2 : 1;
+        case '>':
+            *op = (s[1] == '>') ? OP_DGREAT : OP_GREAT;
+            return (s[1] == '>') ? 2 : 1;
+        case '2':
+            if (s[1] == '>') {
+                *op = (s[2] == '>') ? OP_ERR_DGREAT : OP_ERR_GREAT;
+                return (s[2] == '>') ? 3 : 2;
+            }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+static size_t skip_dollar(const char *line, size_t i, int *status);
+static size_t skip_backtick(const char *line, size_t i, int *status);
+
+// Skip a single-quoted section, i points just past the opening quote
+static size_t skip_squote(const char *line, size_t i, int *status) {
+    while (line[i] && line[i] != '\'') {
+        i++;
+    }
+    if (!line[i]) {
+        *status = -1;
+        return i;
+    }
+    return i + 1;
+}
+
+// Skip a double-quoted section, i points just past the opening quote
+static size_t skip_dquote(const char *line, size_t i, int *status) {
+    while (line[i] && line[i] != '"') {
+        if (line[i] == '\\' && line[i + 1]) {
+            i += 2;
+        } else if (line[i] == '$') {
+            i = skip_dollar(line, i, status);
+        } else if (line[i] == '`') {
+            i = skip_backtick(line, i + 1, status);
+        } else {
+            i++;
+        }
+    }
+    if (!line[i]) {
+        *status = -1;
+        return i;
+    }
+    return i + 1;
+}
+
+// Skip a bracketed group such as $(...) or ${...}, i points just past the opener
+static size_t skip_group(const char *line, size_t i, char open, char close, int *status) {
+    int depth = 1;
+
+    while (line[i]) {
+        char c = line[i];
+        if (c == '\\' && line[i + 1]) {
+            i += 2;
+            continue;
+        }
+        if (c == '\'') {
+            i = skip_squote(line, i + 1, status);
+            continue;
+        }
+        if (c == '"') {
+            i = skip_dquote(line, i + 1, status);
+            continue;
+        }
+        if (c == '`') {
+            i = skip_backtick(line, i + 1, status);
+            continue;
+        }
+        if (c == open) {
+            depth++;
+        } else if (c == close) {
+            depth--;
+            if (depth == 0) {
+                return i + 1;
+            }
+        }
+        i++;
+    }
+
+    *status = -1;
+    return i;
+}
+
+// Skip a backtick substitution, i points just past the opening backtick
+static size_t skip_backtick(const char *line, size_t i, int *status) {
+    while (line[i] && line[i] != '`') {
+        i += (line[i] == '\\' && line[i + 1]) ? 2 : 1;
+    }
+    if (!line[i]) {
+        *status = -1;
+        return i;
+    }
+    return i + 1;
+}
+
+// Skip a $ expansion, i points at the $
+static size_t skip_dollar(const char *line, size_t i, int *status) {
+    if (line[i + 1] == '(') {
+        return skip_group(line, i + 2, '(', ')', status);
+    }
+    if (line[i + 1] == '{') {
+        return skip_group(line, i + 2, '{', '}', status);
+    }
+    // Plain $name, the name itself is ordinary word text
+    return i + 1;
+}
+
+size_t lex_skip_dollar(const char *line, size_t i) {
+    int status = 0;
+    return skip_dollar(line, i, &status);
+}
+
+size_t lex_skip_backtick(const char *line, size_t i) {
+    int status = 0;
+    return skip_backtick(line, i + 1, &status);
+}
+
+// Characters that end an unquoted word
+static int is_word_break(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\a' || c == '\n' ||
+           c == '|' || c == '&' || c == ';' || c == '<' || c == '>';
+}
+
+// Check that a [ at i is closed later in the word, a lone [ as in the test
+// command matches only itself and is not worth globbing
+static int bracket_closes(const char *line, size_t i) {
+    for (i++; line[i] && !is_word_break(line[i]); i++) {
+        if (line[i] == ']') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int is_name(const char *s, size_t len) {
+    if (len == 0 || (!isalpha((unsigned char)s[0]) && s[0] != '_')) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        if (!isalnum((unsigned char)s[i]) && s[i] != '_') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int hush_lex(const char *line, TokenList *list) {
+    size_t i = 0;
+    int status = 0;
+
+    list->count = 0;
+
+    while (line[i]) {
+        char c = line[i];
+
+        // Blanks separate tokens
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\a') {
+            i++;
+            continue;
+        }
+
+        // A # at the start of a word comments out the rest of the line
+        if (c == '#') {
+            while (line[i] && line[i] != '\n') {
+                i++;
+            }
+            continue;
+        }
+
+        // Line continuation
+        if (c == '\\' && line[i + 1] == '\n') {
+            i += 2;
+            continue;
+        }
+
+        int op = OP_NONE;
+        size_t op_len = match_operator(line + i, &op);
+        if (op_len > 0) {
+            token_push(list, i, op_len, HUSH_TOK_OPERATOR | ((unsigned int)op << HUSH_TOK_OP_SHIFT));
+            i += op_len;
+            continue;
+        }
+
+        // Scan a word, quoted sections and expansions included
+        size_t start = i;
+        unsigned int flags = 0;
+
+        while (line[i] && !is_word_break(line[i])) {
+            c = line[i];
+            if (c == '\\') {
+                flags |= HUSH_TOK_ESCAPED;
+                i += line[i + 1] ? 2 : 1;
+            } else if (c == '\'') {
+                flags |= HUSH_TOK_SQUOTED;
+                i = skip_squote(line, i + 1, &status);
+            } else if (c == '"') {
+                flags |= HUSH_TOK_DQUOTED;
+                i = skip_dquote(line, i + 1, &status);
+            } else if (c == '$') {
+                flags |= HUSH_TOK_EXPAND;
+                i = skip_dollar(line, i, &status);
+            } else if (c == '`') {
+                flags |= HUSH_TOK_EXPAND;
+                i = skip_backtick(line, i + 1, &status);
+            } else if (c == '(' && i == start && line[i + 1] == '(') {
+                // ((expression)) is one word, blanks and operators included
+                i = skip_group(line, i + 1, '(', ')', &status);
+            } else if (c == '(' && i > start && line[i - 1] == '=' && is_name(line + start, i - 1 - start)) {
+                // name=(...) keeps its elements for the assignment to expand
+                flags |= HUSH_TOK_ARRAY;
+                i = skip_group(line, i + 1, '(', ')', &status);
+            } else if (c == '(' && line[i + 1] == ')' && is_name(line + start, i - start)) {
+                // name() ends the word, so a body may follow as in f(){
+                i += 2;
+                break;
+            } else {
+                if (c == '*' || c == '?' || c == '{' || (c == '[' && bracket_closes(line, i))) {
+                    flags |= HUSH_TOK_GLOB;
+                }
+                i++;
+            }
+        }
+
+        if (flags & HUSH_TOK_ARRAY) {
+            flags &= ~HUSH_TOK_GLOB;
+        }
+        token_push(list, start, i - start, flags);
+    }
+
+    return status;
+}
+
+char *token_dequote(char *line, const Token *token) {
+    char *src = line + token->offset;
+    char *end = src + token->length;
+    char *dst = src;
+    char *word = src;
+
+    // Nothing to remove, just terminate the span
+    if (!(token->flags & HUSH_TOK_QUOTED)) {
+        *end = '\0';
+        return word;
+    }
+
+    while (src < end) {
+        if (*src == '\\') {
+            if (src + 1 < end) {
+                if (src[1] != '\n') {
+                    *dst++ = src[1];
+                }
+                src += 2;
+            } else {
+                src++;
+            }
+        } else if (*src == '\'') {
+            src++;
+            while (src < end && *src != '\'') {
+                *dst++ = *src++;
+            }
+            src++;
+        } else if (*src == '"') {
+            src++;
+            while (src < end && *src != '"') {
+                if (*src == '\\' && src + 1 < end &&
+                    (src[1] == '$' || src[1] == '`' || src[1] == '"' ||
+                     src[1] == '\\' || src[1] == '\n')) {
+                    if (src[1] != '\n') {
+                        *dst++ = src[1];
+                    }
+                    src += 2;
+                } else {
+                    *dst++ = *src++;
+                }
+            }
+            src++;
+        } else {
+            *dst++ = *src++;
+        }
+    }
+
+    *dst = '\0';
+    return word;
+}
@@ -8,6 +8,9 @@
 #include "control.h"
 #include "jobs.h"
 #include "variables.h"
+#include "script_cache.h"
+#include "vm.h"
+#include "output.h"
 
 int execute_script(const char *filename, int argc, char **argv) {
     FILE *script = fopen(filename, "r");
@@ -33,13 +36,36 @@ int execute_script(const char *filename, int argc, char **argv) {
         free(script_args);
     }
 
-    int result = process_script_control_flow(script);
+    shell_runs_script = 1;
+
+    // Reuse the compiled form from an earlier run while the script is unchanged
+    struct stat st;
+    uint64_t hash;
+    int cacheable = fstat(fileno(script), &st) == 0 && S_ISREG(st.st_mode) &&
+                    st.st_size <= SCRIPT_CACHE_MAX_SIZE &&
+                    script_cache_hash(script, &hash) == 0;
+
+    Program *prog = cacheable ? script_cache_load(filename, &st, hash) : NULL;
+    if (prog) {
+        vm_execute(prog);
+    } else {
+        process_script_compiled(script, cacheable ? &prog : NULL);
+        if (prog) {
+            script_cache_store(filename, &st, hash, prog);
+        }
+    }
+    free_program(prog);
     fclose(script);
-    return result;
+
+    // The script's status is that of its last command (or of exit N)
+    return get_last_exit_status();
 }
 
 // Update main function
 int main(int argc, char **argv) {
+    // Before anything is written to stdout
+    output_init();
+
     // Set up our signal handlers
     setup_signal_handlers();
 
@@ -85,5 +111,5 @@ int main(int argc, char **argv) {
 
     rl_deprep_terminal();
 
-    return EXIT_SUCCESS;
+    return get_last_exit_status();
 }
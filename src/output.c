@@ -0,0 +1,444 @@
+#include "output.h"
+#include "arena.h"
+#include "variables.h"
+#include "lexer.h"
+#include "arith.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+void output_init(void) {
+    // A terminal keeps the usual line buffering so output shows up as it
+    // is written
+    if (isatty(STDOUT_FILENO)) {
+        return;
+    }
+
+    // Sharing a file with stderr, whole lines keep messages in order
+    struct stat out, err;
+    if (fstat(STDOUT_FILENO, &out) == 0 && fstat(STDERR_FILENO, &err) == 0 &&
+        out.st_dev == err.st_dev && out.st_ino == err.st_ino) {
+        setvbuf(stdout, NULL, _IOLBF, OUTPUT_BUFFER_SIZE);
+        return;
+    }
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+}
+
+int output_flush(const char *name) {
+    if (fflush(stdout) == 0 && !ferror(stdout)) {
+        return 1;
+    }
+    if (name) {
+        fprintf(stderr, "hush: %s: write error: %s\n", name, strerror(errno));
+    } else {
+        fprintf(stderr, "hush: write error: %s\n", strerror(errno));
+    }
+    clearerr(stdout);
+    return 0;
+}
+
+static int is_octal(char c) {
+    return c >= '0' && c <= '7';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Write the escape sequence that follows a backslash, returning how many
+// characters of s it used
+// echo -e and %b spell octal as \0nnn, a printf format as \nnn. *stop is
+// set by \c, which ends the output.
+static size_t put_escape(FILE *out, const char *s, int octal_zero, int *stop) {
+    static const char names[] = "abefnrtv\\\"'";
+    static const char values[] = "\a\b\033\f\n\r\t\v\\\"'";
+
+    // Quotes are only escaped in a printf format
+    const char *name = *s ? strchr(names, *s) : NULL;
+    if (name && !(octal_zero && (*s == '"' || *s == '\''))) {
+        putc(values[name - names], out);
+        return 1;
+    }
+
+    size_t i = 0;
+    int value = 0;
+    switch (*s) {
+        case 'c':
+            *stop = 1;
+            return 1;
+
+        case 'x':
+            for (i = 1; i <= 2 && hex_value(s[i]) >= 0; i++) {
+                value = value * 16 + hex_value(s[i]);
+            }
+            if (i == 1) {
+                break;
+            }
+            putc(value, out);
+            return i;
+
+        default:
+            if (!is_octal(*s) || (octal_zero && *s != '0')) {
+                break;
+            }
+            i = octal_zero ? 1 : 0;
+            for (size_t start = i; i < start + 3 && is_octal(s[i]); i++) {
+                value = value * 8 + (s[i] - '0');
+            }
+            putc(value & 0xff, out);
+            return i;
+    }
+
+    // Not an escape, the backslash stands for itself
+    putc('\\', out);
+    return 0;
+}
+
+// Write s with its backslash escapes interpreted
+// Returns 0 if \c cut the output short.
+static int put_escaped(FILE *out, const char *s, int octal_zero) {
+    int stop = 0;
+    while (*s) {
+        const char *run = s;
+        while (*s && *s != '\\') {
+            s++;
+        }
+        fwrite(run, 1, (size_t)(s - run), out);
+        if (*s == '\\') {
+            s++;
+            s += put_escape(out, s, octal_zero, &stop);
+            if (stop) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+int hush_echo(char **args) {
+    int newline = 1;
+    int escapes = 0;
+    int i = 1;
+
+    // Options are words made only of n, e and E
+    for (; args[i] && args[i][0] == '-' && args[i][1] &&
+           strspn(args[i] + 1, "neE") == strlen(args[i] + 1); i++) {
+        for (const char *opt = args[i] + 1; *opt; opt++) {
+            if (*opt == 'n') {
+                newline = 0;
+            } else {
+                escapes = *opt == 'e';
+            }
+        }
+    }
+
+    for (; args[i]; i++) {
+        if (!escapes) {
+            fputs(args[i], stdout);
+        } else if (!put_escaped(stdout, args[i], 1)) {
+            return 1;
+        }
+        if (args[i + 1]) {
+            putchar(' ');
+        }
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return 1;
+}
+
+// printf
+// The format is walked directly; each conversion is rebuilt as a C format
+// with a j length modifier for integers and handed to fprintf.
+
+typedef struct {
+    FILE *out;
+    char **args;  // Arguments not used yet
+    int error;    // Set once a message was printed
+} PrintfState;
+
+static const char *next_arg(PrintfState *st) {
+    return *st->args ? *st->args++ : NULL;
+}
+
+// An integer argument: a constant in any form arithmetic takes, or 'c for
+// the code of the character c
+// A plain decimal, octal or hex constant is read as unsigned for the
+// unsigned conversions, and one out of range is clamped with a warning.
+static intmax_t integer_arg(PrintfState *st, int is_unsigned) {
+    const char *arg = next_arg(st);
+    if (!arg || !*arg) {
+        return 0;
+    }
+    if (*arg == '\'' || *arg == '"') {
+        return (unsigned char)arg[1];
+    }
+
+    char *end;
+    errno = 0;
+    intmax_t clamped = is_unsigned ? (intmax_t)strtoumax(arg, &end, 0) : strtoimax(arg, &end, 0);
+    int range = errno == ERANGE;
+    while (end > arg && isspace((unsigned char)*end)) {
+        end++;
+    }
+    if (end > arg && !*end) {
+        if (range) {
+            fprintf(stderr, "hush: printf: warning: %s: %s\n", arg, strerror(ERANGE));
+        }
+        return clamped;
+    }
+
+    int64_t value;
+    if (!arith_parse_number(arg, strlen(arg), &value)) {
+        fprintf(stderr, "hush: printf: %s: invalid number\n", arg);
+        st->error = 1;
+        return 0;
+    }
+    return value;
+}
+
+static double float_arg(PrintfState *st) {
+    const char *arg = next_arg(st);
+    if (!arg || !*arg) {
+        return 0;
+    }
+    if (*arg == '\'' || *arg == '"') {
+        return (unsigned char)arg[1];
+    }
+
+    char *end;
+    errno = 0;
+    double value = strtod(arg, &end);
+    if (end == arg || *end || errno == ERANGE) {
+        fprintf(stderr, "hush: printf: %s: invalid number\n", arg);
+        st->error = 1;
+    }
+    return value;
+}
+
+// Copy a width or precision into spec, taking it from the arguments for *
+static size_t copy_field(PrintfState *st, const char **p, char *spec, size_t n, size_t size) {
+    if (**p == '*') {
+        (*p)++;
+        intmax_t value = integer_arg(st, 0);
+        if (value > INT32_MAX) {
+            value = INT32_MAX;
+        } else if (value < -INT32_MAX) {
+            value = -INT32_MAX;
+        }
+        return n + (size_t)snprintf(spec + n, size - n, "%d", (int)value);
+    }
+    while (**p >= '0' && **p <= '9') {
+        if (n < size - 1) {
+            spec[n++] = **p;
+        }
+        (*p)++;
+    }
+    return n;
+}
+
+// Print the format once, taking arguments as its conversions ask for them
+// Returns 1 when it ran to the end, 0 when \c stopped it and -1 on an
+// invalid format.
+static int print_format(PrintfState *st, const char *format) {
+    FILE *out = st->out;
+    const char *p = format;
+    int stop = 0;
+
+    while (*p) {
+        if (*p == '\\') {
+            p++;
+            p += put_escape(out, p, 0, &stop);
+            if (stop) {
+                return 0;
+            }
+            continue;
+        }
+        if (*p != '%') {
+            const char *run = p;
+            while (*p && *p != '%' && *p != '\\') {
+                p++;
+            }
+            fwrite(run, 1, (size_t)(p - run), out);
+            continue;
+        }
+        if (p[1] == '%') {
+            putc('%', out);
+            p += 2;
+            continue;
+        }
+
+        // %[flags][width][.precision]conversion
+        char spec[64];
+        size_t n = 0;
+        const char *start = p++;
+        spec[n++] = '%';
+        while (*p && strchr("-+ #0", *p)) {
+            if (n < 8) {
+                spec[n++] = *p;
+            }
+            p++;
+        }
+        n = copy_field(st, &p, spec, n, 24);
+        if (*p == '.') {
+            spec[n++] = *p++;
+            n = copy_field(st, &p, spec, n, 48);
+        }
+
+        char conv = *p;
+        if (!conv || !strchr("diouxXeEfFgGaAcsb", conv)) {
+            if (conv) {
+                fprintf(stderr, "hush: printf: `%c': invalid format character\n", conv);
+            } else {
+                fprintf(stderr, "hush: printf: %s: missing format character\n", start);
+            }
+            st->error = 1;
+            return -1;
+        }
+        p++;
+
+        switch (conv) {
+            case 'd':
+            case 'i':
+                spec[n++] = 'j';
+                spec[n++] = 'd';
+                spec[n] = '\0';
+                fprintf(out, spec, integer_arg(st, 0));
+                break;
+
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                spec[n++] = 'j';
+                spec[n++] = conv;
+                spec[n] = '\0';
+                fprintf(out, spec, (uintmax_t)integer_arg(st, 1));
+                break;
+
+            case 'c': {
+                // The first character of the argument, nothing for an empty one
+                const char *arg = next_arg(st);
+                char text[2] = { arg ? arg[0] : '\0', '\0' };
+                spec[n++] = 's';
+                spec[n] = '\0';
+                fprintf(out, spec, text);
+                break;
+            }
+
+            case 's': {
+                const char *arg = next_arg(st);
+                if (n == 1) {
+                    fputs(arg ? arg : "", out);
+                    break;
+                }
+                spec[n++] = 's';
+                spec[n] = '\0';
+                fprintf(out, spec, arg ? arg : "");
+                break;
+            }
+
+            case 'b': {
+                // The argument's escapes are expanded first, then it is
+                // padded like %s
+                const char *arg = next_arg(st);
+                if (n == 1) {
+                    if (!put_escaped(out, arg ? arg : "", 1)) {
+                        return 0;
+                    }
+                    break;
+                }
+                char *text = NULL;
+                size_t len = 0;
+                FILE *mem = open_memstream(&text, &len);
+                if (!mem) {
+                    alloc_error();
+                }
+                stop = !put_escaped(mem, arg ? arg : "", 1);
+                fclose(mem);
+                spec[n++] = 's';
+                spec[n] = '\0';
+                fprintf(out, spec, text);
+                free(text);
+                if (stop) {
+                    return 0;
+                }
+                break;
+            }
+
+            default:
+                spec[n++] = conv;
+                spec[n] = '\0';
+                fprintf(out, spec, float_arg(st));
+                break;
+        }
+    }
+    return 1;
+}
+
+int hush_printf(char **args) {
+    int i = 1;
+    const char *var = NULL;
+
+    if (args[i] && strcmp(args[i], "-v") == 0) {
+        var = args[i + 1];
+        i += 2;
+    }
+    if (args[i] && strcmp(args[i], "--") == 0) {
+        i++;
+    }
+    if ((args[1] && strcmp(args[1], "-v") == 0 && !var) || !args[i]) {
+        fprintf(stderr, "hush: printf: usage: printf [-v var] format [arguments]\n");
+        set_last_exit_status(2);
+        return 1;
+    }
+    if (var && !is_name(var, strlen(var))) {
+        fprintf(stderr, "hush: printf: `%s': not a valid identifier\n", var);
+        set_last_exit_status(1);
+        return 1;
+    }
+
+    // -v collects the output to assign it
+    char *text = NULL;
+    size_t len = 0;
+    PrintfState st = { stdout, args + i + 1, 0 };
+    if (var) {
+        st.out = open_memstream(&text, &len);
+        if (!st.out) {
+            alloc_error();
+        }
+    }
+
+    // The format is used again while arguments remain, if it takes any
+    const char *format = args[i];
+    for (;;) {
+        char **before = st.args;
+        if (print_format(&st, format) <= 0 || !*st.args || st.args == before) {
+            break;
+        }
+    }
+
+    if (var) {
+        fclose(st.out);
+        set_shell_variable(var, text);
+        free(text);
+    }
+    set_last_exit_status(st.error ? 1 : 0);
+    return 1;
+}
@@ -0,0 +1,880 @@
+#include "parser.h"
+#include "arena.h"
+#include "variables.h"
+#include "test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Parser state over one lexed line
+typedef struct {
+    char *source;
+    const char *text;  // The input as given, untouched by take_word
+    Token *tokens;
+    int count;
+    int pos;
+    int error;
+    int continuable;   // Running out of input means "read more", not an error
+    int incomplete;    // The input ended before the command did
+} Parser;
+
+// Allocate an empty node
+static AstNode *ast_new(AstType type) {
+    AstNode *node = calloc(1, sizeof(AstNode));
+    if (!node) {
+        alloc_error();
+    }
+    node->type = type;
+    return node;
+}
+
+// Append a child node with its joining operator
+static void ast_add_child(AstNode *node, AstNode *child, int op) {
+    if ((node->child_count & (node->child_count - 1)) == 0) {
+        // Grow at powers of two
+        int capacity = node->child_count ? node->child_count * 2 : 1;
+        AstNode **children = realloc(node->children, capacity * sizeof(AstNode *));
+        int *ops = realloc(node->ops, capacity * sizeof(int));
+        if (!children || !ops) {
+            alloc_error();
+        }
+        node->children = children;
+        node->ops = ops;
+    }
+    node->children[node->child_count] = child;
+    node->ops[node->child_count] = op;
+    node->child_count++;
+}
+
+// Append a word to a simple command
+static void ast_add_word(AstNode *node, char *text, unsigned int flags) {
+    if ((node->word_count & (node->word_count - 1)) == 0) {
+        int capacity = node->word_count ? node->word_count * 2 : 1;
+        Word *words = realloc(node->words, capacity * sizeof(Word));
+        if (!words) {
+            alloc_error();
+        }
+        node->words = words;
+    }
+    node->words[node->word_count].text = text;
+    node->words[node->word_count].flags = flags;
+    node->word_count++;
+}
+
+// Operator kind of the current token, OP_NONE for a word, -1 at the end
+static int current_op(Parser *p) {
+    if (p->pos >= p->count) {
+        return -1;
+    }
+    Token *token = &p->tokens[p->pos];
+    return (token->flags & HUSH_TOK_OPERATOR) ? HUSH_TOK_OP(token->flags) : OP_NONE;
+}
+
+// Report an unexpected token
+static void unexpected(Parser *p, const char *text, int length) {
+    p->error = 1;
+    fprintf(stderr, "hush: syntax error near unexpected token `%.*s'\n", length, text);
+    set_last_exit_status(2);
+}
+
+// Report a syntax error at the current token
+static void syntax_error(Parser *p) {
+    if (p->error) {
+        return;
+    }
+
+    int op = current_op(p);
+    if (op == -1) {
+        p->error = 1;
+        if (p->continuable) {
+            p->incomplete = 1;
+            return;
+        }
+        fprintf(stderr, "hush: syntax error: unexpected end of file\n");
+        set_last_exit_status(2);
+    } else if (op == OP_NEWLINE) {
+        unexpected(p, "newline", 7);
+    } else if (op != OP_NONE) {
+        unexpected(p, operator_str(op), (int)strlen(operator_str(op)));
+    } else {
+        Token *token = &p->tokens[p->pos];
+        unexpected(p, p->source + token->offset, (int)token->length);
+    }
+}
+
+// Compare a token's text with a word
+static int word_is(const char *text, size_t len, const char *word) {
+    return strlen(word) == len && strncmp(text, word, len) == 0;
+}
+
+// Check if the current token is the unquoted reserved word kw
+static int at_reserved(Parser *p, const char *kw) {
+    if (current_op(p) != OP_NONE) {
+        return 0;
+    }
+    Token *token = &p->tokens[p->pos];
+    return !(token->flags & HUSH_TOK_QUOTED) &&
+           word_is(p->source + token->offset, token->length, kw);
+}
+
+// Reserved words that end a list inside a compound command
+static int at_closer(Parser *p) {
+    return at_reserved(p, "then") || at_reserved(p, "elif") || at_reserved(p, "else") ||
+           at_reserved(p, "fi") || at_reserved(p, "do") || at_reserved(p, "done") ||
+           at_reserved(p, "}");
+}
+
+// Consume the reserved word kw or report an error
+static int expect(Parser *p, const char *kw) {
+    if (p->error) {
+        return 0;
+    }
+    if (!at_reserved(p, kw)) {
+        syntax_error(p);
+        return 0;
+    }
+    p->pos++;
+    return 1;
+}
+
+// Terminate the current word in the source copy and return its text
+static char *take_word(Parser *p) {
+    Token *token = &p->tokens[p->pos++];
+    char *text = p->source + token->offset;
+    text[token->length] = '\0';
+    return text;
+}
+
+static void skip_newlines(Parser *p) {
+    while (current_op(p) == OP_NEWLINE) {
+        p->pos++;
+    }
+}
+
+static AstNode *parse_list(Parser *p);
+
+// compound_list : linebreak and_or (separator and_or)* [separator], not empty
+static AstNode *parse_compound_list(Parser *p) {
+    AstNode *node = parse_list(p);
+    if (!p->error && node->child_count == 0) {
+        syntax_error(p);
+    }
+    return node;
+}
+
+// if_clause : 'if' compound_list 'then' compound_list
+//             ('elif' compound_list 'then' compound_list)*
+//             ['else' compound_list] 'fi'
+static AstNode *parse_if(Parser *p) {
+    AstNode *node = ast_new(AST_IF);
+    p->pos++;
+
+    while (!p->error) {
+        ast_add_child(node, parse_compound_list(p), OP_NONE);
+        if (!expect(p, "then")) {
+            break;
+        }
+        ast_add_child(node, parse_compound_list(p), OP_NONE);
+        if (p->error) {
+            break;
+        }
+
+        if (at_reserved(p, "elif")) {
+            p->pos++;
+            continue;
+        }
+        if (at_reserved(p, "else")) {
+            p->pos++;
+            ast_add_child(node, parse_compound_list(p), OP_NONE);
+        }
+        expect(p, "fi");
+        break;
+    }
+    return node;
+}
+
+// do_group : 'do' compound_list 'done'
+static void parse_do_group(Parser *p, AstNode *node) {
+    if (!expect(p, "do")) {
+        return;
+    }
+    ast_add_child(node, parse_compound_list(p), OP_NONE);
+    expect(p, "done");
+}
+
+// while_clause : ('while' | 'until') compound_list do_group
+static AstNode *parse_while(Parser *p, AstType type) {
+    AstNode *node = ast_new(type);
+    p->pos++;
+
+    ast_add_child(node, parse_compound_list(p), OP_NONE);
+    parse_do_group(p, node);
+    return node;
+}
+
+// Check for a ((expression)) word, which the lexer keeps whole
+static int at_arith(Parser *p) {
+    if (current_op(p) != OP_NONE) {
+        return 0;
+    }
+    Token *token = &p->tokens[p->pos];
+    const char *text = p->source + token->offset;
+    return token->length >= 4 && text[0] == '(' && text[1] == '(' &&
+           text[token->length - 2] == ')' && text[token->length - 1] == ')';
+}
+
+// arith_for : 'for' '((' [expr] ';' [expr] ';' [expr] '))' [';'] linebreak do_group
+// The three expressions become AST_ARITH children, empty ones included
+static void parse_arith_for(Parser *p, AstNode *node) {
+    Token *token = &p->tokens[p->pos++];
+    const char *text = p->source + token->offset + 2;
+    size_t len = token->length - 4;
+
+    // Split at the semicolons outside parentheses
+    size_t start = 0;
+    int depth = 0;
+    for (size_t i = 0; i <= len; i++) {
+        if (i < len && text[i] == '(') {
+            depth++;
+        } else if (i < len && text[i] == ')') {
+            depth--;
+        } else if (i == len || (text[i] == ';' && depth == 0)) {
+            AstNode *part = ast_new(AST_ARITH);
+            part->source = strndup(text + start, i - start);
+            if (!part->source) {
+                alloc_error();
+            }
+            ast_add_child(node, part, OP_NONE);
+            start = i + 1;
+        }
+    }
+    if (node->child_count != 3) {
+        syntax_error(p);
+        return;
+    }
+
+    if (current_op(p) == OP_SEMI) {
+        p->pos++;
+    }
+    skip_newlines(p);
+    parse_do_group(p, node);
+}
+
+// for_clause : 'for' NAME linebreak ['in' WORD* separator] linebreak do_group
+static AstNode *parse_for(Parser *p) {
+    AstNode *node = ast_new(AST_FOR);
+    p->pos++;
+
+    if (at_arith(p)) {
+        node->type = AST_ARITH_FOR;
+        parse_arith_for(p, node);
+        return node;
+    }
+    if (current_op(p) != OP_NONE) {
+        syntax_error(p);
+        return node;
+    }
+    Token *name = &p->tokens[p->pos];
+    ast_add_word(node, take_word(p), name->flags);
+    skip_newlines(p);
+
+    if (at_reserved(p, "in")) {
+        p->pos++;
+        while (current_op(p) == OP_NONE) {
+            unsigned int flags = p->tokens[p->pos].flags;
+            ast_add_word(node, take_word(p), flags);
+        }
+        if (current_op(p) != OP_SEMI && current_op(p) != OP_NEWLINE) {
+            syntax_error(p);
+            return node;
+        }
+        p->pos++;
+    } else {
+        node->flags |= AST_FOR_ARGS;
+        if (current_op(p) == OP_SEMI) {
+            p->pos++;
+        }
+    }
+
+    skip_newlines(p);
+    parse_do_group(p, node);
+    return node;
+}
+
+// brace_group : '{' compound_list '}'
+static AstNode *parse_group(Parser *p) {
+    AstNode *node = ast_new(AST_GROUP);
+    p->pos++;
+
+    ast_add_child(node, parse_compound_list(p), OP_NONE);
+    expect(p, "}");
+    return node;
+}
+
+// A NAME=value, NAME[subscript]=value or NAME=(list) word
+static int is_assignment(const char *text, unsigned int flags) {
+    if (flags & HUSH_TOK_OPERATOR) {
+        return 0;
+    }
+    size_t len = strcspn(text, "=[");
+    if (!is_name(text, len)) {
+        return 0;
+    }
+    if (text[len] == '[') {
+        const char *close = strchr(text + len, ']');
+        return close && close[1] == '=';
+    }
+    return text[len] == '=';
+}
+
+// Length of the function name when the current token starts a definition,
+// as name() or name (), zero otherwise
+static size_t function_name_length(Parser *p) {
+    if (current_op(p) != OP_NONE) {
+        return 0;
+    }
+    Token *token = &p->tokens[p->pos];
+    const char *text = p->source + token->offset;
+    if (token->flags & HUSH_TOK_QUOTED) {
+        return 0;
+    }
+
+    if (token->length > 2 && text[token->length - 2] == '(' && text[token->length - 1] == ')') {
+        return is_name(text, token->length - 2) ? token->length - 2 : 0;
+    }
+    if (p->pos + 1 < p->count && is_name(text, token->length)) {
+        Token *next = &p->tokens[p->pos + 1];
+        if (!(next->flags & (HUSH_TOK_OPERATOR | HUSH_TOK_QUOTED)) &&
+            word_is(p->source + next->offset, next->length, "()")) {
+            return token->length;
+        }
+    }
+    return 0;
+}
+
+static AstNode *parse_command(Parser *p);
+
+// function_definition : NAME '(' ')' linebreak compound_command
+//                     | 'function' NAME ['(' ')'] linebreak compound_command
+// The body is kept as source text as well, it is compiled on its own
+// each time the definition runs
+static AstNode *parse_function(Parser *p, int keyword) {
+    AstNode *node = ast_new(AST_FUNCTION);
+    if (keyword) {
+        p->pos++;
+    }
+
+    size_t name_len = function_name_length(p);
+    Token *name = &p->tokens[p->pos];
+    int paren = name_len > 0;
+    if (!paren) {
+        // Only function NAME may leave out the parentheses
+        name_len = name->length;
+        if (!keyword || current_op(p) != OP_NONE || (name->flags & HUSH_TOK_QUOTED) ||
+            !is_name(p->source + name->offset, name_len)) {
+            syntax_error(p);
+            return node;
+        }
+    }
+    // Ended at the name, not after the token: a name() token may run into
+    // the body
+    char *text = p->source + name->offset;
+    text[name_len] = '\0';
+    ast_add_word(node, text, 0);
+    p->pos++;
+    if (paren && name->length == name_len) {
+        p->pos++;  // The separate ()
+    }
+    skip_newlines(p);
+
+    if (!(at_reserved(p, "{") || at_reserved(p, "if") || at_reserved(p, "while") ||
+          at_reserved(p, "until") || at_reserved(p, "for"))) {
+        syntax_error(p);
+        return node;
+    }
+    size_t start = p->tokens[p->pos].offset;
+    ast_add_child(node, parse_command(p), OP_NONE);
+    if (p->error) {
+        return node;
+    }
+    const Token *last = &p->tokens[p->pos - 1];
+    node->source = strndup(p->text + start, last->offset + last->length - start);
+    if (!node->source) {
+        alloc_error();
+    }
+    return node;
+}
+
+// arith_command : '((' expression '))'
+static AstNode *parse_arith(Parser *p) {
+    Token *token = &p->tokens[p->pos++];
+    AstNode *node = ast_new(AST_ARITH);
+    node->source = strndup(p->source + token->offset + 2, token->length - 4);
+    if (!node->source) {
+        alloc_error();
+    }
+    return node;
+}
+
+// The binary operator at the current token inside [[ ]], TEST_NONE if none
+// < and > arrive as redirection operators and compare strings here.
+static TestBinary cond_binary_at(Parser *p) {
+    int op = current_op(p);
+    if (op == OP_LESS) {
+        return TEST_STR_LT;
+    }
+    if (op == OP_GREAT) {
+        return TEST_STR_GT;
+    }
+    if (op != OP_NONE || (p->tokens[p->pos].flags & HUSH_TOK_QUOTED)) {
+        return TEST_NONE;
+    }
+
+    Token *token = &p->tokens[p->pos];
+    const char *text = p->source + token->offset;
+    char word[4];
+    if (token->length >= sizeof(word)) {
+        return TEST_NONE;
+    }
+    memcpy(word, text, token->length);
+    word[token->length] = '\0';
+
+    // = == and != match patterns, and -a -o are && || here
+    if (strcmp(word, "=~") == 0) {
+        return TEST_REGEX;
+    }
+    TestBinary binary = test_binary_op(word, 0);
+    if (binary == TEST_STR_EQ) {
+        return TEST_MATCH;
+    }
+    return binary == TEST_STR_NE ? TEST_NO_MATCH : binary;
+}
+
+// Take one operand word inside [[ ]]
+static void cond_word(Parser *p, AstNode *node) {
+    if (current_op(p) != OP_NONE || at_reserved(p, "]]")) {
+        syntax_error(p);
+        return;
+    }
+    unsigned int flags = p->tokens[p->pos].flags;
+    ast_add_word(node, take_word(p), flags);
+}
+
+// Take the operand of =~, which runs up to the next blank so that the
+// | ( ) < > of a regular expression need no quoting
+static void cond_regex_word(Parser *p, AstNode *node) {
+    int op = current_op(p);
+    if (!(op == OP_NONE || op == OP_PIPE || op == OP_LESS || op == OP_GREAT) || at_reserved(p, "]]")) {
+        syntax_error(p);
+        return;
+    }
+
+    Token *first = &p->tokens[p->pos];
+    Token *last = first;
+    unsigned int flags = 0;
+    while (p->pos < p->count) {
+        Token *token = &p->tokens[p->pos];
+        op = current_op(p);
+        if ((token != first && token->offset != last->offset + last->length) ||
+            !(op == OP_NONE || op == OP_PIPE || op == OP_LESS || op == OP_GREAT)) {
+            break;
+        }
+        if (op == OP_NONE) {
+            flags |= token->flags;
+        }
+        last = token;
+        p->pos++;
+    }
+    char *text = p->source + first->offset;
+    text[last->offset + last->length - first->offset] = '\0';
+    ast_add_word(node, text, flags);
+}
+
+static AstNode *parse_cond_or(Parser *p);
+
+// cond_primary : '!' cond_primary | '(' cond_or ')'
+//              | unary-op WORD | WORD binary-op WORD | WORD
+static AstNode *parse_cond_primary(Parser *p) {
+    skip_newlines(p);
+
+    if (at_reserved(p, "!")) {
+        AstNode *node = ast_new(AST_COND_NOT);
+        p->pos++;
+        ast_add_child(node, parse_cond_primary(p), OP_NONE);
+        return node;
+    }
+    if (at_reserved(p, "(")) {
+        p->pos++;
+        AstNode *node = parse_cond_or(p);
+        expect(p, ")");
+        return node;
+    }
+
+    AstNode *node = ast_new(AST_COND_TEST);
+    if (current_op(p) != OP_NONE || at_reserved(p, "]]")) {
+        syntax_error(p);
+        return node;
+    }
+
+    // A unary operator needs an operand after it, or it is a plain word
+    Token *token = &p->tokens[p->pos];
+    char unary = 0;
+    p->pos++;
+    int has_operand = current_op(p) == OP_NONE && !at_reserved(p, "]]");
+    p->pos--;
+    if (!(token->flags & HUSH_TOK_QUOTED) && token->length == 2 && has_operand) {
+        char word[3] = { p->source[token->offset], p->source[token->offset + 1], '\0' };
+        unary = test_unary_op(word);
+    }
+    if (unary) {
+        p->pos++;
+        node->flags = unary;
+        cond_word(p, node);
+        return node;
+    }
+
+    cond_word(p, node);
+    TestBinary op = p->error ? TEST_NONE : cond_binary_at(p);
+    if (op == TEST_NONE) {
+        node->flags = 'n';
+        return node;
+    }
+    p->pos++;
+    node->flags = op;
+    if (op == TEST_REGEX) {
+        cond_regex_word(p, node);
+    } else {
+        cond_word(p, node);
+    }
+    return node;
+}
+
+// cond_and : cond_primary (linebreak '&&' linebreak cond_primary)*
+static AstNode *parse_cond_and(Parser *p) {
+    AstNode *node = ast_new(AST_AND_OR);
+    ast_add_child(node, parse_cond_primary(p), OP_NONE);
+
+    skip_newlines(p);
+    while (!p->error && current_op(p) == OP_AND) {
+        p->pos++;
+        ast_add_child(node, parse_cond_primary(p), OP_AND);
+        skip_newlines(p);
+    }
+    return node;
+}
+
+// cond_or : cond_and (linebreak '||' linebreak cond_and)*
+static AstNode *parse_cond_or(Parser *p) {
+    AstNode *node = ast_new(AST_AND_OR);
+    ast_add_child(node, parse_cond_and(p), OP_NONE);
+
+    while (!p->error && current_op(p) == OP_OR) {
+        p->pos++;
+        ast_add_child(node, parse_cond_and(p), OP_OR);
+    }
+    return node;
+}
+
+// cond_command : '[[' cond_or linebreak ']]'
+// && || ! and ( ) work as in the expression, not as in a command list, and
+// the operands are never split or globbed
+static AstNode *parse_cond(Parser *p) {
+    AstNode *node = ast_new(AST_COND);
+    p->pos++;
+
+    ast_add_child(node, parse_cond_or(p), OP_NONE);
+    expect(p, "]]");
+    return node;
+}
+
+// Add the redirection operator at the current token and check that a
+// target word follows it
+static int add_redirection(Parser *p, AstNode *node) {
+    int op = current_op(p);
+    ast_add_word(node, (char *)operator_str(op), p->tokens[p->pos].flags);
+    p->pos++;
+    if (current_op(p) == -1) {
+        // A redirection target never continues on the next line
+        unexpected(p, "newline", 7);
+        return 0;
+    }
+    if (current_op(p) != OP_NONE) {
+        syntax_error(p);
+        return 0;
+    }
+    return 1;
+}
+
+// compound_command redirect_list
+// The redirections wrap the whole command, which runs with them in place.
+static AstNode *parse_redirect_list(Parser *p, AstNode *compound) {
+    if (p->error || !is_redirection_op(current_op(p))) {
+        return compound;
+    }
+
+    AstNode *node = ast_new(AST_REDIRECT);
+    ast_add_child(node, compound, OP_NONE);
+    while (is_redirection_op(current_op(p)) && add_redirection(p, node)) {
+        unsigned int flags = p->tokens[p->pos].flags;
+        ast_add_word(node, take_word(p), flags);
+    }
+    return node;
+}
+
+static AstNode *parse_compound(Parser *p) {
+    if (at_reserved(p, "if")) {
+        return parse_if(p);
+    }
+    if (at_reserved(p, "while")) {
+        return parse_while(p, AST_WHILE);
+    }
+    if (at_reserved(p, "until")) {
+        return parse_while(p, AST_UNTIL);
+    }
+    if (at_reserved(p, "for")) {
+        return parse_for(p);
+    }
+    if (at_reserved(p, "{")) {
+        return parse_group(p);
+    }
+    if (at_arith(p)) {
+        return parse_arith(p);
+    }
+    if (at_reserved(p, "[[")) {
+        return parse_cond(p);
+    }
+    return NULL;
+}
+
+// command : compound_command [redirect_list] | function_definition
+//         | (WORD | redirection WORD)+
+static AstNode *parse_command(Parser *p) {
+    AstNode *compound = parse_compound(p);
+    if (compound) {
+        return parse_redirect_list(p, compound);
+    }
+    if (at_reserved(p, "function")) {
+        return parse_function(p, 1);
+    }
+    if (function_name_length(p) > 0) {
+        return parse_function(p, 0);
+    }
+
+    AstNode *node = ast_new(AST_COMMAND);
+
+    while (p->pos < p->count) {
+        Token *token = &p->tokens[p->pos];
+        int op = current_op(p);
+
+        if (op == OP_NONE) {
+            // Words point into the source copy, terminated where they end
+            unsigned int flags = token->flags;
+            char *text = take_word(p);
+            if (node->assign_count == node->word_count && is_assignment(text, flags)) {
+                node->assign_count++;
+            }
+            ast_add_word(node, text, flags);
+        } else if (is_redirection_op(op)) {
+            if (!add_redirection(p, node)) {
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+
+    if (node->word_count == 0) {
+        syntax_error(p);
+    }
+    return node;
+}
+
+// pipeline : command ('|' linebreak command)*
+static AstNode *parse_pipeline(Parser *p) {
+    AstNode *node = ast_new(AST_PIPELINE);
+    ast_add_child(node, parse_command(p), OP_NONE);
+
+    while (!p->error && current_op(p) == OP_PIPE) {
+        p->pos++;
+        skip_newlines(p);
+        ast_add_child(node, parse_command(p), OP_PIPE);
+    }
+    return node;
+}
+
+// and_or : pipeline (('&&' | '||') linebreak pipeline)*
+static AstNode *parse_and_or(Parser *p) {
+    AstNode *node = ast_new(AST_AND_OR);
+    ast_add_child(node, parse_pipeline(p), OP_NONE);
+
+    while (!p->error && (current_op(p) == OP_AND || current_op(p) == OP_OR)) {
+        int op = current_op(p);
+        p->pos++;
+        skip_newlines(p);
+        ast_add_child(node, parse_pipeline(p), op);
+    }
+    return node;
+}
+
+// list : and_or ((';' | '&' | newline) and_or)*, up to a closing reserved word
+static AstNode *parse_list(Parser *p) {
+    AstNode *node = ast_new(AST_LIST);
+
+    skip_newlines(p);
+    while (!p->error && p->pos < p->count && !at_closer(p)) {
+        AstNode *child = parse_and_or(p);
+        int op = OP_SEMI;
+
+        if (!p->error) {
+            int next = current_op(p);
+            if (next == OP_AMP) {
+                op = OP_AMP;
+                p->pos++;
+            } else if (next == OP_SEMI || next == OP_NEWLINE) {
+                p->pos++;
+            } else if (next != -1 && !at_closer(p)) {
+                syntax_error(p);
+            }
+        }
+
+        ast_add_child(node, child, op);
+        skip_newlines(p);
+    }
+    return node;
+}
+
+// Parse a whole input text into a list
+static AstNode *parse_text(const char *text, int continuable, int *incomplete) {
+    Parser p;
+    TokenList tokens;
+
+    if (incomplete) {
+        *incomplete = 0;
+    }
+
+    p.source = strdup(text);
+    if (!p.source) {
+        perror("hush: memory allocation error");
+        return NULL;
+    }
+
+    token_list_init(&tokens);
+    if (hush_lex(p.source, &tokens) != 0) {
+        if (continuable) {
+            *incomplete = 1;
+        } else {
+            fprintf(stderr, "hush: syntax error: unterminated quote\n");
+            set_last_exit_status(2);
+        }
+        token_list_free(&tokens);
+        free(p.source);
+        return NULL;
+    }
+
+    p.text = text;
+    p.tokens = tokens.items;
+    p.count = tokens.count;
+    p.pos = 0;
+    p.error = 0;
+    p.continuable = continuable;
+    p.incomplete = 0;
+
+    AstNode *root = parse_list(&p);
+    root->source = p.source;
+
+    // A closing reserved word with nothing open
+    if (!p.error && p.pos < p.count) {
+        syntax_error(&p);
+    }
+    token_list_free(&tokens);
+
+    if (p.error) {
+        if (incomplete) {
+            *incomplete = p.incomplete;
+        }
+        free_ast(root);
+        return NULL;
+    }
+    return root;
+}
+
+AstNode *parse_line(const char *line) {
+    return parse_text(line, 0, NULL);
+}
+
+AstNode *parse_input(const char *text, int *incomplete) {
+    return parse_text(text, 1, incomplete);
+}
+
+int parse_block_depth(const char *line) {
+    TokenList tokens;
+    int depth = 0;
+    int command_position = 1;
+    int skip_target = 0;
+    int function_name = 0;
+
+    token_list_init(&tokens);
+    hush_lex(line, &tokens);
+
+    for (int i = 0; i < tokens.count; i++) {
+        Token *token = &tokens.items[i];
+
+        if (token->flags & HUSH_TOK_OPERATOR) {
+            int op = HUSH_TOK_OP(token->flags);
+            skip_target = is_redirection_op(op);
+            command_position = !skip_target;
+            continue;
+        }
+        const char *text = line + token->offset;
+        size_t len = token->length;
+
+        // A function body starts in command position
+        if (!skip_target && !(token->flags & HUSH_TOK_QUOTED) &&
+            (function_name || word_is(text, len, "()") ||
+             (len > 2 && text[len - 2] == '(' && text[len - 1] == ')' && is_name(text, len - 2)))) {
+            function_name = 0;
+            command_position = 1;
+            continue;
+        }
+
+        if (skip_target || !command_position || (token->flags & HUSH_TOK_QUOTED)) {
+            skip_target = 0;
+            command_position = 0;
+            continue;
+        }
+
+        if (word_is(text, len, "function")) {
+            function_name = 1;
+        } else if (word_is(text, len, "if") || word_is(text, len, "while") || word_is(text, len, "until") ||
+                   word_is(text, len, "{")) {
+            depth++;
+        } else if (word_is(text, len, "for")) {
+            depth++;
+            command_position = 0;
+        } else if (word_is(text, len, "fi") || word_is(text, len, "done") || word_is(text, len, "}")) {
+            depth--;
+            command_position = 0;
+        } else if (!(word_is(text, len, "then") || word_is(text, len, "else") ||
+                     word_is(text, len, "elif") || word_is(text, len, "do"))) {
+            command_position = 0;
+        }
+    }
+
+    token_list_free(&tokens);
+    return depth;
+}
+
+void free_ast(AstNode *node) {
+    if (!node) {
+        return;
+    }
+    for (int i = 0; i < node->child_count; i++) {
+        free_ast(node->children[i]);
+    }
+    free(node->children);
+    free(node->ops);
+    free(node->words);
+    free(node->source);
+    free(node);
+}
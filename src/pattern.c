@@ -0,0 +1,343 @@
+#include "pattern.h"
+#include "arena.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void set_add(PatternSet *set, unsigned char c) {
+    set->bits[c >> 3] |= (uint8_t)(1u << (c & 7));
+}
+
+static int set_has(const PatternSet *set, unsigned char c) {
+    return (set->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+// Named classes inside a bracket expression, [:alpha:] and friends
+static const struct {
+    const char *name;
+    int (*test)(int);
+} char_classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+// Parse the bracket expression at text[i] (just past the [) into set
+// Returns the index past the closing ], or 0 when there is none and the
+// [ is an ordinary character
+static size_t parse_set(const char *text, size_t i, size_t len, PatternSet *set) {
+    int negate = 0;
+    memset(set, 0, sizeof(*set));
+
+    if (i < len && (text[i] == '!' || text[i] == '^')) {
+        negate = 1;
+        i++;
+    }
+
+    // A ] right at the start is a member
+    int first = 1;
+    while (i < len && (text[i] != ']' || first)) {
+        first = 0;
+
+        if (text[i] == '[' && i + 1 < len && text[i + 1] == ':') {
+            const char *end = memchr(text + i + 2, ':', len - i - 2);
+            if (end && end + 1 < text + len && end[1] == ']') {
+                size_t name_len = (size_t)(end - (text + i + 2));
+                for (size_t k = 0; k < sizeof(char_classes) / sizeof(char_classes[0]); k++) {
+                    if (strlen(char_classes[k].name) == name_len &&
+                        memcmp(char_classes[k].name, text + i + 2, name_len) == 0) {
+                        for (int c = 0; c < 256; c++) {
+                            if (char_classes[k].test(c)) {
+                                set_add(set, (unsigned char)c);
+                            }
+                        }
+                    }
+                }
+                i = (size_t)(end - text) + 2;
+                continue;
+            }
+        }
+
+        unsigned char lo = (unsigned char)text[i];
+        if (lo == '\\' && i + 1 < len) {
+            lo = (unsigned char)text[++i];
+        }
+        i++;
+
+        // A range, unless the - is last
+        if (i + 1 < len && text[i] == '-' && text[i + 1] != ']') {
+            unsigned char hi = (unsigned char)text[i + 1];
+            i += 2;
+            if (hi == '\\' && i < len) {
+                hi = (unsigned char)text[i++];
+            }
+            for (int c = lo; c <= hi; c++) {
+                set_add(set, (unsigned char)c);
+            }
+        } else {
+            set_add(set, lo);
+        }
+    }
+
+    if (i >= len) {
+        return 0;
+    }
+    if (negate) {
+        for (size_t k = 0; k < sizeof(set->bits); k++) {
+            set->bits[k] = (uint8_t)~set->bits[k];
+        }
+    }
+    return i + 1;
+}
+
+static PatternOp *add_op(Pattern *pattern, int *capacity, int kind) {
+    if (pattern->count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 8;
+        pattern->ops = realloc(pattern->ops, *capacity * sizeof(PatternOp));
+        if (!pattern->ops) {
+            alloc_error();
+        }
+    }
+    PatternOp *op = &pattern->ops[pattern->count++];
+    op->kind = (uint8_t)kind;
+    op->offset = 0;
+    op->len = 0;
+    return op;
+}
+
+Pattern *pattern_compile(const char *text, size_t len) {
+    Pattern *pattern = calloc(1, sizeof(Pattern));
+    if (!pattern) {
+        alloc_error();
+    }
+    // Literal bytes never outnumber the pattern's
+    pattern->text = malloc(len + 1);
+    if (!pattern->text) {
+        alloc_error();
+    }
+
+    int capacity = 0;
+    int set_count = 0;
+    size_t text_len = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        char c = text[i];
+        PatternSet set;
+        size_t end;
+
+        if (c == '*') {
+            // Runs of stars are one star
+            if (pattern->count == 0 || pattern->ops[pattern->count - 1].kind != PAT_STAR) {
+                add_op(pattern, &capacity, PAT_STAR);
+            }
+            pattern->has_star = 1;
+            i++;
+            continue;
+        }
+        if (c == '?') {
+            add_op(pattern, &capacity, PAT_ANY);
+            pattern->min_len++;
+            i++;
+            continue;
+        }
+        if (c == '[' && (end = parse_set(text, i + 1, len, &set)) > 0) {
+            pattern->sets = realloc(pattern->sets, (set_count + 1) * sizeof(PatternSet));
+            if (!pattern->sets) {
+                alloc_error();
+            }
+            pattern->sets[set_count] = set;
+            add_op(pattern, &capacity, PAT_SET)->offset = (uint32_t)set_count++;
+            pattern->min_len++;
+            i = end;
+            continue;
+        }
+
+        if (c == '\\' && i + 1 < len) {
+            c = text[++i];
+        }
+        i++;
+
+        // Extend the previous literal run or start one
+        PatternOp *op = pattern->count > 0 ? &pattern->ops[pattern->count - 1] : NULL;
+        if (!op || op->kind != PAT_LITERAL) {
+            op = add_op(pattern, &capacity, PAT_LITERAL);
+            op->offset = (uint32_t)text_len;
+        }
+        pattern->text[text_len++] = c;
+        op->len++;
+        pattern->min_len++;
+    }
+    pattern->text[text_len] = '\0';
+
+    // The literal runs at either end, checked before anything else
+    if (pattern->count > 0 && pattern->ops[0].kind == PAT_LITERAL) {
+        pattern->head = pattern->ops[0].len;
+    }
+    if (pattern->count > 0 && pattern->ops[pattern->count - 1].kind == PAT_LITERAL) {
+        pattern->tail = pattern->ops[pattern->count - 1].len;
+    }
+    return pattern;
+}
+
+void pattern_free(Pattern *pattern) {
+    if (!pattern) {
+        return;
+    }
+    free(pattern->ops);
+    free(pattern->text);
+    free(pattern->sets);
+    free(pattern);
+}
+
+// Match ops[first..last) against all of s, backtracking to the last star
+static int match_ops(const Pattern *pattern, int first, int last, const char *s, size_t len) {
+    int op = first;
+    size_t i = 0;
+    int star_op = -1;
+    size_t star_i = 0;
+
+    for (;;) {
+        if (op < last) {
+            const PatternOp *o = &pattern->ops[op];
+            switch (o->kind) {
+                case PAT_STAR:
+                    star_op = ++op;
+                    star_i = i;
+                    continue;
+                case PAT_LITERAL:
+                    if (len - i >= o->len && memcmp(s + i, pattern->text + o->offset, o->len) == 0) {
+                        i += o->len;
+                        op++;
+                        continue;
+                    }
+                    break;
+                case PAT_ANY:
+                    if (i < len) {
+                        i++;
+                        op++;
+                        continue;
+                    }
+                    break;
+                case PAT_SET:
+                    if (i < len && set_has(&pattern->sets[o->offset], (unsigned char)s[i])) {
+                        i++;
+                        op++;
+                        continue;
+                    }
+                    break;
+            }
+        } else if (i == len) {
+            return 1;
+        }
+
+        // Let the last star take one more byte and try again
+        if (star_op < 0 || star_i >= len) {
+            return 0;
+        }
+        i = ++star_i;
+        op = star_op;
+    }
+}
+
+int pattern_match(const Pattern *pattern, const char *s, size_t len) {
+    if (len < pattern->min_len || (!pattern->has_star && len != pattern->min_len)) {
+        return 0;
+    }
+
+    // The fixed ends first, then only the middle needs the general matcher
+    int first = 0;
+    int last = pattern->count;
+    if (pattern->head) {
+        if (memcmp(s, pattern->text, pattern->head) != 0) {
+            return 0;
+        }
+        s += pattern->head;
+        len -= pattern->head;
+        first = 1;
+    }
+    if (pattern->tail && last > first) {
+        const PatternOp *o = &pattern->ops[last - 1];
+        if (len < o->len || memcmp(s + len - o->len, pattern->text + o->offset, o->len) != 0) {
+            return 0;
+        }
+        len -= o->len;
+        last--;
+    }
+    return match_ops(pattern, first, last, s, len);
+}
+
+long pattern_match_prefix(const Pattern *pattern, const char *s, size_t len, int longest) {
+    if (len < pattern->min_len) {
+        return -1;
+    }
+    if (!pattern->has_star) {
+        return pattern_match(pattern, s, pattern->min_len) ? (long)pattern->min_len : -1;
+    }
+
+    if (longest) {
+        for (size_t n = len + 1; n-- > pattern->min_len;) {
+            if (pattern_match(pattern, s, n)) {
+                return (long)n;
+            }
+        }
+    } else {
+        for (size_t n = pattern->min_len; n <= len; n++) {
+            if (pattern_match(pattern, s, n)) {
+                return (long)n;
+            }
+        }
+    }
+    return -1;
+}
+
+long pattern_match_suffix(const Pattern *pattern, const char *s, size_t len, int longest) {
+    if (len < pattern->min_len) {
+        return -1;
+    }
+    if (!pattern->has_star) {
+        size_t start = len - pattern->min_len;
+        return pattern_match(pattern, s + start, pattern->min_len) ? (long)start : -1;
+    }
+
+    if (longest) {
+        for (size_t start = 0; start + pattern->min_len <= len; start++) {
+            if (pattern_match(pattern, s + start, len - start)) {
+                return (long)start;
+            }
+        }
+    } else {
+        for (size_t start = len - pattern->min_len + 1; start-- > 0;) {
+            if (pattern_match(pattern, s + start, len - start)) {
+                return (long)start;
+            }
+        }
+    }
+    return -1;
+}
+
+long pattern_search(const Pattern *pattern, const char *s, size_t len, size_t *match_len) {
+    size_t min = pattern->min_len ? pattern->min_len : 1;
+
+    for (size_t start = 0; start + min <= len; start++) {
+        // A pattern that starts with literal text can only match where it occurs
+        if (pattern->head) {
+            const char *hit = memchr(s + start, pattern->text[0], len - start);
+            if (!hit) {
+                return -1;
+            }
+            start = (size_t)(hit - s);
+            if (start + min > len) {
+                return -1;
+            }
+        }
+        long n = pattern_match_prefix(pattern, s + start, len - start, 1);
+        if (n > 0) {
+            *match_len = (size_t)n;
+            return (long)start;
+        }
+    }
+    return -1;
+}
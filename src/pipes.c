@@ -2,7 +2,12 @@
 #include "launch.h"
 #include "redirection.h"
 #include "signals.h"
+#include "jobs.h"
+#include "variables.h"
+#include "arena.h"
+#include "input.h"
 #include <sys/wait.h>
+#include <errno.h>
 
 // External variable
 extern volatile sig_atomic_t child_running;
@@ -12,7 +17,7 @@ int is_pipe(char *token) {
     return (token != NULL && strcmp(token, "|") == 0);
 }
 
-// Split a command line by pipe symbols
+// Split a command line by pipe symbols, the words are shared with args
 char ***split_by_pipe(char **args, int *num_commands) {
     // First, count the number of commands (separated by pipes)
     int count = 1; // At least one command
@@ -23,11 +28,7 @@ char ***split_by_pipe(char **args, int *num_commands) {
     }
 
     // Allocate space for the commands array
-    char ***commands = malloc(count * sizeof(char **));
-    if (!commands) {
-        perror("hush: allocation error");
-        exit(EXIT_FAILURE);
-    }
+    char ***commands = arena_alloc(count * sizeof(char **));
 
     // Now split the args into separate commands
     int cmd_index = 0;
@@ -42,15 +43,11 @@ char ***split_by_pipe(char **args, int *num_commands) {
             }
 
             // Allocate space for this command's arguments
-            commands[cmd_index] = malloc((arg_count + 1) * sizeof(char *));
-            if (!commands[cmd_index]) {
-                perror("hush: allocation error");
-                exit(EXIT_FAILURE);
-            }
+            commands[cmd_index] = arena_alloc((arg_count + 1) * sizeof(char *));
 
             // Copy the arguments for this command
             for (int j = 0; j < arg_count; j++) {
-                commands[cmd_index][j] = strdup(args[start_index + j]);
+                commands[cmd_index][j] = args[start_index + j];
             }
             commands[cmd_index][arg_count] = NULL; // Null-terminate
 
@@ -63,6 +60,25 @@ char ***split_by_pipe(char **args, int *num_commands) {
     return commands;
 }
 
+// Wait for every process of a pipeline, $? is the status of the last one
+static void wait_for_pipeline(pid_t *pids, int count) {
+    int status = 0;
+
+    child_running = 1;
+    for (int i = 0; i < count; i++) {
+        if (pids[i] <= 0) {
+            continue;
+        }
+        while (waitpid(pids[i], &status, 0) < 0 && errno == EINTR) {
+            // Interrupted, wait again
+        }
+        if (i == count - 1) {
+            set_last_exit_status(wait_status_to_exit(status));
+        }
+    }
+    child_running = 0;
+}
+
 // Execute a pipeline of commands
 int execute_pipeline(char **args) {
     int num_commands = 0;
@@ -70,16 +86,7 @@ int execute_pipeline(char **args) {
 
     if (num_commands == 1) {
         // No pipes, just execute normally
-        int result = hush_launch(commands[0]);
-
-        // Free memory allocated for commands
-        for (int i = 0; commands[0][i] != NULL; i++) {
-            free(commands[0][i]);
-        }
-        free(commands[0]);
-        free(commands);
-
-        return result;
+        return hush_launch(commands[0]);
     }
 
     // Array to hold all pipe file descriptors
@@ -89,14 +96,6 @@ int execute_pipeline(char **args) {
     for (int i = 0; i < num_commands - 1; i++) {
         if (pipe(pipes[i]) == -1) {
             perror("hush: pipe error");
-            // Clean up
-            for (int j = 0; j < num_commands; j++) {
-                for (int k = 0; commands[j][k] != NULL; k++) {
-                    free(commands[j][k]);
-                }
-                free(commands[j]);
-            }
-            free(commands);
             return 1;
         }
     }
@@ -104,6 +103,13 @@ int execute_pipeline(char **args) {
     // Prepare to store all child PIDs
     pid_t pids[num_commands];
 
+    // Keep the SIGCHLD handler away from the children we wait for below
+    sigset_t old_mask;
+    block_sigchld(&old_mask);
+    input_sync();
+    fflush(stdout);
+    exported_environment();
+
     // Run all commands in the pipeline
     for (int i = 0; i < num_commands; i++) {
         pids[i] = fork();
@@ -114,12 +120,13 @@ int execute_pipeline(char **args) {
             exit(EXIT_FAILURE);
         } else if (pids[i] == 0) {
             // Child process
+            prepare_child_process(-1, 0);
 
             // Set up stdin from the previous pipe (if not first command)
             if (i > 0) {
                 if (dup2(pipes[i-1][0], STDIN_FILENO) == -1) {
                     perror("hush: dup2 error");
-                    exit(EXIT_FAILURE);
+                    _exit(EXIT_FAILURE);
                 }
             }
 
@@ -127,7 +134,7 @@ int execute_pipeline(char **args) {
             if (i < num_commands - 1) {
                 if (dup2(pipes[i][1], STDOUT_FILENO) == -1) {
                     perror("hush: dup2 error");
-                    exit(EXIT_FAILURE);
+                    _exit(EXIT_FAILURE);
                 }
             }
 
@@ -144,7 +151,7 @@ int execute_pipeline(char **args) {
             // Execute the command
             if (execvp(clean_args[0], clean_args) == -1) {
                 perror("hush");
-                exit(EXIT_FAILURE);
+                _exit(EXIT_FAILURE);
             }
         }
     }
@@ -156,23 +163,85 @@ int execute_pipeline(char **args) {
     }
 
     // Wait for all child processes to finish
-    child_running = 1;
-    int status;
+    wait_for_pipeline(pids, num_commands);
+    restore_sigmask(&old_mask);
+
+    return 1;
+}
+
+// Execute a compiled pipeline, every stage runs in its own forked subshell
+int execute_pipeline_stages(int num_commands, pipeline_stage_fn stage, void *data) {
+    int pipes[num_commands - 1][2];
+    pid_t pids[num_commands];
+
     for (int i = 0; i < num_commands; i++) {
-        do {
-            waitpid(pids[i], &status, WUNTRACED);
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+        pids[i] = 0;
     }
-    child_running = 0;
 
-    // Clean up memory
+    // Create all pipes
+    for (int i = 0; i < num_commands - 1; i++) {
+        if (pipe(pipes[i]) == -1) {
+            perror("hush: pipe error");
+            for (int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            set_last_exit_status(1);
+            return 1;
+        }
+    }
+
+    // Keep the SIGCHLD handler away from the children we wait for below
+    sigset_t old_mask;
+    block_sigchld(&old_mask);
+    input_sync();
+    fflush(stdout);
+    exported_environment();
+
     for (int i = 0; i < num_commands; i++) {
-        for (int j = 0; commands[i][j] != NULL; j++) {
-            free(commands[i][j]);
+        pids[i] = fork();
+
+        if (pids[i] < 0) {
+            perror("hush: fork error");
+            break;
+        }
+
+        if (pids[i] == 0) {
+            prepare_child_process(-1, 0);
+
+            // Set up stdin from the previous pipe (if not first command)
+            if (i > 0 && dup2(pipes[i-1][0], STDIN_FILENO) == -1) {
+                perror("hush: dup2 error");
+                _exit(EXIT_FAILURE);
+            }
+            if (i > 0) {
+                input_reset();
+            }
+
+            // Set up stdout to the next pipe (if not last command)
+            if (i < num_commands - 1 && dup2(pipes[i][1], STDOUT_FILENO) == -1) {
+                perror("hush: dup2 error");
+                _exit(EXIT_FAILURE);
+            }
+
+            // Close all pipe file descriptors in the child
+            for (int j = 0; j < num_commands - 1; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+
+            stage(i, data);
         }
-        free(commands[i]);
     }
-    free(commands);
+
+    // Parent process closes all pipe file descriptors
+    for (int i = 0; i < num_commands - 1; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+
+    wait_for_pipeline(pids, num_commands);
+    restore_sigmask(&old_mask);
 
     return 1;
 }
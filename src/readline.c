@@ -1,5 +1,6 @@
 #include "readline.h"
 #include "completion.h"
+#include "input.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -119,6 +120,11 @@ void hush_readline_init(void) {
 
 // Read a line using readline
 char *hush_read_line(void) {
+    // Output still buffered has to show before the prompt, and input read
+    // ahead goes back for readline
+    input_sync();
+    fflush(stdout);
+
     // Set the prompt
     char *line = readline("$ ");
 
@@ -1,4 +1,7 @@
 #include "redirection.h"
+#include "lexer.h"
+#include "arena.h"
+#include "input.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -14,40 +17,67 @@ int is_redirection(char *token) {
             strcmp(token, "<<") == 0);
 }
 
+int redirection_failed = 0;
+
+// Keep a copy of a standard descriptor the first time a redirection
+// replaces it, only what was replaced is restored afterwards
+// Whatever the read builtin buffered from standard input is put aside.
+static int save_fd(int target, int *copy) {
+    if (*copy != -1) {
+        return 1;
+    }
+    *copy = dup(target);
+    if (*copy == -1) {
+        return 0;
+    }
+    if (target == STDIN_FILENO) {
+        input_push();
+    }
+    return 1;
+}
+
 // Setup redirection based on command arguments
 // Returns new args array with redirection operators removed
 char **setup_redirection(char **args, int *stdin_copy, int *stdout_copy, int *stderr_copy) {
-    // Make copies of the standard file descriptors
-    *stdin_copy = dup(STDIN_FILENO);
-    *stdout_copy = dup(STDOUT_FILENO);
-    *stderr_copy = dup(STDERR_FILENO);
-
-    if (*stdin_copy == -1 || *stdout_copy == -1 || *stderr_copy == -1) {
-        perror("hush: dup error");
-        return args;
-    }
+    return setup_redirection_flags(args, NULL, stdin_copy, stdout_copy, stderr_copy);
+}
 
+// Setup redirection, trusting the lexer flags (if given) to identify operators
+char **setup_redirection_flags(char **args, const unsigned int *flags,
+                               int *stdin_copy, int *stdout_copy, int *stderr_copy) {
     // Count number of arguments
     int argc = 0;
+    int redirects = 0;
     while (args[argc] != NULL) {
+        redirects |= flags ? is_redirection_op(HUSH_TOK_OP(flags[argc])) : is_redirection(args[argc]);
         argc++;
     }
 
-    // Allocate new array for cleaned arguments (without redirection)
-    char **new_args = malloc((argc + 1) * sizeof(char *));
-    if (new_args == NULL) {
-        perror("hush: allocation error");
+    // Most commands have no redirections and nothing to save or restore
+    *stdin_copy = *stdout_copy = *stderr_copy = -1;
+    redirection_failed = 0;
+    if (!redirects) {
         return args;
     }
 
+    // Buffered output was written before the redirection, it goes to the
+    // old standard output
+    fflush(stdout);
+
+    // Allocate new array for cleaned arguments (without redirection)
+    char **new_args = arena_alloc((argc + 1) * sizeof(char *));
+
     int new_argc = 0;
     int here_doc = 0;  // Flag to indicate if we're processing a here document
     char *delimiter = NULL;  // Delimiter for here document
     char *here_doc_content = NULL;  // Content of here document
 
-    // Process all arguments, looking for redirection operators
-    for (int i = 0; i < argc; i++) {
-        if (is_redirection(args[i])) {
+    // Process all arguments, looking for redirection operators, stopping
+    // at the first one that fails
+    int i;
+    for (i = 0; i < argc; i++) {
+        int redirect = flags ? is_redirection_op(HUSH_TOK_OP(flags[i])) : is_redirection(args[i]);
+        if (redirect) {
             // It's a redirection operator
             if (i + 1 < argc) { // Make sure there's a filename/delimiter after
                 int fd; // File descriptor for the redirection
@@ -59,7 +89,7 @@ char **setup_redirection(char **args, int *stdin_copy, int *stdout_copy, int *st
                         perror("hush: input redirection error");
                         break;
                     }
-                    if (dup2(fd, STDIN_FILENO) == -1) {
+                    if (!save_fd(STDIN_FILENO, stdin_copy) || dup2(fd, STDIN_FILENO) == -1) {
                         perror("hush: dup2 error");
                         close(fd);
                         break;
@@ -73,7 +103,7 @@ char **setup_redirection(char **args, int *stdin_copy, int *stdout_copy, int *st
                         perror("hush: output redirection error");
                         break;
                     }
-                    if (dup2(fd, STDOUT_FILENO) == -1) {
+                    if (!save_fd(STDOUT_FILENO, stdout_copy) || dup2(fd, STDOUT_FILENO) == -1) {
                         perror("hush: dup2 error");
                         close(fd);
                         break;
@@ -87,7 +117,7 @@ char **setup_redirection(char **args, int *stdin_copy, int *stdout_copy, int *st
                         perror("hush: output redirection error");
                         break;
                     }
-                    if (dup2(fd, STDOUT_FILENO) == -1) {
+                    if (!save_fd(STDOUT_FILENO, stdout_copy) || dup2(fd, STDOUT_FILENO) == -1) {
                         perror("hush: dup2 error");
                         close(fd);
                         break;
@@ -101,7 +131,7 @@ char **setup_redirection(char **args, int *stdin_copy, int *stdout_copy, int *st
                         perror("hush: error redirection error");
                         break;
                     }
-                    if (dup2(fd, STDERR_FILENO) == -1) {
+                    if (!save_fd(STDERR_FILENO, stderr_copy) || dup2(fd, STDERR_FILENO) == -1) {
                         perror("hush: dup2 error");
                         close(fd);
                         break;
@@ -115,7 +145,7 @@ char **setup_redirection(char **args, int *stdin_copy, int *stdout_copy, int *st
                         perror("hush: error redirection error");
                         break;
                     }
-                    if (dup2(fd, STDERR_FILENO) == -1) {
+                    if (!save_fd(STDERR_FILENO, stderr_copy) || dup2(fd, STDERR_FILENO) == -1) {
                         perror("hush: dup2 error");
                         close(fd);
                         break;
@@ -130,7 +160,8 @@ char **setup_redirection(char **args, int *stdin_copy, int *stdout_copy, int *st
                         break;
                     }
                     // Redirect both stdout and stderr to the same file
-                    if (dup2(fd, STDOUT_FILENO) == -1 || dup2(fd, STDERR_FILENO) == -1) {
+                    if (!save_fd(STDOUT_FILENO, stdout_copy) || !save_fd(STDERR_FILENO, stderr_copy) ||
+                        dup2(fd, STDOUT_FILENO) == -1 || dup2(fd, STDERR_FILENO) == -1) {
                         perror("hush: dup2 error");
                         close(fd);
                         break;
@@ -193,7 +224,7 @@ char **setup_redirection(char **args, int *stdin_copy, int *stdout_copy, int *st
                     }
 
                     // Redirect stdin from this temp file
-                    if (dup2(fd, STDIN_FILENO) == -1) {
+                    if (!save_fd(STDIN_FILENO, stdin_copy) || dup2(fd, STDIN_FILENO) == -1) {
                         perror("hush: dup2 error");
                         close(fd);
                         break;
@@ -215,15 +246,22 @@ char **setup_redirection(char **args, int *stdin_copy, int *stdout_copy, int *st
 
     // Null-terminate the new args array
     new_args[new_argc] = NULL;
+    redirection_failed = i < argc;
 
     return new_args;
 }
 
 // Reset file descriptors after a command completes
 void reset_redirection(int stdin_copy, int stdout_copy, int stderr_copy) {
+    // Output must reach the redirected descriptor before it is restored
+    if (stdout_copy != -1) {
+        fflush(stdout);
+    }
+
     if (stdin_copy != -1) {
         dup2(stdin_copy, STDIN_FILENO);
         close(stdin_copy);
+        input_pop();
     }
 
     if (stdout_copy != -1) {
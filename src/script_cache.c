@@ -0,0 +1,346 @@
+#include "script_cache.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "HUSHBC\r\n"
+#define CACHE_VERSION 11
+
+// Fixed-size header at the start of every cache file
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t instr_size;     // Guards against a changed instruction layout
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint64_t hash;           // Content hash of the script
+    uint32_t path_len;       // Absolute script path follows the header
+    uint32_t code_count;
+    uint32_t word_count;
+    uint32_t slot_count;
+    uint64_t strings_len;
+} CacheHeader;
+
+// 64-bit FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const unsigned char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+#define HASH_INIT 14695981039346656037ULL
+
+int script_cache_hash(FILE *file, uint64_t *hash) {
+    unsigned char buffer[16384];
+    size_t n;
+    uint64_t h = HASH_INIT;
+
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        h = hash_bytes(h, buffer, n);
+    }
+    if (ferror(file)) {
+        return -1;
+    }
+
+    rewind(file);
+    *hash = h;
+    return 0;
+}
+
+// Find the cache directory, NULL when caching is disabled
+static char *cache_dir(void) {
+    const char *dir = getenv("HUSH_CACHE_DIR");
+    char path[PATH_MAX];
+
+    if (dir) {
+        if (dir[0] == '\0') {
+            return NULL;
+        }
+        return strdup(dir);
+    }
+
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0] == '/') {
+        snprintf(path, sizeof(path), "%s/hush", xdg);
+        return strdup(path);
+    }
+
+    const char *home = getenv("HOME");
+    if (!home || home[0] == '\0') {
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/.cache/hush", home);
+    return strdup(path);
+}
+
+// Create a directory and any missing parents
+static int make_dirs(char *dir) {
+    for (char *p = dir + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+                *p = '/';
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+// Build the cache file name for a script from a hash of its absolute path
+static int cache_file(const char *abs_path, char *out, size_t size, int create_dir) {
+    char *dir = cache_dir();
+    if (!dir) {
+        return -1;
+    }
+    if (create_dir && make_dirs(dir) < 0) {
+        free(dir);
+        return -1;
+    }
+
+    uint64_t key = hash_bytes(HASH_INIT, (const unsigned char *)abs_path, strlen(abs_path));
+    int n = snprintf(out, size, "%s/%016llx.hbc", dir, (unsigned long long)key);
+    free(dir);
+
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+// Check that every index in a loaded program stays in bounds
+static int program_is_valid(const Program *prog) {
+    uint32_t code_count = (uint32_t)prog->code_count;
+
+    if (code_count == 0 || prog->code[code_count - 1].op != BC_HALT) {
+        return 0;
+    }
+    if (prog->strings_len > 0 && prog->strings[prog->strings_len - 1] != '\0') {
+        return 0;
+    }
+
+    for (int i = 0; i < prog->word_count; i++) {
+        if (prog->words[i].offset >= prog->strings_len) {
+            return 0;
+        }
+    }
+
+    for (uint32_t pc = 0; pc < code_count; pc++) {
+        const Instr *instr = &prog->code[pc];
+
+        switch (instr->op) {
+            case BC_PUSH:
+            case BC_EXPAND:
+                if (instr->a >= (uint32_t)prog->word_count) {
+                    return 0;
+                }
+                break;
+            case BC_ASSIGN:
+                if (instr->a >= (uint32_t)prog->word_count ||
+                    !strchr(prog->strings + prog->words[instr->a].offset, '=')) {
+                    return 0;
+                }
+                break;
+            case BC_ARITH:
+                if (instr->a >= prog->strings_len) {
+                    return 0;
+                }
+                break;
+            case BC_COND_UNARY:
+                if (instr->a >= (uint32_t)prog->word_count ||
+                    !test_unary_op((char[]){ '-', (char)instr->flags, '\0' })) {
+                    return 0;
+                }
+                break;
+            case BC_COND:
+                if (instr->a >= (uint32_t)prog->word_count || instr->b >= (uint32_t)prog->word_count ||
+                    instr->flags == TEST_NONE || instr->flags >= TEST_BINARY_COUNT) {
+                    return 0;
+                }
+                break;
+            case BC_FUNCTION:
+                if (instr->b >= prog->strings_len) {
+                    return 0;
+                }
+                // fall through
+            case BC_FOR_INIT:
+                // The loop variable must be a name the VM can intern
+                if (instr->a >= (uint32_t)prog->word_count ||
+                    !(prog->words[instr->a].flags & HUSH_TOK_INTERNED)) {
+                    return 0;
+                }
+                break;
+            case BC_SLOT_SAVE:
+            case BC_SLOT_LOAD:
+                if (instr->a >= (uint32_t)prog->slot_count) {
+                    return 0;
+                }
+                break;
+            case BC_PIPELINE:
+                if (instr->b < 2 || instr->b >= code_count - pc) {
+                    return 0;
+                }
+                for (uint32_t i = 1; i <= instr->b; i++) {
+                    if (prog->code[pc + i].op != BC_STAGE) {
+                        return 0;
+                    }
+                }
+                // fall through
+            case BC_JUMP:
+            case BC_JUMP_IF_OK:
+            case BC_JUMP_IF_FAIL:
+            case BC_FOR_NEXT:
+            case BC_STAGE:
+            case BC_REDIRECT:
+                if (instr->a >= code_count) {
+                    return 0;
+                }
+                break;
+            case BC_BACKGROUND:
+                if (instr->a >= code_count || instr->b >= prog->strings_len) {
+                    return 0;
+                }
+                break;
+            case BC_HALT:
+            case BC_EXEC:
+            case BC_STATUS:
+            case BC_FOR_POP:
+            case BC_EXIT:
+            case BC_NOT:
+            case BC_UNREDIRECT:
+                break;
+            default:
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// Read exactly n bytes
+static int read_all(FILE *file, void *buf, size_t n) {
+    return n == 0 || fread(buf, 1, n, file) == n;
+}
+
+Program *script_cache_load(const char *path, const struct stat *st, uint64_t hash) {
+    char abs_path[PATH_MAX];
+    char file_name[PATH_MAX];
+
+    if (!realpath(path, abs_path) || cache_file(abs_path, file_name, sizeof(file_name), 0) < 0) {
+        return NULL;
+    }
+
+    FILE *file = fopen(file_name, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    CacheHeader header;
+    size_t path_len = strlen(abs_path);
+    if (!read_all(file, &header, sizeof(header)) ||
+        memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.instr_size != sizeof(Instr) ||
+        header.mtime_sec != (int64_t)st->st_mtim.tv_sec ||
+        header.mtime_nsec != (int64_t)st->st_mtim.tv_nsec ||
+        header.size != (int64_t)st->st_size ||
+        header.hash != hash ||
+        header.path_len != path_len ||
+        header.code_count > INT_MAX / sizeof(Instr) ||
+        header.word_count > INT_MAX / sizeof(ProgWord) ||
+        header.slot_count > INT_MAX ||
+        header.strings_len > UINT32_MAX) {
+        fclose(file);
+        return NULL;
+    }
+
+    // The path guards against two scripts whose path hashes collide
+    char stored_path[PATH_MAX];
+    if (!read_all(file, stored_path, path_len) || memcmp(stored_path, abs_path, path_len) != 0) {
+        fclose(file);
+        return NULL;
+    }
+
+    Program *prog = calloc(1, sizeof(Program));
+    if (!prog) {
+        fclose(file);
+        return NULL;
+    }
+    prog->code = malloc(header.code_count * sizeof(Instr) + 1);
+    prog->words = malloc(header.word_count * sizeof(ProgWord) + 1);
+    prog->strings = malloc(header.strings_len + 1);
+    prog->code_count = prog->code_capacity = (int)header.code_count;
+    prog->word_count = prog->word_capacity = (int)header.word_count;
+    prog->strings_len = prog->strings_capacity = header.strings_len;
+    prog->slot_count = (int)header.slot_count;
+
+    int ok = prog->code && prog->words && prog->strings &&
+             read_all(file, prog->code, header.code_count * sizeof(Instr)) &&
+             read_all(file, prog->words, header.word_count * sizeof(ProgWord)) &&
+             read_all(file, prog->strings, header.strings_len) &&
+             fgetc(file) == EOF &&
+             program_is_valid(prog);
+    fclose(file);
+
+    if (!ok) {
+        free_program(prog);
+        return NULL;
+    }
+    program_resolve_names(prog);
+    return prog;
+}
+
+void script_cache_store(const char *path, const struct stat *st, uint64_t hash,
+                        const Program *prog) {
+    char abs_path[PATH_MAX];
+    char file_name[PATH_MAX];
+    char temp_name[PATH_MAX + 8];
+
+    if (!realpath(path, abs_path) || cache_file(abs_path, file_name, sizeof(file_name), 1) < 0) {
+        return;
+    }
+
+    // Write a temporary file and rename it so readers never see half an entry
+    snprintf(temp_name, sizeof(temp_name), "%s.XXXXXX", file_name);
+    int fd = mkstemp(temp_name);
+    if (fd < 0) {
+        return;
+    }
+    FILE *file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(temp_name);
+        return;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.instr_size = sizeof(Instr);
+    header.mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    header.mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+    header.size = (int64_t)st->st_size;
+    header.hash = hash;
+    header.path_len = (uint32_t)strlen(abs_path);
+    header.code_count = (uint32_t)prog->code_count;
+    header.word_count = (uint32_t)prog->word_count;
+    header.slot_count = (uint32_t)prog->slot_count;
+    header.strings_len = prog->strings_len;
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(abs_path, 1, header.path_len, file) == header.path_len &&
+             fwrite(prog->code, sizeof(Instr), prog->code_count, file) == (size_t)prog->code_count &&
+             fwrite(prog->words, sizeof(ProgWord), prog->word_count, file) == (size_t)prog->word_count &&
+             fwrite(prog->strings, 1, prog->strings_len, file) == prog->strings_len;
+
+    if (fclose(file) != 0 || !ok || rename(temp_name, file_name) < 0) {
+        unlink(temp_name);
+    }
+}
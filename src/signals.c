@@ -54,6 +54,17 @@ void handle_sigwinch(int sig) {
     signal(SIGWINCH, handle_sigwinch);
 }
 
+void block_sigchld(sigset_t *old_mask) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, old_mask);
+}
+
+void restore_sigmask(const sigset_t *old_mask) {
+    sigprocmask(SIG_SETMASK, old_mask, NULL);
+}
+
 void setup_signal_handlers(void) {
     // Use simple signal() for this basic implementation
     signal(SIGINT, handle_sigint);
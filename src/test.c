@@ -0,0 +1,461 @@
+#include "test.h"
+#include "arena.h"
+#include "variables.h"
+#include "arith.h"
+#include "pattern.h"
+#include "text_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <regex.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// test and [
+// The operand count picks the meaning first, as POSIX specifies for up to
+// four operands; longer expressions go through a recursive parser with
+// ! -a -o and parentheses. Each file operand is looked at with one system
+// call: fstatat, or faccessat for -r -w -x.
+
+typedef struct {
+    char **args;
+    int count;
+    int pos;          // Next operand, for the expression parser
+    int error;        // Set once a message was printed
+    const char *name; // test or [
+} TestState;
+
+static void test_error(TestState *t, const char *arg, const char *message) {
+    if (!t->error) {
+        if (arg) {
+            fprintf(stderr, "hush: %s: %s: %s\n", t->name, arg, message);
+        } else {
+            fprintf(stderr, "hush: %s: %s\n", t->name, message);
+        }
+        t->error = 1;
+    }
+}
+
+char test_unary_op(const char *s) {
+    return s[0] == '-' && s[1] && !s[2] && strchr("bcdefghkprstuwxGLNOSnzv", s[1]) ? s[1] : 0;
+}
+
+TestBinary test_binary_op(const char *s, int connectives) {
+    static const struct {
+        const char *text;
+        TestBinary op;
+    } ops[] = {
+        { "=", TEST_STR_EQ }, { "==", TEST_STR_EQ }, { "!=", TEST_STR_NE },
+        { "<", TEST_STR_LT }, { ">", TEST_STR_GT },
+        { "-eq", TEST_EQ }, { "-ne", TEST_NE }, { "-lt", TEST_LT },
+        { "-le", TEST_LE }, { "-gt", TEST_GT }, { "-ge", TEST_GE },
+        { "-nt", TEST_NEWER }, { "-ot", TEST_OLDER }, { "-ef", TEST_SAME_FILE },
+        { "-a", TEST_AND }, { "-o", TEST_OR },
+    };
+
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(s, ops[i].text) == 0) {
+            return (ops[i].op == TEST_AND || ops[i].op == TEST_OR) && !connectives ? TEST_NONE : ops[i].op;
+        }
+    }
+    return TEST_NONE;
+}
+
+// A decimal integer operand, blanks around it allowed
+static int test_integer(TestState *t, const char *s, long long *value) {
+    char *end;
+    errno = 0;
+    *value = strtoll(s, &end, 10);
+    while (isspace((unsigned char)*end)) {
+        end++;
+    }
+    if (end == s || *end || errno == ERANGE) {
+        test_error(t, s, "integer expression expected");
+        return 0;
+    }
+    return 1;
+}
+
+static int test_file(char op, const char *path) {
+    struct stat st;
+
+    switch (op) {
+        case 'r':
+            return faccessat(AT_FDCWD, path, R_OK, AT_EACCESS) == 0;
+        case 'w':
+            return faccessat(AT_FDCWD, path, W_OK, AT_EACCESS) == 0;
+        case 'x':
+            return faccessat(AT_FDCWD, path, X_OK, AT_EACCESS) == 0;
+    }
+
+    // -h and -L look at a link itself, everything else at its target
+    int flags = (op == 'h' || op == 'L') ? AT_SYMLINK_NOFOLLOW : 0;
+    if (fstatat(AT_FDCWD, path, &st, flags) != 0) {
+        return 0;
+    }
+
+    switch (op) {
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'f': return S_ISREG(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 'h':
+        case 'L': return S_ISLNK(st.st_mode);
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'u': return (st.st_mode & S_ISUID) != 0;
+        case 'k': return (st.st_mode & S_ISVTX) != 0;
+        case 's': return st.st_size > 0;
+        case 'O': return st.st_uid == geteuid();
+        case 'G': return st.st_gid == getegid();
+        case 'N':
+            return st.st_mtim.tv_sec > st.st_atim.tv_sec ||
+                   (st.st_mtim.tv_sec == st.st_atim.tv_sec && st.st_mtim.tv_nsec > st.st_atim.tv_nsec);
+        default: return 1;  // -e
+    }
+}
+
+static int test_unary(TestState *t, char op, const char *arg) {
+    long long fd;
+
+    switch (op) {
+        case 'n':
+            return arg[0] != '\0';
+        case 'z':
+            return arg[0] == '\0';
+        case 't':
+            return test_integer(t, arg, &fd) && fd >= 0 && fd <= INT_MAX && isatty((int)fd);
+        case 'v': {
+            VarView view;
+            return lookup_variable(arg, strlen(arg), &view);
+        }
+        default:
+            return test_file(op, arg);
+    }
+}
+
+static int test_binary(TestState *t, const char *a, TestBinary op, const char *b) {
+    long long x, y;
+    struct stat sa, sb;
+    int has_a, has_b;
+
+    switch (op) {
+        case TEST_STR_EQ: return strcmp(a, b) == 0;
+        case TEST_STR_NE: return strcmp(a, b) != 0;
+        case TEST_STR_LT: return strcmp(a, b) < 0;
+        case TEST_STR_GT: return strcmp(a, b) > 0;
+        case TEST_AND: return a[0] && b[0];
+        case TEST_OR: return a[0] || b[0];
+
+        case TEST_NEWER:
+        case TEST_OLDER:
+        case TEST_SAME_FILE:
+            has_a = fstatat(AT_FDCWD, a, &sa, 0) == 0;
+            has_b = fstatat(AT_FDCWD, b, &sb, 0) == 0;
+            if (op == TEST_SAME_FILE) {
+                return has_a && has_b && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+            }
+            // A file that exists is newer than one that does not
+            if (!has_a || !has_b) {
+                return op == TEST_NEWER ? has_a : has_b;
+            }
+            if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec) {
+                return op == TEST_NEWER ? sa.st_mtim.tv_sec > sb.st_mtim.tv_sec
+                                        : sa.st_mtim.tv_sec < sb.st_mtim.tv_sec;
+            }
+            return op == TEST_NEWER ? sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec
+                                    : sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec;
+
+        default:
+            if (!test_integer(t, a, &x) || !test_integer(t, b, &y)) {
+                return 0;
+            }
+            switch (op) {
+                case TEST_EQ: return x == y;
+                case TEST_NE: return x != y;
+                case TEST_LT: return x < y;
+                case TEST_LE: return x <= y;
+                case TEST_GT: return x > y;
+                default: return x >= y;
+            }
+    }
+}
+
+static int test_or(TestState *t);
+
+// ( expr ) | unary-op operand | operand binary-op operand | operand
+static int test_primary(TestState *t) {
+    if (t->pos >= t->count) {
+        test_error(t, NULL, "argument expected");
+        return 0;
+    }
+    char **args = t->args;
+    const char *arg = args[t->pos];
+
+    // A binary operator next wins, so [ -f = -f ] compares strings
+    TestBinary op;
+    if (t->pos + 2 < t->count && (op = test_binary_op(args[t->pos + 1], 0)) != TEST_NONE) {
+        t->pos += 3;
+        return test_binary(t, arg, op, args[t->pos - 1]);
+    }
+    if (strcmp(arg, "(") == 0) {
+        t->pos++;
+        int result = test_or(t);
+        if (t->pos >= t->count || strcmp(args[t->pos], ")") != 0) {
+            test_error(t, NULL, "`)' expected");
+            return 0;
+        }
+        t->pos++;
+        return result;
+    }
+    if (test_unary_op(arg) && t->pos + 1 < t->count) {
+        t->pos += 2;
+        return test_unary(t, arg[1], args[t->pos - 1]);
+    }
+    t->pos++;
+    return arg[0] != '\0';
+}
+
+static int test_not(TestState *t) {
+    if (t->pos < t->count && strcmp(t->args[t->pos], "!") == 0) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static int test_and(TestState *t) {
+    int result = test_not(t);
+    while (!t->error && t->pos < t->count && strcmp(t->args[t->pos], "-a") == 0) {
+        t->pos++;
+        int right = test_not(t);
+        result = result && right;
+    }
+    return result;
+}
+
+static int test_or(TestState *t) {
+    int result = test_and(t);
+    while (!t->error && t->pos < t->count && strcmp(t->args[t->pos], "-o") == 0) {
+        t->pos++;
+        int right = test_and(t);
+        result = result || right;
+    }
+    return result;
+}
+
+// Evaluate args[0..count), by operand count up to four
+static int test_count(TestState *t, char **args, int count) {
+    TestBinary op;
+
+    switch (count) {
+        case 0:
+            return 0;
+        case 1:
+            return args[0][0] != '\0';
+        case 2:
+            if (strcmp(args[0], "!") == 0) {
+                return args[1][0] == '\0';
+            }
+            if (test_unary_op(args[0])) {
+                return test_unary(t, args[0][1], args[1]);
+            }
+            test_error(t, args[0], "unary operator expected");
+            return 0;
+        case 3:
+            if ((op = test_binary_op(args[1], 1)) != TEST_NONE) {
+                return test_binary(t, args[0], op, args[2]);
+            }
+            if (strcmp(args[0], "!") == 0) {
+                return !test_count(t, args + 1, 2);
+            }
+            if (strcmp(args[0], "(") == 0 && strcmp(args[2], ")") == 0) {
+                return args[1][0] != '\0';
+            }
+            break;
+        case 4:
+            if (strcmp(args[0], "!") == 0) {
+                return !test_count(t, args + 1, 3);
+            }
+            if (strcmp(args[0], "(") == 0 && strcmp(args[3], ")") == 0) {
+                return test_count(t, args + 1, 2);
+            }
+            break;
+    }
+
+    TestState sub = { args, count, 0, 0, t->name };
+    int result = test_or(&sub);
+    if (!sub.error && sub.pos < count) {
+        test_error(&sub, args[sub.pos], "too many arguments");
+    }
+    t->error |= sub.error;
+    return result;
+}
+
+int hush_test(char **args) {
+    int count = 0;
+    while (args[count + 1]) {
+        count++;
+    }
+
+    TestState t = { args + 1, count, 0, 0, args[0] };
+    if (strcmp(args[0], "[") == 0) {
+        if (count == 0 || strcmp(args[count], "]") != 0) {
+            test_error(&t, NULL, "missing `]'");
+            set_last_exit_status(2);
+            return 1;
+        }
+        t.count--;
+    }
+
+    int result = test_count(&t, t.args, t.count);
+    set_last_exit_status(t.error ? 2 : !result);
+    return 1;
+}
+
+// [[ ]]
+// The compiler has already split the expression into primaries, so these
+// only evaluate one operator. Patterns and regular expressions come from a
+// cache keyed by their text and kind, so a loop matching against the same
+// one compiles it once.
+
+typedef struct {
+    Pattern *pattern;   // For a pattern
+    regex_t compiled;   // For a regular expression
+} Matcher;
+
+#define MATCHER_CACHE_SIZE 64
+
+static void free_matcher(void *value, int regex) {
+    Matcher *m = value;
+    if (regex) {
+        regfree(&m->compiled);
+    } else {
+        pattern_free(m->pattern);
+    }
+    free(m);
+}
+
+static TextCacheEntry matcher_entries[MATCHER_CACHE_SIZE];
+static TextCache matchers = TEXT_CACHE_INIT(matcher_entries, MATCHER_CACHE_SIZE, free_matcher);
+
+// Find or compile the matcher for text
+// Returns NULL after printing a message if a regular expression is invalid.
+static Matcher *get_matcher(const char *text, int regex) {
+    Matcher *m = text_cache_find(&matchers, text, regex);
+    if (m) {
+        return m;
+    }
+
+    m = malloc(sizeof(Matcher));
+    if (!m) {
+        alloc_error();
+    }
+    if (regex) {
+        int err = regcomp(&m->compiled, text, REG_EXTENDED);
+        if (err != 0) {
+            char message[256];
+            regerror(err, &m->compiled, message, sizeof(message));
+            fprintf(stderr, "hush: [[: %s: %s\n", text, message);
+            free(m);
+            return NULL;
+        }
+    } else {
+        m->pattern = pattern_compile(text, strlen(text));
+    }
+
+    text_cache_store(&matchers, text, regex, m);
+    return m;
+}
+
+// Match s against a regular expression, setting BASH_REMATCH to the match
+// and its groups, or unsetting it when there is none
+static int cond_regex(const char *s, const char *re) {
+    Matcher *m = get_matcher(re, 1);
+    if (!m) {
+        return 2;
+    }
+
+    regmatch_t stack_groups[10];
+    size_t count = m->compiled.re_nsub + 1;
+    regmatch_t *groups = stack_groups;
+    if (count > sizeof(stack_groups) / sizeof(stack_groups[0])) {
+        groups = malloc(count * sizeof(regmatch_t));
+        if (!groups) {
+            alloc_error();
+        }
+    }
+
+    int status = regexec(&m->compiled, s, count, groups, 0) == 0 ? 0 : 1;
+    unset_shell_variable("BASH_REMATCH");
+    if (status == 0) {
+        declare_array("BASH_REMATCH", VAR_INDEXED);
+        for (size_t i = 0; i < count; i++) {
+            char key[ARITH_NUMBER_MAX];
+            size_t key_len = arith_format((int64_t)i, key);
+            if (groups[i].rm_so < 0) {
+                set_element("BASH_REMATCH", key, key_len, "", 0);
+            } else {
+                set_element("BASH_REMATCH", key, key_len, s + groups[i].rm_so,
+                            (size_t)(groups[i].rm_eo - groups[i].rm_so));
+            }
+        }
+    }
+
+    if (groups != stack_groups) {
+        free(groups);
+    }
+    return status;
+}
+
+int cond_unary(char op, const char *arg) {
+    TestState t = { NULL, 0, 0, 0, "[[" };
+    int result = test_unary(&t, op, arg);
+    return t.error ? 2 : !result;
+}
+
+int cond_binary(const char *left, TestBinary op, const char *right) {
+    int64_t x, y;
+
+    switch (op) {
+        case TEST_MATCH:
+        case TEST_NO_MATCH: {
+            Matcher *m = get_matcher(right, 0);
+            int match = pattern_match(m->pattern, left, strlen(left));
+            return op == TEST_MATCH ? !match : match;
+        }
+
+        case TEST_REGEX:
+            return cond_regex(left, right);
+
+        // Integer operands are arithmetic expressions here
+        case TEST_EQ:
+        case TEST_NE:
+        case TEST_LT:
+        case TEST_LE:
+        case TEST_GT:
+        case TEST_GE:
+            if (!arith_evaluate(left, &x) || !arith_evaluate(right, &y)) {
+                return 2;
+            }
+            switch (op) {
+                case TEST_EQ: return x != y;
+                case TEST_NE: return x == y;
+                case TEST_LT: return x >= y;
+                case TEST_LE: return x > y;
+                case TEST_GT: return x <= y;
+                default: return x < y;
+            }
+
+        default: {
+            TestState t = { NULL, 0, 0, 0, "[[" };
+            int result = test_binary(&t, left, op, right);
+            return t.error ? 2 : !result;
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#include "text_cache.h"
+#include "arena.h"
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Find the entry holding text and kind, or the empty entry where it would go
+static TextCacheEntry *find_entry(const TextCache *cache, const char *text, int kind) {
+    size_t mask = cache->size - 1;
+    size_t i = hash_text(text, strlen(text), (uint32_t)kind) & mask;
+    while (cache->entries[i].text) {
+        TextCacheEntry *entry = &cache->entries[i];
+        if (entry->kind == kind && strcmp(entry->text, text) == 0) {
+            return entry;
+        }
+        i = (i + 1) & mask;
+    }
+    return &cache->entries[i];
+}
+
+void *text_cache_find(const TextCache *cache, const char *text, int kind) {
+    return find_entry(cache, text, kind)->value;
+}
+
+int text_cache_full(const TextCache *cache) {
+    return cache->count * 2 >= cache->size;
+}
+
+void text_cache_store(TextCache *cache, const char *text, int kind, void *value) {
+    if (text_cache_full(cache)) {
+        text_cache_clear(cache);
+    }
+
+    TextCacheEntry *entry = find_entry(cache, text, kind);
+    entry->text = strdup(text);
+    if (!entry->text) {
+        alloc_error();
+    }
+    entry->kind = kind;
+    entry->value = value;
+    cache->count++;
+}
+
+void text_cache_clear(TextCache *cache) {
+    for (size_t i = 0; i < cache->size; i++) {
+        TextCacheEntry *entry = &cache->entries[i];
+        if (!entry->text) {
+            continue;
+        }
+        cache->free_value(entry->value, entry->kind);
+        free(entry->text);
+        entry->text = NULL;
+        entry->value = NULL;
+    }
+    cache->count = 0;
+}
@@ -1,17 +1,62 @@
 #include "variables.h"
+#include "intern.h"
+#include "arrays.h"
+#include "expand.h"
+#include "lexer.h"
+#include "arena.h"
+#include "glob.h"
+#include "functions.h"
+#include "arith.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-
-#define MAX_VARIABLES 256
+#include <stdint.h>
 
 typedef struct {
-    char *name;
-    char *value;
+    const char *name;  // Interned, NULL once the variable is unset
+    char *value;       // Scalars only
+    size_t value_len;
+    uint32_t hash;     // Of the name pointer, kept for rehashing
+    int exported;
+    char *env_entry;   // "name=value" once placed in the environment
+    VarKind kind;
+    union {
+        IndexedArray *indexed;
+        AssocArray *assoc;
+    } array;
+    int integer;       // declare -i: assignments are evaluated arithmetically
+    int has_number;    // value is the decimal form of number
+    int64_t number;
 } ShellVar;
 
-static ShellVar variables[MAX_VARIABLES];
-static int var_count = 0;
+// Variables in the order they were first set, so `set` output is stable
+// Unsetting leaves a hole that is squeezed out once holes dominate
+static ShellVar *variables = NULL;
+static int var_count = 0;      // Entries in use, holes included
+static int var_capacity = 0;
+static int var_holes = 0;
+
+// Open-addressing index over the entries, with linear probing
+// A slot holds an entry index plus one, zero when empty
+static int *var_slots = NULL;
+static size_t slot_capacity = 0;   // Always a power of two
+
+// The environment handed to exec, built from the exported variables
+// It is only rebuilt after an exported variable changed. Entries that went
+// stale stay allocated until then, since environ may still point at them.
+static char **env_vector = NULL;
+static size_t env_capacity = 0;
+static int env_dirty = 1;
+static char **env_retired = NULL;
+static size_t env_retired_count = 0;
+static size_t env_retired_capacity = 0;
+
+// Prefix assignments laid over the environment for one command, and the
+// merged vector built from them, both in the command arena
+static char **env_overlay = NULL;
+static char **env_overlay_vector = NULL;
+
+extern char **environ;
 
 // Special value trackers
 static int last_exit_status = 0;
@@ -19,14 +64,135 @@ static pid_t last_background_pid = 0;
 static char **script_args = NULL;
 static int script_arg_count = 0;
 
+// Special parameters as text, formatted only when they change
+typedef struct {
+    char text[24];
+    size_t len;
+} NumberText;
+
+static NumberText status_text;       // $?
+static NumberText pid_text;          // $$
+static NumberText background_text;   // $!
+static NumberText arg_count_text;    // $#
+
+// $@ as one value, joined with spaces when first asked for
+static char *args_text = NULL;
+static size_t args_text_len = 0;
+static int args_text_stale = 1;
+
+static void format_number(NumberText *number, long value) {
+    number->len = (size_t)snprintf(number->text, sizeof(number->text), "%ld", value);
+}
+
+// Names are interned, so the pointer identifies the name
+static uint32_t hash_name(const char *name) {
+    uint64_t x = (uint64_t)(uintptr_t)name;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+// Find the slot for a name: the one holding it or the empty one where it goes
+static size_t find_slot(const char *name, uint32_t hash) {
+    size_t mask = slot_capacity - 1;
+    size_t i = hash & mask;
+
+    while (var_slots[i] && variables[var_slots[i] - 1].name != name) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Rebuild the index with the given size, squeezing out holes first
+static void rebuild_index(size_t capacity) {
+    if (var_holes > 0) {
+        int n = 0;
+        for (int i = 0; i < var_count; i++) {
+            if (variables[i].name) {
+                variables[n++] = variables[i];
+            }
+        }
+        var_count = n;
+        var_holes = 0;
+    }
+
+    free(var_slots);
+    var_slots = calloc(capacity, sizeof(int));
+    if (!var_slots) {
+        alloc_error();
+    }
+    slot_capacity = capacity;
+
+    for (int i = 0; i < var_count; i++) {
+        var_slots[find_slot(variables[i].name, variables[i].hash)] = i + 1;
+    }
+}
+
+static ShellVar *find_variable(const char *name);
+static ShellVar *get_or_add_variable(const char *name);
+
+// Note that an exported variable changed, dropping its environment entry
+static void env_changed(ShellVar *var) {
+    if (!var->exported) {
+        return;
+    }
+    env_dirty = 1;
+    if (!var->env_entry) {
+        return;
+    }
+
+    if (env_retired_count == env_retired_capacity) {
+        size_t capacity = env_retired_capacity ? env_retired_capacity * 2 : 16;
+        char **grown = realloc(env_retired, capacity * sizeof(char *));
+        if (!grown) {
+            alloc_error();
+        }
+        env_retired = grown;
+        env_retired_capacity = capacity;
+    }
+    env_retired[env_retired_count++] = var->env_entry;
+    var->env_entry = NULL;
+}
+
+// Free a variable's value, whatever its kind
+static void free_value(ShellVar *var) {
+    env_changed(var);
+    free(var->value);
+    var->value = NULL;
+    var->has_number = 0;
+    if (var->kind == VAR_INDEXED) {
+        indexed_free(var->array.indexed);
+    } else if (var->kind == VAR_ASSOC) {
+        assoc_free(var->array.assoc);
+    }
+    var->kind = VAR_SCALAR;
+}
+
 void init_shell_variables() {
+    for (int i = 0; i < var_count; i++) {
+        free_value(&variables[i]);
+    }
     var_count = 0;
+    var_holes = 0;
+    rebuild_index(64);
+
+    // The environment the shell started with becomes exported variables
+    for (char **env = environ; env && *env; env++) {
+        const char *equals = strchr(*env, '=');
+        if (equals && equals > *env) {
+            ShellVar *var = get_or_add_variable(intern_n(*env, equals - *env));
+            set_interned_variable(var->name, equals + 1);
+            var->exported = 1;
+        }
+    }
+    env_dirty = 1;
 
     // Set default POSIX variables
     set_shell_variable("IFS", " \t\n");
 
     // Set PATH if not already set
-    if (getenv("PATH") == NULL) {
+    if (!find_variable(intern_find("PATH"))) {
         set_shell_variable("PATH", "/usr/local/bin:/usr/bin:/bin");
     }
 
@@ -35,31 +201,340 @@ void init_shell_variables() {
     last_background_pid = 0;
     script_args = NULL;
     script_arg_count = 0;
+
+    // $$ stays the shell's pid in subshells
+    format_number(&status_text, 0);
+    format_number(&pid_text, (long)getpid());
+    format_number(&background_text, 0);
+    format_number(&arg_count_text, 0);
+}
+
+// Find a variable by its interned name
+static ShellVar *find_variable(const char *name) {
+    if (!name || !var_slots) return NULL;
+
+    int index = var_slots[find_slot(name, hash_name(name))];
+    return index ? &variables[index - 1] : NULL;
 }
 
 // Set or update a shell variable
 int set_shell_variable(const char *name, const char *value) {
     if (!name || !value) return 0;
+    return set_interned_variable(intern(name), value);
+}
+
+// Find a variable, adding an empty scalar if there is none
+static ShellVar *get_or_add_variable(const char *name) {
+    // Keep the index at most half full
+    if ((size_t)(var_count - var_holes + 1) * 2 > slot_capacity) {
+        rebuild_index(slot_capacity ? slot_capacity * 2 : 64);
+    }
+
+    uint32_t hash = hash_name(name);
+    size_t slot = find_slot(name, hash);
+    if (var_slots[slot]) {
+        return &variables[var_slots[slot] - 1];
+    }
+
+    if (var_count == var_capacity) {
+        int capacity = var_capacity ? var_capacity * 2 : 64;
+        ShellVar *grown = realloc(variables, capacity * sizeof(ShellVar));
+        if (!grown) {
+            alloc_error();
+        }
+        variables = grown;
+        var_capacity = capacity;
+    }
+
+    ShellVar *var = &variables[var_count];
+    memset(var, 0, sizeof(*var));
+    var->name = name;
+    var->hash = hash;
+    var->kind = VAR_SCALAR;
+    var_slots[slot] = ++var_count;
+    return var;
+}
+
+// Replace a scalar's value with a copy of value
+static void store_scalar(ShellVar *var, const char *value, size_t len) {
+    char *copy = malloc(len + 1);
+    if (!copy) {
+        alloc_error();
+    }
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+
+    env_changed(var);
+    free(var->value);
+    var->value = copy;
+    var->value_len = len;
+    var->has_number = 0;
+}
+
+int set_interned_variable(const char *name, const char *value) {
+    if (!name || !value) return 0;
+
+    ShellVar *var = get_or_add_variable(name);
+    size_t len = strlen(value);
+
+    // Assigning to an array sets element 0
+    if (var->kind == VAR_INDEXED) {
+        return indexed_set(var->array.indexed, 0, value, len);
+    }
+    if (var->kind == VAR_ASSOC) {
+        assoc_set(var->array.assoc, "0", 1, value, len);
+        return 1;
+    }
+
+    // An integer variable takes the value of the expression; evaluating it
+    // may add variables, so var is not used after
+    if (var->integer) {
+        int64_t number;
+        if (!arith_parse_number(value, len, &number) && !arith_evaluate(value, &number)) {
+            return 0;
+        }
+        return set_number_variable(name, number);
+    }
+
+    store_scalar(var, value, len);
+    return 1;
+}
+
+int set_number_variable(const char *name, int64_t value) {
+    char text[ARITH_NUMBER_MAX];
+    size_t len = arith_format(value, text);
+
+    ShellVar *var = get_or_add_variable(name);
+    if (var->kind != VAR_SCALAR) {
+        return set_interned_variable(name, text);
+    }
+    store_scalar(var, text, len);
+    var->number = value;
+    var->has_number = 1;
+    return 1;
+}
+
+int lookup_number(const char *name, int64_t *value) {
+    ShellVar *var = find_variable(name);
+    if (!var || !var->has_number) {
+        return 0;
+    }
+    *value = var->number;
+    return 1;
+}
+
+int export_variable(const char *name) {
+    ShellVar *var = find_variable(intern_find(name));
+    if (!var || var->kind != VAR_SCALAR) return 0;
+
+    if (!var->exported) {
+        var->exported = 1;
+        env_dirty = 1;
+    }
+    return 1;
+}
+
+// Length of the name of a NAME=value entry
+static size_t entry_name_length(const char *entry) {
+    return strcspn(entry, "=");
+}
+
+// Check for an overlay entry with the same name at or after index from
+static int overlay_has(const char *entry, size_t from) {
+    size_t len = entry_name_length(entry);
+    for (size_t i = from; env_overlay[i]; i++) {
+        if (strncmp(env_overlay[i], entry, len + 1) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The cached environment with the overlay entries replacing or added to it
+static char **overlay_environment(void) {
+    size_t count = 0;
+    while (env_vector[count]) {
+        count++;
+    }
+    size_t overlay_count = 0;
+    while (env_overlay[overlay_count]) {
+        overlay_count++;
+    }
+
+    char **merged = arena_alloc((count + overlay_count + 1) * sizeof(char *));
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!overlay_has(env_vector[i], 0)) {
+            merged[n++] = env_vector[i];
+        }
+    }
+    // A name given twice takes its last value
+    for (size_t i = 0; i < overlay_count; i++) {
+        if (!overlay_has(env_overlay[i], i + 1)) {
+            merged[n++] = env_overlay[i];
+        }
+    }
+    merged[n] = NULL;
+    return merged;
+}
+
+void set_environment_overlay(char **entries) {
+    env_overlay = entries;
+    env_overlay_vector = NULL;
+    if (!entries && env_vector) {
+        environ = env_vector;
+    }
+}
+
+char **exported_environment(void) {
+    if (!env_dirty) {
+        if (env_overlay && !env_overlay_vector) {
+            env_overlay_vector = overlay_environment();
+            environ = env_overlay_vector;
+        }
+        return env_overlay ? env_overlay_vector : env_vector;
+    }
+
+    size_t count = 0;
+    for (int i = 0; i < var_count; i++) {
+        if (variables[i].name && variables[i].exported && variables[i].value) {
+            count++;
+        }
+    }
+    if (count + 1 > env_capacity) {
+        size_t capacity = env_capacity ? env_capacity : 64;
+        while (capacity < count + 1) {
+            capacity *= 2;
+        }
+        char **grown = realloc(env_vector, capacity * sizeof(char *));
+        if (!grown) {
+            alloc_error();
+        }
+        env_vector = grown;
+        env_capacity = capacity;
+    }
 
-    // Check if variable already exists
+    // Only entries whose variable changed are formatted again
+    size_t n = 0;
     for (int i = 0; i < var_count; i++) {
-        if (strcmp(variables[i].name, name) == 0) {
-            // Update existing variable
-            free(variables[i].value);
-            variables[i].value = strdup(value);
+        ShellVar *var = &variables[i];
+        // Arrays are never exported
+        if (!var->name || !var->exported || !var->value) {
+            continue;
+        }
+        if (!var->env_entry) {
+            size_t name_len = strlen(var->name);
+            var->env_entry = malloc(name_len + var->value_len + 2);
+            if (!var->env_entry) {
+                alloc_error();
+            }
+            memcpy(var->env_entry, var->name, name_len);
+            var->env_entry[name_len] = '=';
+            memcpy(var->env_entry + name_len + 1, var->value, var->value_len + 1);
+        }
+        env_vector[n++] = var->env_entry;
+    }
+    env_vector[n] = NULL;
+
+    environ = env_vector;
+    for (size_t i = 0; i < env_retired_count; i++) {
+        free(env_retired[i]);
+    }
+    env_retired_count = 0;
+    env_dirty = 0;
+
+    if (env_overlay) {
+        env_overlay_vector = overlay_environment();
+        environ = env_overlay_vector;
+        return env_overlay_vector;
+    }
+    return env_vector;
+}
+
+static void set_view(VarView *view, const char *ptr, size_t len) {
+    view->ptr = ptr;
+    view->len = len;
+}
+
+// Join the positional parameters from $1 on into args_text
+static void join_args(void) {
+    size_t len = 0;
+    for (int i = 1; i < script_arg_count; i++) {
+        len += strlen(script_args[i]) + 1;
+    }
+    char *text = realloc(args_text, len);
+    if (!text) {
+        alloc_error();
+    }
+    args_text = text;
+    args_text_len = 0;
+    for (int i = 1; i < script_arg_count; i++) {
+        size_t n = strlen(script_args[i]);
+        memcpy(text + args_text_len, script_args[i], n);
+        args_text_len += n;
+        text[args_text_len++] = ' ';
+    }
+    text[--args_text_len] = '\0';
+    args_text_stale = 0;
+}
+
+int lookup_variable(const char *name, size_t name_len, VarView *view) {
+    if (name_len == 0) return 0;
+
+    // Special parameters are kept formatted
+    if (name_len == 1 && (name[0] == '@' || name[0] == '*')) {
+        if (script_arg_count < 2) return 0;
+        if (args_text_stale) {
+            join_args();
+        }
+        set_view(view, args_text, args_text_len);
+        return 1;
+    }
+    if (name_len == 1) {
+        const NumberText *number = NULL;
+        switch (name[0]) {
+            case '?': number = &status_text; break;
+            case '$': number = &pid_text; break;
+            case '!': number = &background_text; break;
+            case '#': number = &arg_count_text; break;
+        }
+        if (number) {
+            set_view(view, number->text, number->len);
             return 1;
         }
     }
 
-    // Add new variable if room
-    if (var_count < MAX_VARIABLES) {
-        variables[var_count].name = strdup(name);
-        variables[var_count].value = strdup(value);
-        var_count++;
+    if (isdigit((unsigned char)name[0])) {
+        // Positional parameter
+        long index = 0;
+        for (size_t i = 0; i < name_len && isdigit((unsigned char)name[i]) && index <= script_arg_count; i++) {
+            index = index * 10 + (name[i] - '0');
+        }
+        const char *arg = (index <= script_arg_count && script_args) ? script_args[index] : NULL;
+        if (!arg) return 0;
+        set_view(view, arg, strlen(arg));
         return 1;
     }
 
-    fprintf(stderr, "hush: too many shell variables\n");
+    // Check shell variables, a name never interned cannot be one
+    ShellVar *var = find_variable(intern_find_n(name, name_len));
+    if (var) {
+        // An array's plain value is element 0
+        const ArrayItem *item = NULL;
+        if (var->kind == VAR_INDEXED) {
+            item = indexed_get(var->array.indexed, 0);
+        } else if (var->kind == VAR_ASSOC) {
+            item = assoc_get(var->array.assoc, "0", 1);
+        } else {
+            set_view(view, var->value, var->value_len);
+            return 1;
+        }
+        if (!item) return 0;
+        set_view(view, item->value, item->len);
+        return 1;
+    }
+
+    // The environment was imported at startup, so that is everything
     return 0;
 }
 
@@ -67,73 +542,232 @@ int set_shell_variable(const char *name, const char *value) {
 char *get_shell_variable(const char *name) {
     if (!name) return NULL;
 
-    // Check for special variables first
-    if (strcmp(name, "?") == 0) {
-        char *result = malloc(16);
-        if (result) sprintf(result, "%d", last_exit_status);
-        return result;
+    VarView view;
+    if (!lookup_variable(name, strlen(name), &view)) {
+        return NULL;
+    }
+    char *copy = malloc(view.len + 1);
+    if (copy) {
+        memcpy(copy, view.ptr, view.len);
+        copy[view.len] = '\0';
+    }
+    return copy;
+}
+
+// Index of an indexed array element, an arithmetic expression that is 0
+// when it does not evaluate
+// Negative indexes count back from one past the last element.
+static long parse_index(const IndexedArray *array, const char *key, size_t key_len) {
+    int64_t index;
+    if (!arith_parse_number(key, key_len, &index) &&
+        !arith_evaluate(arena_strndup(key, key_len), &index)) {
+        index = 0;
     }
-    else if (strcmp(name, "$") == 0) {
-        char *result = malloc(16);
-        if (result) sprintf(result, "%d", (int)getpid());
-        return result;
+
+    if (index < 0) {
+        return array ? array->end + (long)index : (long)index;
     }
-    else if (strcmp(name, "!") == 0) {
-        char *result = malloc(16);
-        if (result) sprintf(result, "%d", (int)last_background_pid);
-        return result;
+    return (long)index;
+}
+
+int lookup_element(const char *name, size_t name_len, const char *key, size_t key_len, VarView *view) {
+    ShellVar *var = find_variable(intern_find_n(name, name_len));
+    if (!var) {
+        // Anything else only has an element 0
+        return parse_index(NULL, key, key_len) == 0 && lookup_variable(name, name_len, view);
     }
-    else if (strcmp(name, "#") == 0) {
-        char *result = malloc(16);
-        if (result) sprintf(result, "%d", script_arg_count);
-        return result;
+
+    const ArrayItem *item = NULL;
+    if (var->kind == VAR_ASSOC) {
+        item = assoc_get(var->array.assoc, key, key_len);
+    } else if (var->kind == VAR_INDEXED) {
+        item = indexed_get(var->array.indexed, parse_index(var->array.indexed, key, key_len));
+    } else if (parse_index(NULL, key, key_len) == 0) {
+        set_view(view, var->value, var->value_len);
+        return 1;
     }
-    else if (isdigit(name[0])) {
-        // Positional parameter
-        int index = atoi(name);
-        if (index >= 0 && index <= script_arg_count) {
-            return script_args[index] ? strdup(script_args[index]) : strdup("");
+    if (!item) return 0;
+    set_view(view, item->value, item->len);
+    return 1;
+}
+
+// Turn a variable into an array of the given kind, a scalar value becomes
+// element 0
+static int make_array(ShellVar *var, VarKind kind) {
+    if (var->kind == kind) {
+        return 1;
+    }
+    if (var->kind != VAR_SCALAR) {
+        fprintf(stderr, "hush: %s: cannot convert %s array to %s array\n", var->name,
+                var->kind == VAR_INDEXED ? "indexed" : "associative",
+                kind == VAR_INDEXED ? "indexed" : "associative");
+        return 0;
+    }
+
+    env_changed(var);
+    char *value = var->value;
+    size_t len = var->value_len;
+    var->value = NULL;
+    var->has_number = 0;
+    var->kind = kind;
+    if (kind == VAR_INDEXED) {
+        var->array.indexed = indexed_new();
+        if (value) {
+            indexed_set(var->array.indexed, 0, value, len);
+        }
+    } else {
+        var->array.assoc = assoc_new();
+        if (value) {
+            assoc_set(var->array.assoc, "0", 1, value, len);
         }
-        return strdup("");
     }
+    free(value);
+    return 1;
+}
 
-    // Check shell variables
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(variables[i].name, name) == 0) {
-            return strdup(variables[i].value);
+int declare_array(const char *name, VarKind kind) {
+    if (!name || kind == VAR_SCALAR) return 0;
+    return make_array(get_or_add_variable(intern(name)), kind);
+}
+
+int set_element(const char *name, const char *key, size_t key_len, const char *value, size_t len) {
+    if (!name || !value) return 0;
+
+    ShellVar *var = get_or_add_variable(intern(name));
+    if (var->kind == VAR_ASSOC) {
+        assoc_set(var->array.assoc, key, key_len, value, len);
+        return 1;
+    }
+
+    // Scalars become indexed arrays once an element is assigned
+    make_array(var, VAR_INDEXED);
+    long index = parse_index(var->array.indexed, key, key_len);
+    if (!indexed_set(var->array.indexed, index, value, len)) {
+        fprintf(stderr, "hush: %s[%.*s]: bad array subscript\n", name, (int)key_len, key);
+        return 0;
+    }
+    return 1;
+}
+
+int unset_element(const char *name, const char *key, size_t key_len) {
+    ShellVar *var = find_variable(intern_find(name));
+    if (!var) return 0;
+
+    if (var->kind == VAR_ASSOC) {
+        assoc_unset(var->array.assoc, key, key_len);
+    } else if (var->kind == VAR_INDEXED) {
+        indexed_unset(var->array.indexed, parse_index(var->array.indexed, key, key_len));
+    } else if (parse_index(NULL, key, key_len) == 0) {
+        unset_shell_variable(name);
+    }
+    return 1;
+}
+
+size_t for_each_element(const char *name, size_t name_len, ElementVisitor visit, void *data) {
+    VarView key, value;
+
+    // $@ and $* are the positional parameters from $1 on
+    if (name_len == 1 && (name[0] == '@' || name[0] == '*')) {
+        int count = script_arg_count > 0 ? script_arg_count - 1 : 0;
+        if (visit) {
+            NumberText index;
+            for (int i = 1; i <= count; i++) {
+                format_number(&index, i);
+                set_view(&key, index.text, index.len);
+                set_view(&value, script_args[i], strlen(script_args[i]));
+                visit(key, value, data);
+            }
+        }
+        return (size_t)count;
+    }
+
+    ShellVar *var = find_variable(intern_find_n(name, name_len));
+
+    if (!var || var->kind == VAR_SCALAR) {
+        // A scalar is an array of one
+        if (!lookup_variable(name, name_len, &value)) return 0;
+        if (visit) {
+            set_view(&key, "0", 1);
+            visit(key, value, data);
+        }
+        return 1;
+    }
+
+    if (var->kind == VAR_ASSOC) {
+        AssocArray *array = var->array.assoc;
+        if (visit) {
+            for (int i = 0; i < array->count; i++) {
+                const AssocEntry *entry = &array->entries[i];
+                if (entry->key) {
+                    set_view(&key, entry->key, entry->key_len);
+                    set_view(&value, entry->item.value, entry->item.len);
+                    visit(key, value, data);
+                }
+            }
         }
+        return assoc_size(array);
     }
 
-    // Then check environment variables
-    char *env_value = getenv(name);
-    return env_value ? strdup(env_value) : NULL;
+    IndexedArray *array = var->array.indexed;
+    if (visit) {
+        NumberText index;
+        int count;
+        const IndexedEntry *entries = indexed_entries(array, &count);
+        for (int i = 0; i < count; i++) {
+            format_number(&index, entries[i].index);
+            set_view(&key, index.text, index.len);
+            set_view(&value, entries[i].item.value, entries[i].item.len);
+            visit(key, value, data);
+        }
+    }
+    return indexed_size(array);
 }
 
 // Remove a shell variable
 int unset_shell_variable(const char *name) {
     if (!name) return 0;
 
-    // Find and remove variable
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(variables[i].name, name) == 0) {
-            free(variables[i].name);
-            free(variables[i].value);
+    // A name never interned cannot be set
+    const char *key = intern_find(name);
+    if (!key || !var_slots) return 0;
 
-            // Move last variable to this slot
-            if (i < var_count - 1) {
-                variables[i] = variables[var_count - 1];
-            }
+    size_t mask = slot_capacity - 1;
+    size_t i = find_slot(key, hash_name(key));
+    if (!var_slots[i]) return 0;
 
-            var_count--;
-            return 1;
+    ShellVar *var = &variables[var_slots[i] - 1];
+    free_value(var);
+    var->name = NULL;
+    var_holes++;
+
+    // Shift later entries of the probe run back so no lookup stops early
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!var_slots[j]) {
+            break;
+        }
+        size_t home = variables[var_slots[j] - 1].hash & mask;
+        int movable = (j > i) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable) {
+            var_slots[i] = var_slots[j];
+            i = j;
         }
     }
+    var_slots[i] = 0;
 
-    return 0;
+    // Squeeze out the holes once they outnumber the variables
+    if (var_holes > 32 && var_holes * 2 > var_count) {
+        rebuild_index(slot_capacity);
+    }
+    return 1;
 }
 
 // Set the last exit status
 void set_last_exit_status(int status) {
+    if (status != last_exit_status) {
+        format_number(&status_text, status);
+    }
     last_exit_status = status;
 }
 
@@ -144,6 +778,9 @@ int get_last_exit_status() {
 
 // Set last background process PID
 void set_last_background_pid(pid_t pid) {
+    if (pid != last_background_pid) {
+        format_number(&background_text, (long)pid);
+    }
     last_background_pid = pid;
 }
 
@@ -152,6 +789,13 @@ pid_t get_last_background_pid() {
     return last_background_pid;
 }
 
+// Format $#, which does not count $0, after the positional parameters
+// changed
+static void format_arg_count(void) {
+    format_number(&arg_count_text, script_arg_count > 0 ? script_arg_count - 1 : 0);
+    args_text_stale = 1;
+}
+
 // Set script arguments
 void set_script_args(int argc, char **argv) {
     // Free any existing arguments
@@ -178,6 +822,172 @@ void set_script_args(int argc, char **argv) {
     } else {
         script_args = NULL;
     }
+    format_arg_count();
+}
+
+// A variable as it was before a local shadowed it
+typedef struct {
+    const char *name;  // Interned
+    int existed;
+    ShellVar saved;    // Its entry, value and all, when it existed
+} ShadowedVar;
+
+// Locals of every active scope, innermost last; a scope is the stretch
+// after the mark taken when it was pushed
+static ShadowedVar *shadowed = NULL;
+static size_t shadow_count = 0;
+static size_t shadow_capacity = 0;
+
+static size_t *scope_marks = NULL;
+static int scope_depth = 0;
+static int scope_capacity = 0;
+
+void push_variable_scope(void) {
+    if (scope_depth == scope_capacity) {
+        int capacity = scope_capacity ? scope_capacity * 2 : 16;
+        size_t *marks = realloc(scope_marks, capacity * sizeof(size_t));
+        if (!marks) {
+            alloc_error();
+        }
+        scope_marks = marks;
+        scope_capacity = capacity;
+    }
+    scope_marks[scope_depth++] = shadow_count;
+}
+
+void pop_variable_scope(void) {
+    if (scope_depth == 0) return;
+    size_t mark = scope_marks[--scope_depth];
+
+    // Newest first, so a name shadowed twice ends up with its oldest value
+    while (shadow_count > mark) {
+        ShadowedVar *shadow = &shadowed[--shadow_count];
+        ShellVar *var = find_variable(shadow->name);
+
+        if (!shadow->existed) {
+            if (var) {
+                unset_shell_variable(shadow->name);
+            }
+            continue;
+        }
+        if (!var) {
+            var = get_or_add_variable(shadow->name);
+        }
+        free_value(var);
+        var->value = shadow->saved.value;
+        var->value_len = shadow->saved.value_len;
+        var->kind = shadow->saved.kind;
+        var->array = shadow->saved.array;
+        var->exported = shadow->saved.exported;
+        var->env_entry = shadow->saved.env_entry;
+        var->integer = shadow->saved.integer;
+        var->has_number = shadow->saved.has_number;
+        var->number = shadow->saved.number;
+        if (var->exported) {
+            env_dirty = 1;
+        }
+    }
+}
+
+int make_local(const char *name) {
+    if (scope_depth == 0) return 0;
+    name = intern(name);
+
+    // Already local to this scope
+    for (size_t i = scope_marks[scope_depth - 1]; i < shadow_count; i++) {
+        if (shadowed[i].name == name) {
+            return 1;
+        }
+    }
+
+    if (shadow_count == shadow_capacity) {
+        size_t capacity = shadow_capacity ? shadow_capacity * 2 : 32;
+        ShadowedVar *grown = realloc(shadowed, capacity * sizeof(ShadowedVar));
+        if (!grown) {
+            alloc_error();
+        }
+        shadowed = grown;
+        shadow_capacity = capacity;
+    }
+
+    // The entry's value moves aside whole, nothing is copied; the local
+    // starts out unset and unexported
+    ShadowedVar *shadow = &shadowed[shadow_count++];
+    ShellVar *var = find_variable(name);
+    shadow->name = name;
+    shadow->existed = var != NULL;
+    if (var) {
+        shadow->saved = *var;
+        if (var->exported) {
+            // environ may point at the saved entry until the next rebuild
+            env_dirty = 1;
+        }
+        var->value = NULL;
+        var->value_len = 0;
+        var->kind = VAR_SCALAR;
+        var->exported = 0;
+        var->env_entry = NULL;
+        var->integer = 0;
+        var->has_number = 0;
+    }
+    return 1;
+}
+
+// Assign one NAME=value entry, returning the interned name
+static const char *assign_entry(const char *entry) {
+    size_t len = entry_name_length(entry);
+    const char *name = intern_n(entry, len);
+    set_interned_variable(name, entry + len + 1);
+    return name;
+}
+
+void assign_variables(char **entries) {
+    for (; *entries; entries++) {
+        assign_entry(*entries);
+    }
+}
+
+void push_assignment_scope(char **entries) {
+    push_variable_scope();
+    for (; *entries; entries++) {
+        const char *name = intern_n(*entries, entry_name_length(*entries));
+        make_local(name);
+        assign_entry(*entries);
+        export_variable(name);
+    }
+}
+
+ScriptArgs replace_script_args(char **argv) {
+    ScriptArgs saved = { script_args, script_arg_count };
+
+    int argc = 1;
+    while (argv[argc]) {
+        argc++;
+    }
+    script_args = malloc((argc + 1) * sizeof(char *));
+    if (!script_args) {
+        alloc_error();
+    }
+
+    // $0 stays what it was
+    script_args[0] = strdup(saved.count > 0 && saved.args[0] ? saved.args[0] : "hush");
+    for (int i = 1; i < argc; i++) {
+        script_args[i] = strdup(argv[i]);
+    }
+    script_args[argc] = NULL;
+    script_arg_count = argc;
+    format_arg_count();
+    return saved;
+}
+
+void restore_script_args(ScriptArgs saved) {
+    for (int i = 0; i < script_arg_count; i++) {
+        free(script_args[i]);
+    }
+    free(script_args);
+    script_args = saved.args;
+    script_arg_count = saved.count;
+    format_arg_count();
 }
 
 // Get script argument count
@@ -193,275 +1003,189 @@ char *get_script_arg(int index) {
     return NULL;
 }
 
-// Helper function to parse parameter expansion arguments
-static char *parse_expansion_arg(const char *param, int *offset) {
-    char buffer[1024] = {0};
-    int buf_pos = 0;
-    int brace_level = 0;
-
-    while (param[*offset]) {
-        if (param[*offset] == '}' && brace_level == 0) {
-            break;
-        } else if (param[*offset] == '{') {
-            brace_level++;
-            buffer[buf_pos++] = param[(*offset)++];
-        } else if (param[*offset] == '}') {
-            brace_level--;
-            buffer[buf_pos++] = param[(*offset)++];
-        } else {
-            buffer[buf_pos++] = param[(*offset)++];
-        }
-    }
-
-    // Null-terminate
-    buffer[buf_pos] = '\0';
-    return strdup(buffer);
-}
-
-// Handle advanced parameter expansion
-char *expand_parameter(const char *param, int *offset) {
-    char var_name[256] = {0};
-    int var_name_len = 0;
-    char *default_value = NULL;
-    int op_type = 0;  // 0: normal, 1: :-, 2: :=, 3: :+, 4: :?, 5: #, 6: ##, etc.
-
-    // Skip the ${
-    *offset += 2;
-
-    // Parse the variable name and operator
-    while (param[*offset] && !isspace(param[*offset])) {
-        if (param[*offset] == '}') {
-            // Simple ${var} form
-            var_name[var_name_len] = '\0';
-            (*offset)++;  // Skip }
-            return get_shell_variable(var_name);
-        } else if (param[*offset] == ':' && param[*offset + 1] == '-') {
-            // ${var:-default}
-            var_name[var_name_len] = '\0';
-            *offset += 2;  // Skip :-
-            op_type = 1;
-            default_value = parse_expansion_arg(param, offset);
-            break;
-        } else if (param[*offset] == ':' && param[*offset + 1] == '=') {
-            // ${var:=default}
-            var_name[var_name_len] = '\0';
-            *offset += 2;  // Skip :=
-            op_type = 2;
-            default_value = parse_expansion_arg(param, offset);
-            break;
-        } else if (param[*offset] == ':' && param[*offset + 1] == '+') {
-            // ${var:+value}
-            var_name[var_name_len] = '\0';
-            *offset += 2;  // Skip :+
-            op_type = 3;
-            default_value = parse_expansion_arg(param, offset);
-            break;
-        } else if (param[*offset] == ':' && param[*offset + 1] == '?') {
-            // ${var:?message}
-            var_name[var_name_len] = '\0';
-            *offset += 2;  // Skip :?
-            op_type = 4;
-            default_value = parse_expansion_arg(param, offset);
-            break;
-        } else if (param[*offset] == '#' && param[*offset + 1] != '#') {
-            // ${#var} - length of var
-            var_name[var_name_len] = '\0';
-            *offset += 1;  // Skip #
-            op_type = 5;
-            break;
-        } else {
-            // Part of variable name
-            var_name[var_name_len++] = param[(*offset)++];
+// Print a value in double quotes, escaped so it can be read back
+static void print_quoted(const char *s, size_t len) {
+    putchar('"');
+    for (size_t i = 0; i < len; i++) {
+        if (strchr("\"\\$`", s[i])) {
+            putchar('\\');
         }
+        putchar(s[i]);
     }
+    putchar('"');
+}
 
-    if (param[*offset] == '}') {
-        (*offset)++; // Skip closing brace
+static void print_element(VarView key, VarView value, void *data) {
+    int *first = data;
+    printf(*first ? "[" : " [");
+    *first = 0;
+    if (strpbrk(key.ptr, " \t\n\"\\$`]")) {
+        print_quoted(key.ptr, key.len);
+    } else {
+        fwrite(key.ptr, 1, key.len, stdout);
     }
+    printf("]=");
+    print_quoted(value.ptr, value.len);
+}
 
-    // Get variable value
-    char *var_value = get_shell_variable(var_name);
+// Print name=value, arrays as name=([key]="value" ...)
+static void print_variable(const ShellVar *var) {
+    if (var->kind == VAR_SCALAR) {
+        printf("%s=%s\n", var->name, var->value);
+        return;
+    }
+    int first = 1;
+    printf("%s=(", var->name);
+    for_each_element(var->name, strlen(var->name), print_element, &first);
+    printf(")\n");
+}
 
-    // Process according to operator
-    switch (op_type) {
-        case 0:  // ${var} - simple variable
-            return var_value ? var_value : strdup("");
+// Assign the elements of an array literal, the text between the parens
+// The elements are expanded like command words: [key]=value elements
+// without splitting, the rest split and globbed into one element per field.
+static int assign_list(ShellVar *var, VarKind kind, const char *list, size_t len) {
+    if (kind == VAR_SCALAR) {
+        kind = var->kind == VAR_ASSOC ? VAR_ASSOC : VAR_INDEXED;
+    }
+    if (var->kind != VAR_SCALAR && var->kind != kind) {
+        return make_array(var, kind);
+    }
 
-        case 1:  // ${var:-default}
-            if (var_value && *var_value) {
-                free(default_value);
-                return var_value;
-            }
-            free(var_value);
-            return default_value ? default_value : strdup("");
+    char *text = arena_strndup(list, len);
+    TokenList tokens;
+    token_list_init(&tokens);
+    if (hush_lex(text, &tokens) != 0) {
+        fprintf(stderr, "hush: %s: unterminated quote in array assignment\n", var->name);
+        token_list_free(&tokens);
+        return 0;
+    }
 
-        case 2:  // ${var:=default}
-            if (var_value && *var_value) {
-                free(default_value);
-                return var_value;
-            }
-            free(var_value);
-            set_shell_variable(var_name, default_value ? default_value : "");
-            return default_value ? strdup(default_value) : strdup("");
-
-        case 3:  // ${var:+value}
-            if (var_value && *var_value) {
-                free(var_value);
-                return default_value ? default_value : strdup("");
-            }
-            free(var_value);
-            free(default_value);
-            return strdup("");
-
-        case 4:  // ${var:?message}
-            if (var_value && *var_value) {
-                free(default_value);
-                return var_value;
-            }
-            // Print error message and fail
-            fprintf(stderr, "hush: %s: %s\n", var_name,
-                    default_value ? default_value : "parameter null or not set");
-            free(var_value);
-            free(default_value);
-            return strdup("");
-
-        case 5:  // ${#var} - length
-            {
-                if (var_value) {
-                    int len = strlen(var_value);
-                    free(var_value);
-                    char *result = malloc(16);
-                    if (result) sprintf(result, "%d", len);
-                    return result;
-                }
-                return strdup("0");
+    // Build the new value aside, so the old one can be used by the elements
+    IndexedArray *indexed = kind == VAR_INDEXED ? indexed_new() : NULL;
+    AssocArray *assoc = kind == VAR_ASSOC ? assoc_new() : NULL;
+    long next = 0;
+    int ok = 1;
+
+    for (int i = 0; i < tokens.count && ok; i++) {
+        const Token *token = &tokens.items[i];
+        if (token->flags & HUSH_TOK_OPERATOR) {
+            if (HUSH_TOK_OP(token->flags) == OP_NEWLINE) {
+                continue;
             }
+            fprintf(stderr, "hush: %s: syntax error in array assignment\n", var->name);
+            ok = 0;
+            break;
+        }
 
-        default:
-            free(var_value);
-            free(default_value);
-            return strdup("");
-    }
-}
-
-// Improved variable expansion to handle all types of variables
-char *expand_variables(char *line) {
-    if (!line) return NULL;
-
-    // First pass: calculate size needed for expansion
-    size_t expanded_size = 0;
-    for (char *p = line; *p; p++) {
-        if (*p == '$') {
-            if (*(p+1) == '{') {
-                // Complex variable, e.g. ${VAR}
-                char *close_brace = strchr(p+2, '}');
-                if (close_brace) {
-                    int offset = 0;
-                    char *value = expand_parameter(p, &offset);
-                    if (value) {
-                        expanded_size += strlen(value);
-                        free(value);
-                    }
-                    p = p + offset - 1;  // -1 because of p++ in loop
-                } else {
-                    // Malformed ${, treat as literal
-                    expanded_size += 2;
-                    p++;
-                }
-            } else if (isalnum(*(p+1)) || *(p+1) == '_' ||
-                      *(p+1) == '?' || *(p+1) == '$' ||
-                      *(p+1) == '!' || *(p+1) == '#' ||
-                      isdigit(*(p+1))) {
-                // Simple variable or special variable
-                char var_name[256] = {0};
-                int i = 0;
-                p++;  // Skip $
-
-                // Extract variable name
-                while (isalnum(*p) || *p == '_' || *p == '?' ||
-                       *p == '$' || *p == '!' || *p == '#' || isdigit(*p)) {
-                    var_name[i++] = *p++;
-                }
-                p--;  // Step back one as the loop will p++
-
-                // Get variable value
-                char *value = get_shell_variable(var_name);
-                if (value) {
-                    expanded_size += strlen(value);
-                    free(value);
-                }
+        char *raw = arena_strndup(text + token->offset, token->length);
+        char *close = raw[0] == '[' ? strstr(raw, "]=") : NULL;
+
+        if (close) {
+            // [key]=value
+            *close = '\0';
+            char *key = expand_word_nosplit(raw + 1);
+            char *value = expand_word_nosplit(close + 2);
+            if (expansion_failed) {
+                ok = 0;
+                break;
+            } else if (assoc) {
+                assoc_set(assoc, key, strlen(key), value, strlen(value));
             } else {
-                // Literal $ (not followed by valid variable start)
-                expanded_size++;
+                next = parse_index(indexed, key, strlen(key));
+                ok = indexed_set(indexed, next, value, strlen(value));
+                next++;
             }
+        } else if (assoc) {
+            fprintf(stderr, "hush: %s: %s: must use subscript when assigning associative array\n",
+                    var->name, raw);
+            ok = 0;
         } else {
-            expanded_size++;
-        }
-    }
-
-    // Allocate result
-    char *result = malloc(expanded_size + 1);  // +1 for null terminator
-    if (!result) {
-        perror("hush: malloc error in expand_variables");
-        return strdup(line);
-    }
-
-    // Second pass: perform expansion
-    char *dest = result;
-    for (char *p = line; *p; p++) {
-        if (*p == '$') {
-            if (*(p+1) == '{') {
-                // Complex variable, e.g. ${VAR}
-                char *close_brace = strchr(p+2, '}');
-                if (close_brace) {
-                    int offset = 0;
-                    char *value = expand_parameter(p, &offset);
-                    if (value) {
-                        strcpy(dest, value);
-                        dest += strlen(value);
-                        free(value);
-                    }
-                    p = p + offset - 1;  // -1 because of p++ in loop
-                } else {
-                    // Malformed ${, treat as literal
-                    *dest++ = *p++;
-                    *dest++ = *p;
-                }
-            } else if (isalnum(*(p+1)) || *(p+1) == '_' ||
-                      *(p+1) == '?' || *(p+1) == '$' ||
-                      *(p+1) == '!' || *(p+1) == '#' ||
-                      isdigit(*(p+1))) {
-                // Simple variable or special variable
-                char var_name[256] = {0};
-                int i = 0;
-                p++;  // Skip $
-
-                // Extract variable name
-                while (isalnum(*p) || *p == '_' || *p == '?' ||
-                       *p == '$' || *p == '!' || *p == '#' || isdigit(*p)) {
-                    var_name[i++] = *p++;
-                }
-                p--;  // Step back one as the loop will p++
-
-                // Get variable value
-                char *value = get_shell_variable(var_name);
-                if (value) {
-                    strcpy(dest, value);
-                    dest += strlen(value);
-                    free(value);
-                }
-            } else {
-                // Literal $ (not followed by valid variable start)
-                *dest++ = *p;
+            Word word = { raw, token->flags };
+            unsigned int *flags = NULL;
+            char **fields = expand_words(&word, 1, &flags);
+            if (!fields) {
+                ok = 0;
+                break;
             }
-        } else {
-            *dest++ = *p;
+            fields = expand_wildcards_flags(fields, flags, NULL);
+            for (int j = 0; fields[j] && ok; j++) {
+                ok = indexed_set(indexed, next++, fields[j], strlen(fields[j]));
+            }
+        }
+        if (!ok && indexed) {
+            fprintf(stderr, "hush: %s: bad array subscript\n", var->name);
         }
     }
+    token_list_free(&tokens);
+
+    if (!ok) {
+        indexed_free(indexed);
+        assoc_free(assoc);
+        return 0;
+    }
+
+    free_value(var);
+    var->kind = kind;
+    if (indexed) {
+        var->array.indexed = indexed;
+    } else {
+        var->array.assoc = assoc;
+    }
+    return 1;
+}
+
+// Assign a name=value, name[key]=value or name=(list) word, forcing the
+// variable to kind unless it is VAR_SCALAR and making it an integer if
+// asked to; a bare name just declares
+// Returns 0 after printing an error.
+static int assign_word(const char *word, VarKind kind, int integer) {
+    const char *equals = strchr(word, '=');
+    size_t len = equals ? (size_t)(equals - word) : strlen(word);
+    const char *bracket = memchr(word, '[', len);
+    size_t name_len = bracket ? (size_t)(bracket - word) : len;
+
+    if (!is_name(word, name_len) || (bracket && word[len - 1] != ']')) {
+        fprintf(stderr, "hush: `%.*s': not a valid identifier\n", (int)len, word);
+        return 0;
+    }
+
+    ShellVar *var = get_or_add_variable(intern_n(word, name_len));
+    if (kind != VAR_SCALAR && !make_array(var, kind)) {
+        return 0;
+    }
+    if (integer) {
+        var->integer = 1;
+    }
+    if (!equals) {
+        // Declared but never given a value
+        if (var->kind == VAR_SCALAR && !var->value) {
+            set_interned_variable(var->name, "");
+        }
+        return 1;
+    }
+
+    const char *value = equals + 1;
+    size_t value_len = strlen(value);
+    if (bracket) {
+        return set_element(var->name, bracket + 1, len - name_len - 2, value, value_len);
+    }
+    if (value[0] == '(' && value_len > 1 && value[value_len - 1] == ')') {
+        return assign_list(var, kind, value + 1, value_len - 2);
+    }
+    return set_interned_variable(var->name, value);
+}
 
-    *dest = '\0';  // Null-terminate
+int assign_command_word(const char *word, int list) {
+    if (list || word[strcspn(word, "=[")] == '[') {
+        return assign_word(word, VAR_SCALAR, 0);
+    }
+    assign_entry(word);
+    return 1;
+}
 
-    return result;
+void assign_local_entry(const char *entry) {
+    make_local(intern_n(entry, entry_name_length(entry)));
+    assign_entry(entry);
 }
 
 // Built-in: set
@@ -470,11 +1194,23 @@ int hush_set(char **args) {
     if (args[1] == NULL) {
         // Print all shell variables
         for (int i = 0; i < var_count; i++) {
-            printf("%s=%s\n", variables[i].name, variables[i].value);
+            if (variables[i].name) {
+                print_variable(&variables[i]);
+            }
         }
         return 1;
     }
 
+    // set -- args replaces the positional parameters
+    if (strcmp(args[1], "--") == 0) {
+        ScriptArgs saved = replace_script_args(args + 1);
+        for (int i = 0; i < saved.count; i++) {
+            free(saved.args[i]);
+        }
+        free(saved.args);
+        return 1;
+    }
+
     // Check for flags
     if (args[1][0] == '-') {
         // Process shell option flags
@@ -500,30 +1236,134 @@ int hush_set(char **args) {
         return 1;
     }
 
-    // Parse name=value arguments
+    // Parse name=value, name[key]=value and name=(...) arguments
     for (int i = 1; args[i] != NULL; i++) {
-        // Check for name=value format
-        char *equals = strchr(args[i], '=');
-        if (equals) {
-            *equals = '\0'; // Split at equals sign
-            set_shell_variable(args[i], equals + 1);
-            *equals = '='; // Restore string
+        if (strchr(args[i], '=') && !assign_word(args[i], VAR_SCALAR, 0)) {
+            set_last_exit_status(1);
         }
     }
 
     return 1;
 }
 
+// Parse the -a, -A and -i options of declare and local
+// Returns the index of the first operand, or 0 after printing an error
+static int parse_kind_options(char **args, VarKind *kind, int *integer) {
+    int i = 1;
+    *kind = VAR_SCALAR;
+    *integer = 0;
+
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        for (int j = 1; args[i][j]; j++) {
+            switch (args[i][j]) {
+                case 'a': *kind = VAR_INDEXED; break;
+                case 'A': *kind = VAR_ASSOC; break;
+                case 'i': *integer = 1; break;
+                default:
+                    fprintf(stderr, "hush: %s: -%c: invalid option\n", args[0], args[i][j]);
+                    fprintf(stderr, "hush: %s: usage: %s [-a|-A] [-i] [name[=value] ...]\n", args[0], args[0]);
+                    set_last_exit_status(2);
+                    return 0;
+            }
+        }
+    }
+    return i;
+}
+
+// Built-in: declare
+int hush_declare(char **args) {
+    VarKind kind;
+    int integer;
+    int i = parse_kind_options(args, &kind, &integer);
+    if (i == 0) {
+        return 1;
+    }
+
+    int status = 0;
+    if (!args[i]) {
+        // Print the variables of the requested kind
+        for (int j = 0; j < var_count; j++) {
+            if (variables[j].name && (kind == VAR_SCALAR || variables[j].kind == kind) &&
+                (!integer || variables[j].integer)) {
+                print_variable(&variables[j]);
+            }
+        }
+    }
+    for (; args[i]; i++) {
+        if (!assign_word(args[i], kind, integer)) {
+            status = 1;
+        }
+    }
+    set_last_exit_status(status);
+    return 1;
+}
+
+// Built-in: local
+int hush_local(char **args) {
+    VarKind kind;
+    int integer;
+    int i = parse_kind_options(args, &kind, &integer);
+    if (i == 0) {
+        return 1;
+    }
+    if (scope_depth == 0) {
+        fprintf(stderr, "hush: local: can only be used in a function\n");
+        set_last_exit_status(1);
+        return 1;
+    }
+
+    int status = 0;
+    for (; args[i]; i++) {
+        size_t len = strcspn(args[i], "=[");
+        if (!is_name(args[i], len)) {
+            fprintf(stderr, "hush: local: `%s': not a valid identifier\n", args[i]);
+            status = 1;
+            continue;
+        }
+        char saved = args[i][len];
+        args[i][len] = '\0';
+        make_local(args[i]);
+        args[i][len] = saved;
+
+        // A bare local name stays unset until assigned
+        if ((saved || kind != VAR_SCALAR || integer) && !assign_word(args[i], kind, integer)) {
+            status = 1;
+        }
+    }
+    set_last_exit_status(status);
+    return 1;
+}
+
 // Built-in: unset
 int hush_unset(char **args) {
-    if (args[1] == NULL) {
-        fprintf(stderr, "hush: unset: usage: unset NAME...\n");
+    int i = 1;
+    int functions = 0;
+
+    // -f removes functions, -v (the default) variables
+    for (; args[i] && (strcmp(args[i], "-f") == 0 || strcmp(args[i], "-v") == 0); i++) {
+        functions = args[i][1] == 'f';
+    }
+    if (args[i] == NULL) {
+        fprintf(stderr, "hush: unset: usage: unset [-f|-v] NAME...\n");
         return 1;
     }
 
-    for (int i = 1; args[i] != NULL; i++) {
+    for (; args[i] != NULL; i++) {
+        if (functions) {
+            remove_function(args[i]);
+            continue;
+        }
+
+        // name[key] removes one element
+        char *bracket = strchr(args[i], '[');
+        size_t len = strlen(args[i]);
+        if (bracket && args[i][len - 1] == ']') {
+            *bracket = '\0';
+            unset_element(args[i], bracket + 1, len - (bracket - args[i]) - 2);
+            *bracket = '[';
+            continue;
+        }
         unset_shell_variable(args[i]);
-        unsetenv(args[i]); // Also unset environment variable if it exists
     }
 
     return 1;
@@ -537,24 +1377,28 @@ int hush_shift(char **args) {
         n = atoi(args[1]);
         if (n < 0) {
             fprintf(stderr, "hush: shift: %s: shift count must be >= 0\n", args[1]);
+            set_last_exit_status(1);
             return 1;
         }
     }
 
-    if (n > script_arg_count) {
-        fprintf(stderr, "hush: shift: shift count must be <= %d\n", script_arg_count);
+    int count = script_arg_count > 0 ? script_arg_count - 1 : 0;
+    if (n > count) {
+        fprintf(stderr, "hush: shift: shift count must be <= %d\n", count);
+        set_last_exit_status(1);
         return 1;
     }
 
     if (n == 0) return 1;  // Nothing to do
 
-    // Shift arguments
-    for (int i = n; i <= script_arg_count; i++) {
-        free(script_args[i - n]);
-        script_args[i - n] = (i < script_arg_count) ? strdup(script_args[i]) : NULL;
+    // Shift arguments and the NULL after them down, $0 stays
+    for (int i = 1; i <= n; i++) {
+        free(script_args[i]);
     }
+    memmove(script_args + 1, script_args + 1 + n, (script_arg_count - n) * sizeof(char *));
 
     script_arg_count -= n;
+    format_arg_count();
 
     return 1;
 }
@@ -0,0 +1,727 @@
+#include "vm.h"
+#include "execute.h"
+#include "expand.h"
+#include "glob.h"
+#include "pipes.h"
+#include "jobs.h"
+#include "launch.h"
+#include "variables.h"
+#include "arena.h"
+#include "functions.h"
+#include "arith.h"
+#include "test.h"
+#include "redirection.h"
+#include "input.h"
+#include "alias.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A running for loop, its items live in the arena above mark
+typedef struct {
+    char **items;
+    int count;
+    int next;
+    const char *var;   // Interned
+    ArenaMark mark;
+} ForLoop;
+
+// The saved descriptors of a redirected compound command
+typedef struct {
+    int stdin_copy;
+    int stdout_copy;
+    int stderr_copy;
+    int owns_input;
+} RedirectScope;
+
+// Interpreter state
+typedef struct {
+    const Program *prog;
+
+    // Fields pushed for the next BC_EXEC or BC_FOR_INIT, the arrays are
+    // reused and the strings are in the arena
+    char **fields;
+    unsigned int *flags;
+    int field_count;
+    int field_capacity;
+
+    // NAME=value assignments for the next BC_EXEC, NULL-terminated
+    char **assigns;
+    int assign_count;
+    int assign_capacity;
+    int assign_scope;     // Earlier prefix assignments are visible as locals
+
+    // A command of only assignments makes them itself, its status is that
+    // of the last substitution they ran
+    int bare_assigned;
+    int bare_status;
+
+    // Arena position before the current command's first word
+    ArenaMark command_mark;
+    int in_command;
+
+    // Substitutions of the current command run ahead of time, if any
+    CaptureBatch batch;
+    CaptureBatch *outer_batch;
+    int batch_active;
+
+    ForLoop *loops;
+    int loop_count;
+    int loop_capacity;
+
+    int *slots;
+
+    RedirectScope *redirects;
+    int redirect_count;
+    int redirect_capacity;
+} Vm;
+
+// Push a field, keeping room for the NULL terminator
+static void push_field(Vm *vm, char *text, unsigned int flags) {
+    if (vm->field_count + 1 >= vm->field_capacity) {
+        int capacity = vm->field_capacity ? vm->field_capacity * 2 : 16;
+        char **fields = realloc(vm->fields, capacity * sizeof(char *));
+        unsigned int *field_flags = realloc(vm->flags, capacity * sizeof(unsigned int));
+        if (!fields || !field_flags) {
+            alloc_error();
+        }
+        vm->fields = fields;
+        vm->flags = field_flags;
+        vm->field_capacity = capacity;
+    }
+    vm->fields[vm->field_count] = text;
+    vm->flags[vm->field_count] = flags;
+    vm->field_count++;
+}
+
+// The pushed fields as a NULL-terminated array, valid until the next push
+static char **take_fields(Vm *vm, unsigned int **flags) {
+    push_field(vm, NULL, 0);
+    vm->field_count = 0;
+
+    *flags = vm->flags;
+    return vm->fields;
+}
+
+// Add a prefix assignment, keeping room for the NULL terminator
+static void push_assignment(Vm *vm, char *text) {
+    if (vm->assign_count + 1 >= vm->assign_capacity) {
+        int capacity = vm->assign_capacity ? vm->assign_capacity * 2 : 4;
+        char **assigns = realloc(vm->assigns, capacity * sizeof(char *));
+        if (!assigns) {
+            alloc_error();
+        }
+        vm->assigns = assigns;
+        vm->assign_capacity = capacity;
+    }
+    vm->assigns[vm->assign_count++] = text;
+    vm->assigns[vm->assign_count] = NULL;
+}
+
+// Words of a new command are about to be allocated
+static void begin_command(Vm *vm) {
+    if (!vm->in_command) {
+        vm->command_mark = arena_mark();
+        vm->in_command = 1;
+        vm->bare_assigned = 0;
+        vm->bare_status = 0;
+        expansion_failed = 0;
+    }
+}
+
+// The prefix assignments have all been expanded, the command's own words
+// see none of them
+static void end_assign_scope(Vm *vm) {
+    if (vm->assign_scope) {
+        pop_variable_scope();
+        vm->assign_scope = 0;
+    }
+}
+
+// Check if an error such as a failed expansion ends the shell, as it does
+// a script or subshell; at a terminal only the command is abandoned
+static int error_ends_shell(void) {
+    return !shell_is_interactive || shell_runs_script;
+}
+
+// An expansion in the current command's words failed after printing why
+// Returns 0 when the shell should exit. Otherwise the rest of the words
+// are skipped and *pc is left at the instruction that would have used
+// them, which sees expansion_failed and does not run.
+static int skip_failed_words(Vm *vm, uint32_t *pc) {
+    set_last_exit_status(1);
+    end_assign_scope(vm);
+    if (error_ends_shell()) {
+        return 0;
+    }
+
+    const Instr *code = vm->prog->code;
+    while (code[*pc].op == BC_PUSH || code[*pc].op == BC_EXPAND || code[*pc].op == BC_ASSIGN) {
+        (*pc)++;
+    }
+    vm->field_count = 0;
+    vm->assign_count = 0;
+    return 1;
+}
+
+// At a command's first word, run its substitutions together if asked to
+static void start_batch(Vm *vm, uint32_t pc) {
+    const Program *prog = vm->prog;
+
+    int count = 0;
+    int assigns = 0;
+    for (;; count++) {
+        int op = prog->code[pc + count].op;
+        if (op == BC_ASSIGN) {
+            assigns++;
+        } else if (op != BC_PUSH && op != BC_EXPAND) {
+            break;
+        }
+    }
+    if (prog->code[pc + count].op != BC_EXEC) {
+        return;
+    }
+
+    // Only words that still need expanding can hold substitutions or ${...}
+    Word *words = NULL;
+    int expand_count = 0;
+    for (int i = 0; i < count; i++) {
+        const Instr *instr = &prog->code[pc + i];
+        const ProgWord *pw = &prog->words[instr->a];
+        const char *text = prog->strings + pw->offset;
+
+        // Assignments are made one by one, a word after the first that
+        // reads a parameter has to wait for the ones before it
+        if (assigns > 1 && i > 0) {
+            for (const char *dollar = strchr(text, '$'); dollar; dollar = strchr(dollar + 1, '$')) {
+                if (dollar[1] != '(' || dollar[2] == '(') {
+                    return;
+                }
+            }
+        }
+
+        int expands = instr->op == BC_EXPAND ||
+                      (instr->op == BC_ASSIGN && !(pw->flags & HUSH_TOK_ARRAY));
+        if (expands && strpbrk(text, "({`")) {
+            if (!words) {
+                words = arena_alloc(count * sizeof(Word));
+            }
+            words[expand_count].text = prog->strings + pw->offset;
+            words[expand_count].flags = pw->flags;
+            expand_count++;
+        }
+    }
+
+    if (expand_count > 0 && expand_substitutions_early(words, expand_count, &vm->batch)) {
+        vm->outer_batch = capture_batch_use(&vm->batch);
+        vm->batch_active = 1;
+    }
+}
+
+static void end_batch(Vm *vm) {
+    if (vm->batch_active) {
+        capture_batch_use(vm->outer_batch);
+        vm->batch_active = 0;
+    }
+}
+
+// Release everything the command allocated
+static void end_command(Vm *vm) {
+    end_batch(vm);
+    arena_end_command(vm->command_mark);
+    vm->in_command = 0;
+}
+
+// Expand a [[ ]] operand into the arena, unsplit and never globbed
+// The right side of == != and =~ keeps its quoted parts literal.
+static const char *cond_operand(const Program *prog, uint32_t index, int op) {
+    const ProgWord *pw = &prog->words[index];
+    const char *text = prog->strings + pw->offset;
+    if (!(pw->flags & (HUSH_TOK_QUOTED | HUSH_TOK_EXPAND)) && text[0] != '~') {
+        return text;
+    }
+    if (op == TEST_MATCH || op == TEST_NO_MATCH || op == TEST_REGEX) {
+        return expand_pattern_word(text, op == TEST_REGEX);
+    }
+    return expand_word_nosplit(text);
+}
+
+static void pop_loop(Vm *vm) {
+    ForLoop *loop = &vm->loops[--vm->loop_count];
+    arena_release(loop->mark);
+}
+
+// Start a for loop over the pushed fields or the positional parameters
+static void start_for(Vm *vm, const Instr *instr) {
+    const Program *prog = vm->prog;
+    char **items;
+
+    begin_command(vm);
+    if (instr->flags & BC_FLAG_ARGS) {
+        int count = get_script_arg_count();
+        items = arena_alloc((count > 1 ? count : 1) * sizeof(char *));
+        int n = 0;
+        for (int i = 1; i < count; i++) {
+            char *arg = get_script_arg(i);
+            if (arg) {
+                items[n++] = arena_strdup(arg);
+                free(arg);
+            }
+        }
+        items[n] = NULL;
+    } else {
+        unsigned int *flags;
+        char **fields = take_fields(vm, &flags);
+        items = expand_wildcards_flags(fields, flags, NULL);
+    }
+
+    if (vm->loop_count >= vm->loop_capacity) {
+        int capacity = vm->loop_capacity ? vm->loop_capacity * 2 : 8;
+        ForLoop *loops = realloc(vm->loops, capacity * sizeof(ForLoop));
+        if (!loops) {
+            alloc_error();
+        }
+        vm->loops = loops;
+        vm->loop_capacity = capacity;
+    }
+
+    ForLoop *loop = &vm->loops[vm->loop_count++];
+    loop->items = items;
+    loop->count = 0;
+    while (items[loop->count] != NULL) {
+        loop->count++;
+    }
+    loop->next = 0;
+    loop->var = prog->names[instr->a];
+
+    // The items stay until the loop ends, the body's commands mark above them
+    loop->mark = vm->command_mark;
+    vm->in_command = 0;
+
+    set_last_exit_status(0);
+}
+
+// Check that the commands from pc up to end are still the builtins they
+// were compiled as, not functions or aliases that could read stdin too
+static int runs_builtins(const Program *prog, uint32_t pc, uint32_t end) {
+    for (; pc < end; pc++) {
+        const Instr *instr = &prog->code[pc];
+        const char *name = instr->op == BC_PUSH ? prog->names[instr->a] : NULL;
+        if (name && (find_function(name) || get_alias(name))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Apply the pushed redirections for a compound command
+// Returns 0 if one failed, the scope is entered all the same so the
+// matching BC_UNREDIRECT undoes the ones that were made.
+static int push_redirect(Vm *vm, int owns_input) {
+    if (vm->redirect_count >= vm->redirect_capacity) {
+        int capacity = vm->redirect_capacity ? vm->redirect_capacity * 2 : 4;
+        RedirectScope *redirects = realloc(vm->redirects, capacity * sizeof(RedirectScope));
+        if (!redirects) {
+            alloc_error();
+        }
+        vm->redirects = redirects;
+        vm->redirect_capacity = capacity;
+    }
+
+    // After a failed expansion the scope is entered with nothing redirected
+    int failed = expansion_failed;
+    unsigned int *flags;
+    char **fields = take_fields(vm, &flags);
+    RedirectScope *scope = &vm->redirects[vm->redirect_count++];
+    begin_command(vm);
+    setup_redirection_flags(fields, flags, &scope->stdin_copy, &scope->stdout_copy,
+                            &scope->stderr_copy);
+    end_command(vm);
+
+    failed = failed || redirection_failed;
+    scope->owns_input = owns_input && !failed;
+    if (scope->owns_input) {
+        input_own();
+    }
+    return !failed;
+}
+
+static void pop_redirect(Vm *vm) {
+    RedirectScope *scope = &vm->redirects[--vm->redirect_count];
+    if (scope->owns_input) {
+        input_disown();
+    }
+    if (scope->stdout_copy != -1 && !output_flush(NULL)) {
+        set_last_exit_status(1);
+    }
+    reset_redirection(scope->stdin_copy, scope->stdout_copy, scope->stderr_copy);
+}
+
+static int vm_run(Vm *vm, uint32_t pc);
+
+// Child side of a pipeline stage or background job, never returns
+static void run_subshell(Vm *vm, const Instr *entry, uint32_t start) {
+    // No job control inside a subshell, and a lone command may replace it
+    shell_is_interactive = 0;
+    launch_in_place = (entry->flags & BC_FLAG_SINGLE) != 0;
+
+    vm_run(vm, start);
+
+    // _exit: stdio cleanup in the child would move the offset of the
+    // script file it shares with the parent
+    input_sync();
+    fflush(stdout);
+    fflush(stderr);
+    _exit(get_last_exit_status());
+}
+
+typedef struct {
+    Vm *vm;
+    const Instr *entry;  // BC_BACKGROUND, or the first BC_STAGE
+} SubshellContext;
+
+static void run_stage(int index, void *data) {
+    SubshellContext *ctx = data;
+    run_subshell(ctx->vm, &ctx->entry[index], ctx->entry[index].a);
+}
+
+static void run_background(void *data) {
+    SubshellContext *ctx = data;
+    uint32_t start = (uint32_t)(ctx->entry - ctx->vm->prog->code) + 1;
+    run_subshell(ctx->vm, ctx->entry, start);
+}
+
+// The interpreter loop, returns 0 when the shell (or subshell) should exit
+static int vm_run(Vm *vm, uint32_t pc) {
+    const Program *prog = vm->prog;
+    const Instr *code = prog->code;
+
+    for (;;) {
+        const Instr *instr = &code[pc];
+
+        switch (instr->op) {
+            case BC_HALT:
+                return 1;
+
+            case BC_PUSH: {
+                const ProgWord *word = &prog->words[instr->a];
+                if (!vm->in_command) {
+                    begin_command(vm);
+                    start_batch(vm, pc);
+                }
+                if (prog->names[instr->a]) {
+                    // Interned names are shared, nobody writes to a command name
+                    push_field(vm, (char *)prog->names[instr->a], word->flags);
+                } else {
+                    push_field(vm, arena_strdup(prog->strings + word->offset), word->flags);
+                }
+                pc++;
+                break;
+            }
+
+            case BC_EXPAND: {
+                const ProgWord *pw = &prog->words[instr->a];
+                Word word = { prog->strings + pw->offset, pw->flags };
+                unsigned int *flags = NULL;
+                if (!vm->in_command) {
+                    begin_command(vm);
+                    start_batch(vm, pc);
+                }
+                char **fields = expand_words(&word, 1, &flags);
+                if (!fields) {
+                    if (!skip_failed_words(vm, &pc)) {
+                        return 0;
+                    }
+                    break;
+                }
+                for (int i = 0; fields[i] != NULL; i++) {
+                    push_field(vm, fields[i], flags[i]);
+                }
+                pc++;
+                break;
+            }
+
+            case BC_ASSIGN: {
+                const ProgWord *pw = &prog->words[instr->a];
+                const char *text = prog->strings + pw->offset;
+                int list = (pw->flags & HUSH_TOK_ARRAY) != 0;
+                if (!vm->in_command) {
+                    begin_command(vm);
+                    start_batch(vm, pc);
+                }
+
+                // An array literal's elements are expanded by the assignment
+                unsigned long captures = capture_count;
+                char *assign = list ? (char *)text : expand_assignment(text);
+                int ok = 1;
+                if (!expansion_failed && (instr->flags & BC_FLAG_BARE)) {
+                    // Made at once, so the next one sees it
+                    ok = assign_command_word(assign, list);
+                    vm->bare_assigned = 1;
+                }
+                if (expansion_failed) {
+                    if (!skip_failed_words(vm, &pc)) {
+                        return 0;
+                    }
+                    break;
+                }
+
+                if (instr->flags & BC_FLAG_BARE) {
+                    if (!ok) {
+                        vm->bare_status = 1;
+                    } else if (capture_count != captures) {
+                        vm->bare_status = get_last_exit_status();
+                    }
+                } else if (list || assign[strcspn(assign, "=[")] == '[') {
+                    // Arrays cannot be passed to a command
+                    fprintf(stderr, "hush: `%.*s': not a valid identifier\n",
+                            (int)strcspn(assign, "="), assign);
+                } else {
+                    push_assignment(vm, assign);
+
+                    // Later prefix assignments see this one
+                    if (code[pc + 1].op == BC_ASSIGN) {
+                        if (!vm->assign_scope) {
+                            push_variable_scope();
+                            vm->assign_scope = 1;
+                        }
+                        assign_local_entry(assign);
+                    }
+                }
+                if (code[pc + 1].op != BC_ASSIGN) {
+                    end_assign_scope(vm);
+                }
+                pc++;
+                break;
+            }
+
+            case BC_EXEC: {
+                if (expansion_failed) {
+                    // The words were not all expanded, the command never runs
+                    end_command(vm);
+                    pc++;
+                    break;
+                }
+                unsigned int *flags;
+                char **fields = take_fields(vm, &flags);
+                char **assigns = vm->assign_count > 0 ? vm->assigns : NULL;
+                vm->assign_count = 0;
+                begin_command(vm);
+                int redirected = fields[0] != NULL;
+                int keep_going = execute_fields(fields, flags, assigns);
+                if (vm->bare_assigned && !(redirected && redirection_failed)) {
+                    set_last_exit_status(vm->bare_status);
+                }
+                end_command(vm);
+                if (!keep_going || (expansion_failed && error_ends_shell())) {
+                    return 0;
+                }
+                if (function_returning) {
+                    // return ends the function's program, loops and all
+                    return 1;
+                }
+                pc++;
+                break;
+            }
+
+            case BC_JUMP:
+                pc = instr->a;
+                break;
+
+            case BC_JUMP_IF_OK:
+                pc = get_last_exit_status() == 0 ? instr->a : pc + 1;
+                break;
+
+            case BC_JUMP_IF_FAIL:
+                pc = get_last_exit_status() != 0 ? instr->a : pc + 1;
+                break;
+
+            case BC_STATUS:
+                set_last_exit_status((int)instr->a);
+                pc++;
+                break;
+
+            case BC_SLOT_SAVE:
+                vm->slots[instr->a] = get_last_exit_status();
+                pc++;
+                break;
+
+            case BC_SLOT_LOAD:
+                set_last_exit_status(vm->slots[instr->a]);
+                pc++;
+                break;
+
+            case BC_FOR_INIT:
+                if (expansion_failed) {
+                    // No items, the loop ends at once
+                    vm->field_count = 0;
+                    start_for(vm, instr);
+                    set_last_exit_status(1);
+                } else {
+                    start_for(vm, instr);
+                }
+                pc++;
+                break;
+
+            case BC_FOR_NEXT: {
+                ForLoop *loop = &vm->loops[vm->loop_count - 1];
+                if (loop->next < loop->count) {
+                    set_interned_variable(loop->var, loop->items[loop->next++]);
+                    pc++;
+                } else {
+                    pop_loop(vm);
+                    pc = instr->a;
+                }
+                break;
+            }
+
+            case BC_FOR_POP:
+                pop_loop(vm);
+                pc++;
+                break;
+
+            case BC_PIPELINE: {
+                SubshellContext ctx = { vm, instr + 1 };
+                execute_pipeline_stages((int)instr->b, run_stage, &ctx);
+                pc = instr->a;
+                break;
+            }
+
+            case BC_BACKGROUND: {
+                SubshellContext ctx = { vm, instr };
+                launch_background(prog->strings + instr->b, run_background, &ctx);
+                pc = instr->a;
+                break;
+            }
+
+            case BC_EXIT:
+                return 0;
+
+            case BC_ARITH: {
+                const char *text = prog->strings + instr->a;
+                int64_t value;
+                begin_command(vm);
+                if (strpbrk(text, "$`\\'\"")) {
+                    text = expand_word_nosplit(text);
+                }
+                if (expansion_failed) {
+                    set_last_exit_status(1);
+                } else {
+                    set_last_exit_status(arith_evaluate(text, &value) && value != 0 ? 0 : 1);
+                }
+                end_command(vm);
+                if (expansion_failed && error_ends_shell()) {
+                    return 0;
+                }
+                pc++;
+                break;
+            }
+
+            case BC_COND_UNARY: {
+                begin_command(vm);
+                const char *operand = cond_operand(prog, instr->a, TEST_NONE);
+                if (!expansion_failed) {
+                    set_last_exit_status(cond_unary((char)instr->flags, operand));
+                }
+                end_command(vm);
+                if (expansion_failed && error_ends_shell()) {
+                    return 0;
+                }
+                pc++;
+                break;
+            }
+
+            case BC_COND: {
+                begin_command(vm);
+                const char *left = cond_operand(prog, instr->a, TEST_NONE);
+                const char *right = expansion_failed ? NULL : cond_operand(prog, instr->b, instr->flags);
+                if (!expansion_failed) {
+                    set_last_exit_status(cond_binary(left, (TestBinary)instr->flags, right));
+                }
+                end_command(vm);
+                if (expansion_failed && error_ends_shell()) {
+                    return 0;
+                }
+                pc++;
+                break;
+            }
+
+            case BC_NOT:
+                set_last_exit_status(get_last_exit_status() == 0 ? 1 : 0);
+                pc++;
+                break;
+
+            case BC_REDIRECT:
+                if (push_redirect(vm, (instr->flags & BC_FLAG_OWN_INPUT) &&
+                                      runs_builtins(prog, pc + 1, instr->a))) {
+                    pc++;
+                } else {
+                    // Like a command, the body does not run without them
+                    set_last_exit_status(1);
+                    pc = instr->a;
+                }
+                break;
+
+            case BC_UNREDIRECT:
+                if (vm->redirect_count > 0) {
+                    pop_redirect(vm);
+                }
+                pc++;
+                break;
+
+            case BC_FUNCTION:
+                if (!define_function(prog->names[instr->a], prog->strings + instr->b)) {
+                    set_last_exit_status(2);
+                } else {
+                    set_last_exit_status(0);
+                }
+                pc++;
+                break;
+
+            default:
+                fprintf(stderr, "hush: bad instruction %d at %u\n", instr->op, pc);
+                set_last_exit_status(1);
+                return 1;
+        }
+    }
+}
+
+int vm_execute(const Program *prog) {
+    return vm_execute_at(prog, 0);
+}
+
+int vm_execute_at(const Program *prog, int pc) {
+    Vm vm;
+    memset(&vm, 0, sizeof(vm));
+    vm.prog = prog;
+
+    if (prog->slot_count > 0) {
+        vm.slots = calloc(prog->slot_count, sizeof(int));
+        if (!vm.slots) {
+            alloc_error();
+        }
+    }
+
+    ArenaMark mark = arena_mark();
+    int result = vm_run(&vm, (uint32_t)pc);
+
+    end_assign_scope(&vm);
+
+    // An exit or return from inside a redirected command leaves it in place
+    while (vm.redirect_count > 0) {
+        pop_redirect(&vm);
+    }
+
+    // An exit from inside loops or a command leaves words in the arena
+    end_batch(&vm);
+    arena_release(mark);
+    free(vm.fields);
+    free(vm.flags);
+    free(vm.assigns);
+    free(vm.loops);
+    free(vm.slots);
+    free(vm.redirects);
+
+    return result;
+}
@@ -0,0 +1,94 @@
+// Build-time generator for the builtin perfect hash
+//
+// Searches for a seed under which every builtin name in HUSH_BUILTINS lands
+// in its own slot of a power-of-two table, then writes builtin_hash.h with
+// the seed and the slot-to-index table. Usage: gen_builtin_hash OUTPUT
+#include "builtin_table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NAME(name, func, flags) name,
+static const char *names[] = { HUSH_BUILTINS(NAME) };
+#undef NAME
+
+#define NAME_COUNT ((int)(sizeof(names) / sizeof(names[0])))
+#define MAX_SEEDS 1000000u
+
+// Try a seed, filling slots with builtin indexes; returns 1 if collision-free
+static int try_seed(uint32_t seed, int size, int *slots) {
+    for (int i = 0; i < size; i++) {
+        slots[i] = -1;
+    }
+    for (int i = 0; i < NAME_COUNT; i++) {
+        uint32_t slot = builtin_hash(names[i], strlen(names[i]), seed) & (uint32_t)(size - 1);
+        if (slots[slot] >= 0) {
+            return 0;
+        }
+        slots[slot] = i;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s OUTPUT\n", argv[0]);
+        return 1;
+    }
+
+    // The generated table stores indexes as signed char
+    if (NAME_COUNT > 127) {
+        fprintf(stderr, "gen_builtin_hash: too many builtins\n");
+        return 1;
+    }
+
+    // Start with at least twice as many slots as names, grow if no seed fits
+    int size = 1;
+    while (size < NAME_COUNT * 2) {
+        size *= 2;
+    }
+
+    int *slots = NULL;
+    uint32_t seed = 0;
+    for (;;) {
+        slots = realloc(slots, size * sizeof(int));
+        if (!slots) {
+            fprintf(stderr, "gen_builtin_hash: allocation error\n");
+            return 1;
+        }
+        for (seed = 0; seed < MAX_SEEDS; seed++) {
+            if (try_seed(seed, size, slots)) {
+                break;
+            }
+        }
+        if (seed < MAX_SEEDS) {
+            break;
+        }
+        size *= 2;
+    }
+
+    FILE *out = fopen(argv[1], "w");
+    if (!out) {
+        perror("gen_builtin_hash");
+        return 1;
+    }
+
+    fprintf(out, "// Generated by tools/gen_builtin_hash.c from include/builtin_table.h\n");
+    fprintf(out, "// Do not edit\n");
+    fprintf(out, "#ifndef BUILTIN_HASH_H\n#define BUILTIN_HASH_H\n\n");
+    fprintf(out, "#define BUILTIN_HASH_SEED %uu\n", seed);
+    fprintf(out, "#define BUILTIN_HASH_SIZE %d\n\n", size);
+    fprintf(out, "// Builtin index for each hash slot, -1 when empty\n");
+    fprintf(out, "static const signed char builtin_hash_slots[BUILTIN_HASH_SIZE] = {");
+    for (int i = 0; i < size; i++) {
+        fprintf(out, "%s%d,", i % 16 == 0 ? "\n    " : " ", slots[i]);
+    }
+    fprintf(out, "\n};\n\n#endif // BUILTIN_HASH_H\n");
+
+    free(slots);
+    if (fclose(out) != 0) {
+        perror("gen_builtin_hash");
+        return 1;
+    }
+    return 0;
+}